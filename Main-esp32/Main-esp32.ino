@@ -28,6 +28,7 @@
 #include "dosing_logic.h"
 #include "calibration_logic.h"
 #include "esp_now_handler.h"
+#include "esp_now_tx.h"           // Очередь передачи ESP-NOW
 #include "pid_controller.h"
 #include "web_server_handlers.h" // Added
 #include "motor_control.h"       // Added (was missing from previous includes)
@@ -37,6 +38,17 @@
 #include "sensitive_config.h"    // <-- ДОБАВЛЕНО: Для getWifiSsid/Password
 #include "localization.h" // <-- ДОБАВЛЕНО: Для локализации
 #include "button_handler.h"      // <-- ДОБАВЛЕНО: Для обработки кнопок
+#include "compressor_control.h"  // Планировщик компрессора
+#include "ilc_controller.h"      // Обучение профиля скорости на старте цикла
+#include "stall_monitor.h"       // Монитор срыва/проскальзывания насоса
+#include "standby_controller.h"  // Удержание холода между циклами
+#include "cycle_records.h"       // Записи по циклам на LittleFS
+#include "usage_rollups.h"       // Сводки использования по часам/суткам
+#include "counter_journal.h"     // Журнал счетчиков наработки
+#include "crash_record.h"        // Запись об аварийной перезагрузке (RTC-память)
+#include "error_journal.h"       // Журнал ошибок на LittleFS
+#include "dosing_queue.h"        // Очередь заданий дозирования
+#include "cluster_coordinator.h" // Кластер соседних контроллеров (ESP-NOW)
 
 // --- Firmware Version ---
 const char* MAIN_FIRMWARE_VERSION = "4.3.1"; // Define the main firmware version
@@ -153,8 +165,6 @@ unsigned long last_wifi_reconnect = 0; // Для контроля перепод
 // Error Handling variables are now in error_handler.c/error_handler.h
 // Dosing State Machine variables are now in dosing_logic.c/dosing_logic.h
 // ESP-NOW variables are now in esp_now_handler.c/esp_now_handler.h
-unsigned long last_esp_now_status_send_time = 0;
-const unsigned long ESP_NOW_STATUS_INTERVAL_MS = 2000; // Send status every 2 seconds
 
 // Watchdog Timer
 const int WDT_TIMEOUT_S = 30; // Таймаут сторожевого таймера в секундах
@@ -244,6 +254,7 @@ void toggleSystemPower(bool fromWeb) {
     }
     config.systemPowerStateSaved = system_power_enabled;
     saveConfig();
+    if (!system_power_enabled) flushConfigNow(); // После выключения питание могут отключить сразу
     if (fromWeb) { server.sendHeader("Location", "/"); server.send(303); }
 }
 
@@ -351,46 +362,31 @@ void setup() {
 
     app_log_i("SETUP_DBG", "--- STARTING MINIMAL SETUP FOR DIAGNOSTICS ---");
 
-    // Проверка на наличие сохраненной фатальной ошибки
-    Preferences error_prefs_check;
-    if (error_prefs_check.begin(PREFS_ERROR_LOG_NAMESPACE, true)) { // R/O mode
-        uint32_t last_fatal_code = error_prefs_check.getUInt("last_fatal", 0); // Используем SystemErrorCode
-        error_prefs_check.end(); // Закрываем R/O сессию
-        if (last_fatal_code != 0) {
-            // _T might not be fully ready if language from config isn't loaded yet.
-            // Using direct Serial print for very early critical messages might be safer, or ensure localization_init_default_lang() is called.
-            // Assuming localization_init_default_lang() will be called before this point.
-            app_log_e("REBOOT_INFO", _T(L_REBOOTED_DUE_TO_FATAL_ERROR), last_fatal_code);
-            // Очищаем флаг
-            Preferences error_prefs_clear; // Новый экземпляр для записи
-            if (error_prefs_clear.begin(PREFS_ERROR_LOG_NAMESPACE, false)) { // R/W mode
-                error_prefs_clear.remove("last_fatal");
-                error_prefs_clear.end();
-                app_log_i("REBOOT_INFO", _T(L_FATAL_ERROR_FLAG_CLEARED_MSG));
-            } else {
-                 app_log_e("REBOOT_INFO", _T(L_PREFS_OPEN_FAIL_CLEAR_FATAL_FLAG));
-            }
-        }
-    } else {
-        app_log_w("REBOOT_INFO", _T(L_PREFS_OPEN_FAIL_CHECK_FATAL_FLAG), PREFS_ERROR_LOG_NAMESPACE);
-        g_preferences_operational = false; // Отмечаем, что Preferences не работают
-    }
+    // Запись о фатальной ошибке прошлой загрузки лежит в RTC-памяти и разбирается после loadConfig() (initCrashRecord)
 
     app_log_i("SETUP_DBG", "Preferences check for 'err_log' completed. g_preferences_operational: %s", g_preferences_operational ? "true" : "false");
 
  // ВРЕМЕННО ОТКЛЮЧАЕМ БОЛЬШУЮ ЧАСТЬ ИНИЦИАЛИЗАЦИЙ ДЛЯ ДИАГНОСТИКИ  // <--- УБИРАЕМ НАЧАЛО КОММЕНТАРИЯ БЛОКА
 
     localization_init_default_lang(); // Initialize with default language (e.g., "en" or "ru")
+    initErrorJournal(); // Журнал ошибок на LittleFS - до loadConfig(), чтобы попали и ошибки загрузки настроек
     loadConfig(); // Загружаем конфигурацию, включая system_power_enabled and config.currentLanguage
     set_current_language(config.currentLanguage); // Set the language from config
 
     // Инициализация модулей
     initErrorHandler();
+    initCrashRecord(); // Аварийная перезагрузка прошлой загрузки: сообщение и счетчик ошибок (без записи NVS здесь)
     initMotor();      // Из motor_control.c
     initSensors();    // Из sensors.c (включая Flow Sensor interrupt и Compressor pin)
+    initCompressorControl(); // Планировщик компрессора (после initSensors - пин уже настроен)
+    initDosingQueue(); // Очередь заданий дозирования
     initDosingLogic(); // Из dosing_logic.c
     initCalibrationLogic(); // Из calibration_logic.c
     initPidController(); // Из pid_controller.c
+    initIlcController(); // Профили ILC из NVS
+    initStallMonitor(); // Монитор срыва основного насоса
+    initCycleRecords(); // Файл записей по циклам (LittleFS уже смонтирована)
+    initUsageRollups(); // Часовые/суточные сводки из NVS
     initSensitiveConfig(); // Инициализация модуля чувствительных настроек
 
     // Инициализация пинов кнопок (важно, если handleButtons() вызывается в loop)
@@ -453,6 +449,8 @@ void setup() {
 
     // Initialize ESP-NOW after Wi-Fi interface is up (either STA attempted or AP started)
     initEspNow(); // Из esp_now_handler.c (должен быть после loadConfig для MAC-адреса)
+    initClusterCoordinator(); // После initEspNow: кластер включается пирами с ролью контроллера
+    initStandbyController(); // Удержание холода по гистограмме запросов (NTP - после запуска Wi-Fi)
 
     initWebServerUtils();   // Initialize CSRF token
     setupWebServerRoutes(); // Setup all server.on() routes and server.begin()
@@ -490,9 +488,8 @@ void loop() {
             }
         }
     } else if (!ap_mode_active && WiFi.status() == WL_CONNECTED) { // WiFi подключен в режиме STA
-        if (getSystemErrorCode() == WIFI_ERROR) { // Если была ошибка WiFi, но сейчас подключено
-            app_log_i("WIFI", "WiFi reconnected. Clearing WiFi error."); // Исправлен формат спецификатора
-            clearSystemError();
+        if (clearSystemErrorRecovered(WIFI_ERROR)) { // Если была ошибка WiFi, но сейчас подключено (с удержанием)
+            app_log_i("WIFI", "WiFi reconnected. WiFi error cleared.");
         }
         // Логика проверки и передобавления пира ESP-NOW теперь в esp_now_handler
         // esp_now_handler сам будет пытаться восстановить пир при необходимости,
@@ -508,21 +505,26 @@ void loop() {
     // или выполняется ограниченно. Сейчас мы его пропускаем.
     if (!ap_mode_active) {
         handleButtons();
+        handleEspNowCommands(); // Команды экрана, принятые задачей WiFi, применяются здесь
         // Логика для режима STA
         // ... (существующий код для режима STA) ...
 
         handleFlowSensor();
+        handleStallMonitor(); // Сравнение шагов и импульсов потока, снижение скорости при срыве
         handleDosingState();
+        handleIlc(); // Запись траектории старта цикла (ILC)
         handleCalibrationLogic();
         // handleTempLogic() теперь вызывается после dosing_logic, чтобы dosing_logic мог сначала обновить свое состояние,
         // а затем sensors.c мог учесть это состояние при управлении компрессором.
         handleTempLogic(); // Читает температуры и управляет общим температурным режимом
+        handleStandbyController(); // Удержание линии охлажденной в ожидании следующего запроса
+        handleClusterCoordinator(); // Кластер: heartbeat, лидер, очередь пусков компрессоров, передача заданий
+        handleCycleRecords(); // Выборка температуры и компрессора для записи цикла
+        handleUsageRollups(); // Смена часовых/суточных корзин и редкое сохранение
+        handleCompressorScheduler(); // Применяет запросы к реле компрессора с учетом min ON/OFF
         handleMotorStepping();
-        // ESP-NOW статус отправляется из esp_now_handler.c по таймеру или по событию
-        if (esp_now_peer_added && WiFi.status() == WL_CONNECTED && millis() - last_esp_now_status_send_time >= ESP_NOW_STATUS_INTERVAL_MS) {
-            sendSystemStatusEspNow();
-            last_esp_now_status_send_time = millis(); // Исправлен формат спецификатора
-        }
+        handleEspNowStatus(); // Статус на экран: дельты по изменению и периодический ключевой кадр
+        handleEspNowTx();     // Очередь передачи ESP-NOW: следующий кадр, повторы по результату доставки
 
         DosingState_t local_dosing_state_for_pid; // Используем DosingState_t, так как dosing_logic.h будет обновлен
         portENTER_CRITICAL(&dosing_state_mutex);
@@ -535,6 +537,10 @@ void loop() {
         }
     }
 
+    handleConfigPersistence(); // Отложенная запись изменившихся настроек в NVS (и в режиме AP)
+    handleCounterJournal(); // Отложенная запись счетчиков наработки
+    handleErrorJournal(); // Дописывание новых записей журнала ошибок
+
     // --- Web Server and DNS Handling ---
     server.handleClient(); // Обрабатываем HTTP-запросы клиента (должно вызываться в каждой итерации loop)
 
@@ -3,6 +3,7 @@
 #include "motor_control.h"       // Для manualMotorForward, manualMotorReverse, stopManualMotor, isMotorRunningManual, motor_dir (если он там)
 #include "main.h"                // Для toggleSystemPower, app_log_w, app_log_i, system_power_enabled
 #include "localization.h"        // Для _T() и L_* строк
+#include "config_manager.h"      // Для flushConfigNow перед перезагрузкой
 #include <Arduino.h>             // Для digitalRead, millis, ESP.restart, HIGH, LOW
 
 // --- Button Debounce and State Variables (теперь статические в этом файле) ---
@@ -85,6 +86,7 @@ void handleButtons() {
 
     if (reset_requested && (c_ms - reset_request_time > reset_delay_ms)) {
         app_log_w("SYSTEM", _T(L_RESET_BUTTON_HELD_RESTART_MSG), reset_delay_ms);
+        flushConfigNow();
         ESP.restart();
     }
 }
\ No newline at end of file
@@ -72,7 +72,7 @@ void startCalibrationMode(float targetVolume, bool fromWeb) {
     local_dosing_state_check = current_dosing_state;
     portEXIT_CRITICAL(&dosing_state_mutex);
 
-    if (motor_running_auto || (local_dosing_state_check != DOSING_STATE_IDLE && local_dosing_state_check != DOSING_STATE_FINISHED && local_dosing_state_check != DOSING_STATE_ERROR)) {
+    if (isMotorRunningAuto() || (local_dosing_state_check != DOSING_STATE_IDLE && local_dosing_state_check != DOSING_STATE_FINISHED && local_dosing_state_check != DOSING_STATE_ERROR)) {
         setSystemError(LOGIC_ERROR, _T(L_ERROR_DOSING_CYCLE_ACTIVE_CANNOT_CALIBRATE));
         return;
     }
@@ -112,7 +112,7 @@ void stopCalibrationMode(float actualVolume, bool fromWeb) { // Для кали
 
     log_i("CAL_MOTOR", "Motor Calibration Stopped. Actual Volume: %.1f ml, Steps: %ld", actualVolume, final_steps);
     if (final_steps > 0 && actualVolume > 0 && !isnan(actualVolume)) {
-        config.mlPerStep = actualVolume / (float)final_steps;
+        getMotor(MOTOR_PRIMARY_CHANNEL).setMlPerStep(actualVolume / (float)final_steps);
         log_i("CAL_MOTOR", "New mlPerStep: %.6f", config.mlPerStep);
         saveConfig();
     } else {
@@ -0,0 +1,598 @@
+#include "cluster_coordinator.h"
+#include "cluster_core.h"     // Выбор лидера, очередь пусков, выбор узла для задания
+#include "esp_now_tx.h"       // Очередь передачи
+#include "esp_now_peers.h"    // Для getEspNowPeerCountByRole
+#include "dosing_logic.h"     // Для getDosingState
+#include "dosing_queue.h"     // Для peek/pop/requeueDosingJobFront, enqueueDosingJob
+#include "calibration_logic.h" // Для getCalibrationModeState
+#include "error_handler.h"    // Для getSystemErrorCode
+#include "sensors.h"          // Для tOut, tOut_filtered, compressorRunning
+#include "config_manager.h"   // Для config.tempSetpoint
+#include "utils.h"            // Для getUptimeSeconds
+#include "main.h"             // Для isSystemPowerEnabled и функций логирования
+#include <esp_wifi.h>         // Для esp_wifi_get_mac
+#include <string.h>
+#include <math.h>
+
+portMUX_TYPE cluster_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+static const uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Таблица узлов (защищена cluster_mutex: heartbeat соседей пишет задача WiFi). [0] - свой узел.
+static ClusterNode_t nodes[CLUSTER_MAX_NODES];
+static int node_count = 1;
+static ClusterStats_t stats = {};
+
+// Принятые задания (пишет задача WiFi, забирает loop; защищены cluster_mutex)
+typedef struct {
+    uint8_t mac[6];
+    struct_cluster_job_t job;
+} ClusterInboxJob_t;
+static ClusterInboxJob_t job_inbox[CLUSTER_JOB_INBOX_SIZE];
+static uint8_t job_inbox_count = 0;
+
+// Ответ на задание: ответы, решенные в задаче WiFi (полный прием, повтор; отправляет loop), и ответ на свое задание
+typedef struct {
+    uint8_t mac[6];
+    uint32_t job_id;
+    bool accepted;
+} ClusterJobAnswer_t;
+static ClusterJobAnswer_t job_answers[CLUSTER_JOB_INBOX_SIZE];
+static uint8_t job_answers_count = 0;
+static ClusterJobAnswer_t dispatch_reply;
+static bool dispatch_reply_pending = false;
+
+// Последнее принятое задание каждого соседа: повтор после потерянного ответа подтверждается снова,
+// но в очередь не ставится
+typedef struct {
+    uint8_t mac[6];
+    uint32_t job_id;
+    uint32_t sender_uptime_s; // Меньший uptime в heartbeat - отправитель перезагрузился, номера пошли заново
+} ClusterAcceptedJob_t;
+static ClusterAcceptedJob_t accepted_jobs[CLUSTER_MAX_NODES];
+static uint8_t accepted_jobs_count = 0;
+static uint8_t accepted_jobs_next = 0; // Заменяется при переполнении
+
+// Дальше - только из loop
+static uint8_t self_mac[6];
+static bool cluster_active = false;
+static unsigned long init_ms = 0;
+static unsigned long last_active_check_ms = 0;
+static unsigned long last_hb_ms = 0;
+static uint8_t last_hb_flags = 0;
+static bool hb_dirty = false;
+static ClusterLeaderState_t leader_state = {};
+static uint8_t current_grant_mac[6];  // Разрешение действующего лидера (свое или из его heartbeat)
+
+// Пуск компрессора
+static unsigned long start_pending_since = 0; // 0 - запроса нет
+static unsigned long last_ask_ms = 0;
+static unsigned long last_start_ms = 0;
+static bool have_start = false;
+static bool start_deferred_logged = false;
+
+// Переданное задание ждет ответа получателя; без ответа тот же номер уходит тому же узлу повторно
+static bool dispatch_in_flight = false;
+static DosingJob_t dispatch_job;
+static uint8_t dispatch_mac[6];
+static bool dispatch_tx_pending = false;    // Ждем результат передачи
+static bool dispatch_delivered = false;     // Хотя бы одна передача подтверждена - сосед мог задание принять
+static unsigned long dispatch_sent_ms = 0;  // Результат последней передачи
+static unsigned long last_dispatch_ms = 0;
+static uint8_t backoff_mac[6];
+static unsigned long backoff_since = 0;         // 0 - заданий получают все свободные узлы
+
+#define CLUSTER_NODE_FORGET_MS      (10UL * CLUSTER_NODE_TIMEOUT_MS) // Выбывший узел удаляется из таблицы
+#define CLUSTER_HEARTBEAT_MIN_GAP_MS 200 // Внеочередной heartbeat (смена флагов) не чаще
+
+static void formatMac(const uint8_t* mac, char* out, size_t size) {
+    snprintf(out, size, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static int16_t toCenti(float value) {
+    float c = roundf(value * 100.0f);
+    if (c > 32767.0f) c = 32767.0f;
+    if (c < -32767.0f) c = -32767.0f;
+    return (int16_t)c;
+}
+
+void initClusterCoordinator() {
+    esp_wifi_get_mac(WIFI_IF_STA, self_mac);
+    unsigned long now = millis();
+    portENTER_CRITICAL(&cluster_mutex);
+    memset(nodes, 0, sizeof(nodes));
+    memcpy(nodes[0].mac, self_mac, 6);
+    nodes[0].self = true;
+    nodes[0].heard_ms = now;
+    nodes[0].hb.line_temp_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+    nodes[0].hb.compressor_start_age_s = ESPNOW_CLUSTER_AGE_UNKNOWN;
+    node_count = 1;
+    job_inbox_count = 0;
+    job_answers_count = 0;
+    accepted_jobs_count = 0;
+    dispatch_reply_pending = false;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&cluster_mutex);
+    memset(&leader_state, 0, sizeof(leader_state));
+    memset(current_grant_mac, 0, sizeof(current_grant_mac));
+    init_ms = now;
+    last_active_check_ms = now - CLUSTER_HEARTBEAT_MS; // Проверка ролей на первом проходе loop
+    char mac_str[18];
+    formatMac(self_mac, mac_str, sizeof(mac_str));
+    log_i("CLUSTER", "Cluster coordinator initialized, node %s.", mac_str);
+}
+
+void clusterOnHeartbeat(const uint8_t* mac, const struct_cluster_heartbeat_t* hb) {
+    if (!mac || !hb) return;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&cluster_mutex);
+    int idx = clusterFindNode(nodes, node_count, mac);
+    if (idx < 0 && node_count < CLUSTER_MAX_NODES) {
+        idx = node_count++;
+        memset(&nodes[idx], 0, sizeof(nodes[idx]));
+        memcpy(nodes[idx].mac, mac, 6);
+    }
+    if (idx > 0) {
+        nodes[idx].hb = *hb;
+        nodes[idx].heard_ms = now;
+        stats.heartbeats_rx++;
+    }
+    portEXIT_CRITICAL(&cluster_mutex);
+}
+
+// Функции *Locked вызываются под cluster_mutex
+static uint32_t senderUptimeLocked(const uint8_t* mac) {
+    int idx = clusterFindNode(nodes, node_count, mac);
+    return idx > 0 ? nodes[idx].hb.uptime_seconds : 0;
+}
+
+static bool isRepeatedJobLocked(const uint8_t* mac, uint32_t job_id) {
+    for (uint8_t i = 0; i < accepted_jobs_count; i++) {
+        const ClusterAcceptedJob_t* a = &accepted_jobs[i];
+        if (memcmp(a->mac, mac, 6) == 0) return a->job_id == job_id && senderUptimeLocked(mac) >= a->sender_uptime_s;
+    }
+    return false;
+}
+
+static void noteAcceptedJobLocked(const uint8_t* mac, uint32_t job_id) {
+    uint8_t slot = accepted_jobs_count;
+    for (uint8_t i = 0; i < accepted_jobs_count; i++) {
+        if (memcmp(accepted_jobs[i].mac, mac, 6) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == accepted_jobs_count) {
+        if (accepted_jobs_count < CLUSTER_MAX_NODES) {
+            accepted_jobs_count++;
+        } else {
+            slot = accepted_jobs_next;
+            accepted_jobs_next = (accepted_jobs_next + 1) % CLUSTER_MAX_NODES;
+        }
+    }
+    memcpy(accepted_jobs[slot].mac, mac, 6);
+    accepted_jobs[slot].job_id = job_id;
+    accepted_jobs[slot].sender_uptime_s = senderUptimeLocked(mac);
+}
+
+// Если и список ответов полон, отправитель повторит задание
+static void queueAnswerLocked(const uint8_t* mac, uint32_t job_id, bool accepted) {
+    if (job_answers_count >= CLUSTER_JOB_INBOX_SIZE) return;
+    memcpy(job_answers[job_answers_count].mac, mac, 6);
+    job_answers[job_answers_count].job_id = job_id;
+    job_answers[job_answers_count].accepted = accepted;
+    job_answers_count++;
+}
+
+void clusterOnJob(const uint8_t* mac, const struct_cluster_job_t* job) {
+    if (!mac || !job) return;
+    bool stored = false;
+    bool repeated = false;
+    portENTER_CRITICAL(&cluster_mutex);
+    if (isRepeatedJobLocked(mac, job->job_id)) {
+        repeated = true;
+        queueAnswerLocked(mac, job->job_id, true);
+    } else if (job_inbox_count < CLUSTER_JOB_INBOX_SIZE) {
+        memcpy(job_inbox[job_inbox_count].mac, mac, 6);
+        job_inbox[job_inbox_count].job = *job;
+        job_inbox_count++;
+        stored = true;
+    } else {
+        stats.jobs_rejected++;
+        queueAnswerLocked(mac, job->job_id, false);
+    }
+    portEXIT_CRITICAL(&cluster_mutex);
+    if (repeated) log_i("CLUSTER", "Job #%lu repeated by peer, already queued - confirming again.", (unsigned long)job->job_id);
+    else if (!stored) log_w("CLUSTER", "Job inbox full, job #%lu from peer rejected.", (unsigned long)job->job_id);
+}
+
+void clusterOnJobReply(const uint8_t* mac, const struct_cluster_job_reply_t* reply) {
+    if (!mac || !reply) return;
+    portENTER_CRITICAL(&cluster_mutex);
+    memcpy(dispatch_reply.mac, mac, 6);
+    dispatch_reply.job_id = reply->job_id;
+    dispatch_reply.accepted = reply->accepted != 0;
+    dispatch_reply_pending = true;
+    portEXIT_CRITICAL(&cluster_mutex);
+}
+
+bool clusterCompressorStartAllowed() {
+    if (!cluster_active) return true;
+    unsigned long now = millis();
+    last_ask_ms = now;
+    if (start_pending_since == 0) {
+        start_pending_since = now ? now : 1;
+        start_deferred_logged = false;
+        hb_dirty = true;
+    }
+    // После загрузки сначала слушаем соседей: иначе узел считает себя одиноким лидером
+    bool granted = now - init_ms >= CLUSTER_NODE_TIMEOUT_MS && memcmp(current_grant_mac, self_mac, 6) == 0;
+    if (granted) return true;
+
+    if (now - start_pending_since >= CLUSTER_START_MAX_WAIT_MS) {
+        log_w("CLUSTER", "No start grant for %lu ms, starting compressor without cluster slot.", now - start_pending_since);
+        portENTER_CRITICAL(&cluster_mutex);
+        stats.starts_forced++;
+        portEXIT_CRITICAL(&cluster_mutex);
+        return true;
+    }
+    if (!start_deferred_logged) {
+        log_i("CLUSTER", "Compressor start waits for a cluster slot.");
+        start_deferred_logged = true;
+        portENTER_CRITICAL(&cluster_mutex);
+        stats.starts_deferred++;
+        portEXIT_CRITICAL(&cluster_mutex);
+    }
+    return false;
+}
+
+void clusterNoteCompressorStart() {
+    unsigned long now = millis();
+    last_start_ms = now;
+    have_start = true;
+    start_pending_since = 0;
+    hb_dirty = true;
+}
+
+// Собственный heartbeat; флаг лидера и разрешение дописываются после выборов
+static void buildSelfHeartbeat(unsigned long now, struct_cluster_heartbeat_t* hb) {
+    memset(hb, 0, sizeof(*hb));
+    SystemErrorCode err = getSystemErrorCode();
+    bool idle = getDosingState() == DOSING_STATE_IDLE && isSystemPowerEnabled() && !getCalibrationModeState() &&
+                (err == NO_ERROR || err == WARN_ESP_NOW_SEND_FAIL);
+    if (idle) hb->flags |= ESPNOW_CLUSTER_F_IDLE;
+    if (compressorRunning) hb->flags |= ESPNOW_CLUSTER_F_COMPRESSOR_ON;
+    if (start_pending_since != 0) hb->flags |= ESPNOW_CLUSTER_F_START_PENDING;
+    hb->queue_len = getDosingQueueLength();
+    float control_temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+    hb->line_temp_c100 = control_temp == -127.0f ? ESPNOW_CLUSTER_TEMP_UNKNOWN : toCenti(control_temp);
+    hb->setpoint_c100 = toCenti(getDosingTempSetpoint());
+    unsigned long start_age = now - last_start_ms;
+    hb->compressor_start_age_s = (have_start && start_age / 1000UL < ESPNOW_CLUSTER_AGE_UNKNOWN)
+                                 ? (uint16_t)(start_age / 1000UL) : ESPNOW_CLUSTER_AGE_UNKNOWN;
+    if (start_pending_since != 0) {
+        unsigned long wait_s = (now - start_pending_since) / 1000UL;
+        hb->start_wait_s = wait_s > 0xFFFE ? 0xFFFE : (uint16_t)wait_s;
+    }
+    hb->uptime_seconds = getUptimeSeconds();
+}
+
+static void sendHeartbeat(unsigned long now, const struct_cluster_heartbeat_t* hb) {
+    uint8_t frame[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeClusterHeartbeat(0, hb, frame, sizeof(frame)); // Номер назначит очередь передачи
+    if (len == 0) return;
+    // Широковещательно: все контроллеры слышат один кадр, подтверждения нет - пропуск покрывает следующий
+    if (espNowTxEnqueue(broadcast_mac, frame, len, ESP_NOW_TX_PRIO_NORMAL, ESP_NOW_TX_KEY_CLUSTER, NULL, NULL) != 0) {
+        portENTER_CRITICAL(&cluster_mutex);
+        stats.heartbeats_tx++;
+        portEXIT_CRITICAL(&cluster_mutex);
+    }
+    last_hb_ms = now;
+    last_hb_flags = hb->flags;
+    hb_dirty = false;
+}
+
+// Задание не передано - в начало своей очереди: выполнится здесь или уйдет другому узлу
+static void returnDispatchedJob(bool unanswered) {
+    dispatch_in_flight = false;
+    requeueDosingJobFront(&dispatch_job);
+    portENTER_CRITICAL(&cluster_mutex);
+    stats.jobs_returned++;
+    if (unanswered) stats.jobs_unanswered++;
+    portEXIT_CRITICAL(&cluster_mutex);
+}
+
+// arg - номер задания: результат передачи прежнего задания не относится к текущему
+static void onDispatchDone(uint32_t id, EspNowTxResult_t result, const uint8_t* frame, size_t len, void* arg) {
+    (void)frame; (void)len;
+    // Ответ получателя мог прийти раньше результата передачи - тогда задание уже решено
+    if (!dispatch_in_flight || (uint32_t)(uintptr_t)arg != dispatch_job.id) return;
+    dispatch_tx_pending = false;
+    dispatch_sent_ms = millis();
+    if (result == ESP_NOW_TX_DELIVERED) {
+        dispatch_delivered = true;
+        log_i("CLUSTER", "Job #%lu (%d ml) delivered to peer (tx %lu), waiting for reply.", (unsigned long)dispatch_job.id, dispatch_job.volume_ml, (unsigned long)id);
+        return;
+    }
+    if (dispatch_delivered) { // Прежняя передача дошла - задание могло быть принято, повторим
+        log_w("CLUSTER", "Job #%lu repeat not delivered (result %d), will retry.", (unsigned long)dispatch_job.id, (int)result);
+        return;
+    }
+    log_w("CLUSTER", "Job #%lu not delivered (result %d), returned to local queue.", (unsigned long)dispatch_job.id, (int)result);
+    returnDispatchedJob(false);
+}
+
+static bool sendDispatchedJob() {
+    struct_cluster_job_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.job_id = dispatch_job.id;
+    msg.volume_ml = dispatch_job.volume_ml;
+    msg.temp_setpoint_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+    msg.motor_speed = (int16_t)dispatch_job.motor_speed;
+    msg.channel_mask = dispatch_job.channel_mask;
+    uint8_t frame[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeClusterJob(0, &msg, frame, sizeof(frame));
+    dispatch_tx_pending = true; // До постановки: при вытеснении обработчик вызывается сразу
+    if (len == 0 || espNowTxEnqueue(dispatch_mac, frame, len, ESP_NOW_TX_PRIO_HIGH, ESP_NOW_TX_KEY_NONE, onDispatchDone,
+                                    (void*)(uintptr_t)dispatch_job.id) == 0) {
+        dispatch_tx_pending = false;
+        dispatch_sent_ms = millis();
+        return false;
+    }
+    return true;
+}
+
+static void backoffNode(const uint8_t* mac, unsigned long now) {
+    memcpy(backoff_mac, mac, 6);
+    backoff_since = now ? now : 1;
+}
+
+// Задание считается переданным только после согласия получателя: подтверждение MAC-уровня не говорит,
+// что прием или очередь соседа не были полны
+static void handleDispatchReply(unsigned long now) {
+    ClusterJobAnswer_t reply;
+    bool have_reply;
+    portENTER_CRITICAL(&cluster_mutex);
+    have_reply = dispatch_reply_pending;
+    reply = dispatch_reply;
+    dispatch_reply_pending = false;
+    portEXIT_CRITICAL(&cluster_mutex);
+    if (!dispatch_in_flight) return;
+
+    char mac_str[18];
+    formatMac(dispatch_mac, mac_str, sizeof(mac_str));
+    if (have_reply && reply.job_id == dispatch_job.id && memcmp(reply.mac, dispatch_mac, 6) == 0) {
+        if (reply.accepted) {
+            dispatch_in_flight = false;
+            log_i("CLUSTER", "Job #%lu (%d ml) accepted by %s.", (unsigned long)dispatch_job.id, dispatch_job.volume_ml, mac_str);
+            portENTER_CRITICAL(&cluster_mutex);
+            stats.jobs_dispatched++;
+            portEXIT_CRITICAL(&cluster_mutex);
+        } else {
+            log_w("CLUSTER", "Job #%lu rejected by %s, returned to local queue.", (unsigned long)dispatch_job.id, mac_str);
+            backoffNode(dispatch_mac, now);
+            returnDispatchedJob(false);
+        }
+        return;
+    }
+    if (dispatch_tx_pending || (long)(now - dispatch_sent_ms) < (long)CLUSTER_JOB_REPLY_TIMEOUT_MS) return; // sent_ms может быть позже now прохода
+
+    // Ответ потерян: повторяем тот же номер тому же узлу - получатель узнает повтор и не поставит его дважды.
+    // Себе задание возвращается, только если получатель выбыл из кластера (его очередь в RAM не пережила бы сбой).
+    bool alive;
+    portENTER_CRITICAL(&cluster_mutex);
+    int idx = clusterFindNode(nodes, node_count, dispatch_mac);
+    alive = idx > 0 && clusterNodeAlive(&nodes[idx], now);
+    if (alive) stats.jobs_resent++;
+    portEXIT_CRITICAL(&cluster_mutex);
+    if (!alive) {
+        log_w("CLUSTER", "Node %s left the cluster without answering job #%lu, returned to local queue.", mac_str, (unsigned long)dispatch_job.id);
+        backoffNode(dispatch_mac, now);
+        returnDispatchedJob(true);
+        return;
+    }
+    log_w("CLUSTER", "No reply from %s for job #%lu, sending it again.", mac_str, (unsigned long)dispatch_job.id);
+    sendDispatchedJob();
+}
+
+// Задание, ждущее за идущим здесь циклом, - свободному соседу с самой холодной линией
+static void dispatchWaitingJob(unsigned long now, ClusterNode_t* snap, int count) {
+    if (dispatch_in_flight || now - last_dispatch_ms < CLUSTER_HEARTBEAT_MS) return;
+    if (getDosingState() == DOSING_STATE_IDLE) return; // Свободен - выполнит сам
+    DosingJob_t job;
+    if (!peekDosingJob(&job) || job.source == DOSING_JOB_SOURCE_CLUSTER) return; // Переданные дальше не передаются
+    // Уставка задания относится к своей линии: у соседа свой продукт и своя уставка - такое задание не передается
+    if (!isnan(job.temp_setpoint)) return;
+    if (backoff_since != 0) {
+        if (now - backoff_since >= CLUSTER_JOB_BACKOFF_MS) {
+            backoff_since = 0;
+        } else {
+            int idx = clusterFindNode(snap, count, backoff_mac);
+            if (idx > 0) snap[idx].hb.flags &= ~ESPNOW_CLUSTER_F_IDLE;
+        }
+    }
+    int target = clusterPickDispatchTarget(snap, count, now);
+    if (target < 0 || !popDosingJob(&job)) return;
+    last_dispatch_ms = now;
+
+    dispatch_job = job;
+    memcpy(dispatch_mac, snap[target].mac, 6);
+    dispatch_delivered = false;
+    dispatch_in_flight = true;
+    if (!sendDispatchedJob()) {
+        dispatch_in_flight = false;
+        requeueDosingJobFront(&job);
+        return;
+    }
+    char mac_str[18];
+    formatMac(snap[target].mac, mac_str, sizeof(mac_str));
+    log_i("CLUSTER", "Job #%lu (%d ml) waits behind local cycle, dispatching to idle node %s (T %.2fC, setpoint %.2fC).",
+          (unsigned long)job.id, job.volume_ml, mac_str, snap[target].hb.line_temp_c100 / 100.0f, snap[target].hb.setpoint_c100 / 100.0f);
+    // До следующего heartbeat соседа считаем его занятым, чтобы не отдать ему всю очередь сразу
+    portENTER_CRITICAL(&cluster_mutex);
+    int idx = clusterFindNode(nodes, node_count, snap[target].mac);
+    if (idx > 0) {
+        nodes[idx].hb.flags &= ~ESPNOW_CLUSTER_F_IDLE;
+        nodes[idx].hb.queue_len++;
+    }
+    portEXIT_CRITICAL(&cluster_mutex);
+}
+
+static void sendJobReply(const uint8_t* mac, uint32_t job_id, bool accepted) {
+    struct_cluster_job_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.job_id = job_id;
+    reply.accepted = accepted ? 1 : 0;
+    uint8_t frame[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeClusterJobReply(0, &reply, frame, sizeof(frame));
+    if (len == 0 || espNowTxEnqueue(mac, frame, len, ESP_NOW_TX_PRIO_HIGH, ESP_NOW_TX_KEY_NONE, NULL, NULL) == 0) {
+        log_w("CLUSTER", "Reply to job #%lu not queued, sender will time out.", (unsigned long)job_id);
+    }
+}
+
+static void drainJobInbox() {
+    ClusterInboxJob_t jobs[CLUSTER_JOB_INBOX_SIZE];
+    ClusterJobAnswer_t answers[CLUSTER_JOB_INBOX_SIZE];
+    uint8_t count, answer_count;
+    portENTER_CRITICAL(&cluster_mutex);
+    count = job_inbox_count;
+    memcpy(jobs, job_inbox, count * sizeof(ClusterInboxJob_t));
+    job_inbox_count = 0;
+    answer_count = job_answers_count;
+    memcpy(answers, job_answers, answer_count * sizeof(ClusterJobAnswer_t));
+    job_answers_count = 0;
+    portEXIT_CRITICAL(&cluster_mutex);
+
+    for (uint8_t i = 0; i < answer_count; i++) sendJobReply(answers[i].mac, answers[i].job_id, answers[i].accepted);
+
+    for (uint8_t i = 0; i < count; i++) {
+        const struct_cluster_job_t* j = &jobs[i].job;
+        char mac_str[18];
+        formatMac(jobs[i].mac, mac_str, sizeof(mac_str));
+        // Повтор мог попасть в прием раньше, чем оригинал был поставлен в очередь
+        bool repeated;
+        portENTER_CRITICAL(&cluster_mutex);
+        repeated = isRepeatedJobLocked(jobs[i].mac, j->job_id);
+        portEXIT_CRITICAL(&cluster_mutex);
+        if (repeated) {
+            log_i("CLUSTER", "Job #%lu from %s already queued - confirming again.", (unsigned long)j->job_id, mac_str);
+            sendJobReply(jobs[i].mac, j->job_id, true);
+            continue;
+        }
+        // Каналы соседа могут быть не у нас: принятое задание с такой маской не запустилось бы и пропало.
+        // Уставка соседа не применяется и на цикл: охлаждение этой линии ведется по своей уставке.
+        bool channels_ok = isDosingChannelMaskUsable(j->channel_mask);
+        bool ok = channels_ok &&
+                  enqueueDosingJob(j->volume_ml, DOSING_QUEUE_KEEP_TEMP, j->motor_speed, j->channel_mask, DOSING_JOB_SOURCE_CLUSTER);
+        portENTER_CRITICAL(&cluster_mutex);
+        if (ok) {
+            stats.jobs_received++;
+            noteAcceptedJobLocked(jobs[i].mac, j->job_id);
+        } else {
+            stats.jobs_rejected++;
+        }
+        portEXIT_CRITICAL(&cluster_mutex);
+        if (ok) log_i("CLUSTER", "Job #%lu (%d ml) from %s queued.", (unsigned long)j->job_id, (int)j->volume_ml, mac_str);
+        else if (!channels_ok) log_w("CLUSTER", "Job #%lu from %s rejected: channels 0x%02X invalid or not calibrated here.", (unsigned long)j->job_id, mac_str, j->channel_mask);
+        else log_w("CLUSTER", "Job #%lu (%d ml) from %s rejected by local queue.", (unsigned long)j->job_id, (int)j->volume_ml, mac_str);
+        sendJobReply(jobs[i].mac, j->job_id, ok);
+    }
+}
+
+void handleClusterCoordinator() {
+    unsigned long now = millis();
+
+    // Кластер включается пирами с ролью контроллера; таблица меняется редко - проверка раз в период heartbeat
+    if (now - last_active_check_ms >= CLUSTER_HEARTBEAT_MS) {
+        last_active_check_ms = now;
+        bool active = getEspNowPeerCountByRole(ESP_NOW_PEER_CONTROLLER) > 0;
+        if (active != cluster_active) {
+            log_i("CLUSTER", "Cluster mode %s.", active ? "enabled" : "disabled (no controller peers)");
+            cluster_active = active;
+            memset(&leader_state, 0, sizeof(leader_state));
+            memset(current_grant_mac, 0, sizeof(current_grant_mac));
+            start_pending_since = 0;
+            // Свой heartbeat - в бюджет эфира, чтобы он не вытеснял дельты статуса на экран
+            espNowTxSetExtraAirtime(active ? espNowAirtimeUs(ESPNOW_FRAME_OVERHEAD + sizeof(struct_cluster_heartbeat_t)) * 1000 / CLUSTER_HEARTBEAT_MS : 0);
+            portENTER_CRITICAL(&cluster_mutex);
+            node_count = 1;
+            stats.active = active;
+            stats.leader = false;
+            stats.nodes_alive = 1;
+            portEXIT_CRITICAL(&cluster_mutex);
+        }
+    }
+    handleDispatchReply(now); // И после выключения кластера: переданное задание не должно потеряться
+    if (!cluster_active) return;
+
+    // Планировщик перестал спрашивать (спрос снят или компрессор включен иначе) - запрос на пуск снят
+    if (start_pending_since != 0 && now - last_ask_ms > CLUSTER_PENDING_ASK_MS) {
+        start_pending_since = 0;
+        hb_dirty = true;
+    }
+
+    struct_cluster_heartbeat_t self_hb;
+    buildSelfHeartbeat(now, &self_hb);
+
+    ClusterNode_t snap[CLUSTER_MAX_NODES];
+    int count;
+    portENTER_CRITICAL(&cluster_mutex);
+    nodes[0].hb = self_hb;
+    nodes[0].heard_ms = now;
+    for (int i = node_count - 1; i > 0; i--) {
+        if (now - nodes[i].heard_ms >= CLUSTER_NODE_FORGET_MS) nodes[i] = nodes[--node_count];
+    }
+    count = node_count;
+    memcpy(snap, nodes, count * sizeof(ClusterNode_t));
+    portEXIT_CRITICAL(&cluster_mutex);
+
+    int leader = clusterElectLeader(snap, count, now);
+    bool self_leader = leader == 0;
+    if (self_leader) {
+        if (clusterLeaderUpdate(&leader_state, snap, count, now)) hb_dirty = true;
+        memcpy(current_grant_mac, leader_state.grant_mac, 6);
+        self_hb.flags |= ESPNOW_CLUSTER_F_LEADER;
+        memcpy(self_hb.grant_mac, leader_state.grant_mac, 6);
+    } else {
+        leader_state.granted = false; // Разрешения выдает только действующий лидер
+        memset(leader_state.grant_mac, 0, sizeof(leader_state.grant_mac));
+        memcpy(current_grant_mac, snap[leader].hb.grant_mac, 6);
+    }
+
+    uint8_t alive = 0;
+    for (int i = 0; i < count; i++) {
+        if (clusterNodeAlive(&snap[i], now)) alive++;
+    }
+    bool leader_changed;
+    portENTER_CRITICAL(&cluster_mutex);
+    nodes[0].hb = self_hb;
+    leader_changed = memcmp(stats.leader_mac, snap[leader].mac, 6) != 0;
+    memcpy(stats.leader_mac, snap[leader].mac, 6);
+    if (leader_changed) stats.leader_changes++;
+    stats.leader = self_leader;
+    stats.nodes_alive = alive;
+    stats.grants_issued = leader_state.grants_issued;
+    stats.start_pending = start_pending_since != 0;
+    stats.start_wait_ms = start_pending_since != 0 ? now - start_pending_since : 0;
+    portEXIT_CRITICAL(&cluster_mutex);
+    if (leader_changed) {
+        char mac_str[18];
+        formatMac(snap[leader].mac, mac_str, sizeof(mac_str));
+        log_i("CLUSTER", "Leader: %s%s (%u nodes alive).", mac_str, self_leader ? " (this node)" : "", alive);
+    }
+
+    if (self_hb.flags != last_hb_flags) hb_dirty = true;
+    if (now - last_hb_ms >= CLUSTER_HEARTBEAT_MS || (hb_dirty && now - last_hb_ms >= CLUSTER_HEARTBEAT_MIN_GAP_MS)) {
+        sendHeartbeat(now, &self_hb);
+    }
+
+    drainJobInbox();
+    dispatchWaitingJob(now, snap, count);
+}
+
+void getClusterStats(ClusterStats_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&cluster_mutex);
+    *out = stats;
+    portEXIT_CRITICAL(&cluster_mutex);
+}
@@ -0,0 +1,55 @@
+#ifndef CLUSTER_COORDINATOR_H
+#define CLUSTER_COORDINATOR_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+#include "esp_now_protocol.h"  // Для struct_cluster_heartbeat_t, struct_cluster_job_t, struct_cluster_job_reply_t
+
+// Кластер из нескольких главных ESP32 поверх ESP-NOW. Включается сам, когда в таблице пиров есть хотя бы
+// один пир с ролью "Контроллер". Узлы раз в секунду рассылают heartbeat (состояние, линия, компрессор);
+// лидер (наименьший MAC) по очереди разрешает пуски компрессоров не чаще CLUSTER_START_STAGGER_MS,
+// чтобы пусковые токи не совпадали. Задание из очереди, ждущее за идущим циклом, передается свободному
+// узлу с самой холодной линией; получатель отвечает, принял ли задание в свою очередь, и без согласия
+// задание возвращается отправителю. Без ответа задание повторяется с тем же номером, получатель
+// подтверждает повтор, не ставя его в очередь второй раз. Решения - в cluster_core.h.
+
+#define CLUSTER_JOB_INBOX_SIZE      4      // Принятые задания: задача WiFi -> loop
+#define CLUSTER_PENDING_ASK_MS      1000   // Планировщик не спрашивал разрешение дольше - запрос на пуск снят
+#define CLUSTER_JOB_REPLY_TIMEOUT_MS 2000  // Ответа на задание нет - тот же номер уходит тому же узлу повторно
+#define CLUSTER_JOB_BACKOFF_MS      10000  // Отклонивший или выбывший без ответа узел столько не получает заданий
+
+typedef struct {
+    bool active;                // В таблице пиров есть контроллеры
+    bool leader;
+    uint8_t leader_mac[6];
+    uint8_t nodes_alive;        // Включая себя
+    bool start_pending;
+    unsigned long start_wait_ms;
+    uint32_t heartbeats_tx;
+    uint32_t heartbeats_rx;
+    uint32_t leader_changes;
+    uint32_t grants_issued;     // Выдано этим узлом, пока он лидер
+    uint32_t starts_deferred;   // Пуск отложен: нет разрешения
+    uint32_t starts_forced;     // Пуск без разрешения после CLUSTER_START_MAX_WAIT_MS
+    uint32_t jobs_dispatched;   // Передано соседям и принято их очередью
+    uint32_t jobs_returned;     // Не доставлено, отклонено или получатель выбыл - возвращено в свою очередь
+    uint32_t jobs_unanswered;   // Из них получатель выбыл, не ответив
+    uint32_t jobs_resent;       // Повторы задания без ответа
+    uint32_t jobs_received;
+    uint32_t jobs_rejected;     // Получено, но свой прием или очередь полны
+} ClusterStats_t;
+
+extern portMUX_TYPE cluster_mutex;
+
+void initClusterCoordinator();   // После initEspNow()
+void handleClusterCoordinator(); // Вызывается из loop() перед handleCompressorScheduler()
+// Из задачи WiFi (onEspNowReceive), только от пиров с ролью контроллера
+void clusterOnHeartbeat(const uint8_t* mac, const struct_cluster_heartbeat_t* hb);
+void clusterOnJob(const uint8_t* mac, const struct_cluster_job_t* job);
+void clusterOnJobReply(const uint8_t* mac, const struct_cluster_job_reply_t* reply);
+// Из handleCompressorScheduler(): спрос есть, минимальный простой выдержан. false - ждать очереди кластера.
+bool clusterCompressorStartAllowed();
+void clusterNoteCompressorStart(); // Из compressorNotifyStateChange(true)
+void getClusterStats(ClusterStats_t* out);
+
+#endif // CLUSTER_COORDINATOR_H
@@ -0,0 +1,140 @@
+#ifndef CLUSTER_CORE_H
+#define CLUSTER_CORE_H
+
+// Решения кластера главных ESP32: выбор лидера, очередь пусков компрессоров, выбор узла для задания.
+// Только чистые функции над таблицей узлов и явным временем (без millis() и драйверов), поэтому
+// несколько узлов можно прогнать в одном процессе на хосте, передавая их heartbeat друг другу.
+// Обвязка прошивки (прием, передача, компрессор, очередь дозирования) - в cluster_coordinator.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_now_protocol.h" // Для struct_cluster_heartbeat_t, ESPNOW_CLUSTER_F_*
+
+#define CLUSTER_MAX_NODES            8      // Включая себя
+#define CLUSTER_HEARTBEAT_MS         1000
+#define CLUSTER_NODE_TIMEOUT_MS      3500   // Узел без heartbeat дольше - выбыл (пропуск трех кадров)
+#define CLUSTER_START_STAGGER_MS     15000  // Минимум между пусками компрессоров кластера (пусковой ток)
+#define CLUSTER_GRANT_TIMEOUT_MS     5000   // Разрешение не использовано за это время - следующему
+#define CLUSTER_START_MAX_WAIT_MS    120000 // Ждет дольше - пуск без разрешения (лидер молчит, охлаждение важнее)
+
+typedef struct {
+    uint8_t mac[6];
+    bool self;
+    unsigned long heard_ms;           // Прием последнего heartbeat (для себя - момент обновления)
+    struct_cluster_heartbeat_t hb;
+} ClusterNode_t;
+
+// Состояние лидера: одно разрешение на пуск за раз
+typedef struct {
+    bool granted;
+    uint8_t grant_mac[6];
+    unsigned long grant_ms;
+    uint32_t grants_issued;
+} ClusterLeaderState_t;
+
+static inline bool clusterNodeAlive(const ClusterNode_t* node, unsigned long now) {
+    return node->self || now - node->heard_ms < CLUSTER_NODE_TIMEOUT_MS;
+}
+
+static inline bool clusterMacIsZero(const uint8_t* mac) {
+    static const uint8_t zero[6] = {0, 0, 0, 0, 0, 0};
+    return memcmp(mac, zero, 6) == 0;
+}
+
+// Лидер - живой узел с наименьшим MAC. Голосования нет: все узлы видят одни и те же heartbeat
+// и приходят к одному ответу за CLUSTER_NODE_TIMEOUT_MS после появления или пропажи узла.
+static inline int clusterElectLeader(const ClusterNode_t* nodes, int count, unsigned long now) {
+    int leader = -1;
+    for (int i = 0; i < count; i++) {
+        if (!clusterNodeAlive(&nodes[i], now)) continue;
+        if (leader < 0 || memcmp(nodes[i].mac, nodes[leader].mac, 6) < 0) leader = i;
+    }
+    return leader;
+}
+
+static inline int clusterFindNode(const ClusterNode_t* nodes, int count, const uint8_t* mac) {
+    for (int i = 0; i < count; i++) {
+        if (memcmp(nodes[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+// Последний пуск компрессора в кластере по возрасту из heartbeat. false - пусков не было (или давно).
+// Новый лидер знает о пусках из чужих heartbeat, поэтому смена лидера не обнуляет интервал.
+static inline bool clusterLastStartMs(const ClusterNode_t* nodes, int count, unsigned long now, unsigned long* out) {
+    bool found = false;
+    unsigned long newest_age = 0;
+    for (int i = 0; i < count; i++) {
+        if (!clusterNodeAlive(&nodes[i], now) || nodes[i].hb.compressor_start_age_s == ESPNOW_CLUSTER_AGE_UNKNOWN) continue;
+        unsigned long age = (unsigned long)nodes[i].hb.compressor_start_age_s * 1000UL + (now - nodes[i].heard_ms);
+        if (!found || age < newest_age) newest_age = age;
+        found = true;
+    }
+    if (found && out) *out = now - newest_age;
+    return found;
+}
+
+// Шаг лидера: снять использованное/просроченное разрешение, выдать новое самому долго ждущему узлу,
+// если с последнего пуска прошло CLUSTER_START_STAGGER_MS. Возвращает true, если разрешение сменилось.
+static inline bool clusterLeaderUpdate(ClusterLeaderState_t* st, const ClusterNode_t* nodes, int count, unsigned long now) {
+    bool changed = false;
+    if (st->granted) {
+        int idx = clusterFindNode(nodes, count, st->grant_mac);
+        bool consumed = idx >= 0 && (long)(nodes[idx].heard_ms - st->grant_ms) >= 0 &&
+                        !(nodes[idx].hb.flags & ESPNOW_CLUSTER_F_START_PENDING);
+        bool lost = idx < 0 || !clusterNodeAlive(&nodes[idx], now);
+        if (consumed || lost || now - st->grant_ms >= CLUSTER_GRANT_TIMEOUT_MS) {
+            st->granted = false;
+            memset(st->grant_mac, 0, sizeof(st->grant_mac));
+            changed = true;
+        }
+    }
+    if (st->granted) return changed;
+
+    unsigned long last_start;
+    if (clusterLastStartMs(nodes, count, now, &last_start) && now - last_start < CLUSTER_START_STAGGER_MS) return changed;
+
+    int best = -1;
+    unsigned long best_wait = 0;
+    for (int i = 0; i < count; i++) {
+        if (!clusterNodeAlive(&nodes[i], now) || !(nodes[i].hb.flags & ESPNOW_CLUSTER_F_START_PENDING)) continue;
+        unsigned long wait = (unsigned long)nodes[i].hb.start_wait_s * 1000UL + (now - nodes[i].heard_ms);
+        if (best < 0 || wait > best_wait || (wait == best_wait && memcmp(nodes[i].mac, nodes[best].mac, 6) < 0)) {
+            best = i;
+            best_wait = wait;
+        }
+    }
+    if (best < 0) return changed;
+    st->granted = true;
+    memcpy(st->grant_mac, nodes[best].mac, 6);
+    st->grant_ms = now;
+    st->grants_issued++;
+    return true;
+}
+
+// Разрешен ли пуск узлу self_mac по последнему heartbeat лидера
+static inline bool clusterStartGranted(const ClusterNode_t* nodes, int leader, const uint8_t* self_mac) {
+    return leader >= 0 && memcmp(nodes[leader].hb.grant_mac, self_mac, 6) == 0;
+}
+
+// Узел для задания из очереди: свободный (IDLE, пустая очередь) с самой холодной относительно уставки линией.
+// Узлы с неготовым датчиком не выбираются. -1 - свободных нет.
+static inline int clusterPickDispatchTarget(const ClusterNode_t* nodes, int count, unsigned long now) {
+    int best = -1;
+    int32_t best_excess = 0;
+    for (int i = 0; i < count; i++) {
+        const ClusterNode_t* n = &nodes[i];
+        if (n->self || !clusterNodeAlive(n, now)) continue;
+        if (!(n->hb.flags & ESPNOW_CLUSTER_F_IDLE) || n->hb.queue_len != 0) continue;
+        if (n->hb.line_temp_c100 == ESPNOW_CLUSTER_TEMP_UNKNOWN) continue;
+        int32_t excess = (int32_t)n->hb.line_temp_c100 - (int32_t)n->hb.setpoint_c100;
+        if (best < 0 || excess < best_excess || (excess == best_excess && memcmp(n->mac, nodes[best].mac, 6) < 0)) {
+            best = i;
+            best_excess = excess;
+        }
+    }
+    return best;
+}
+
+#endif // CLUSTER_CORE_H
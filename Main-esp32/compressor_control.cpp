@@ -0,0 +1,234 @@
+#include "compressor_control.h"
+#include "sensors.h"        // Для compressorOn/Off, compressorRunning, tOut, tOut_filtered
+#include "main.h"           // Для system_power_enabled и функций логирования
+#include "usage_rollups.h"  // Учет работы компрессора по часам/суткам
+#include "minute_rate.h"    // Скользящее окно метрик
+#include "cluster_coordinator.h" // Очередь пусков компрессоров соседних контроллеров
+#include "dosing_logic.h"   // Для getDosingTempSetpoint
+
+portMUX_TYPE compressor_sched_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Состояние планировщика (защищено compressor_sched_mutex)
+static uint8_t compressor_demand_mask = 0;
+static unsigned long compressor_last_on_ms = 0;
+static unsigned long compressor_last_off_ms = 0;
+static bool compressor_deferred_logged = false;
+static uint32_t compressor_deferred_requests = 0;
+static uint32_t compressor_predictive_starts = 0;
+static bool compressor_predict_active = false;
+
+// Оценка наклона T_out (только из loop)
+static float slope_c_per_min = 0.0f;
+static float slope_last_temp = -127.0f;
+static unsigned long slope_last_sample_ms = 0;
+
+// Скользящее окно метрик: минутные корзины
+typedef struct {
+    uint32_t on_ms;
+    uint32_t above_ms;
+    uint16_t starts;
+} CompressorBucket_t;
+
+static MinuteRing<CompressorBucket_t, COMPRESSOR_METRICS_BUCKETS> metric_ring; // Под compressor_sched_mutex
+static unsigned long metric_last_tick_ms = 0;
+
+void initCompressorControl() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    compressor_demand_mask = 0;
+    compressor_last_on_ms = 0;
+    // После перезагрузки компрессор мог только что работать - выдерживаем простой и при старте
+    compressor_last_off_ms = now;
+    metric_ring.reset(now);
+    metric_last_tick_ms = now;
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+
+    slope_c_per_min = 0.0f;
+    slope_last_temp = -127.0f;
+    slope_last_sample_ms = now;
+    log_i("COMP_SCHED", "Compressor scheduler initialized (min ON %lu ms, min OFF %lu ms).", (unsigned long)COMPRESSOR_MIN_ON_TIME_MS, (unsigned long)COMPRESSOR_MIN_OFF_TIME_MS);
+}
+
+void compressorRequest(uint8_t source, bool on) {
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    if (on) {
+        compressor_demand_mask |= source;
+    } else {
+        compressor_demand_mask &= ~source;
+    }
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+}
+
+void compressorReleaseAll() {
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    compressor_demand_mask = 0;
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+}
+
+void compressorNotifyStateChange(bool running) {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    metric_ring.rotate(now);
+    if (running) {
+        compressor_last_on_ms = now;
+        metric_ring.current().starts++;
+    } else {
+        compressor_last_off_ms = now;
+    }
+    compressor_deferred_logged = false;
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+    usageRollupNoteCompressor(running);
+    if (running) clusterNoteCompressorStart();
+}
+
+bool compressorPredictsOvershoot(float control_temp, float upper_limit) {
+    if (control_temp == -127.0f || slope_c_per_min < COMPRESSOR_PREDICT_MIN_SLOPE) {
+        compressor_predict_active = false;
+        return false;
+    }
+    // Горизонт = время упреждения + остаток блокировки простоя: раньше этого момента пуск все равно невозможен
+    unsigned long horizon_ms = COMPRESSOR_PREDICT_LEAD_MS;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    if (!compressorRunning && now - compressor_last_off_ms < COMPRESSOR_MIN_OFF_TIME_MS) {
+        horizon_ms += COMPRESSOR_MIN_OFF_TIME_MS - (now - compressor_last_off_ms);
+    }
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+
+    float predicted = control_temp + slope_c_per_min * ((float)horizon_ms / 60000.0f);
+    bool overshoot = predicted > upper_limit;
+    if (overshoot && !compressor_predict_active && !compressorRunning) {
+        log_i("COMP_SCHED", "Predictive start: T=%.2fC, slope %.3f C/min, predicted %.2fC > %.2fC in %lu s.", control_temp, slope_c_per_min, predicted, upper_limit, horizon_ms / 1000);
+        portENTER_CRITICAL(&compressor_sched_mutex);
+        compressor_predictive_starts++;
+        portEXIT_CRITICAL(&compressor_sched_mutex);
+    }
+    compressor_predict_active = overshoot;
+    return overshoot;
+}
+
+void compressorPreStart() {
+    float control_temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+    float setpoint = getDosingTempSetpoint(); // Уставка цикла (задание очереди может ее переопределить)
+    // Датчик не готов - охлаждать придется в любом случае (PRE_COOLING)
+    if (control_temp == -127.0f || control_temp > setpoint ||
+        compressorPredictsOvershoot(control_temp, setpoint + COMPRESSOR_BAND_C)) {
+        log_i("COMP_SCHED", "Dosing requested, pre-starting compressor (T=%.2fC, setpoint %.1fC).", control_temp, setpoint);
+        compressorRequest(COMP_DEMAND_DOSING, true);
+    }
+}
+
+static void updateTempSlope(unsigned long now, float control_temp) {
+    if (now - slope_last_sample_ms < COMPRESSOR_SLOPE_SAMPLE_MS) return;
+    if (control_temp == -127.0f) {
+        slope_last_temp = -127.0f;
+        slope_c_per_min = 0.0f;
+    } else {
+        if (slope_last_temp != -127.0f) {
+            float dt_min = (float)(now - slope_last_sample_ms) / 60000.0f;
+            float inst = (control_temp - slope_last_temp) / dt_min;
+            slope_c_per_min = COMPRESSOR_SLOPE_ALPHA * inst + (1.0f - COMPRESSOR_SLOPE_ALPHA) * slope_c_per_min;
+        }
+        slope_last_temp = control_temp;
+    }
+    slope_last_sample_ms = now;
+}
+
+void handleCompressorScheduler() {
+    unsigned long now = millis();
+    float control_temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+    updateTempSlope(now, control_temp);
+
+    uint8_t demand;
+    unsigned long last_on, last_off;
+    bool running = compressorRunning;
+    bool above = control_temp != -127.0f && control_temp > getDosingTempSetpoint() + COMPRESSOR_BAND_C;
+
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    metric_ring.rotate(now);
+    unsigned long dt = now - metric_last_tick_ms;
+    metric_last_tick_ms = now;
+    CompressorBucket_t* bucket = &metric_ring.current();
+    if (running) bucket->on_ms += dt;
+    if (above) bucket->above_ms += dt;
+    if (!system_power_enabled) {
+        compressor_demand_mask = 0; // После включения питания не стартуем по "старому" запросу
+    }
+    demand = compressor_demand_mask;
+    last_on = compressor_last_on_ms;
+    last_off = compressor_last_off_ms;
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+
+    if (!system_power_enabled) return; // Выключение реле при отключенном питании делает handleTempLogic()
+
+    if (demand != 0 && !running) {
+        if (now - last_off >= COMPRESSOR_MIN_OFF_TIME_MS) {
+            // В кластере пуск ждет своей очереди (пусковые токи соседей не совпадают); отказ логирует кластер
+            if (clusterCompressorStartAllowed()) {
+                log_i("COMP_SCHED", "Demand 0x%02X -> compressor ON.", demand);
+                compressorOn();
+            }
+        } else if (!compressor_deferred_logged) {
+            log_i("COMP_SCHED", "Start deferred: min OFF time, %lu ms remaining.", COMPRESSOR_MIN_OFF_TIME_MS - (now - last_off));
+            portENTER_CRITICAL(&compressor_sched_mutex);
+            compressor_deferred_logged = true;
+            compressor_deferred_requests++;
+            portEXIT_CRITICAL(&compressor_sched_mutex);
+        }
+    } else if (demand == 0 && running) {
+        if (now - last_on >= COMPRESSOR_MIN_ON_TIME_MS) {
+            log_i("COMP_SCHED", "No demand -> compressor OFF.");
+            compressorOff();
+        } else if (!compressor_deferred_logged) {
+            log_d("COMP_SCHED", "Stop deferred: min ON time, %lu ms remaining.", COMPRESSOR_MIN_ON_TIME_MS - (now - last_on));
+            portENTER_CRITICAL(&compressor_sched_mutex);
+            compressor_deferred_logged = true;
+            portEXIT_CRITICAL(&compressor_sched_mutex);
+        }
+    } else {
+        compressor_deferred_logged = false;
+    }
+}
+
+void getCompressorMetrics(CompressorMetrics_t* out) {
+    if (!out) return;
+    unsigned long now = millis();
+    uint32_t on_ms = 0, above_ms = 0, starts = 0;
+
+    portENTER_CRITICAL(&compressor_sched_mutex);
+    metric_ring.rotate(now);
+    for (int i = 0; i < COMPRESSOR_METRICS_BUCKETS; i++) {
+        on_ms += metric_ring.buckets[i].on_ms;
+        above_ms += metric_ring.buckets[i].above_ms;
+        starts += metric_ring.buckets[i].starts;
+    }
+    out->demand_mask = compressor_demand_mask;
+    out->running = compressorRunning;
+    if (out->running) {
+        unsigned long since = now - compressor_last_on_ms;
+        out->lockout_remaining_ms = since < COMPRESSOR_MIN_ON_TIME_MS ? COMPRESSOR_MIN_ON_TIME_MS - since : 0;
+    } else {
+        unsigned long since = now - compressor_last_off_ms;
+        out->lockout_remaining_ms = since < COMPRESSOR_MIN_OFF_TIME_MS ? COMPRESSOR_MIN_OFF_TIME_MS - since : 0;
+    }
+    out->predictive_starts = compressor_predictive_starts;
+    out->deferred_requests = compressor_deferred_requests;
+    unsigned long window = metric_ring.windowMs(now);
+    portEXIT_CRITICAL(&compressor_sched_mutex);
+
+    out->window_ms = window;
+    out->slope_c_per_min = slope_c_per_min;
+    out->starts_last_hour = (uint16_t)starts;
+    out->above_setpoint_ms = above_ms;
+    if (window > 0) {
+        out->duty_percent = 100.0f * (float)on_ms / (float)window;
+        out->above_setpoint_percent = 100.0f * (float)above_ms / (float)window;
+        out->starts_per_hour = minuteRatePerHour(starts, window);
+    } else {
+        out->duty_percent = 0.0f;
+        out->above_setpoint_percent = 0.0f;
+        out->starts_per_hour = 0.0f;
+    }
+    if (out->duty_percent > 100.0f) out->duty_percent = 100.0f;
+    if (out->above_setpoint_percent > 100.0f) out->above_setpoint_percent = 100.0f;
+}
@@ -0,0 +1,59 @@
+#ifndef COMPRESSOR_CONTROL_H
+#define COMPRESSOR_CONTROL_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Планировщик компрессора: модули не включают реле напрямую, а выставляют "запрос" (demand).
+// handleCompressorScheduler() включает/выключает реле с учетом минимального времени работы и простоя
+// (защита от коротких циклов). Аварийные пути (ошибки, кнопка STOP) по-прежнему вызывают compressorOff() напрямую.
+// В кластере (cluster_coordinator.h) пуск дополнительно ждет разрешения лидера.
+
+// --- Anti-short-cycle ---
+#define COMPRESSOR_MIN_ON_TIME_MS        60000  // Минимальное время работы после включения (мс)
+#define COMPRESSOR_MIN_OFF_TIME_MS       120000 // Минимальный простой перед повторным пуском (мс), выравнивание давления
+
+// --- Прогнозный пуск по наклону T_out ---
+#define COMPRESSOR_SLOPE_SAMPLE_MS       5000   // Период оценки наклона температуры (мс)
+#define COMPRESSOR_SLOPE_ALPHA           0.3f   // Коэффициент сглаживания наклона (EMA)
+#define COMPRESSOR_PREDICT_LEAD_MS       60000  // На сколько вперед прогнозируем выход из полосы (мс), плюс остаток блокировки
+#define COMPRESSOR_PREDICT_MIN_SLOPE     0.05f  // Минимальный рост (°C/мин), ниже которого прогноз не срабатывает
+#define COMPRESSOR_BAND_C                0.5f   // Верх полосы над уставкой (°C), как у общего гистерезиса
+
+// --- Метрики ---
+#define COMPRESSOR_METRICS_BUCKETS       60     // Количество минутных корзин (скользящее окно 1 час)
+
+// Источники запроса (битовая маска)
+enum CompressorDemandSource {
+    COMP_DEMAND_GENERAL  = 0x01, // Общее поддержание температуры (handleTempLogic)
+    COMP_DEMAND_DOSING   = 0x02, // Цикл дозирования (PRE_COOLING и удержание во время дозирования)
+    COMP_DEMAND_STANDBY  = 0x04, // Удержание холода между циклами в ожидании запроса (standby_controller)
+};
+
+typedef struct {
+    bool running;
+    uint8_t demand_mask;
+    unsigned long lockout_remaining_ms; // Сколько осталось до разрешенного переключения (0 - можно)
+    float slope_c_per_min;              // Текущий наклон T_out (°C/мин)
+    uint16_t starts_last_hour;
+    float starts_per_hour;              // Пересчитано на час, если окно еще не заполнено
+    float duty_percent;                 // Доля времени работы за окно
+    float above_setpoint_percent;       // Доля времени выше уставки + COMPRESSOR_BAND_C
+    unsigned long above_setpoint_ms;    // То же в мс за окно
+    unsigned long window_ms;            // Фактическая длина окна (до 1 часа)
+    uint32_t predictive_starts;         // Пуски, запрошенные прогнозом (с момента загрузки)
+    uint32_t deferred_requests;         // Запросы, отложенные из-за блокировки (с момента загрузки)
+} CompressorMetrics_t;
+
+extern portMUX_TYPE compressor_sched_mutex;
+
+void initCompressorControl();
+void handleCompressorScheduler(); // Вызывается из loop()
+void compressorRequest(uint8_t source, bool on);
+void compressorReleaseAll();      // Снять все запросы (реле выключится после COMPRESSOR_MIN_ON_TIME_MS)
+void compressorPreStart();        // Пуск заранее при запросе дозирования
+bool compressorPredictsOvershoot(float control_temp, float upper_limit); // Прогноз выхода за upper_limit
+void compressorNotifyStateChange(bool running); // Вызывается из compressorOn()/compressorOff() в sensors.cpp
+void getCompressorMetrics(CompressorMetrics_t* out);
+
+#endif // COMPRESSOR_CONTROL_H
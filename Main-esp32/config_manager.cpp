@@ -7,6 +7,17 @@
 #include <stdio.h>         // Для sscanf
 #include <string.h>        // Для strncpy, strcmp, strlen
 #include "pid_controller.h" // Для setPidCoefficients
+#include "ilc_controller.h" // Для resetIlcProfiles (сброс к заводским)
+#include "standby_controller.h" // Для resetStandbyHistogram
+#include "cycle_records.h"  // Для clearCycleRecords
+#include "usage_rollups.h"  // Для resetUsageRollups
+#include "error_journal.h"  // Для clearErrorJournal
+#include "esp_now_peers.h"  // Для resetEspNowPeers
+#include "dosing_logic.h"   // Для getDosingState (запись откладывается во время налива)
+#include <nvs.h>            // Запись конфигурации одним коммитом
+#include <rom/crc.h>        // Для crc32_le
+#include "counter_journal.h" // Счетчики наработки хранятся отдельно
+#include <stddef.h>         // Для offsetof
 // Внешние переменные теперь доступны через соответствующие .h файлы
 // extern String last_error_msg; // Доступно через error_handler.h
 // extern bool system_power_enabled; // Доступно через main.h (предполагается)
@@ -16,151 +27,549 @@
 // Определяем глобальную переменную config
 Config config;
 
+portMUX_TYPE config_publish_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Опубликованные снимки: читатель (loop) загружает указатель одной операцией, писатель заполняет
+// следующий слот и только потом переключает указатель. Защиты читателя от перезаписи слота нет - см. config_manager.h
+static Config config_snapshots[CONFIG_SNAPSHOT_SLOTS];
+static uint8_t config_snapshot_index = 0;
+static const Config* volatile config_published = &config_snapshots[0];
+static volatile uint32_t config_version = 0;
+
 // Функции логирования доступны через main.h (который должен быть включен, если они здесь используются)
 // Если main.h не включен, а функции логирования нужны, то #include "main.h"
 
+portMUX_TYPE config_persist_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Конфигурация хранится одной записью (ключ CONFIG_BLOB_KEY): одно чтение при загрузке, одна запись NVS при сохранении.
+// Поля фиксированной ширины, чтобы формат не зависел от выравнивания структуры Config.
+// Счетчики наработки в запись не входят (с версии 2 они в counter_journal).
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t length;            // sizeof(ConfigBlob_t) при записи
+    float tempSetpoint;
+    int32_t volumeTarget;
+    int32_t motorSpeed;
+    float mlPerStep;
+    float flowMlPerPulse;
+    float extraMlPerStep[MOTOR_MAX_CHANNELS - 1];
+    char remotePeerMacStr[18];
+    float pidKp;
+    float pidKi;
+    float pidKd;
+    uint8_t systemPowerStateSaved;
+    uint8_t wifiChannel;
+    char currentLanguage[3];
+    char lastErrStr[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE];
+    uint32_t crc;               // CRC32 всех предыдущих байт
+} ConfigBlob_t;
+
+// Версия 1 (со счетчиками): нужна только для переноса
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t length;
+    float tempSetpoint;
+    int32_t volumeTarget;
+    int32_t motorSpeed;
+    float mlPerStep;
+    float flowMlPerPulse;
+    float extraMlPerStep[MOTOR_MAX_CHANNELS - 1];
+    char remotePeerMacStr[18];
+    uint32_t totalVolumeDispensed;
+    uint32_t compressorRunTime;
+    int32_t compressorStartCount;
+    int32_t totalDosingCycles;
+    int32_t errorCount;
+    float pidKp;
+    float pidKi;
+    float pidKd;
+    uint8_t systemPowerStateSaved;
+    uint8_t wifiChannel;
+    char currentLanguage[3];
+    char lastErrStr[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE];
+    uint32_t crc;
+} ConfigBlobV1_t;
+
+// Старая раскладка "одно поле - один ключ" (до CONFIG_BLOB_VERSION 1): нужна только для переноса
+typedef enum { CFG_FIELD_FLOAT, CFG_FIELD_INT, CFG_FIELD_ULONG, CFG_FIELD_UCHAR, CFG_FIELD_BOOL, CFG_FIELD_STR } ConfigFieldType_t;
+
+typedef struct {
+    const char* key;
+    ConfigFieldType_t type;
+    size_t offset;
+    size_t size;                // Для строк - размер буфера
+} ConfigField_t;
+
+#define CFG_FIELD(key, type, member) {key, type, offsetof(Config, member), sizeof(((Config*)0)->member)}
+static const ConfigField_t legacy_config_fields[] = {
+    CFG_FIELD("tempSet",     CFG_FIELD_FLOAT, tempSetpoint),
+    CFG_FIELD("volTarget",   CFG_FIELD_INT,   volumeTarget),
+    CFG_FIELD("motorSpd",    CFG_FIELD_INT,   motorSpeed),
+    CFG_FIELD("mlPerStep",   CFG_FIELD_FLOAT, mlPerStep),
+    CFG_FIELD("flowMlPP",    CFG_FIELD_FLOAT, flowMlPerPulse),
+    CFG_FIELD("peerMAC",     CFG_FIELD_STR,   remotePeerMacStr),
+    CFG_FIELD("wifiChan",    CFG_FIELD_UCHAR, wifiChannel),
+    CFG_FIELD("totalVol",    CFG_FIELD_ULONG, totalVolumeDispensed),
+    CFG_FIELD("compTime",    CFG_FIELD_ULONG, compressorRunTime),
+    CFG_FIELD("compStarts",  CFG_FIELD_INT,   compressorStartCount),
+    CFG_FIELD("totalCycles", CFG_FIELD_INT,   totalDosingCycles),
+    CFG_FIELD("errCount",    CFG_FIELD_INT,   errorCount),
+    CFG_FIELD("pidKp",       CFG_FIELD_FLOAT, pidKp),
+    CFG_FIELD("pidKi",       CFG_FIELD_FLOAT, pidKi),
+    CFG_FIELD("pidKd",       CFG_FIELD_FLOAT, pidKd),
+    CFG_FIELD("sysPower",    CFG_FIELD_BOOL,  systemPowerStateSaved),
+    CFG_FIELD("curr_lang",   CFG_FIELD_STR,   currentLanguage),
+};
+#define LEGACY_CONFIG_FIELD_COUNT (sizeof(legacy_config_fields) / sizeof(legacy_config_fields[0]))
+#define LEGACY_LAST_ERR_KEY "lastErrStr"
+#define LEGACY_CONFIG_FIELDS_PROBE_KEY "tempSet" // Есть в любой старой конфигурации
+
+// Последняя записанная в NVS запись: с ней сравнивается новая при сбросе на флеш
+static ConfigBlob_t persisted_blob;
+static bool persisted_valid = false; // false - при следующем сбросе запись пишется безусловно
+
+// Отложенная запись (защищена config_persist_mutex: saveConfig() вызывается и из обработчика ESP-NOW)
+static bool persist_pending = false;
+static bool persist_busy = false;
+static unsigned long persist_first_request_ms = 0;
+static unsigned long persist_last_request_ms = 0;
+static ConfigPersistStats_t persist_stats;
+static ConfigLoadInfo_t load_info;
+
+static uint32_t configBlobCrc(const ConfigBlob_t* blob) {
+    return crc32_le(0, (const uint8_t*)blob, offsetof(ConfigBlob_t, crc));
+}
+
+static uint32_t configBlobV1Crc(const ConfigBlobV1_t* blob) {
+    return crc32_le(0, (const uint8_t*)blob, offsetof(ConfigBlobV1_t, crc));
+}
+
+static void copyConfigString(char* dst, size_t dst_size, const char* src) {
+    strncpy(dst, src, dst_size - 1);
+    dst[dst_size - 1] = '\0';
+}
+
+static void encodeConfigBlob(const Config* c, const char* last_err, ConfigBlob_t* blob) {
+    memset(blob, 0, sizeof(*blob));
+    blob->magic = CONFIG_BLOB_MAGIC;
+    blob->version = CONFIG_BLOB_VERSION;
+    blob->length = sizeof(ConfigBlob_t);
+    blob->tempSetpoint = c->tempSetpoint;
+    blob->volumeTarget = c->volumeTarget;
+    blob->motorSpeed = c->motorSpeed;
+    blob->mlPerStep = c->mlPerStep;
+    blob->flowMlPerPulse = c->flowMlPerPulse;
+    memcpy(blob->extraMlPerStep, c->extraMlPerStep, sizeof(blob->extraMlPerStep));
+    copyConfigString(blob->remotePeerMacStr, sizeof(blob->remotePeerMacStr), c->remotePeerMacStr);
+    blob->pidKp = c->pidKp;
+    blob->pidKi = c->pidKi;
+    blob->pidKd = c->pidKd;
+    blob->systemPowerStateSaved = c->systemPowerStateSaved ? 1 : 0;
+    blob->wifiChannel = c->wifiChannel;
+    copyConfigString(blob->currentLanguage, sizeof(blob->currentLanguage), c->currentLanguage);
+    copyConfigString(blob->lastErrStr, sizeof(blob->lastErrStr), last_err);
+    blob->crc = configBlobCrc(blob);
+}
+
+static void decodeConfigBlob(const ConfigBlob_t* blob, Config* c, char* last_err, size_t last_err_size) {
+    c->tempSetpoint = blob->tempSetpoint;
+    c->volumeTarget = blob->volumeTarget;
+    c->motorSpeed = blob->motorSpeed;
+    c->mlPerStep = blob->mlPerStep;
+    c->flowMlPerPulse = blob->flowMlPerPulse;
+    memcpy(c->extraMlPerStep, blob->extraMlPerStep, sizeof(c->extraMlPerStep));
+    copyConfigString(c->remotePeerMacStr, sizeof(c->remotePeerMacStr), blob->remotePeerMacStr);
+    c->pidKp = blob->pidKp;
+    c->pidKi = blob->pidKi;
+    c->pidKd = blob->pidKd;
+    c->systemPowerStateSaved = blob->systemPowerStateSaved != 0;
+    c->wifiChannel = blob->wifiChannel;
+    copyConfigString(c->currentLanguage, sizeof(c->currentLanguage), blob->currentLanguage);
+    copyConfigString(last_err, last_err_size, blob->lastErrStr);
+}
+
+// Перенос версии 1: счетчики попадают в config.* и оттуда засевают журнал счетчиков
+static bool decodeConfigBlobV1(const uint8_t* data, size_t len, Config* c, char* last_err, size_t last_err_size) {
+    const ConfigBlobV1_t* blob = (const ConfigBlobV1_t*)data;
+    if (len != sizeof(ConfigBlobV1_t) || blob->magic != CONFIG_BLOB_MAGIC || blob->version != 1 ||
+        blob->length != sizeof(ConfigBlobV1_t) || blob->crc != configBlobV1Crc(blob)) return false;
+    c->tempSetpoint = blob->tempSetpoint;
+    c->volumeTarget = blob->volumeTarget;
+    c->motorSpeed = blob->motorSpeed;
+    c->mlPerStep = blob->mlPerStep;
+    c->flowMlPerPulse = blob->flowMlPerPulse;
+    memcpy(c->extraMlPerStep, blob->extraMlPerStep, sizeof(c->extraMlPerStep));
+    copyConfigString(c->remotePeerMacStr, sizeof(c->remotePeerMacStr), blob->remotePeerMacStr);
+    c->totalVolumeDispensed = blob->totalVolumeDispensed;
+    c->compressorRunTime = blob->compressorRunTime;
+    c->compressorStartCount = blob->compressorStartCount;
+    c->totalDosingCycles = blob->totalDosingCycles;
+    c->errorCount = blob->errorCount;
+    c->pidKp = blob->pidKp;
+    c->pidKi = blob->pidKi;
+    c->pidKd = blob->pidKd;
+    c->systemPowerStateSaved = blob->systemPowerStateSaved != 0;
+    c->wifiChannel = blob->wifiChannel;
+    copyConfigString(c->currentLanguage, sizeof(c->currentLanguage), blob->currentLanguage);
+    copyConfigString(last_err, last_err_size, blob->lastErrStr);
+    return true;
+}
+
+// Проверка заголовка и CRC текущей версии; предыдущие версии переносятся в loadConfig()
+static bool configBlobValid(const ConfigBlob_t* blob) {
+    if (blob->magic != CONFIG_BLOB_MAGIC) return false;
+    if (blob->version != CONFIG_BLOB_VERSION || blob->length != sizeof(ConfigBlob_t)) return false;
+    return blob->crc == configBlobCrc(blob);
+}
+
+static void setConfigDefaults() {
+    config.tempSetpoint = 4.0f;
+    config.volumeTarget = 100;
+    config.motorSpeed = 100;
+    config.mlPerStep = 0.01f;
+    for (int ch = 1; ch < MOTOR_MAX_CHANNELS; ch++) config.extraMlPerStep[ch - 1] = 0.01f;
+    config.flowMlPerPulse = 0.2f;
+    copyConfigString(config.remotePeerMacStr, sizeof(config.remotePeerMacStr), "N/A");
+    config.totalVolumeDispensed = 0;
+    config.compressorRunTime = 0;
+    config.compressorStartCount = 0;
+    config.totalDosingCycles = 0;
+    config.errorCount = 0;
+    config.pidKp = 20.0f; // Default Kp
+    config.pidKi = 0.5f;  // Default Ki
+    config.pidKd = 5.0f;  // Default Kd
+    config.systemPowerStateSaved = false;
+    copyConfigString(config.currentLanguage, sizeof(config.currentLanguage), DEFAULT_LANGUAGE); // Устанавливаем язык по умолчанию
+    config.wifiChannel = 1; // Канал WiFi по умолчанию
+    copyConfigString(last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal), "None");
+}
+
+// Чтение старой раскладки; отсутствующие ключи остаются значениями по умолчанию
+static void loadLegacyConfig(Preferences& preferences) {
+    setConfigDefaults();
+    for (size_t i = 0; i < LEGACY_CONFIG_FIELD_COUNT; i++) {
+        const ConfigField_t* f = &legacy_config_fields[i];
+        if (!preferences.isKey(f->key)) continue;
+        uint8_t* p = (uint8_t*)&config + f->offset;
+        switch (f->type) {
+            case CFG_FIELD_FLOAT: *(float*)p = preferences.getFloat(f->key, *(float*)p); break;
+            case CFG_FIELD_INT:   *(int*)p = preferences.getInt(f->key, *(int*)p); break;
+            case CFG_FIELD_ULONG: *(unsigned long*)p = preferences.getULong(f->key, *(unsigned long*)p); break;
+            case CFG_FIELD_UCHAR: *(uint8_t*)p = preferences.getUChar(f->key, *(uint8_t*)p); break;
+            case CFG_FIELD_BOOL:  *(bool*)p = preferences.getBool(f->key, *(bool*)p); break;
+            case CFG_FIELD_STR:
+                preferences.getString(f->key, (char*)p, f->size);
+                ((char*)p)[f->size - 1] = '\0';
+                break;
+        }
+    }
+    for (int ch = 1; ch < MOTOR_MAX_CHANNELS; ch++) { // Калибровка дополнительных каналов: mlPerStep1, mlPerStep2...
+        char key[16];
+        snprintf(key, sizeof(key), "mlPerStep%d", ch);
+        config.extraMlPerStep[ch - 1] = preferences.getFloat(key, config.extraMlPerStep[ch - 1]);
+    }
+    if (preferences.isKey(LEGACY_LAST_ERR_KEY)) {
+        preferences.getString(LEGACY_LAST_ERR_KEY, last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal));
+        last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal) - 1] = '\0';
+    }
+}
+
+// Удаление ключей старой раскладки после того, как запись сохранена (освобождает записи NVS)
+static uint16_t eraseLegacyConfigKeys() {
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return 0;
+    uint16_t erased = 0;
+    for (size_t i = 0; i < LEGACY_CONFIG_FIELD_COUNT; i++) {
+        if (nvs_erase_key(handle, legacy_config_fields[i].key) == ESP_OK) erased++;
+    }
+    for (int ch = 1; ch < MOTOR_MAX_CHANNELS; ch++) {
+        char key[16];
+        snprintf(key, sizeof(key), "mlPerStep%d", ch);
+        if (nvs_erase_key(handle, key) == ESP_OK) erased++;
+    }
+    if (nvs_erase_key(handle, LEGACY_LAST_ERR_KEY) == ESP_OK) erased++;
+    nvs_commit(handle);
+    nvs_close(handle);
+    return erased;
+}
+
+// Запись конфигурации одним коммитом NVS, если она отличается от последней записанной
+static bool writeConfigBlob(bool* written_out) {
+    static Config snapshot;
+    static ConfigBlob_t blob;
+    char last_err[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE];
+    memcpy(&snapshot, &config, sizeof(snapshot));
+    portENTER_CRITICAL(&error_handler_mutex);
+    strncpy(last_err, last_error_msg_buffer_internal, sizeof(last_err) - 1);
+    portEXIT_CRITICAL(&error_handler_mutex);
+    last_err[sizeof(last_err) - 1] = '\0';
+    encodeConfigBlob(&snapshot, last_err, &blob);
+
+    *written_out = false;
+    if (persisted_valid && memcmp(&blob, &persisted_blob, sizeof(blob)) == 0) return true; // Изменения вернулись к сохраненному
+
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        // НЕ вызываем setSystemError отсюда: она сама сохраняет конфигурацию
+        log_e("PREFS", "CRITICAL: Error opening preferences for writing. Config NOT saved.");
+        return false;
+    }
+    esp_err_t err = nvs_set_blob(handle, CONFIG_BLOB_KEY, &blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        log_e("PREFS", "Config write failed: %s.", esp_err_to_name(err));
+        return false;
+    }
+    memcpy(&persisted_blob, &blob, sizeof(persisted_blob));
+    persisted_valid = true;
+    *written_out = true;
+    return true;
+}
+
+static bool flushConfig(bool forced) {
+    unsigned long wait_start = millis();
+    for (;;) {
+        portENTER_CRITICAL(&config_persist_mutex);
+        if (!persist_busy) {
+            persist_busy = true;
+            persist_pending = false; // Запросы во время записи снова выставят флаг
+            portEXIT_CRITICAL(&config_persist_mutex);
+            break;
+        }
+        portEXIT_CRITICAL(&config_persist_mutex);
+        if (millis() - wait_start > CONFIG_FLUSH_WAIT_MS) {
+            log_w("PREFS", "Config flush already in progress, skipping forced flush.");
+            return false;
+        }
+        delay(1);
+    }
+
+    bool written = false;
+    unsigned long t0 = micros();
+    bool ok = writeConfigBlob(&written);
+    uint32_t dt = (uint32_t)(micros() - t0);
+
+    portENTER_CRITICAL(&config_persist_mutex);
+    persist_busy = false;
+    ConfigPersistStats_t* st = &persist_stats;
+    if (!ok) {
+        st->failures++;
+        if (!persist_pending) { // Повторим после обычной задержки
+            persist_pending = true;
+            persist_first_request_ms = persist_last_request_ms = millis();
+        }
+    } else if (!written) {
+        st->unchanged++;
+    } else {
+        st->flushes++;
+        if (forced) st->forced_flushes++;
+        st->last_flush_us = dt;
+        if (dt > st->max_flush_us) st->max_flush_us = dt;
+        st->avg_flush_us += ((float)dt - st->avg_flush_us) / (float)st->flushes;
+    }
+    portEXIT_CRITICAL(&config_persist_mutex);
+    if (written) log_d("PREFS", "Config flushed (%u bytes, %lu us).", (unsigned)sizeof(ConfigBlob_t), (unsigned long)dt);
+    return ok;
+}
+
+const Config* getConfigSnapshot() {
+    return config_published;
+}
+
+uint32_t getConfigVersion() {
+    return config_version;
+}
+
+void publishConfig() {
+    portENTER_CRITICAL(&config_publish_mutex);
+    config_snapshot_index = (config_snapshot_index + 1) % CONFIG_SNAPSHOT_SLOTS;
+    Config* slot = &config_snapshots[config_snapshot_index];
+    memcpy(slot, &config, sizeof(Config));
+    __sync_synchronize(); // Содержимое слота видно другому ядру раньше нового указателя
+    config_published = slot;
+    config_version++;
+    portEXIT_CRITICAL(&config_publish_mutex);
+}
+
 void saveConfig() {
-    log_i("PREFS", "Saving config...");
-    Preferences preferences;
-    // if (!preferences.begin(CONFIG_NAMESPACE, false)) { // Пример, как НЕ НАДО делать, если setSystemError вызывает saveConfig
-    //     log_e("PREFS", "Error opening preferences for writing.");
-    //     setSystemError(PREFERENCES_ERROR, "Failed to open Prefs for write"); 
-    //     return;
-    // }
-    // Безопаснее:
-     if (!preferences.begin(CONFIG_NAMESPACE, false)) {
-         log_e("PREFS", "CRITICAL: Error opening preferences for writing. Config NOT saved.");
-         // НЕ вызываем setSystemError отсюда, чтобы избежать рекурсии,
-         // так как setSystemError сама вызывает saveConfig.
-         // Ошибка будет залогирована, но система продолжит работу с текущей конфигурацией в памяти.
-         return;
-     }
-    preferences.putFloat("tempSet", config.tempSetpoint);
-    preferences.putInt("volTarget", config.volumeTarget);
-    preferences.putInt("motorSpd", config.motorSpeed);
-    preferences.putFloat("mlPerStep", config.mlPerStep);
-    preferences.putFloat("flowMlPP", config.flowMlPerPulse);
-    preferences.putString("peerMAC", config.remotePeerMacStr);
-    preferences.putUChar("wifiChan", config.wifiChannel); // Сохраняем канал WiFi
-    preferences.putULong("totalVol", config.totalVolumeDispensed);
-    preferences.putULong("compTime", config.compressorRunTime);
-    preferences.putInt("compStarts", config.compressorStartCount);
-    preferences.putInt("totalCycles", config.totalDosingCycles);
-    preferences.putInt("errCount", config.errorCount);
-    preferences.putString("lastErrStr", last_error_msg_buffer_internal); // Используем буфер из error_handler
-    preferences.putFloat("pidKp", config.pidKp); 
-    preferences.putFloat("pidKi", config.pidKi);
-    preferences.putFloat("pidKd", config.pidKd);
-    preferences.putBool("sysPower", config.systemPowerStateSaved);
-    preferences.putString("curr_lang", config.currentLanguage); // Сохраняем язык
-    preferences.end();
-    log_i("PREFS", "Config saved.");
+    publishConfig();
+    unsigned long now = millis();
+    portENTER_CRITICAL(&config_persist_mutex);
+    persist_stats.save_requests++;
+    if (persist_pending) {
+        persist_stats.coalesced++;
+    } else {
+        persist_pending = true;
+        persist_first_request_ms = now;
+    }
+    persist_last_request_ms = now;
+    portEXIT_CRITICAL(&config_persist_mutex);
+}
+
+void flushConfigNow() {
+    bool pending;
+    portENTER_CRITICAL(&config_persist_mutex);
+    pending = persist_pending;
+    portEXIT_CRITICAL(&config_persist_mutex);
+    if (pending) flushConfig(true);
+    flushCounterJournal(); // Счетчики наработки тоже не должны потеряться
+}
+
+void handleConfigPersistence() {
+    bool pending;
+    unsigned long first, last;
+    portENTER_CRITICAL(&config_persist_mutex);
+    pending = persist_pending;
+    first = persist_first_request_ms;
+    last = persist_last_request_ms;
+    portEXIT_CRITICAL(&config_persist_mutex);
+    if (!pending) return;
+
+    unsigned long now = millis();
+    bool overdue = now - first >= CONFIG_FLUSH_MAX_DELAY_MS;
+    if (now - last < CONFIG_FLUSH_DEBOUNCE_MS && !overdue) return; // Ждем, пока изменения утихнут
+    // Запись во флеш останавливает кэш - во время налива откладываем до предельной задержки
+    if (getDosingState() == DOSING_STATE_RUNNING && !overdue) return;
+    flushConfig(false);
+}
+
+void getConfigPersistStats(ConfigPersistStats_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&config_persist_mutex);
+    *out = persist_stats;
+    out->pending = persist_pending;
+    out->pending_age_ms = persist_pending ? (uint32_t)(millis() - persist_first_request_ms) : 0;
+    portEXIT_CRITICAL(&config_persist_mutex);
+}
+
+void getConfigLoadInfo(ConfigLoadInfo_t* out) {
+    if (out) *out = load_info;
+}
+
+// Исправление недопустимых значений; true - что-то исправлено
+static bool validateConfig() {
+    bool corrected = false;
+    if (isnan(config.flowMlPerPulse) || config.flowMlPerPulse <= 0.000001f || config.flowMlPerPulse > 10.0f) {
+        log_w("PREFS", "Invalid flowMlPerPulse loaded (%.6f). Setting default: 0.2", config.flowMlPerPulse);
+        config.flowMlPerPulse = 0.2f;
+        corrected = true;
+    }
+    if (isnan(config.mlPerStep) || config.mlPerStep <= 0.0000001f || config.mlPerStep > 1.0f) {
+        log_w("PREFS", "Invalid mlPerStep loaded (%.6f). Setting default: 0.01", config.mlPerStep);
+        config.mlPerStep = 0.01f; // Пример значения по умолчанию
+        corrected = true;
+    }
+    for (int ch = 1; ch < MOTOR_MAX_CHANNELS; ch++) {
+        float v = config.extraMlPerStep[ch - 1];
+        if (isnan(v) || v <= 0.0000001f || v > 1.0f) {
+            log_w("PREFS", "Invalid mlPerStep for channel %d loaded (%.6f). Setting default: 0.01", ch, v);
+            config.extraMlPerStep[ch - 1] = 0.01f;
+            corrected = true;
+        }
+    }
+    if (config.motorSpeed < 0 || config.motorSpeed > 2000) {
+        log_w("PREFS", "Invalid motorSpeed loaded (%d). Setting default: 100", config.motorSpeed);
+        config.motorSpeed = 100;
+        corrected = true;
+    }
+    if (isnan(config.tempSetpoint) || config.tempSetpoint < -10.0f || config.tempSetpoint > 30.0f) {
+        log_w("PREFS", "Invalid tempSetpoint loaded (%.1f). Setting default: 4.0", config.tempSetpoint);
+        config.tempSetpoint = 4.0f;
+        corrected = true;
+    }
+    if (isnan(config.pidKp) || isnan(config.pidKi) || isnan(config.pidKd) || config.pidKp < 0 || config.pidKi < 0 || config.pidKd < 0) { // Примерная проверка
+        log_w("PREFS", "Invalid PID coefficients loaded (Kp:%.2f, Ki:%.2f, Kd:%.2f). Setting defaults.", config.pidKp, config.pidKi, config.pidKd);
+        config.pidKp = 20.0f; config.pidKi = 0.5f; config.pidKd = 5.0f;
+        corrected = true;
+    }
+    if (strcmp(config.currentLanguage, "ru") != 0 && strcmp(config.currentLanguage, "en") != 0) {
+        log_w("PREFS", "Invalid currentLanguage loaded ('%s'). Setting default: '%s'", config.currentLanguage, DEFAULT_LANGUAGE);
+        copyConfigString(config.currentLanguage, sizeof(config.currentLanguage), DEFAULT_LANGUAGE);
+        corrected = true;
+    }
+    if (config.wifiChannel == 0 || config.wifiChannel > 13) { // Каналы WiFi обычно 1-13
+        log_w("PREFS", "Invalid wifiChannel loaded (%u). Setting default: 1", config.wifiChannel);
+        config.wifiChannel = 1;
+    }
+    return corrected;
 }
 
 void loadConfig() {
     log_i("PREFS", "Loading config...");
+    unsigned long t0 = micros();
     bool defaults_applied_this_load = false;
+    bool migrate = false;
+    static ConfigBlob_t blob;
+    static uint8_t old_blob[sizeof(ConfigBlobV1_t)];
+    memset(&load_info, 0, sizeof(load_info));
     Preferences preferences;
 
     if (!preferences.begin(CONFIG_NAMESPACE, true)) {
         log_w("PREFS", "Error opening preferences. Using ALL defaults.");
+        setConfigDefaults();
+        copyConfigString(last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal), _T(L_ERROR_PREFS_DEFAULTS_APPLIED_OPEN_FAIL));
         defaults_applied_this_load = true;
-        // ... (установка всех полей config значениями по умолчанию) ...
-        config.tempSetpoint = 4.0f;
-        config.volumeTarget = 100;
-        // ... и т.д.
-        config.motorSpeed = 100;
-        config.flowMlPerPulse = 0.2f;
-        strncpy(config.remotePeerMacStr, "N/A", sizeof(config.remotePeerMacStr)-1);
-        config.remotePeerMacStr[sizeof(config.remotePeerMacStr)-1] = '\0'; // Добавлено для безопасности
-        config.remotePeerMacStr[sizeof(config.remotePeerMacStr)-1] = '\0';
-        config.pidKp = 20.0f; // Default Kp
-        config.pidKi = 0.5f;  // Default Ki
-        strncpy(last_error_msg_buffer_internal, _T(L_ERROR_PREFS_DEFAULTS_APPLIED_OPEN_FAIL), sizeof(last_error_msg_buffer_internal) -1);
-        last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal)-1] = '\0';
-
-        strncpy(config.currentLanguage, DEFAULT_LANGUAGE, sizeof(config.currentLanguage) - 1); // Устанавливаем язык по умолчанию
-        config.currentLanguage[sizeof(config.currentLanguage)-1] = '\0';
-        config.pidKd = 5.0f;  // Default Kd
-        config.wifiChannel = 1; // Канал WiFi по умолчанию
-        
+        load_info.source = CONFIG_SOURCE_DEFAULTS;
     } else {
-        config.tempSetpoint = preferences.getFloat("tempSet", 4.0f);
-        config.volumeTarget = preferences.getInt("volTarget", 100); // <--- ИСПРАВЛЕНО
-        config.motorSpeed = preferences.getInt("motorSpd", 100);     // <--- ИСПРАВЛЕНО
-        config.mlPerStep = preferences.getFloat("mlPerStep", 0.01f); // Пример значения по умолчанию
-        config.flowMlPerPulse = preferences.getFloat("flowMlPP", 0.2f);
-        String mac_str_loaded = preferences.getString("peerMAC", "N/A");
-        strncpy(config.remotePeerMacStr, mac_str_loaded.c_str(), sizeof(config.remotePeerMacStr)-1);
-        config.pidKp = preferences.getFloat("pidKp", 20.0f); 
-        config.pidKi = preferences.getFloat("pidKi", 0.5f);
-        config.pidKd = preferences.getFloat("pidKd", 5.0f);
-        config.remotePeerMacStr[sizeof(config.remotePeerMacStr)-1] = '\0';
-        
-        String loaded_err_str = preferences.getString("lastErrStr", "None");
-        strncpy(last_error_msg_buffer_internal, loaded_err_str.c_str(), sizeof(last_error_msg_buffer_internal) -1);
-        last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal)-1] = '\0';
-
-        config.totalVolumeDispensed = preferences.getULong("totalVol", 0);
-        config.compressorRunTime = preferences.getULong("compTime", 0);
-        config.compressorStartCount = preferences.getInt("compStarts", 0);
-        config.totalDosingCycles = preferences.getInt("totalCycles", 0);
-        config.errorCount = preferences.getInt("errCount", 0);
-
-        config.systemPowerStateSaved = preferences.getBool("sysPower", false);
-        
-        String loaded_lang_str = preferences.getString("curr_lang", DEFAULT_LANGUAGE); // Загружаем язык
-        strncpy(config.currentLanguage, loaded_lang_str.c_str(), sizeof(config.currentLanguage) - 1);
-        config.currentLanguage[sizeof(config.currentLanguage) - 1] = '\0';
-        preferences.end();
-
-        // ... (валидация загруженных значений и применение defaults_applied_this_load = true при необходимости) ...
-        if (isnan(config.flowMlPerPulse) || config.flowMlPerPulse <= 0.000001f || config.flowMlPerPulse > 10.0f) {
-            log_w("PREFS", "Invalid flowMlPerPulse loaded (%.6f). Setting default: 0.2", config.flowMlPerPulse);
-            config.flowMlPerPulse = 0.2f;
+        size_t blob_len = preferences.getBytesLength(CONFIG_BLOB_KEY);
+        if (blob_len == sizeof(blob) && preferences.getBytes(CONFIG_BLOB_KEY, &blob, sizeof(blob)) == sizeof(blob) && configBlobValid(&blob)) {
+            decodeConfigBlob(&blob, &config, last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal));
+            // Прочитанное уже лежит в NVS; исправления ниже запишутся как изменение
+            memcpy(&persisted_blob, &blob, sizeof(persisted_blob));
+            persisted_valid = true;
+            load_info.source = CONFIG_SOURCE_BLOB;
+        } else if (blob_len == sizeof(ConfigBlobV1_t) && preferences.getBytes(CONFIG_BLOB_KEY, old_blob, sizeof(old_blob)) == sizeof(old_blob) &&
+                   decodeConfigBlobV1(old_blob, sizeof(old_blob), &config, last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal))) {
+            log_i("PREFS", "Config blob v1 found, migrating to v%d.", CONFIG_BLOB_VERSION);
+            migrate = true;
+            load_info.source = CONFIG_SOURCE_BLOB_V1;
+        } else if (blob_len == 0 && preferences.isKey(LEGACY_CONFIG_FIELDS_PROBE_KEY)) {
+            log_i("PREFS", "Legacy per-key config found, migrating to blob v%d.", CONFIG_BLOB_VERSION);
+            loadLegacyConfig(preferences);
+            migrate = true;
+            load_info.source = CONFIG_SOURCE_LEGACY;
+        } else {
+            setConfigDefaults();
+            if (blob_len > 0) {
+                // Запись повреждена или другого формата - работаем на значениях по умолчанию и перезаписываем ее
+                log_e("PREFS", "Config blob invalid (size %u, expected %u). Using defaults.", (unsigned)blob_len, (unsigned)sizeof(blob));
+                copyConfigString(last_error_msg_buffer_internal, sizeof(last_error_msg_buffer_internal), _T(L_ERROR_PREFS_BLOB_CORRUPT));
+                load_info.source = CONFIG_SOURCE_CORRUPT;
+            } else {
+                load_info.source = CONFIG_SOURCE_DEFAULTS; // Первый запуск
+            }
             defaults_applied_this_load = true;
         }
-        if (isnan(config.mlPerStep) || config.mlPerStep <= 0.0000001f || config.mlPerStep > 1.0f) {
-            log_w("PREFS", "Invalid mlPerStep loaded (%.6f). Setting default: 0.01", config.mlPerStep);
-            config.mlPerStep = 0.01f; // Пример значения по умолчанию
-            defaults_applied_this_load = true;
-        }
-        // Добавьте другие проверки валидности для загруженных значений, если необходимо
-        if (config.motorSpeed < 0 || config.motorSpeed > 2000) {
-            log_w("PREFS", "Invalid motorSpeed loaded (%d). Setting default: 100", config.motorSpeed);
-            config.motorSpeed = 100;
-            defaults_applied_this_load = true;
-        }
-        if (isnan(config.tempSetpoint) || config.tempSetpoint < -10.0f || config.tempSetpoint > 30.0f) {
-            log_w("PREFS", "Invalid tempSetpoint loaded (%.1f). Setting default: 4.0", config.tempSetpoint);
-            config.tempSetpoint = 4.0f;
-            defaults_applied_this_load = true;
-        }
-        if (isnan(config.pidKp) || isnan(config.pidKi) || isnan(config.pidKd) || config.pidKp < 0 || config.pidKi < 0 || config.pidKd < 0) { // Примерная проверка
-            log_w("PREFS", "Invalid PID coefficients loaded (Kp:%.2f, Ki:%.2f, Kd:%.2f). Setting defaults.", config.pidKp, config.pidKi, config.pidKd);
-            config.pidKp = 20.0f; config.pidKi = 0.5f; config.pidKd = 5.0f;
-            defaults_applied_this_load = true;
-        }
-        if (strcmp(config.currentLanguage, "ru") != 0 && strcmp(config.currentLanguage, "en") != 0) {
-            log_w("PREFS", "Invalid currentLanguage loaded ('%s'). Setting default: '%s'", config.currentLanguage, DEFAULT_LANGUAGE);
-            strncpy(config.currentLanguage, DEFAULT_LANGUAGE, sizeof(config.currentLanguage) - 1);
-            config.currentLanguage[sizeof(config.currentLanguage) - 1] = '\0';
-            defaults_applied_this_load = true;
-        }
-        if (config.wifiChannel == 0 || config.wifiChannel > 13) { // Каналы WiFi обычно 1-13
-            log_w("PREFS", "Invalid wifiChannel loaded (%u). Setting default: 1", config.wifiChannel);
-            config.wifiChannel = 1;
-        }
+        preferences.end();
     }
+    if (validateConfig()) defaults_applied_this_load = true;
+    load_info.load_us = (uint32_t)(micros() - t0);
+    // Счетчики - из своего журнала; при первом запуске журнал засевается значениями перенесенной конфигурации,
+    // поэтому до записи новой конфигурации и удаления старых ключей
+    initCounterJournal();
 
-    strncpy(config.lastErrorMsgBuffer, last_error_msg_buffer_internal, sizeof(config.lastErrorMsgBuffer)-1);
-    config.lastErrorMsgBuffer[sizeof(config.lastErrorMsgBuffer)-1] = '\0';
+    copyConfigString(config.lastErrorMsgBuffer, sizeof(config.lastErrorMsgBuffer), last_error_msg_buffer_internal);
 
-    if (defaults_applied_this_load) {
+    if (migrate) {
+        // Сразу: ключи старой раскладки удаляются только после успешной записи новой
+        bool ok = flushConfig(true) && persisted_valid;
+        if (ok && load_info.source == CONFIG_SOURCE_LEGACY) load_info.legacy_keys_erased = eraseLegacyConfigKeys();
+        log_i("PREFS", "Config migrated%s, %u legacy keys erased.", ok ? "" : " (write failed)", load_info.legacy_keys_erased);
+    } else if (defaults_applied_this_load) {
         log_i("PREFS", "Defaults were applied. Saving current (corrected) config.");
         saveConfig(); // Сохраняем, если были применены значения по умолчанию
     }
+    if (preferences.begin(CONFIG_NAMESPACE, true)) {
+        load_info.nvs_free_entries = preferences.freeEntries();
+        preferences.end();
+    }
 
+    publishConfig(); // Первый снимок для читателей
     system_power_enabled = config.systemPowerStateSaved; // Обновляем глобальную system_power_enabled
     // digitalWrite(MOSFET_POWER_PIN, system_power_enabled ? HIGH : LOW); // Это должно быть в main.c или где есть доступ к MOSFET_POWER_PIN
     updateMotorSpeed(config.motorSpeed);
@@ -169,7 +578,8 @@ void loadConfig() {
 
     // Парсинг MAC-адреса пира и обновление remotePeerAddress теперь происходит внутри esp_now_handler.c
     // при вызове initEspNow() или ensureEspNowPeer(), которые используют config.remotePeerMacStr.
-    log_i("PREFS", "Config loaded. System power state: %s", system_power_enabled ? "ON" : "OFF");
+    log_i("PREFS", "Config loaded in %lu us (source %u). System power state: %s", (unsigned long)load_info.load_us,
+          (unsigned)load_info.source, system_power_enabled ? "ON" : "OFF");
     // ... (логирование остальных загруженных параметров) ...
 }
 
@@ -180,13 +590,19 @@ void performFactoryReset() {
         preferences.clear();
         preferences.end();
         log_i("PREFS", "Main config namespace '%s' cleared.", CONFIG_NAMESPACE);
+        // Отложенная запись не должна вернуть старые значения после очистки
+        portENTER_CRITICAL(&config_persist_mutex);
+        persist_pending = false;
+        portEXIT_CRITICAL(&config_persist_mutex);
+        persisted_valid = false;
     } else {
         log_e("PREFS", "Failed to open preferences for clearing main config.");
     }
-    // Здесь можно добавить очистку других пространств имен Preferences, если они есть,
-    // например, лог ошибок, если он хранится отдельно и его тоже нужно сбрасывать.
-    // Preferences error_log_prefs;
-    // if (error_log_prefs.begin(PREFS_ERROR_LOG_NAMESPACE, false)) { ... }
+    resetIlcProfiles(); // Обученные профили ILC (пространство имен "ilc")
+    resetStandbyHistogram(); // Гистограмма запросов режима ожидания (пространство имен "standby")
+    resetCounterJournal(); // Счетчики наработки раньше хранились вместе с конфигурацией
+    clearErrorJournal(); // Журнал ошибок на LittleFS
+    resetEspNowPeers(); // Таблица пиров ESP-NOW (пространство имен "espnow_peers")
 }
 
 void resetStats() {
@@ -201,7 +617,12 @@ void resetStats() {
     strncpy(last_error_msg_buffer_internal, _T(L_INFO_STATISTICS_RESET_MSG), sizeof(last_error_msg_buffer_internal) -1);
     last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal)-1] = '\0';
 
+    resetCounterJournal();
+    counterJournalNoteChange(); // Журнал начинается заново с нулевой записи
     saveConfig(); // Сохраняем изменения
+    clearCycleRecords(); // Записи по циклам - тоже статистика
+    resetUsageRollups();
+    clearErrorJournal(); // История ошибок сбрасывается вместе со счетчиком ошибок
     log_i("STATS", "Statistics have been reset.");
 }
 
@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include "error_handler.h" // Для ERROR_HANDLER_LAST_MSG_BUFFER_SIZE
+#include "hardware_pins.h" // Для MOTOR_MAX_CHANNELS
 
 #define CONFIG_NAMESPACE "app_config"
 #define DEFAULT_LANGUAGE "ru" // или "en"
@@ -11,7 +12,7 @@ typedef struct {
     float tempSetpoint;
     int volumeTarget;
     int motorSpeed;
-    float mlPerStep;
+    float mlPerStep; // Калибровка основного канала (0)
     float flowMlPerPulse;
     char remotePeerMacStr[18]; // "XX:XX:XX:XX:XX:XX" + null
     unsigned long totalVolumeDispensed;
@@ -26,13 +27,76 @@ typedef struct {
     bool systemPowerStateSaved; // Сохраненное состояние питания
     char currentLanguage[3]; // "ru" или "en"
     uint8_t wifiChannel; // Канал WiFi для ESP-NOW
+    float extraMlPerStep[MOTOR_MAX_CHANNELS - 1]; // Калибровка дополнительных каналов (1..MOTOR_MAX_CHANNELS-1)
 } Config;
 
 extern Config config; // Делаем структуру config доступной глобально
 
-void saveConfig();
+// Снимки настроек для читателей в задаче loop (автомат дозирования, PID, статус ESP-NOW): проход
+// видит одну версию, даже если сам меняет config по ходу (beginDosingRequest), а getConfigVersion()
+// дает дешевую проверку "настройки изменились". config - рабочая копия писателей; после изменения
+// писатель вызывает publishConfig() (saveConfig() публикует сам).
+// Только для loop: слот перезаписывается через CONFIG_SNAPSHOT_SLOTS публикаций без проверки читателя,
+// и читатель из другой задачи, застрявший в слоте, может увидеть его наполовину записанным
+// (такому читателю нужна проверка номера записи слота, как в seqlock).
+// Снимок берут заново в каждом вызове handle* и не хранят. Счетчики наработки в снимке не
+// обновляются - они меняются часто и публикуются только вместе с настройками.
+#define CONFIG_SNAPSHOT_SLOTS 4
+
+// Конфигурация хранится в NVS одной записью (ключ CONFIG_BLOB_KEY) с версией и CRC32.
+// Сохранение отложенное: saveConfig() только отмечает изменения, а handleConfigPersistence()
+// после затишья пишет запись одним коммитом, если она отличается от последней записанной.
+#define CONFIG_BLOB_KEY            "cfg"
+#define CONFIG_BLOB_MAGIC          0xC0F1
+#define CONFIG_BLOB_VERSION        2     // 2: без счетчиков наработки (они в counter_journal)
+#define CONFIG_FLUSH_DEBOUNCE_MS   2000  // Запись после такой паузы без новых изменений
+#define CONFIG_FLUSH_MAX_DELAY_MS  60000 // Не позже этого срока от первого изменения (в т.ч. во время налива)
+#define CONFIG_FLUSH_WAIT_MS       500   // Ожидание текущей записи при принудительном сбросе
+
+typedef struct {
+    uint32_t save_requests;     // Вызовы saveConfig()
+    uint32_t coalesced;         // Запросы, объединенные с уже ожидающими
+    uint32_t flushes;           // Выполненные записи в NVS
+    uint32_t forced_flushes;    // Из них по flushConfigNow()
+    uint32_t unchanged;         // Сбросы без записи: конфигурация совпала с сохраненной
+    uint32_t failures;
+    uint32_t last_flush_us;
+    uint32_t max_flush_us;
+    float avg_flush_us;
+    bool pending;
+    uint32_t pending_age_ms;
+} ConfigPersistStats_t;
+
+typedef enum {
+    CONFIG_SOURCE_DEFAULTS = 0, // Первый запуск или NVS недоступно
+    CONFIG_SOURCE_BLOB,
+    CONFIG_SOURCE_LEGACY,       // Старая раскладка по ключам, перенесена в запись
+    CONFIG_SOURCE_CORRUPT,      // Запись не прошла проверку CRC/версии - значения по умолчанию
+    CONFIG_SOURCE_BLOB_V1       // Запись версии 1, перенесена
+} ConfigLoadSource_t;
+
+typedef struct {
+    ConfigLoadSource_t source;
+    uint32_t load_us;           // Время loadConfig() до применения настроек
+    uint16_t legacy_keys_erased;
+    uint32_t nvs_free_entries;  // Свободные записи раздела NVS после загрузки
+} ConfigLoadInfo_t;
+
+extern portMUX_TYPE config_persist_mutex;
+
+extern portMUX_TYPE config_publish_mutex;
+
+const Config* getConfigSnapshot(); // Последний опубликованный снимок (только из loop)
+uint32_t getConfigVersion();       // Растет при каждой публикации: дешевая проверка "настройки изменились"
+void publishConfig();              // Публикация текущего config (писатели из разных задач не мешают друг другу)
+void saveConfig();              // Публикация и запрос отложенной записи (безопасен из любой задачи)
+void flushConfigNow();          // Немедленная запись ожидающих изменений (перед перезагрузкой, при выключении)
+void handleConfigPersistence(); // Вызывается из loop()
+void getConfigPersistStats(ConfigPersistStats_t* out);
+void getConfigLoadInfo(ConfigLoadInfo_t* out);
 void loadConfig();
 void performFactoryReset();
 void resetStats();
+bool getScreenMacAddress(uint8_t* mac_addr_buf); // Экран из config.remotePeerMacStr (до таблицы пиров ESP-NOW)
 
 #endif // CONFIG_MANAGER_H
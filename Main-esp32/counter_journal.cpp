@@ -0,0 +1,275 @@
+#include "counter_journal.h"
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <rom/crc.h>        // Для crc32_le
+#include <stddef.h>         // Для offsetof
+#include "config_manager.h" // Счетчики в config.*
+#include "dosing_logic.h"   // Для getDosingState (запись откладывается во время налива)
+#include "main.h"           // Для g_littlefs_mounted и функций логирования
+
+#define COUNTER_NAMESPACE "counters" // Запасной вариант без LittleFS
+#define COUNTER_NVS_KEY   "rec"
+
+portMUX_TYPE counter_journal_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Отложенная запись (защищена counter_journal_mutex: счетчики меняются и вне loop)
+static bool journal_pending = false;
+static bool journal_busy = false;
+static unsigned long journal_first_change_ms = 0;
+static unsigned long journal_last_change_ms = 0;
+
+// Хранилище (под journal_busy)
+static bool journal_on_fs = false;
+static uint32_t journal_records = 0;
+static uint32_t journal_next_seq = 1;
+static uint32_t journal_appends = 0;
+static uint32_t journal_compactions = 0;
+static uint32_t journal_write_failures = 0;
+static uint32_t journal_torn_records = 0;
+
+static uint32_t counterRecordCrc(const CounterRecord_t* rec) {
+    return crc32_le(0, (const uint8_t*)rec, offsetof(CounterRecord_t, crc));
+}
+
+static bool counterRecordValid(const CounterRecord_t* rec) {
+    return rec->magic == COUNTER_RECORD_MAGIC && rec->version == COUNTER_RECORD_VERSION && rec->crc == counterRecordCrc(rec);
+}
+
+static void fillCounterRecord(CounterRecord_t* rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = COUNTER_RECORD_MAGIC;
+    rec->version = COUNTER_RECORD_VERSION;
+    rec->seq = journal_next_seq;
+    rec->total_volume_ml = config.totalVolumeDispensed;
+    rec->compressor_run_ms = config.compressorRunTime;
+    rec->compressor_starts = (uint32_t)config.compressorStartCount;
+    rec->dosing_cycles = (uint32_t)config.totalDosingCycles;
+    rec->errors = (uint32_t)config.errorCount;
+    rec->crc = counterRecordCrc(rec);
+}
+
+static void applyCounterRecord(const CounterRecord_t* rec) {
+    config.totalVolumeDispensed = rec->total_volume_ml;
+    config.compressorRunTime = rec->compressor_run_ms;
+    config.compressorStartCount = (int)rec->compressor_starts;
+    config.totalDosingCycles = (int)rec->dosing_cycles;
+    config.errorCount = (int)rec->errors;
+}
+
+// Последняя целая запись файла; *needs_compaction - в файле есть битые или неполные записи
+static bool readLatestFromFile(CounterRecord_t* latest, bool* needs_compaction) {
+    *needs_compaction = false;
+    // Сжатие прервано: до переименования основной файл цел, после - временного уже нет
+    if (LittleFS.exists(COUNTER_JOURNAL_TMP_FILE)) {
+        if (LittleFS.exists(COUNTER_JOURNAL_FILE)) LittleFS.remove(COUNTER_JOURNAL_TMP_FILE);
+        else LittleFS.rename(COUNTER_JOURNAL_TMP_FILE, COUNTER_JOURNAL_FILE);
+    }
+    if (!LittleFS.exists(COUNTER_JOURNAL_FILE)) return false;
+    File f = LittleFS.open(COUNTER_JOURNAL_FILE, "r");
+    if (!f) {
+        log_e("COUNTERS", "Failed to open %s.", COUNTER_JOURNAL_FILE);
+        return false;
+    }
+    if (f.size() % sizeof(CounterRecord_t) != 0) *needs_compaction = true; // Обрыв при дописывании
+    CounterRecord_t rec;
+    bool found = false;
+    while (f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) {
+        journal_records++;
+        if (!counterRecordValid(&rec)) {
+            journal_torn_records++;
+            *needs_compaction = true;
+            continue;
+        }
+        if (!found || rec.seq > latest->seq) {
+            *latest = rec;
+            found = true;
+        }
+    }
+    f.close();
+    return found;
+}
+
+static bool readFromNvs(CounterRecord_t* rec) {
+    Preferences prefs;
+    if (!prefs.begin(COUNTER_NAMESPACE, true)) return false;
+    bool ok = prefs.getBytesLength(COUNTER_NVS_KEY) == sizeof(*rec) &&
+              prefs.getBytes(COUNTER_NVS_KEY, rec, sizeof(*rec)) == sizeof(*rec) && counterRecordValid(rec);
+    prefs.end();
+    return ok;
+}
+
+static bool appendRecord(const CounterRecord_t* rec) {
+    File f = LittleFS.open(COUNTER_JOURNAL_FILE, "a");
+    if (!f) return false;
+    bool ok = f.write((const uint8_t*)rec, sizeof(*rec)) == sizeof(*rec);
+    f.close();
+    return ok;
+}
+
+// Файл заменяется одной записью: пишем временный файл и переименовываем поверх (rename в LittleFS атомарен)
+static bool compactJournal(const CounterRecord_t* rec) {
+    File f = LittleFS.open(COUNTER_JOURNAL_TMP_FILE, "w");
+    if (!f) return false;
+    bool ok = f.write((const uint8_t*)rec, sizeof(*rec)) == sizeof(*rec);
+    f.close();
+    if (!ok) {
+        LittleFS.remove(COUNTER_JOURNAL_TMP_FILE);
+        return false;
+    }
+    if (!LittleFS.rename(COUNTER_JOURNAL_TMP_FILE, COUNTER_JOURNAL_FILE)) return false;
+    journal_records = 1;
+    journal_compactions++;
+    return true;
+}
+
+static bool writeCounterRecord(bool compact) {
+    CounterRecord_t rec;
+    fillCounterRecord(&rec);
+    bool ok;
+    if (journal_on_fs) {
+        if (compact || journal_records >= COUNTER_JOURNAL_CAPACITY) {
+            ok = compactJournal(&rec);
+        } else {
+            ok = appendRecord(&rec);
+            if (ok) journal_records++;
+        }
+    } else {
+        Preferences prefs;
+        ok = prefs.begin(COUNTER_NAMESPACE, false) && prefs.putBytes(COUNTER_NVS_KEY, &rec, sizeof(rec)) == sizeof(rec);
+        prefs.end();
+    }
+    if (ok) {
+        journal_next_seq++;
+        journal_appends++;
+    } else {
+        journal_write_failures++;
+        log_e("COUNTERS", "Failed to write counter record #%lu.", (unsigned long)rec.seq);
+    }
+    return ok;
+}
+
+static bool claimJournal() {
+    bool claimed = false;
+    portENTER_CRITICAL(&counter_journal_mutex);
+    if (!journal_busy) {
+        journal_busy = true;
+        journal_pending = false; // Изменения во время записи снова выставят флаг
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&counter_journal_mutex);
+    return claimed;
+}
+
+static void releaseJournal(bool ok) {
+    portENTER_CRITICAL(&counter_journal_mutex);
+    journal_busy = false;
+    if (!ok && !journal_pending) { // Повторим после обычной задержки
+        journal_pending = true;
+        journal_first_change_ms = journal_last_change_ms = millis();
+    }
+    portEXIT_CRITICAL(&counter_journal_mutex);
+}
+
+void initCounterJournal() {
+    journal_on_fs = g_littlefs_mounted;
+    journal_records = 0;
+    journal_next_seq = 1;
+    journal_torn_records = 0;
+
+    CounterRecord_t latest;
+    bool found = false;
+    bool needs_compaction = false;
+    if (journal_on_fs) found = readLatestFromFile(&latest, &needs_compaction);
+    // Без файла проверяем и NVS: до этого LittleFS могла быть недоступна
+    if (!found) found = readFromNvs(&latest);
+
+    claimJournal();
+    bool ok = true;
+    if (found) {
+        applyCounterRecord(&latest);
+        journal_next_seq = latest.seq + 1;
+        if (needs_compaction) {
+            log_w("COUNTERS", "Counter journal has %lu damaged records, compacting.", (unsigned long)journal_torn_records);
+            ok = writeCounterRecord(true);
+        }
+        log_i("COUNTERS", "Counters restored from record #%lu (%lu records on %s).", (unsigned long)latest.seq,
+              (unsigned long)journal_records, journal_on_fs ? "LittleFS" : "NVS");
+    } else {
+        // Первый запуск с журналом: значения из перенесенной конфигурации или нули
+        ok = writeCounterRecord(journal_records > 0);
+        log_i("COUNTERS", "Counter journal created on %s.", journal_on_fs ? "LittleFS" : "NVS");
+    }
+    releaseJournal(ok);
+}
+
+void counterJournalNoteChange() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&counter_journal_mutex);
+    if (!journal_pending) {
+        journal_pending = true;
+        journal_first_change_ms = now;
+    }
+    journal_last_change_ms = now;
+    portEXIT_CRITICAL(&counter_journal_mutex);
+}
+
+void handleCounterJournal() {
+    bool pending;
+    unsigned long first, last;
+    portENTER_CRITICAL(&counter_journal_mutex);
+    pending = journal_pending;
+    first = journal_first_change_ms;
+    last = journal_last_change_ms;
+    portEXIT_CRITICAL(&counter_journal_mutex);
+    if (!pending) return;
+
+    unsigned long now = millis();
+    bool overdue = now - first >= COUNTER_JOURNAL_MAX_DELAY_MS;
+    if (now - last < COUNTER_JOURNAL_DEBOUNCE_MS && !overdue) return;
+    if (getDosingState() == DOSING_STATE_RUNNING && !overdue) return;
+    if (!claimJournal()) return;
+    releaseJournal(writeCounterRecord(false));
+}
+
+void flushCounterJournal() {
+    bool pending;
+    portENTER_CRITICAL(&counter_journal_mutex);
+    pending = journal_pending;
+    portEXIT_CRITICAL(&counter_journal_mutex);
+    if (!pending || !claimJournal()) return;
+    releaseJournal(writeCounterRecord(false));
+}
+
+void resetCounterJournal() {
+    unsigned long wait_start = millis();
+    while (!claimJournal()) {
+        if (millis() - wait_start > 500) return;
+        delay(1);
+    }
+    if (journal_on_fs) {
+        LittleFS.remove(COUNTER_JOURNAL_FILE);
+        LittleFS.remove(COUNTER_JOURNAL_TMP_FILE);
+    }
+    Preferences prefs;
+    if (prefs.begin(COUNTER_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+    journal_records = 0;
+    releaseJournal(true);
+    log_w("COUNTERS", "Counter journal cleared.");
+}
+
+void getCounterJournalStatus(CounterJournalStatus_t* out) {
+    if (!out) return;
+    out->on_littlefs = journal_on_fs;
+    out->records = journal_records;
+    out->next_seq = journal_next_seq;
+    out->appends = journal_appends;
+    out->compactions = journal_compactions;
+    out->write_failures = journal_write_failures;
+    out->torn_records = journal_torn_records;
+    portENTER_CRITICAL(&counter_journal_mutex);
+    out->pending = journal_pending;
+    portEXIT_CRITICAL(&counter_journal_mutex);
+}
@@ -0,0 +1,53 @@
+#ifndef COUNTER_JOURNAL_H
+#define COUNTER_JOURNAL_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Журнал счетчиков наработки (объем, циклы, пуски и время компрессора, ошибки) отдельно от настроек.
+// Значения по-прежнему живут в config.*, а сохраняются дописыванием записи фиксированного размера в файл
+// на LittleFS (износ распределяет файловая система). При загрузке берется последняя запись с верным CRC;
+// когда файл заполняется, он сжимается до одной записи. Без LittleFS запись хранится в отдельном пространстве NVS.
+
+#define COUNTER_JOURNAL_FILE         "/counters.bin"
+#define COUNTER_JOURNAL_TMP_FILE     "/counters.tmp"
+#define COUNTER_JOURNAL_CAPACITY     256    // Записей до сжатия (8 КБ)
+#define COUNTER_RECORD_MAGIC         0xC7
+#define COUNTER_RECORD_VERSION       1
+#define COUNTER_JOURNAL_DEBOUNCE_MS  5000   // Запись после такой паузы без новых изменений
+#define COUNTER_JOURNAL_MAX_DELAY_MS 60000  // Не позже этого срока от первого изменения (в т.ч. во время налива)
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t reserved;
+    uint32_t seq;
+    uint32_t total_volume_ml;
+    uint32_t compressor_run_ms;
+    uint32_t compressor_starts;
+    uint32_t dosing_cycles;
+    uint32_t errors;
+    uint32_t crc;               // CRC32 всех предыдущих байт
+} CounterRecord_t;
+
+typedef struct {
+    bool on_littlefs;           // false - запасной вариант в NVS
+    uint32_t records;           // Записей в файле
+    uint32_t next_seq;
+    uint32_t appends;
+    uint32_t compactions;
+    uint32_t write_failures;
+    uint32_t torn_records;      // Отброшенные при загрузке записи с неверным CRC
+    bool pending;
+} CounterJournalStatus_t;
+
+extern portMUX_TYPE counter_journal_mutex;
+
+void initCounterJournal();      // Из loadConfig(): счетчики из журнала, при первом запуске - засев из config.*
+void handleCounterJournal();    // Вызывается из loop(): отложенное дописывание записи
+void counterJournalNoteChange(); // После изменения счетчика в config (безопасен из любой задачи)
+void flushCounterJournal();     // Немедленная запись ожидающих изменений
+void resetCounterJournal();     // Журнал заново с текущими (обнуленными) значениями
+void getCounterJournalStatus(CounterJournalStatus_t* out);
+
+#endif // COUNTER_JOURNAL_H
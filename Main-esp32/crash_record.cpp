@@ -0,0 +1,95 @@
+#include "crash_record.h"
+#include <esp_attr.h>       // Для RTC_NOINIT_ATTR
+#include <esp_system.h>     // Для esp_reset_reason
+#include <rom/crc.h>        // Для crc32_le
+#include <stddef.h>         // Для offsetof
+#include "config_manager.h" // Счетчик ошибок и последнее сообщение в config.*
+#include "counter_journal.h"
+#include "error_journal.h"
+#include "localization.h"
+#include "utils.h"          // Для getUptimeSeconds
+#include "main.h"           // Для функций логирования
+
+// Не инициализируется при старте: содержимое прошлой загрузки проверяется по magic и CRC
+static RTC_NOINIT_ATTR CrashRecord_t rtc_crash_record;
+
+// Разобранная при загрузке запись (только из loop/setup)
+static CrashRecord_t last_crash;
+static bool last_crash_valid = false;
+
+static uint32_t crashRecordCrc(const CrashRecord_t* rec) {
+    return crc32_le(0, (const uint8_t*)rec, offsetof(CrashRecord_t, crc));
+}
+
+// Аварийный сброс без записи (WDT, паника, просадка питания) - код и сообщение по причине сброса
+static SystemErrorCode_t resetReasonToError(esp_reset_reason_t reason, const char** message) {
+    switch (reason) {
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:      *message = _T(L_CRASH_RESET_WDT);      return FATAL_WDT_RESET;
+        case ESP_RST_PANIC:    *message = _T(L_CRASH_RESET_PANIC);    return FATAL_UNHANDLED_EXCEPTION;
+        case ESP_RST_BROWNOUT: *message = _T(L_CRASH_RESET_BROWNOUT); return FATAL_BROWN_OUT;
+        default:               return NO_ERROR;
+    }
+}
+
+void writeCrashRecord(SystemErrorCode_t code, const char* message) {
+    CrashRecord_t* rec = &rtc_crash_record;
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = CRASH_RECORD_MAGIC;
+    rec->version = CRASH_RECORD_VERSION;
+    rec->dosing_state = (uint8_t)getDosingState();
+    rec->error_code = (uint16_t)code;
+    rec->uptime_s = getUptimeSeconds();
+    rec->volume_ml = getCurrentDosedVolume();
+    rec->transition_count = (uint8_t)getDosingJournal(rec->transitions, CRASH_RECORD_TRANSITIONS);
+    strncpy(rec->message, message ? message : "", sizeof(rec->message) - 1);
+    rec->crc = crashRecordCrc(rec);
+}
+
+void initCrashRecord() {
+    esp_reset_reason_t reason = esp_reset_reason();
+    // После включения питания RTC-память содержит мусор - запись не рассматривается
+    bool have_record = reason != ESP_RST_POWERON && rtc_crash_record.magic == CRASH_RECORD_MAGIC &&
+                       rtc_crash_record.version == CRASH_RECORD_VERSION && rtc_crash_record.crc == crashRecordCrc(&rtc_crash_record);
+    if (have_record) {
+        last_crash = rtc_crash_record;
+        last_crash.message[sizeof(last_crash.message) - 1] = '\0';
+    } else {
+        const char* message = NULL;
+        SystemErrorCode_t code = resetReasonToError(reason, &message);
+        if (code == NO_ERROR) {
+            rtc_crash_record.magic = 0;
+            return;
+        }
+        memset(&last_crash, 0, sizeof(last_crash));
+        last_crash.magic = CRASH_RECORD_MAGIC;
+        last_crash.version = CRASH_RECORD_VERSION;
+        last_crash.dosing_state = 0xFF; // Неизвестно
+        last_crash.error_code = (uint16_t)code;
+        strncpy(last_crash.message, message, sizeof(last_crash.message) - 1);
+    }
+    rtc_crash_record.magic = 0; // Запись разобрана: следующая штатная перезагрузка ее не повторит
+    last_crash.reset_reason = (uint8_t)reason;
+    last_crash_valid = true;
+
+    app_log_e("REBOOT_INFO", _T(L_REBOOTED_DUE_TO_FATAL_ERROR), (unsigned)last_crash.error_code);
+    app_log_e("REBOOT_INFO", "Crash record: '%s', dosing state %u, uptime %lu s, reset reason %u, %u transitions.",
+              last_crash.message, last_crash.dosing_state, (unsigned long)last_crash.uptime_s,
+              last_crash.reset_reason, last_crash.transition_count);
+
+    errorJournalAppendCrash((SystemErrorCode_t)last_crash.error_code, last_crash.message, last_crash.dosing_state,
+                            last_crash.uptime_s, last_crash.volume_ml);
+    // Счетчик ошибок и сообщение - через обычную отложенную запись, не в пути загрузки
+    config.errorCount++;
+    counterJournalNoteChange();
+    strncpy(config.lastErrorMsgBuffer, last_crash.message, sizeof(config.lastErrorMsgBuffer) - 1);
+    config.lastErrorMsgBuffer[sizeof(config.lastErrorMsgBuffer) - 1] = '\0';
+    saveConfig();
+}
+
+bool getLastCrashRecord(CrashRecord_t* out) {
+    if (!out || !last_crash_valid) return false;
+    *out = last_crash;
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef CRASH_RECORD_H
+#define CRASH_RECORD_H
+
+#include <Arduino.h>
+#include "error_handler.h"  // Для SystemErrorCode_t
+#include "dosing_logic.h"   // Для DosingJournalEntry_t
+
+// Запись об аварийной перезагрузке в RTC slow memory (RTC_NOINIT: переживает программный сброс, WDT и панику,
+// но не отключение питания). Фатальный путь пишет ее без NVS и задержек и сразу перезагружается;
+// при следующей загрузке запись разбирается в RAM и попадает в журнал ошибок, а счетчик ошибок и сообщение
+// уходят в обычную отложенную запись конфигурации. Сброс по WDT/панике/просадке питания без записи восстанавливается
+// по причине сброса.
+
+#define CRASH_RECORD_MAGIC        0x43525348UL // "CRSH"
+#define CRASH_RECORD_VERSION      1
+#define CRASH_RECORD_TRANSITIONS  8            // Последние переходы автомата дозирования
+#define CRASH_RECORD_MSG_LEN      64
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t dosing_state;       // DosingState_t в момент ошибки
+    uint8_t transition_count;
+    uint8_t reset_reason;       // esp_reset_reason_t загрузки, на которой запись прочитана
+    uint16_t error_code;        // SystemErrorCode_t
+    uint16_t reserved;
+    uint32_t uptime_s;
+    float volume_ml;            // Объем текущего цикла
+    DosingJournalEntry_t transitions[CRASH_RECORD_TRANSITIONS]; // Сначала новые
+    char message[CRASH_RECORD_MSG_LEN];
+    uint32_t crc;               // CRC32 всех предыдущих байт
+} CrashRecord_t;
+
+// Из фатального пути: только RAM и RTC-память, безопасно из обработчиков и других задач
+void writeCrashRecord(SystemErrorCode_t code, const char* message);
+// Из setup() после loadConfig() и initErrorHandler(): разбор записи прошлой загрузки
+void initCrashRecord();
+// Запись прошлой загрузки; false - загрузка была штатной
+bool getLastCrashRecord(CrashRecord_t* out);
+
+#endif // CRASH_RECORD_H
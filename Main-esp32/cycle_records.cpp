@@ -0,0 +1,219 @@
+#include "cycle_records.h"
+#include <LittleFS.h>
+#include <time.h>
+#include "sensors.h"        // Для tOut, tOut_filtered, compressorRunning
+#include "main.h"           // Для g_littlefs_mounted и функций логирования
+
+#define CYCLE_TIME_VALID_AFTER 1600000000UL // Меньшее UNIX-время - часы еще не синхронизированы
+
+portMUX_TYPE cycle_records_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Файл (только из loop)
+static bool records_available = false;
+static uint32_t records_count = 0;
+static uint32_t records_next_seq = 1;
+static uint32_t records_write_failures = 0;
+
+// Текущий цикл (защищен cycle_records_mutex: начало и состояния могут прийти из обработчика ESP-NOW)
+static bool cycle_active = false;
+static uint32_t cycle_generation = 0; // Меняется при каждом начале цикла
+static CycleRecord_t cycle_rec;
+
+// Выборка (только из loop)
+static uint32_t sample_generation = 0;
+static unsigned long sample_last_ms = 0;
+static uint32_t sample_total_ms = 0;
+static uint32_t sample_comp_on_ms = 0;
+static float temp_sum = 0.0f;
+static uint32_t temp_samples = 0;
+
+static void openRecordsFile() {
+    records_available = false;
+    records_count = 0;
+    records_next_seq = 1;
+    if (!g_littlefs_mounted) {
+        log_w("CYCLES", "LittleFS not mounted, cycle records disabled.");
+        return;
+    }
+    if (LittleFS.exists(CYCLE_RECORDS_FILE)) {
+        File f = LittleFS.open(CYCLE_RECORDS_FILE, "r");
+        if (!f) {
+            log_e("CYCLES", "Failed to open %s.", CYCLE_RECORDS_FILE);
+            return;
+        }
+        size_t size = f.size();
+        if (size % sizeof(CycleRecord_t) != 0 || size > (size_t)CYCLE_RECORDS_CAPACITY * sizeof(CycleRecord_t)) {
+            // Другой размер записи или емкость (новая версия прошивки) - начинаем файл заново
+            f.close();
+            log_w("CYCLES", "Cycle records file has unexpected size %u, recreating.", (unsigned)size);
+            LittleFS.remove(CYCLE_RECORDS_FILE);
+        } else {
+            CycleRecord_t rec;
+            uint32_t max_seq = 0;
+            while (f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) {
+                if (rec.magic != CYCLE_RECORD_MAGIC || rec.version != CYCLE_RECORD_VERSION) continue;
+                records_count++;
+                if (rec.seq > max_seq) max_seq = rec.seq;
+            }
+            f.close();
+            records_next_seq = max_seq + 1;
+        }
+    }
+    records_available = true;
+    log_i("CYCLES", "Cycle records ready: %lu records, next #%lu.", (unsigned long)records_count, (unsigned long)records_next_seq);
+}
+
+void initCycleRecords() {
+    portENTER_CRITICAL(&cycle_records_mutex);
+    cycle_active = false;
+    portEXIT_CRITICAL(&cycle_records_mutex);
+    openRecordsFile();
+}
+
+void cycleRecordBegin(float target_ml, uint8_t channel_mask, uint8_t flags) {
+    time_t now_t = time(nullptr);
+    bool synced = (unsigned long)now_t > CYCLE_TIME_VALID_AFTER;
+    portENTER_CRITICAL(&cycle_records_mutex);
+    memset(&cycle_rec, 0, sizeof(cycle_rec));
+    cycle_rec.magic = CYCLE_RECORD_MAGIC;
+    cycle_rec.version = CYCLE_RECORD_VERSION;
+    cycle_rec.flags = flags | (synced ? CYCLE_FLAG_TIME_SYNCED : 0);
+    cycle_rec.channel_mask = channel_mask;
+    cycle_rec.start_time = synced ? (uint32_t)now_t : 0;
+    cycle_rec.start_uptime_s = millis() / 1000;
+    cycle_rec.target_ml = target_ml;
+    cycle_rec.temp_max_c = -127.0f;
+    cycle_active = true;
+    cycle_generation++;
+    portEXIT_CRITICAL(&cycle_records_mutex);
+}
+
+void cycleRecordNoteState(DosingState_t old_state, uint32_t duration_ms) {
+    // Ожидание между циклами в запись не входит
+    if (old_state == DOSING_STATE_IDLE || old_state == DOSING_STATE_FINISHED || old_state == DOSING_STATE_ERROR) return;
+    if ((int)old_state < 0 || (int)old_state >= DOSING_STATE_COUNT) return;
+    portENTER_CRITICAL(&cycle_records_mutex);
+    if (cycle_active) cycle_rec.state_ms[old_state] += duration_ms;
+    portEXIT_CRITICAL(&cycle_records_mutex);
+}
+
+void handleCycleRecords() {
+    unsigned long now = millis();
+    bool active;
+    uint32_t generation;
+    portENTER_CRITICAL(&cycle_records_mutex);
+    active = cycle_active;
+    generation = cycle_generation;
+    portEXIT_CRITICAL(&cycle_records_mutex);
+    // Новый цикл (в т.ч. задание очереди сразу после предыдущего) - выборка начинается заново
+    if (!active || generation != sample_generation) {
+        sample_generation = generation;
+        sample_last_ms = now;
+        sample_total_ms = 0;
+        sample_comp_on_ms = 0;
+        temp_sum = 0.0f;
+        temp_samples = 0;
+        if (!active) return;
+    }
+    if (now - sample_last_ms < CYCLE_RECORDS_SAMPLE_MS) return;
+    uint32_t dt = (uint32_t)(now - sample_last_ms);
+    sample_last_ms = now;
+
+    sample_total_ms += dt;
+    if (compressorRunning) sample_comp_on_ms += dt;
+
+    DosingState_t state = getDosingState();
+    float temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+    if ((state == DOSING_STATE_RUNNING || state == DOSING_STATE_PAUSED) && temp != -127.0f) {
+        temp_sum += temp;
+        temp_samples++;
+        portENTER_CRITICAL(&cycle_records_mutex);
+        if (temp > cycle_rec.temp_max_c) cycle_rec.temp_max_c = temp;
+        portEXIT_CRITICAL(&cycle_records_mutex);
+    }
+}
+
+static bool writeRecord(const CycleRecord_t* rec) {
+    uint32_t slot = (rec->seq - 1) % CYCLE_RECORDS_CAPACITY;
+    bool exists = LittleFS.exists(CYCLE_RECORDS_FILE);
+    File f = LittleFS.open(CYCLE_RECORDS_FILE, exists ? "r+" : "w");
+    if (!f) return false;
+    // До первого оборота слот всегда равен размеру файла (дописывание), после - перезапись самой старой записи
+    bool ok = f.seek(slot * sizeof(CycleRecord_t)) && f.write((const uint8_t*)rec, sizeof(*rec)) == sizeof(*rec);
+    f.close();
+    return ok;
+}
+
+void cycleRecordEnd(float actual_ml, uint8_t error_code) {
+    CycleRecord_t rec;
+    portENTER_CRITICAL(&cycle_records_mutex);
+    if (!cycle_active) {
+        portEXIT_CRITICAL(&cycle_records_mutex);
+        return;
+    }
+    cycle_active = false;
+    rec = cycle_rec;
+    portEXIT_CRITICAL(&cycle_records_mutex);
+
+    rec.actual_ml = actual_ml;
+    bool open_ended = (rec.flags & CYCLE_FLAG_CONTINUOUS) && rec.target_ml <= 0.0f;
+    rec.overshoot_ml = open_ended ? 0.0f : actual_ml - rec.target_ml;
+    rec.temp_mean_c = temp_samples > 0 ? temp_sum / (float)temp_samples : -127.0f;
+    uint32_t running_ms = rec.state_ms[DOSING_STATE_RUNNING];
+    rec.flow_mean_ml_min = running_ms > 0 ? actual_ml * 60000.0f / (float)running_ms : 0.0f;
+    rec.compressor_duty_pct = sample_total_ms > 0 ? (uint8_t)((uint64_t)sample_comp_on_ms * 100 / sample_total_ms) : 0;
+    rec.error_code = error_code;
+
+    if (!records_available) return;
+    rec.seq = records_next_seq;
+    if (writeRecord(&rec)) {
+        records_next_seq++;
+        if (records_count < CYCLE_RECORDS_CAPACITY) records_count++;
+        log_i("CYCLES", "Cycle #%lu recorded: %.1f / %.0f ml, %.1f ml/min, duty %u%%, error %u.", (unsigned long)rec.seq,
+              rec.actual_ml, rec.target_ml, rec.flow_mean_ml_min, rec.compressor_duty_pct, rec.error_code);
+    } else {
+        records_write_failures++;
+        log_e("CYCLES", "Failed to write cycle record #%lu.", (unsigned long)rec.seq);
+    }
+}
+
+int forEachCycleRecord(uint32_t from_time, uint32_t to_time, CycleRecordVisitor visitor, void* arg) {
+    if (!records_available || !visitor || records_count == 0) return 0;
+    File f = LittleFS.open(CYCLE_RECORDS_FILE, "r");
+    if (!f) return 0;
+    bool ranged = from_time != 0 || to_time != 0;
+    uint32_t first_seq = records_next_seq - records_count;
+    int visited = 0;
+    for (uint32_t i = 0; i < records_count; i++) {
+        uint32_t seq = first_seq + i;
+        CycleRecord_t rec;
+        if (!f.seek(((seq - 1) % CYCLE_RECORDS_CAPACITY) * sizeof(CycleRecord_t))) break;
+        if (f.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) break;
+        if (rec.magic != CYCLE_RECORD_MAGIC || rec.version != CYCLE_RECORD_VERSION || rec.seq != seq) continue;
+        if (ranged) {
+            if (rec.start_time == 0) continue;
+            if (from_time != 0 && rec.start_time < from_time) continue;
+            if (to_time != 0 && rec.start_time > to_time) continue;
+        }
+        visited++;
+        if (!visitor(&rec, arg)) break;
+    }
+    f.close();
+    return visited;
+}
+
+void getCycleRecordsStatus(CycleRecordsStatus_t* out) {
+    if (!out) return;
+    out->available = records_available;
+    out->records = records_count;
+    out->next_seq = records_next_seq;
+    out->write_failures = records_write_failures;
+}
+
+void clearCycleRecords() {
+    if (g_littlefs_mounted && LittleFS.exists(CYCLE_RECORDS_FILE)) LittleFS.remove(CYCLE_RECORDS_FILE);
+    records_count = 0;
+    records_next_seq = 1;
+    records_available = g_littlefs_mounted;
+    log_w("CYCLES", "Cycle records cleared.");
+}
@@ -0,0 +1,67 @@
+#ifndef CYCLE_RECORDS_H
+#define CYCLE_RECORDS_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+#include "dosing_logic.h"      // Для DOSING_STATE_COUNT
+
+// Записи по каждому циклу дозирования в кольцевом файле на LittleFS.
+// Записи фиксированного размера пишутся по месту (слот = (seq - 1) % CYCLE_RECORDS_CAPACITY), без заголовка файла:
+// при загрузке голова находится по наибольшему seq. Цикл - от REQUESTED (или следующего задания очереди) до FINISHED/ERROR.
+
+#define CYCLE_RECORDS_FILE        "/cycles.bin"
+#define CYCLE_RECORDS_CAPACITY    500    // ~40 КБ на флеше
+#define CYCLE_RECORD_MAGIC        0xC5
+#define CYCLE_RECORD_VERSION      1
+#define CYCLE_RECORDS_SAMPLE_MS   1000   // Период выборки температуры и компрессора
+
+#define CYCLE_FLAG_CONTINUOUS     0x01   // Непрерывный налив (target_ml - лимит, 0 - без лимита)
+#define CYCLE_FLAG_CHAINED        0x02   // Задание очереди, запущенное сразу после предыдущего
+#define CYCLE_FLAG_TIME_SYNCED    0x04   // start_time - UNIX-время (иначе 0)
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint8_t channel_mask;
+    uint32_t seq;
+    uint32_t start_time;        // UNIX-время старта (с), 0 - время не синхронизировано
+    uint32_t start_uptime_s;
+    uint32_t state_ms[DOSING_STATE_COUNT]; // Время в каждом состоянии за цикл
+    float target_ml;
+    float actual_ml;
+    float overshoot_ml;         // actual - target (для непрерывного налива без лимита - 0)
+    float temp_mean_c;          // Средняя T_out за RUNNING/PAUSED
+    float temp_max_c;
+    float flow_mean_ml_min;     // Объем / время RUNNING
+    uint8_t compressor_duty_pct; // Доля времени работы компрессора за цикл
+    uint8_t error_code;         // SystemErrorCode при завершении
+    uint16_t reserved;
+} CycleRecord_t;
+
+typedef struct {
+    bool available;             // Файл открыт и проверен
+    uint32_t records;           // Записей в файле
+    uint32_t next_seq;
+    uint32_t write_failures;
+} CycleRecordsStatus_t;
+
+// Обход записей от старых к новым; false из visitor прекращает обход
+typedef bool (*CycleRecordVisitor)(const CycleRecord_t* rec, void* arg);
+
+extern portMUX_TYPE cycle_records_mutex;
+
+void initCycleRecords();     // После монтирования LittleFS
+void handleCycleRecords();   // Вызывается из loop(): выборка температуры и компрессора во время цикла
+
+// Точки учета, вызываются автоматом дозирования
+void cycleRecordBegin(float target_ml, uint8_t channel_mask, uint8_t flags);
+void cycleRecordNoteState(DosingState_t old_state, uint32_t duration_ms);
+void cycleRecordEnd(float actual_ml, uint8_t error_code);
+
+// from_time/to_time - UNIX-время (с); 0 - без ограничения. При заданном диапазоне записи без времени пропускаются.
+int forEachCycleRecord(uint32_t from_time, uint32_t to_time, CycleRecordVisitor visitor, void* arg);
+void getCycleRecordsStatus(CycleRecordsStatus_t* out);
+void clearCycleRecords();
+
+#endif // CYCLE_RECORDS_H
@@ -7,6 +7,14 @@
 #include "pid_controller.h" // Для getIsPidTempControlEnabled() и других функций управления PID
 #include "main.h"           // Для system_power_enabled и функций логирования
 #include "localization.h"   // For _T()
+#include "compressor_control.h" // Для compressorRequest, compressorPreStart
+#include "ilc_controller.h" // Обучаемый профиль скорости на старте цикла
+#include "dosing_queue.h"   // Очередь заданий для циклов подряд
+#include "stall_monitor.h"  // Разгон после паузы
+#include "standby_controller.h" // Учет запросов для удержания холода
+#include "cycle_records.h"  // Запись по каждому циклу на LittleFS
+#include "usage_rollups.h"  // Сводки использования по часам/суткам
+#include "counter_journal.h" // Счетчики наработки
 
 // Определения глобальных переменных из dosing_logic.h
 DosingState_t current_dosing_state = DOSING_STATE_IDLE;
@@ -15,6 +23,7 @@ unsigned long dosing_state_start_time = 0;
 portMUX_TYPE dosing_state_mutex = portMUX_INITIALIZER_UNLOCKED;
 
 volatile float volume_dispensed_cycle = 0; // Добавляем volatile в определение
+static uint8_t dosing_channel_mask = MOTOR_PRIMARY_CHANNEL_MASK; // Каналы текущего цикла (пишется только до REQUESTED)
 
 // Внешние переменные
 // extern Config config; // Доступно через config_manager.h
@@ -36,11 +45,55 @@ volatile float volume_dispensed_cycle = 0; // Добавляем volatile в о
 // Мьютекс для volume_dispensed_cycle
 portMUX_TYPE volume_dispensed_mutex = portMUX_INITIALIZER_UNLOCKED;
 
+// --- Журнал переходов и статистика по состояниям (защищены dosing_state_mutex) ---
+static DosingJournalEntry_t dosing_journal[DOSING_JOURNAL_SIZE];
+static uint16_t dosing_journal_head = 0;  // Индекс следующей записи
+static uint16_t dosing_journal_count = 0;
+static DosingStateStats_t dosing_state_stats[DOSING_STATE_COUNT];
+static uint32_t dosing_cycle_ms[DOSING_STATE_COUNT];      // Текущий цикл
+static uint32_t dosing_last_cycle_ms[DOSING_STATE_COUNT]; // Последний завершенный цикл
+
+static DosingState_t sm_active_state = DOSING_STATE_IDLE; // Состояние, для которого выполнен on_enter (только из loop)
+// Пауза: запросы из веба/ESP-NOW (под dosing_state_mutex), остальное - только из loop
+static bool dosing_pause_requested = false;
+static bool dosing_resume_requested = false;
+static uint8_t dosing_paused_mask = 0;           // Каналы, остановленные паузой
+static bool dosing_paused_checking_flow = false; // Проверка no-flow была активна в момент паузы
+static unsigned long dosing_run_accum_ms = 0;    // Время RUNNING до последней паузы
+
+// Непрерывный налив (только из loop, кроме запуска через startContinuousDosing)
+static bool dosing_continuous = false;
+static uint32_t dosing_continuous_limit_ml = 0;  // 0 - до остановки
+static unsigned long cont_flow_ref_ms = 0;       // Начало окна проверки роста объема
+static float cont_flow_ref_volume = 0.0f;
+static bool cont_flow_lost = false;
+static bool cont_temp_high = false;              // T_out выше допуска с cont_temp_high_since
+static unsigned long cont_temp_high_since = 0;
+static bool cont_supervision_paused = false;     // Пауза выставлена надзором (снимается автоматически)
+
+// Уставки текущего цикла (пишутся только из loop). Задание очереди переопределяет уставку и скорость
+// только на свой цикл: config (и NVS) остается с настройками оператора.
+static float cycle_temp_setpoint = DOSING_QUEUE_KEEP_TEMP;  // NAN - уставка оператора
+static int cycle_motor_speed = DOSING_QUEUE_KEEP_SPEED;     // 0 - скорость оператора
+static int cycle_volume_ml = 0;                             // Цель текущего/последнего цикла (0 - config.volumeTarget)
+static uint32_t cycle_settings_version = 0;                 // Растет при смене переопределений (для PID)
+
+// Живые показания (защищены dosing_state_mutex)
+static DosingLiveStatus_t dosing_live;
+static unsigned long live_rate_ms = 0;
+static float live_rate_volume = 0.0f;
+
 void initDosingLogic() {
     portENTER_CRITICAL(&dosing_state_mutex);
     current_dosing_state = DOSING_STATE_IDLE;
     dosing_state_start_time = millis();
+    memset(dosing_state_stats, 0, sizeof(dosing_state_stats));
+    memset(dosing_cycle_ms, 0, sizeof(dosing_cycle_ms));
+    memset(dosing_last_cycle_ms, 0, sizeof(dosing_last_cycle_ms));
+    dosing_journal_head = 0;
+    dosing_journal_count = 0;
     portEXIT_CRITICAL(&dosing_state_mutex);
+    sm_active_state = DOSING_STATE_IDLE;
 
     portENTER_CRITICAL(&volume_dispensed_mutex);
     volume_dispensed_cycle = 0;
@@ -48,55 +101,158 @@ void initDosingLogic() {
     log_i("DOSING", "Dosing Logic Initialized.");
 }
 
-void startDosingCycle(int volumeML, bool fromWeb) {
-    // ... (реализация как в mainbuidv4.c) ...
-    // Важно: setSystemError, getCalibrationModeState, system_power_enabled, config.mlPerStep
-    // будут доступны через .h файлы или extern.    
-    DosingState_t local_current_dosing_state;
-    portENTER_CRITICAL(&dosing_state_mutex);
-    local_current_dosing_state = current_dosing_state;
-    portEXIT_CRITICAL(&dosing_state_mutex);
+// Маска и калибровка каналов - то, что не пройдет само (в отличие от питания и режима калибровки)
+static bool validateDosingChannels(uint8_t channelMask, bool report) {
+    if (channelMask == 0 || (channelMask & ~MOTOR_ALL_CHANNELS_MASK) != 0) {
+        if (report) setSystemError(INPUT_VALIDATION_ERROR, _T(L_ERROR_INVALID_CHANNEL_MASK));
+        return false;
+    }
+    // Для дозирования по объему через датчик потока, важна калибровка датчика потока.
+    // Калибровка mlPerStep для мотора становится менее критичной для точности объема, но важна для скорости.
+    if ((channelMask & MOTOR_PRIMARY_CHANNEL_MASK) && config.flowMlPerPulse <= 0.000001f) {
+        if (report) setSystemError(CALIBRATION_ERROR, _T(L_ERROR_FLOW_SENSOR_NOT_CALIBRATED));
+        return false;
+    }
+    // Дополнительные каналы дозируют по шагам - без калибровки объем не определен
+    for (uint8_t ch = 1; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if ((channelMask & (1u << ch)) && getMotor(ch).getMlPerStep() <= 0.000001f) {
+            if (report) setSystemError(CALIBRATION_ERROR, _T(L_ERROR_CHANNEL_NOT_CALIBRATED));
+            return false;
+        }
+    }
+    return true;
+}
 
+// Проверка запроса на цикл. report = false - только проверка (guard автомата), без setSystemError
+static bool validateDosingRequest(uint8_t channelMask, bool report) {
     if (getCalibrationModeState()) { // getCalibrationModeState() из calibration_logic.h
-        setSystemError(CALIBRATION_ERROR, _T(L_ERROR_CAL_ACTIVE_CANNOT_DOSE));
-        // if (fromWeb) server.send(400, "text/plain", "Calibration active"); // Веб-ответы остаются в web_server_handlers.c
-        return;
+        if (report) setSystemError(CALIBRATION_ERROR, _T(L_ERROR_CAL_ACTIVE_CANNOT_DOSE));
+        return false;
     }
     if (!system_power_enabled) {
-        setSystemError(LOGIC_ERROR, _T(L_ERROR_SYS_NOT_POWERED_CANNOT_DOSE));
-        return;
+        if (report) setSystemError(LOGIC_ERROR, _T(L_ERROR_SYS_NOT_POWERED_CANNOT_DOSE));
+        return false;
+    }
+    return validateDosingChannels(channelMask, report);
+}
+
+bool isDosingChannelMaskUsable(uint8_t channelMask) {
+    return validateDosingChannels(channelMask, false);
+}
+
+// job == NULL - цикл с настройками оператора
+static void setCycleOverrides(const DosingJob_t* job) {
+    float temp = job ? job->temp_setpoint : DOSING_QUEUE_KEEP_TEMP;
+    int speed = job ? job->motor_speed : DOSING_QUEUE_KEEP_SPEED;
+    if (!isnan(temp) || speed != DOSING_QUEUE_KEEP_SPEED) {
+        log_i("DOSING", "Job settings for this cycle only: setpoint %.1fC, speed %d.", temp, speed);
     }
+    cycle_temp_setpoint = temp;
+    cycle_motor_speed = speed;
+    cycle_settings_version++;
+}
+
+// Значения цикла поверх снимка настроек; автомат передает один снимок на проход
+static float cycleTempSetpoint(const Config* cfg) {
+    float temp = cycle_temp_setpoint;
+    return isnan(temp) ? cfg->tempSetpoint : temp;
+}
+
+static int cycleMotorSpeed(const Config* cfg) {
+    int speed = cycle_motor_speed;
+    return speed != DOSING_QUEUE_KEEP_SPEED ? speed : cfg->motorSpeed;
+}
+
+static int cycleVolumeTarget(const Config* cfg) {
+    int volume = cycle_volume_ml;
+    return volume > 0 ? volume : cfg->volumeTarget;
+}
+
+float getDosingTempSetpoint() {
+    return cycleTempSetpoint(getConfigSnapshot());
+}
+
+int getDosingMotorSpeed() {
+    return cycleMotorSpeed(getConfigSnapshot());
+}
+
+int getDosingVolumeTarget() {
+    return cycleVolumeTarget(getConfigSnapshot());
+}
+
+uint32_t getDosingCycleSettingsVersion() {
+    return cycle_settings_version;
+}
+
+static bool beginDosingRequest(int volumeML, bool fromWeb, uint8_t channelMask, bool continuous, uint32_t limitML, const DosingJob_t* job) {
+    DosingState_t local_current_dosing_state;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    local_current_dosing_state = current_dosing_state;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+
     if (local_current_dosing_state != DOSING_STATE_IDLE && local_current_dosing_state != DOSING_STATE_FINISHED && local_current_dosing_state != DOSING_STATE_ERROR) {
         setSystemError(LOGIC_ERROR, _T(L_ERROR_DOSING_CYCLE_BUSY_OR_ERROR));
-        return;
-    }
-    // Для дозирования по объему через датчик потока, важна калибровка датчика потока.
-    // Калибровка mlPerStep для мотора становится менее критичной для точности объема, но важна для скорости.
-    if (config.flowMlPerPulse <= 0.000001f) { 
-        setSystemError(CALIBRATION_ERROR, _T(L_ERROR_FLOW_SENSOR_NOT_CALIBRATED));
-        return;
+        return false;
     }
-    if (config.mlPerStep <= 0.000001f) { // Предупреждение, если скорость мотора важна
+    if (!validateDosingRequest(channelMask, true)) return false;
+    if ((channelMask & MOTOR_PRIMARY_CHANNEL_MASK) && config.mlPerStep <= 0.000001f) { // Предупреждение, если скорость мотора важна
         log_w("DOSING", "Motor (mlPerStep) not calibrated. Dosing by flow sensor, but base speed control might be inaccurate.");
     }
 
-    log_i("DOSING", "Starting dosing cycle request for %d ml. (FromWeb: %s)", volumeML, fromWeb ? "true" : "false");
-    config.volumeTarget = volumeML;
-    // steps_target_dosing = (long)((float)volumeML / config.mlPerStep); // Если контроль по шагам
-    steps_taken_dosing = 0;
+    if (continuous) {
+        log_i("DOSING", "Starting continuous pour request, limit %lu ml (0 - until stop). (FromWeb: %s)", (unsigned long)limitML, fromWeb ? "true" : "false");
+    } else {
+        log_i("DOSING", "Starting dosing cycle request for %d ml, channels 0x%02X. (FromWeb: %s)", volumeML, channelMask, fromWeb ? "true" : "false");
+        cycle_volume_ml = volumeML;
+        if (!job) { // Объем задания очереди действует только на его цикл
+            config.volumeTarget = volumeML;
+            publishConfig();
+        }
+    }
+    setCycleOverrides(job);
+    dosing_continuous = continuous;
+    dosing_continuous_limit_ml = limitML;
+    dosing_channel_mask = channelMask;
     portENTER_CRITICAL(&volume_dispensed_mutex);
     volume_dispensed_cycle = 0; // Сбрасываем объем по датчику потока
     portEXIT_CRITICAL(&volume_dispensed_mutex);
     log_dosing_state_change(DOSING_STATE_REQUESTED);
+    cycleRecordBegin(continuous ? (float)limitML : (float)volumeML, channelMask, continuous ? CYCLE_FLAG_CONTINUOUS : 0);
+    standbyNoteRequest(); // Гистограмма спроса и замер задержки "запрос -> поток"
+    compressorPreStart(); // Запрос компрессора сразу, не дожидаясь REQUESTED/PRE_COOLING (учитывается блокировка простоя)
     clearSystemError(); // Сбрасываем предыдущие ошибки (если это нужно)
     // Ответ веб-серверу должен быть в вызывающей функции в main.c (handleStartDosing)
+    return true;
+}
+
+void startDosingCycle(int volumeML, bool fromWeb, uint8_t channelMask) {
+    beginDosingRequest(volumeML, fromWeb, channelMask, false, 0, NULL);
+}
+
+bool startContinuousDosing(uint32_t limitML, bool fromWeb) {
+    if (limitML > DOSING_CONT_MAX_VOLUME_ML) {
+        setSystemError(INPUT_VALIDATION_ERROR, "Continuous pour limit too large");
+        return false;
+    }
+    // Объем считает только датчик потока, поэтому непрерывный налив - только основным каналом
+    return beginDosingRequest(0, fromWeb, MOTOR_PRIMARY_CHANNEL_MASK, true, limitML, NULL);
+}
+
+bool isDosingContinuous() {
+    return dosing_continuous;
+}
+
+uint32_t getDosingContinuousLimit() {
+    return dosing_continuous_limit_ml;
 }
 
 void stopDosingCycle(bool fromWeb) {
     log_i("DOSING", "Stop dosing cycle requested (fromWeb: %s)", fromWeb ? "true" : "false");
     DosingState_t local_current_dosing_state;
 
-    if (motor_running_auto) {
+    clearDosingQueue(); // Остановка отменяет и задания, ожидающие в очереди
+
+    if (isMotorRunningAuto()) {
         log_i("DOSING", "Motor was running auto, stopping motor.");
         stopMotor(); // Используем функцию из motor_control.h
         checking_for_flow = false; // Останавливаем проверку на отсутствие потока
@@ -111,200 +267,630 @@ void stopDosingCycle(bool fromWeb) {
     }
 }
 
-// Вспомогательная функция для логирования смены состояния
-void log_dosing_state_change(DosingState_t new_state) {
+static void changeDosingState(DosingState_t new_state, uint8_t rule) {
     DosingState_t old_state;
+    unsigned long now = millis();
+    uint8_t err = (uint8_t)getSystemErrorCode();
 
     portENTER_CRITICAL(&dosing_state_mutex);
     old_state = current_dosing_state;
+    uint32_t duration = (uint32_t)(now - dosing_state_start_time);
     current_dosing_state = new_state;
-    dosing_state_start_time = millis();
+    dosing_state_start_time = now;
+
+    if ((int)old_state < DOSING_STATE_COUNT) {
+        DosingStateStats_t* st = &dosing_state_stats[old_state];
+        if (st->count == 0 || duration < st->min_ms) st->min_ms = duration;
+        if (duration > st->max_ms) st->max_ms = duration;
+        st->total_ms += duration;
+        st->count++;
+    }
+    // Разбивка цикла: от REQUESTED до возврата в IDLE (или до ERROR)
+    if (new_state == DOSING_STATE_REQUESTED) {
+        memset(dosing_cycle_ms, 0, sizeof(dosing_cycle_ms));
+    } else if ((int)old_state < DOSING_STATE_COUNT) {
+        dosing_cycle_ms[old_state] += duration;
+        if (new_state == DOSING_STATE_IDLE || new_state == DOSING_STATE_ERROR) {
+            memcpy(dosing_last_cycle_ms, dosing_cycle_ms, sizeof(dosing_last_cycle_ms));
+        }
+    }
+
+    DosingJournalEntry_t* e = &dosing_journal[dosing_journal_head];
+    e->timestamp_ms = (uint32_t)now;
+    e->from_state = (uint8_t)old_state;
+    e->to_state = (uint8_t)new_state;
+    e->rule = rule;
+    e->error_code = err;
+    dosing_journal_head = (dosing_journal_head + 1) % DOSING_JOURNAL_SIZE;
+    if (dosing_journal_count < DOSING_JOURNAL_SIZE) dosing_journal_count++;
     portEXIT_CRITICAL(&dosing_state_mutex);
 
-    log_i("DOSING_SM", "State change: %s -> %s", getDosingStateString(old_state), getDosingStateString(new_state));
+    cycleRecordNoteState(old_state, duration);
+    log_d("DOSING_SM", "State change: %s -> %s (rule %u, %lu ms in old state)", getDosingStateString(old_state), getDosingStateString(new_state), rule, (unsigned long)duration);
 }
 
-void handleDosingState() {
-    // ... (реализация конечного автомата, как в mainbuidv4.c) ...
-    // Важно: tOut_filtered, config.tempSetpoint, compressorOn/Off, updateMotorSpeed,
-    // motor_dir, ENABLE_PIN, motor_running_auto, volume_dispensed_cycle, config.volumeTarget,
-    // setSystemError, config.totalDosingCycles, config.totalVolumeDispensed, saveConfig
-    // будут доступны через .h файлы или extern.
-    // PID-логика (pid_setpoint_temp и т.д.) также будет доступна.
-    unsigned long c_ms = millis();
-    float temp_to_check = (tOut_filtered == -127.0f) ? tOut : tOut_filtered; // Используем фильтрованную, если доступна
-    const float temp_hysteresis_dosing = 1.0f; // Гистерезис для старта дозирования    
-    const unsigned long PRECOOL_TIMEOUT_MS = 5 * 60 * 1000; // 5 минут на предохлаждение
-    const unsigned long MAX_DOSING_DURATION_MS = 15 * 60 * 1000; // 15 минут максимальная длительность дозирования
-    DosingState local_current_dosing_state; // Переименовано для ясности
-    unsigned long local_dosing_state_start_time;
-
+bool pauseDosingCycle() {
+    bool ok;
     portENTER_CRITICAL(&dosing_state_mutex);
-    local_current_dosing_state = current_dosing_state;
-    local_dosing_state_start_time = dosing_state_start_time; // Копируем под мьютексом
+    ok = current_dosing_state == DOSING_STATE_RUNNING;
+    if (ok) {
+        dosing_pause_requested = true;
+        dosing_resume_requested = false;
+    }
     portEXIT_CRITICAL(&dosing_state_mutex);
+    if (!ok) log_w("DOSING", "Pause ignored: dosing is not RUNNING.");
+    return ok;
+}
 
-    switch (local_current_dosing_state) {
-        case DOSING_STATE_IDLE: { // Добавлены скобки
-            // Ничего не делаем, ожидаем запроса
-            break;
-        }
-        case DOSING_STATE_REQUESTED: {
-            if (!system_power_enabled) {
-                log_w("DOSING_SM", "System not powered, cannot proceed from REQUESTED. Returning to IDLE.");
-                setSystemError(LOGIC_ERROR, _T(L_ERROR_DOSING_REQUESTED_SYS_NOT_POWERED));
-                log_dosing_state_change(DOSING_STATE_IDLE);
-                break;
-            }
-            if (getSystemErrorCode() == CRIT_TEMP_SENSOR_OUT_FAIL) { // Используем getSystemErrorCode()
-                log_e("DOSING_SM", "Output temp sensor failed, cannot proceed from REQUESTED. -> STOPPING (will lead to ERROR)");
-                // setSystemError не нужен, он уже должен быть установлен
-                log_dosing_state_change(DOSING_STATE_STOPPING); // STOPPING корректно обработает ошибку и перейдет в ERROR
-            } else if (temp_to_check <= (config.tempSetpoint + temp_hysteresis_dosing) && temp_to_check != -127.0f) {
-                log_i("DOSING_SM", "Temp OK (%.1fC <= %.1fC + %.1fC). -> STARTING", temp_to_check, config.tempSetpoint, temp_hysteresis_dosing);
-                log_dosing_state_change(DOSING_STATE_STARTING);
-                // Инициализация PID происходит в enablePidTempControl()
-            } else { // temp_to_check > setpoint или датчик не готов (-127.0f)
-                log_i("DOSING_SM", "Temp High (%.1fC > %.1fC) or sensor not ready. -> PRE_COOLING", temp_to_check, config.tempSetpoint);
-                compressorOn();
-                log_dosing_state_change(DOSING_STATE_PRE_COOLING);
-            }
-            break; // End of DOSING_STATE_REQUESTED // Добавлены скобки
-        }
-        case DOSING_STATE_PRE_COOLING: {
-            if (!system_power_enabled) { log_dosing_state_change(DOSING_STATE_STOPPING); break; }
-            if (getSystemErrorCode() == CRIT_TEMP_SENSOR_OUT_FAIL) { // Используем getSystemErrorCode()
-                log_w("DOSING_SM", "Temp sensor failed during PRE_COOLING. -> STARTING (will likely fail)");
-                log_dosing_state_change(DOSING_STATE_STARTING);
-                break;
-            }
-            if (temp_to_check <= config.tempSetpoint && temp_to_check != -127.0f) {
-                log_i("DOSING_SM", "Pre-cooling complete (%.1fC <= %.1fC). -> STARTING", temp_to_check, config.tempSetpoint);
-                log_dosing_state_change(DOSING_STATE_STARTING); // Используем локальную копию
-            } else if (c_ms - local_dosing_state_start_time > PRECOOL_TIMEOUT_MS) {
-                log_e("DOSING_SM", "Pre-cooling timeout! Temp: %.1fC, Setpoint: %.1fC", temp_to_check, config.tempSetpoint);
-                setSystemError(CRIT_PRECOOL_TIMEOUT, _T(L_ERROR_PRECOOLING_TIMEOUT));
-                log_dosing_state_change(DOSING_STATE_STOPPING);
-            } else {
-                compressorOn(); // Убедимся, что компрессор включен
-            }
-            break; // End of DOSING_STATE_PRE_COOLING
-        }
-        case DOSING_STATE_STARTING: { // Добавлены скобки
-            if (!system_power_enabled) { log_dosing_state_change(DOSING_STATE_STOPPING); break; }
-            if (getSystemErrorCode() == CRIT_TEMP_SENSOR_OUT_FAIL) { // Используем getSystemErrorCode()
-                 log_e("DOSING_SM", "Cannot start dosing, output temp sensor failed.");
-                 setSystemError(CRIT_TEMP_SENSOR_OUT_FAIL, _T(L_ERROR_DOSING_START_ABORTED_TOUT_FAIL));
-                 log_dosing_state_change(DOSING_STATE_ERROR);
-                 break;
-            }
-            if (temp_to_check > (config.tempSetpoint + temp_hysteresis_dosing) && temp_to_check != -127.0f) {
-                log_w("DOSING_SM", "Temp too high to start dosing (%.1fC > %.1fC). -> PRE_COOLING", temp_to_check, config.tempSetpoint);
-                log_dosing_state_change(DOSING_STATE_PRE_COOLING);
-                break;
-            }
-
-            log_i("DOSING_SM", "Starting motor for dosing. Target: %d ml. Speed: %d steps/s.", config.volumeTarget, config.motorSpeed);
-            steps_taken_dosing = 0;
-            portENTER_CRITICAL(&volume_dispensed_mutex);
-            volume_dispensed_cycle = 0;
-            portEXIT_CRITICAL(&volume_dispensed_mutex);
-            updateMotorSpeed(config.motorSpeed);
-            if (config.motorSpeed > 0) {
-                 // ENABLE_PIN управляется в motor_control.c через handleMotorStepping
-                 // или через явный вызов функции включения мотора, если бы она была.
-                 // Сейчас motor_control.c сам включит ENABLE_PIN при handleMotorStepping, если step_interval_us != 0
-                 motor_running_auto = true;
-                 checking_for_flow = true; // Активируем проверку на отсутствие потока
-                 motor_start_time_with_no_flow = millis(); // Запоминаем время старта для таймаута
-            } else {
-                log_w("DOSING_SM", "Motor speed is 0. Cannot start dosing. -> ERROR");
-                setSystemError(LOGIC_ERROR, _T(L_ERROR_MOTOR_SPEED_ZERO_CANNOT_DOSE));
-                log_dosing_state_change(DOSING_STATE_ERROR);
-                break;
-            }
-            
-            if (getIsPidTempControlEnabled()) {
-                log_i("DOSING_SM", "PID Temperature Control is active for this dosing cycle.");
-                // enablePidTempControl(true) уже должен был быть вызван извне (веб, ESP-NOW)
-                // и он уже инициализирует PID (уставка, сброс интеграла/ошибки)
-            }
-            log_dosing_state_change(DOSING_STATE_RUNNING);
-            break; // End of DOSING_STATE_STARTING // Добавлены скобки
-        }
-        case DOSING_STATE_RUNNING: {
-            if (!system_power_enabled || !motor_running_auto) {
-                log_w("DOSING_SM", "System off or motor stopped externally during RUNNING. -> STOPPING");
-                log_dosing_state_change(DOSING_STATE_STOPPING);
-                break;
-            }
-            SystemErrorCode err_code_running = getSystemErrorCode(); // Используем getSystemErrorCode()
-            if (err_code_running != NO_ERROR && err_code_running != WARN_ESP_NOW_SEND_FAIL) {
-                log_e("DOSING_SM", "System error %d occurred during RUNNING. -> STOPPING", err_code_running);
-                log_dosing_state_change(DOSING_STATE_STOPPING);
-                break;
-            }
-
-            float current_volume_dispensed_local;
-            portENTER_CRITICAL(&volume_dispensed_mutex);
-            current_volume_dispensed_local = volume_dispensed_cycle;
-            portEXIT_CRITICAL(&volume_dispensed_mutex);
-
-            if (current_volume_dispensed_local >= (float)config.volumeTarget) {
-                log_i("DOSING_SM", "Target Volume Reached (Flow: %.2f ml / Target: %d ml). -> STOPPING", current_volume_dispensed_local, config.volumeTarget);
-                log_dosing_state_change(DOSING_STATE_STOPPING);
-            } else if (c_ms - local_dosing_state_start_time > MAX_DOSING_DURATION_MS) { // Используем локальную копию
-                log_e("DOSING_SM", "Max dosing duration timeout! Dispensed: %.2f ml / Target: %d ml", current_volume_dispensed_local, config.volumeTarget);
-                setSystemError(CRIT_DOSING_TIMEOUT, _T(L_ERROR_MAX_DOSING_DURATION_TIMEOUT));
-                log_dosing_state_change(DOSING_STATE_STOPPING);
-            }
-            break; // End of DOSING_STATE_RUNNING // Добавлены скобки
-        }
-        case DOSING_STATE_STOPPING: {
-            log_i("DOSING_SM", "Stopping motor and compressor (if running).");
-            stopMotor();
-            compressorOff();
-            checking_for_flow = false; // Деактивируем проверку на отсутствие потока
-            motor_running_auto = false;
-            
-            SystemErrorCode err_code_stopping = getSystemErrorCode(); // Используем getSystemErrorCode()
-            if (err_code_stopping != NO_ERROR && err_code_stopping != WARN_ESP_NOW_SEND_FAIL &&
-                err_code_stopping != CRIT_PRECOOL_TIMEOUT && err_code_stopping != CRIT_DOSING_TIMEOUT &&
-                err_code_stopping != CRIT_FLOW_SENSOR_FAIL) { // Если ошибка не связана с таймаутами или датчиком потока
-                log_dosing_state_change(DOSING_STATE_ERROR);
-            } else {
-                log_dosing_state_change(DOSING_STATE_FINISHED);
-            }
-            break; // End of DOSING_STATE_STOPPING // Добавлены скобки
+bool resumeDosingCycle() {
+    bool ok;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    ok = current_dosing_state == DOSING_STATE_PAUSED || (current_dosing_state == DOSING_STATE_RUNNING && dosing_pause_requested);
+    if (ok) {
+        if (current_dosing_state == DOSING_STATE_RUNNING) {
+            dosing_pause_requested = false; // Пауза еще не выполнена - просто отменяем
+        } else {
+            dosing_resume_requested = true;
         }
-        case DOSING_STATE_FINISHED: {
-            float final_volume_dispensed;
-            portENTER_CRITICAL(&volume_dispensed_mutex);
-            final_volume_dispensed = volume_dispensed_cycle;
-            portEXIT_CRITICAL(&volume_dispensed_mutex);
-
-            log_i("DOSING_SM", "Dosing cycle finished. Volume dispensed: %.2f ml. Steps: %ld.", final_volume_dispensed, steps_taken_dosing);
-            config.totalDosingCycles++;
-            config.totalVolumeDispensed += (unsigned long)round(final_volume_dispensed);
-            saveConfig();
-            log_dosing_state_change(DOSING_STATE_IDLE);
-            break; // End of DOSING_STATE_FINISHED // Добавлены скобки
+    }
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    if (!ok) log_w("DOSING", "Resume ignored: dosing is not PAUSED.");
+    return ok;
+}
+
+// Запрос снимается при проверке (guard с побочным эффектом допустим: переход по нему безусловен)
+static bool takeRequest(bool* flag) {
+    bool requested;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    requested = *flag;
+    *flag = false;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    return requested;
+}
+
+// Вспомогательная функция для смены состояния извне автомата (веб, ESP-NOW, start/stopDosingCycle)
+void log_dosing_state_change(DosingState_t new_state) {
+    changeDosingState(new_state, DOSING_RULE_EXTERNAL);
+}
+
+// --- Табличный автомат ---
+// Снимок входных данных, читается один раз за проход
+typedef struct {
+    unsigned long now;
+    unsigned long in_state_ms;
+    float temp;            // Фильтрованная T_out, если доступна
+    SystemErrorCode err;
+    bool powered;
+    float volume;          // Объем по датчику потока в текущем цикле
+    float setpoint;        // Уставка, скорость и цель цикла с учетом задания очереди:
+    int speed;             // не меняются посреди прохода
+    int target_ml;
+} DosingContext_t;
+
+typedef bool (*DosingGuardFn)(const DosingContext_t* ctx);
+typedef void (*DosingActionFn)(const DosingContext_t* ctx);
+
+typedef struct {
+    DosingState_t state;
+    DosingActionFn on_enter; // При входе: сразу при переходе по таблице, после внешнего перехода - на следующем проходе
+    DosingActionFn on_exit;  // При выходе
+    DosingActionFn on_do;    // Каждый проход, до проверки переходов
+} DosingStateDesc_t;
+
+typedef struct {
+    DosingState_t from;
+    DosingGuardFn guard;     // NULL - переход безусловный
+    DosingState_t to;
+    DosingActionFn action;   // Выполняется перед сменой состояния
+} DosingTransition_t;
+
+static bool errIsBenign(SystemErrorCode err) {
+    return err == NO_ERROR || err == WARN_ESP_NOW_SEND_FAIL;
+}
+
+// Guards
+static bool gNotPowered(const DosingContext_t* c) { return !c->powered; }
+static bool gToutFailed(const DosingContext_t* c) { return c->err == CRIT_TEMP_SENSOR_OUT_FAIL; }
+static bool gTempOkToStart(const DosingContext_t* c) { return c->temp != -127.0f && c->temp <= c->setpoint + DOSING_TEMP_HYSTERESIS_C; }
+static bool gTempReached(const DosingContext_t* c) { return c->temp != -127.0f && c->temp <= c->setpoint; }
+static bool gTempTooHigh(const DosingContext_t* c) { return c->temp != -127.0f && c->temp > c->setpoint + DOSING_TEMP_HYSTERESIS_C; }
+static bool gPrecoolTimeout(const DosingContext_t* c) { return c->in_state_ms > DOSING_PRECOOL_TIMEOUT_MS; }
+static bool gSpeedZero(const DosingContext_t* c) { return c->speed <= 0; }
+static bool gRunningError(const DosingContext_t* c) { return !errIsBenign(c->err); }
+static bool gChannelsDone(const DosingContext_t* c) { return (getMotorsRunningAutoMask() & dosing_channel_mask) == 0; }
+static bool gDosingTimeout(const DosingContext_t* c) {
+    return dosing_run_accum_ms + c->in_state_ms > (dosing_continuous ? DOSING_CONT_MAX_DURATION_MS : DOSING_MAX_DURATION_MS);
+}
+static bool gContFlowLost(const DosingContext_t* c) { return dosing_continuous && cont_flow_lost; }
+static bool gContTempHigh(const DosingContext_t* c) {
+    return dosing_continuous && cont_temp_high && c->now - cont_temp_high_since > DOSING_CONT_TEMP_GRACE_MS;
+}
+static bool gContTempRecovered(const DosingContext_t* c) {
+    return cont_supervision_paused && c->temp != -127.0f && c->temp <= c->setpoint;
+}
+static bool gPauseRequested(const DosingContext_t* c) { return takeRequest(&dosing_pause_requested); }
+static bool gResumeRequested(const DosingContext_t* c) { return takeRequest(&dosing_resume_requested); }
+static bool gPauseTimeout(const DosingContext_t* c) { return c->in_state_ms > DOSING_PAUSE_TIMEOUT_MS; }
+static bool gJobChainable(const DosingContext_t* c) {
+    DosingJob_t job;
+    return c->powered && errIsBenign(c->err) && peekDosingJob(&job) && validateDosingRequest(job.channel_mask, false);
+}
+static bool gStopToError(const DosingContext_t* c) {
+    // Таймауты и отказ датчика потока завершают цикл штатно (FINISHED), остальные ошибки - в ERROR
+    return !errIsBenign(c->err) && c->err != CRIT_PRECOOL_TIMEOUT && c->err != CRIT_DOSING_TIMEOUT && c->err != CRIT_FLOW_SENSOR_FAIL;
+}
+
+// Transition actions
+static void aRequestedNoPower(const DosingContext_t* c) {
+    log_w("DOSING_SM", "System not powered, cannot proceed from REQUESTED. Returning to IDLE.");
+    setSystemError(LOGIC_ERROR, _T(L_ERROR_DOSING_REQUESTED_SYS_NOT_POWERED));
+}
+static void aRequestedToutFail(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Output temp sensor failed, cannot proceed from REQUESTED. -> STOPPING (will lead to ERROR)");
+}
+static void aTempOk(const DosingContext_t* c) {
+    log_i("DOSING_SM", "Temp OK (%.1fC <= %.1fC + %.1fC). -> STARTING", c->temp, c->setpoint, DOSING_TEMP_HYSTERESIS_C);
+}
+static void aNeedPrecool(const DosingContext_t* c) {
+    log_i("DOSING_SM", "Temp High (%.1fC > %.1fC) or sensor not ready. -> PRE_COOLING", c->temp, c->setpoint);
+    compressorRequest(COMP_DEMAND_DOSING, true);
+}
+static void aPrecoolToutFail(const DosingContext_t* c) {
+    log_w("DOSING_SM", "Temp sensor failed during PRE_COOLING. -> STARTING (will likely fail)");
+}
+static void aPrecoolDone(const DosingContext_t* c) {
+    log_i("DOSING_SM", "Pre-cooling complete (%.1fC <= %.1fC). -> STARTING", c->temp, c->setpoint);
+}
+static void aPrecoolTimeout(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Pre-cooling timeout! Temp: %.1fC, Setpoint: %.1fC", c->temp, c->setpoint);
+    setSystemError(CRIT_PRECOOL_TIMEOUT, _T(L_ERROR_PRECOOLING_TIMEOUT));
+}
+static void aStartToutFail(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Cannot start dosing, output temp sensor failed.");
+    setSystemError(CRIT_TEMP_SENSOR_OUT_FAIL, _T(L_ERROR_DOSING_START_ABORTED_TOUT_FAIL));
+}
+static void aStartTempHigh(const DosingContext_t* c) {
+    log_w("DOSING_SM", "Temp too high to start dosing (%.1fC > %.1fC). -> PRE_COOLING", c->temp, c->setpoint);
+}
+static void aSpeedZero(const DosingContext_t* c) {
+    log_w("DOSING_SM", "Motor speed is 0. Cannot start dosing. -> ERROR");
+    setSystemError(LOGIC_ERROR, _T(L_ERROR_MOTOR_SPEED_ZERO_CANNOT_DOSE));
+}
+static void aStartMotors(const DosingContext_t* c) {
+    if (dosing_continuous) {
+        log_i("DOSING_SM", "Starting motor for continuous pour. Limit: %lu ml. Speed: %d steps/s.", (unsigned long)dosing_continuous_limit_ml, c->speed);
+    } else {
+        log_i("DOSING_SM", "Starting motor for dosing. Target: %d ml. Speed: %d steps/s. Channels: 0x%02X.", c->target_ml, c->speed, dosing_channel_mask);
+    }
+    portENTER_CRITICAL(&volume_dispensed_mutex);
+    volume_dispensed_cycle = 0;
+    portEXIT_CRITICAL(&volume_dispensed_mutex);
+    applyMotorSpeed(c->speed); // Скорость задания не пишется в config
+    // Motor::startAuto() включает ENABLE_PIN канала
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if (!(dosing_channel_mask & (1u << ch))) continue;
+        if (ch == MOTOR_PRIMARY_CHANNEL) {
+            getMotor(ch).startAuto(0); // Объем по датчику потока
+        } else {
+            long target_steps = (long)((float)c->target_ml / getMotor(ch).getMlPerStep());
+            getMotor(ch).startAuto(target_steps > 0 ? target_steps : 1);
         }
-        case DOSING_STATE_ERROR: {
-            log_e("DOSING_SM", "Dosing cycle ended in ERROR state. Last system error: %d", getSystemErrorCode()); // Используем getSystemErrorCode()
-            stopMotor();
-            compressorOff();
-            checking_for_flow = false; // Деактивируем проверку на отсутствие потока
-            motor_running_auto = false;
-            // Остаемся в ERROR до сброса ошибки или нового запроса
-            break; // End of DOSING_STATE_ERROR // Добавлены скобки
+    }
+    if (dosing_channel_mask & MOTOR_PRIMARY_CHANNEL_MASK) {
+        checking_for_flow = true; // Активируем проверку на отсутствие потока
+        motor_start_time_with_no_flow = millis(); // Запоминаем время старта для таймаута
+    }
+    dosing_run_accum_ms = 0;
+    cont_flow_ref_ms = c->now;
+    cont_flow_ref_volume = 0.0f;
+    cont_flow_lost = false;
+    cont_temp_high = false;
+    cont_supervision_paused = false;
+    live_rate_ms = c->now;
+    live_rate_volume = 0.0f;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    dosing_live.flow_ml_min = 0.0f;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    if (getIsPidTempControlEnabled()) {
+        // enablePidTempControl(true) уже вызван извне (веб, ESP-NOW) и инициализировал PID
+        log_i("DOSING_SM", "PID Temperature Control is active for this dosing cycle.");
+    }
+    // Непрерывный налив учится в диапазоне самых больших объемов
+    ilcBeginCycle(dosing_continuous ? (int)DOSING_CONT_MAX_VOLUME_ML : c->target_ml); // Начинаем запись траектории старта
+    dosingQueueNoteRunStart();
+}
+static void aChainNextJob(const DosingContext_t* c) {
+    DosingJob_t job;
+    if (!popDosingJob(&job)) return;
+    setCycleOverrides(&job);
+    cycle_volume_ml = job.volume_ml;
+    dosing_channel_mask = job.channel_mask;
+    dosing_continuous = false;
+    dosingQueueNoteChained();
+    cycleRecordBegin((float)job.volume_ml, job.channel_mask, CYCLE_FLAG_CHAINED);
+    log_i("DOSING_SM", "Queued job #%lu: %d ml, channels 0x%02X. -> STARTING (line kept chilled)", (unsigned long)job.id, job.volume_ml, job.channel_mask);
+}
+static void aRunningNoPower(const DosingContext_t* c) {
+    log_w("DOSING_SM", "System off during RUNNING. -> STOPPING");
+}
+static void aRunningError(const DosingContext_t* c) {
+    log_e("DOSING_SM", "System error %d occurred during RUNNING. -> STOPPING", c->err);
+}
+static void aChannelsDone(const DosingContext_t* c) {
+    bool primary_done = !(dosing_channel_mask & MOTOR_PRIMARY_CHANNEL_MASK) ||
+                        (dosing_continuous ? (dosing_continuous_limit_ml > 0 && c->volume >= (float)dosing_continuous_limit_ml)
+                                           : c->volume >= (float)c->target_ml);
+    if (primary_done) {
+        log_i("DOSING_SM", "All channels (0x%02X) finished. -> STOPPING", dosing_channel_mask);
+    } else {
+        log_w("DOSING_SM", "Motor stopped externally during RUNNING. -> STOPPING");
+    }
+}
+static void aPause(const DosingContext_t* c) {
+    dosing_paused_mask = 0;
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if ((dosing_channel_mask & (1u << ch)) && getMotor(ch).pauseAuto()) dosing_paused_mask |= (1u << ch);
+    }
+    dosing_paused_checking_flow = checking_for_flow;
+    ilcEndCycle(false); // Переходный процесс с паузой не годится для обучения профиля старта
+    log_i("DOSING_SM", "Paused at %.2f / %d ml (channels 0x%02X). -> PAUSED", c->volume, c->target_ml, dosing_paused_mask);
+}
+static void aResume(const DosingContext_t* c) {
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if (dosing_paused_mask & (1u << ch)) getMotor(ch).resumeAuto();
+    }
+    if (dosing_paused_checking_flow) { // Трубка еще не была заполнена - проверка no-flow заново
+        checking_for_flow = true;
+        motor_start_time_with_no_flow = millis();
+    }
+    pidResetTimebase(); // Интеграл сохранен, время паузы в dt не попадает
+    cont_flow_ref_ms = c->now; // Окна надзора и расхода начинаются заново
+    cont_flow_ref_volume = c->volume;
+    cont_flow_lost = false;
+    cont_temp_high = false;
+    cont_supervision_paused = false;
+    live_rate_ms = c->now;
+    live_rate_volume = c->volume;
+    stallMonitorStartRamp(DOSING_RESUME_RAMP_FROM, DOSING_RESUME_RAMP_PER_SEC);
+    log_i("DOSING_SM", "Resumed after %lu ms at %.2f / %d ml. -> RUNNING", c->in_state_ms, c->volume, c->target_ml);
+}
+static void aPauseTimeout(const DosingContext_t* c) {
+    log_w("DOSING_SM", "Pause timeout (%lu ms). Finishing cycle with %.2f / %d ml. -> STOPPING", c->in_state_ms, c->volume, c->target_ml);
+}
+static void aContFlowLost(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Continuous pour: flow lost (< %.1f ml in %d ms) at %.2f ml. -> STOPPING", DOSING_CONT_MIN_FLOW_ML, DOSING_CONT_FLOW_WINDOW_MS, c->volume);
+    setSystemError(CRIT_FLOW_SENSOR_FAIL, _T(L_ERROR_CONTINUOUS_FLOW_LOST));
+}
+static void aContTempPause(const DosingContext_t* c) {
+    log_w("DOSING_SM", "Continuous pour: T_out %.1fC above %.1fC for %d ms, pausing until chilled.", c->temp, c->setpoint + DOSING_CONT_TEMP_MARGIN_C, DOSING_CONT_TEMP_GRACE_MS);
+    aPause(c);
+    cont_supervision_paused = true;
+}
+static void aContTempResume(const DosingContext_t* c) {
+    log_i("DOSING_SM", "Continuous pour: T_out back to %.1fC, resuming.", c->temp);
+    aResume(c);
+}
+static void aDosingTimeout(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Max dosing duration timeout! Dispensed: %.2f ml / Target: %d ml", c->volume, c->target_ml);
+    setSystemError(CRIT_DOSING_TIMEOUT, _T(L_ERROR_MAX_DOSING_DURATION_TIMEOUT));
+}
+
+// Запуск следующего задания из IDLE/ERROR обычным путем (REQUESTED, при необходимости PRE_COOLING)
+static void dispatchQueuedJob(const DosingContext_t* c) {
+    if (!c->powered || !errIsBenign(c->err) || getCalibrationModeState()) return;
+    DosingJob_t job;
+    if (!popDosingJob(&job)) return;
+    log_i("DOSING_SM", "Dispatching queued job #%lu (%d ml, channels 0x%02X).", (unsigned long)job.id, job.volume_ml, job.channel_mask);
+    if (!beginDosingRequest(job.volume_ml, false, job.channel_mask, false, 0, &job)) {
+        // Не возвращаем в очередь: причина (калибровка канала) не пройдет сама, а ошибка уже выставлена
+        log_w("DOSING_SM", "Queued job #%lu (%d ml) could not start, dropped.", (unsigned long)job.id, job.volume_ml);
+        dosingQueueNoteDropped();
+    }
+}
+
+// State actions
+static void doPreCooling(const DosingContext_t* c) {
+    compressorRequest(COMP_DEMAND_DOSING, true); // Включит планировщик (после минимального простоя)
+}
+// Компрессор держит уставку: запрос с гистерезисом, планировщик соблюдает min ON/OFF
+static void holdSetpoint(const DosingContext_t* c) {
+    if (c->temp == -127.0f || c->temp > c->setpoint + COMPRESSOR_BAND_C) {
+        compressorRequest(COMP_DEMAND_DOSING, true);
+    } else if (c->temp < c->setpoint - COMPRESSOR_BAND_C) {
+        compressorRequest(COMP_DEMAND_DOSING, false);
+    }
+}
+// Сглаженный расход для живого мониторинга
+static void updateLiveRate(const DosingContext_t* c) {
+    unsigned long dt = c->now - live_rate_ms;
+    if (dt < DOSING_LIVE_RATE_MS) return;
+    float rate = (c->volume - live_rate_volume) * 60000.0f / (float)dt;
+    live_rate_ms = c->now;
+    live_rate_volume = c->volume;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    dosing_live.flow_ml_min += DOSING_LIVE_RATE_ALPHA * (rate - dosing_live.flow_ml_min);
+    portEXIT_CRITICAL(&dosing_state_mutex);
+}
+// Надзор непрерывного налива: рост объема и температура на выходе
+static void superviseContinuous(const DosingContext_t* c) {
+    if (checking_for_flow || c->volume - cont_flow_ref_volume >= DOSING_CONT_MIN_FLOW_ML) {
+        // Пока трубка заполняется, отсутствие потока ловит no-flow таймаут датчика
+        cont_flow_ref_ms = c->now;
+        cont_flow_ref_volume = c->volume;
+    } else if (c->now - cont_flow_ref_ms > DOSING_CONT_FLOW_WINDOW_MS) {
+        cont_flow_lost = true;
+    }
+    if (c->temp != -127.0f && c->temp > c->setpoint + DOSING_CONT_TEMP_MARGIN_C) {
+        if (!cont_temp_high) cont_temp_high_since = c->now;
+        cont_temp_high = true;
+    } else {
+        cont_temp_high = false;
+    }
+}
+static void doRunning(const DosingContext_t* c) {
+    updateLiveRate(c);
+    if (dosing_continuous) {
+        // Длительный налив: компрессор по гистерезису вместо постоянной работы, надзор вместо одного таймера
+        holdSetpoint(c);
+        superviseContinuous(c);
+    }
+    // Основной канал останавливаем по датчику потока, дополнительные останавливаются сами по шагам
+    Motor& primary = getMotor(MOTOR_PRIMARY_CHANNEL);
+    if (!(dosing_channel_mask & MOTOR_PRIMARY_CHANNEL_MASK) || !primary.isRunningAuto()) return;
+    if (dosing_continuous) {
+        if (dosing_continuous_limit_ml == 0) return;
+        float remaining_limit = (float)dosing_continuous_limit_ml - c->volume;
+        if (!primary.isFineMode() && remaining_limit <= MOTOR_FINE_APPROACH_ML) {
+            log_i("DOSING_SM", "Final approach to limit (%.1f ml left): fine microstepping.", remaining_limit);
+            primary.setFineApproach(true);
         }
-        default: {
-            log_e("DOSING_SM", "Unknown dosing state: %d. Resetting to IDLE.", current_dosing_state);
-            log_dosing_state_change(DOSING_STATE_IDLE);
-            break;
+        if (remaining_limit <= 0.0f) {
+            log_i("DOSING_SM", "Continuous pour limit reached (Flow: %.2f ml / Limit: %lu ml).", c->volume, (unsigned long)dosing_continuous_limit_ml);
+            primary.stop();
         }
+        return;
+    }
+    // Финальный подход основного канала: мелкий микрошаг и сниженная подача
+    float remaining = (float)c->target_ml - c->volume;
+    float approach_ml = (float)c->target_ml * MOTOR_FINE_APPROACH_FRACTION;
+    if (approach_ml < MOTOR_FINE_APPROACH_ML) approach_ml = MOTOR_FINE_APPROACH_ML;
+    if (!primary.isFineMode() && remaining <= approach_ml) {
+        log_i("DOSING_SM", "Final approach (%.1f ml left): fine microstepping.", remaining);
+        primary.setFineApproach(true);
+    }
+    if (c->volume >= (float)c->target_ml) {
+        log_i("DOSING_SM", "Target Volume Reached (Flow: %.2f ml / Target: %d ml).", c->volume, c->target_ml);
+        primary.stop();
+    }
+}
+static void doPaused(const DosingContext_t* c) {
+    holdSetpoint(c);
+}
+static void exitPaused(const DosingContext_t* c) {
+    compressorRequest(COMP_DEMAND_DOSING, true); // Продолжение или остановка - далее запросом управляет RUNNING/STOPPING
+    cont_supervision_paused = false;
+}
+static void exitRunning(const DosingContext_t* c) {
+    checking_for_flow = false; // Проверка no-flow имеет смысл только в RUNNING
+}
+static void enterStopping(const DosingContext_t* c) {
+    portENTER_CRITICAL(&dosing_state_mutex);
+    dosing_pause_requested = false; // Необработанные запросы не переносятся на следующий цикл
+    dosing_resume_requested = false;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    stopMotor();
+    checking_for_flow = false;
+    if (errIsBenign(c->err) && getDosingQueueLength() > 0) {
+        // Следующее задание пойдет сразу - запрос компрессора сохраняем, линия остается охлажденной
+        log_i("DOSING_SM", "Stopping motor, compressor demand kept for queued job.");
+    } else {
+        log_i("DOSING_SM", "Stopping motor and compressor (if running).");
+        compressorReleaseAll(); // Выключит планировщик, когда истечет минимальное время работы
+    }
+    // Профиль ILC обучаем только на штатно завершенных циклах
+    ilcEndCycle(errIsBenign(c->err));
+}
+static void enterFinished(const DosingContext_t* c) {
+    float final_volume_dispensed = c->volume;
+    // Дополнительные каналы без датчика потока учитываем по шагам
+    for (uint8_t ch = 1; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if (dosing_channel_mask & (1u << ch)) final_volume_dispensed += getMotor(ch).getDispensedEstimateMl();
+    }
+    log_i("DOSING_SM", "Dosing cycle finished. Volume dispensed: %.2f ml. Steps (ch0): %ld.", final_volume_dispensed, getMotor(MOTOR_PRIMARY_CHANNEL).getStepsTaken());
+    config.totalDosingCycles++;
+    config.totalVolumeDispensed += (unsigned long)round(final_volume_dispensed);
+    cycleRecordEnd(final_volume_dispensed, (uint8_t)c->err);
+    usageRollupNoteCycle(final_volume_dispensed);
+    dosingQueueNoteRunEnd();
+    counterJournalNoteChange(); // Запись журнала отложена до паузы (и между заданиями очереди)
+}
+static void enterIdle(const DosingContext_t* c) {
+    setCycleOverrides(NULL); // Переопределения задания заканчиваются вместе с его циклом
+}
+static void enterError(const DosingContext_t* c) {
+    log_e("DOSING_SM", "Dosing cycle ended in ERROR state. Last system error: %d", c->err);
+    setCycleOverrides(NULL);
+    cycleRecordEnd(c->volume, (uint8_t)c->err);
+    stopMotor();
+    compressorReleaseAll();
+    compressorOff(); // Аварийно, минуя планировщик
+    checking_for_flow = false;
+}
+static void doError(const DosingContext_t* c) {
+    // Остаемся в ERROR до сброса ошибки или нового запроса; мотор и компрессор держим выключенными
+    if (isMotorRunningAuto()) stopMotor();
+    if (compressorRunning) compressorOff();
+    dispatchQueuedJob(c); // После сброса ошибки очередь продолжает выполняться
+}
+
+static const DosingStateDesc_t dosing_states[] = {
+    { DOSING_STATE_IDLE,        enterIdle,     NULL,        dispatchQueuedJob },
+    { DOSING_STATE_REQUESTED,   NULL,          NULL,        NULL },
+    { DOSING_STATE_PRE_COOLING, NULL,          NULL,        doPreCooling },
+    { DOSING_STATE_STARTING,    NULL,          NULL,        NULL },
+    { DOSING_STATE_RUNNING,     NULL,          exitRunning, doRunning },
+    { DOSING_STATE_PAUSED,      NULL,          exitPaused,  doPaused },
+    { DOSING_STATE_STOPPING,    enterStopping, NULL,        NULL },
+    { DOSING_STATE_FINISHED,    enterFinished, NULL,        NULL },
+    { DOSING_STATE_ERROR,       enterError,    NULL,        doError },
+};
+
+// Переходы проверяются по порядку, срабатывает первый с истинным guard. Индекс строки пишется в журнал.
+static const DosingTransition_t dosing_transitions[] = {
+    { DOSING_STATE_REQUESTED,   gNotPowered,     DOSING_STATE_IDLE,        aRequestedNoPower },
+    { DOSING_STATE_REQUESTED,   gToutFailed,     DOSING_STATE_STOPPING,    aRequestedToutFail },
+    { DOSING_STATE_REQUESTED,   gTempOkToStart,  DOSING_STATE_STARTING,    aTempOk },
+    { DOSING_STATE_REQUESTED,   NULL,            DOSING_STATE_PRE_COOLING, aNeedPrecool },
+
+    { DOSING_STATE_PRE_COOLING, gNotPowered,     DOSING_STATE_STOPPING,    NULL },
+    { DOSING_STATE_PRE_COOLING, gToutFailed,     DOSING_STATE_STARTING,    aPrecoolToutFail },
+    { DOSING_STATE_PRE_COOLING, gTempReached,    DOSING_STATE_STARTING,    aPrecoolDone },
+    { DOSING_STATE_PRE_COOLING, gPrecoolTimeout, DOSING_STATE_STOPPING,    aPrecoolTimeout },
+
+    { DOSING_STATE_STARTING,    gNotPowered,     DOSING_STATE_STOPPING,    NULL },
+    { DOSING_STATE_STARTING,    gToutFailed,     DOSING_STATE_ERROR,       aStartToutFail },
+    { DOSING_STATE_STARTING,    gTempTooHigh,    DOSING_STATE_PRE_COOLING, aStartTempHigh },
+    { DOSING_STATE_STARTING,    gSpeedZero,      DOSING_STATE_ERROR,       aSpeedZero },
+    { DOSING_STATE_STARTING,    NULL,            DOSING_STATE_RUNNING,     aStartMotors },
+
+    { DOSING_STATE_RUNNING,     gNotPowered,     DOSING_STATE_STOPPING,    aRunningNoPower },
+    { DOSING_STATE_RUNNING,     gRunningError,   DOSING_STATE_STOPPING,    aRunningError },
+    { DOSING_STATE_RUNNING,     gChannelsDone,   DOSING_STATE_STOPPING,    aChannelsDone },
+    { DOSING_STATE_RUNNING,     gContFlowLost,   DOSING_STATE_STOPPING,    aContFlowLost },
+    { DOSING_STATE_RUNNING,     gDosingTimeout,  DOSING_STATE_STOPPING,    aDosingTimeout },
+    { DOSING_STATE_RUNNING,     gContTempHigh,   DOSING_STATE_PAUSED,      aContTempPause },
+    { DOSING_STATE_RUNNING,     gPauseRequested, DOSING_STATE_PAUSED,      aPause },
+
+    { DOSING_STATE_PAUSED,      gNotPowered,     DOSING_STATE_STOPPING,    NULL },
+    { DOSING_STATE_PAUSED,      gRunningError,   DOSING_STATE_STOPPING,    aRunningError },
+    { DOSING_STATE_PAUSED,      gResumeRequested, DOSING_STATE_RUNNING,    aResume },
+    { DOSING_STATE_PAUSED,      gContTempRecovered, DOSING_STATE_RUNNING,  aContTempResume },
+    { DOSING_STATE_PAUSED,      gPauseTimeout,   DOSING_STATE_STOPPING,    aPauseTimeout },
+
+    { DOSING_STATE_STOPPING,    gStopToError,    DOSING_STATE_ERROR,       NULL },
+    { DOSING_STATE_STOPPING,    NULL,            DOSING_STATE_FINISHED,    NULL },
+
+    { DOSING_STATE_FINISHED,    gJobChainable,   DOSING_STATE_STARTING,    aChainNextJob },
+    { DOSING_STATE_FINISHED,    NULL,            DOSING_STATE_IDLE,        NULL },
+};
+
+#define DOSING_STATE_DESC_COUNT (sizeof(dosing_states) / sizeof(dosing_states[0]))
+#define DOSING_TRANSITION_COUNT (sizeof(dosing_transitions) / sizeof(dosing_transitions[0]))
+
+static const DosingStateDesc_t* findStateDesc(DosingState_t state) {
+    for (size_t i = 0; i < DOSING_STATE_DESC_COUNT; i++) {
+        if (dosing_states[i].state == state) return &dosing_states[i];
     }
+    return NULL;
+}
+
+// on_exit состояния, для которого выполнен вход, и on_enter нового
+static void activateState(DosingState_t state, const DosingContext_t* ctx) {
+    const DosingStateDesc_t* prev = findStateDesc(sm_active_state);
+    if (prev && prev->on_exit) prev->on_exit(ctx);
+    sm_active_state = state;
+    const DosingStateDesc_t* next = findStateDesc(state);
+    if (next && next->on_enter) next->on_enter(ctx);
+}
+
+void handleDosingState() {
+    DosingContext_t ctx;
+    DosingState_t state;
+    unsigned long state_start;
+
+    portENTER_CRITICAL(&dosing_state_mutex);
+    state = current_dosing_state;
+    state_start = dosing_state_start_time;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    portENTER_CRITICAL(&volume_dispensed_mutex);
+    ctx.volume = volume_dispensed_cycle;
+    portEXIT_CRITICAL(&volume_dispensed_mutex);
+
+    ctx.now = millis();
+    ctx.in_state_ms = ctx.now - state_start;
+    ctx.temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered; // Используем фильтрованную, если доступна
+    ctx.err = getSystemErrorCode();
+    ctx.powered = system_power_enabled;
+    const Config* cfg = getConfigSnapshot(); // Один снимок на проход
+    ctx.setpoint = cycleTempSetpoint(cfg);
+    ctx.speed = cycleMotorSpeed(cfg);
+    ctx.target_ml = cycleVolumeTarget(cfg);
+
+    const DosingStateDesc_t* desc = findStateDesc(state);
+    if (desc == NULL) {
+        log_e("DOSING_SM", "Unknown dosing state: %d. Resetting to IDLE.", state);
+        changeDosingState(DOSING_STATE_IDLE, DOSING_RULE_EXTERNAL);
+        return;
+    }
+
+    // Переход, сделанный извне автомата: вход/выход выполняются на первом проходе после него
+    if (state != sm_active_state) activateState(state, &ctx);
+
+    if (desc->on_do) desc->on_do(&ctx);
+
+    for (size_t i = 0; i < DOSING_TRANSITION_COUNT; i++) {
+        const DosingTransition_t* t = &dosing_transitions[i];
+        if (t->from != state) continue;
+        if (t->guard && !t->guard(&ctx)) continue;
+        if (t->action) t->action(&ctx);
+        if (state == DOSING_STATE_RUNNING && t->to != DOSING_STATE_RUNNING) dosing_run_accum_ms += ctx.in_state_ms;
+        changeDosingState(t->to, (uint8_t)i);
+        // Вход - в том же проходе: enterStopping/enterError останавливают насос до handleMotorStepping() этого loop
+        activateState(t->to, &ctx);
+        break;
+    }
+
+    portENTER_CRITICAL(&dosing_state_mutex);
+    dosing_live.state = (uint8_t)current_dosing_state;
+    dosing_live.continuous = dosing_continuous;
+    dosing_live.volume_ml = ctx.volume;
+    dosing_live.target_ml = dosing_continuous ? dosing_continuous_limit_ml : (uint32_t)getDosingVolumeTarget(); // Переход мог сменить задание
+    dosing_live.run_ms = dosing_run_accum_ms + (state == DOSING_STATE_RUNNING && current_dosing_state == DOSING_STATE_RUNNING ? ctx.in_state_ms : 0);
+    if (state != DOSING_STATE_RUNNING) dosing_live.flow_ml_min = 0.0f;
+    dosing_live.temp_out = ctx.temp;
+    dosing_live.compressor_on = compressorRunning;
+    dosing_live.supervision_paused = cont_supervision_paused;
+    dosing_live.temp_high_ms = cont_temp_high ? (uint32_t)(ctx.now - cont_temp_high_since) : 0;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+}
+
+void getDosingLiveStatus(DosingLiveStatus_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    *out = dosing_live;
+    portEXIT_CRITICAL(&dosing_state_mutex);
+}
+
+bool getDosingStateStats(DosingState_t state, DosingStateStats_t* out) {
+    if ((int)state < 0 || (int)state >= DOSING_STATE_COUNT || !out) return false;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    *out = dosing_state_stats[state];
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    return true;
+}
+
+void getDosingLastCycleBreakdown(uint32_t* out_ms) {
+    if (!out_ms) return;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    memcpy(out_ms, dosing_last_cycle_ms, sizeof(dosing_last_cycle_ms));
+    portEXIT_CRITICAL(&dosing_state_mutex);
+}
+
+int getDosingJournal(DosingJournalEntry_t* buffer, int max_entries) {
+    if (!buffer || max_entries <= 0) return 0;
+    int n = 0;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    // Сначала самые новые записи
+    for (; n < max_entries && n < dosing_journal_count; n++) {
+        int idx = ((int)dosing_journal_head - 1 - n + DOSING_JOURNAL_SIZE) % DOSING_JOURNAL_SIZE;
+        buffer[n] = dosing_journal[idx];
+    }
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    return n;
+}
+
+uint8_t getDosingChannelMask() {
+    return dosing_channel_mask;
 }
 
 DosingState_t getDosingState() {
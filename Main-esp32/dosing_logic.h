@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+#include "motor_control.h"     // Для MOTOR_PRIMARY_CHANNEL_MASK
 // Состояния дозирования (можно оставить в main.h или перенести сюда, если используется только здесь и в main.c)
 enum DosingState {
     DOSING_STATE_IDLE = 0,
@@ -11,11 +12,64 @@ enum DosingState {
     DOSING_STATE_STARTING,
     DOSING_STATE_RUNNING,
     DOSING_STATE_STOPPING,
-    DOSING_STATE_PAUSED, // Пока не используется активно
+    DOSING_STATE_PAUSED, // Пауза RUNNING: объем, шаги и интеграл PID сохраняются
     DOSING_STATE_FINISHED,
     DOSING_STATE_ERROR
 }; // Оставляем DosingState для обратной совместимости, если где-то используется без _t
 typedef enum DosingState DosingState_t; // Определяем DosingState_t
+#define DOSING_STATE_COUNT (DOSING_STATE_ERROR + 1)
+
+#define DOSING_TEMP_HYSTERESIS_C   1.0f               // Гистерезис для старта дозирования
+#define DOSING_PRECOOL_TIMEOUT_MS  (5UL * 60 * 1000)  // 5 минут на предохлаждение
+#define DOSING_MAX_DURATION_MS     (15UL * 60 * 1000) // 15 минут максимальная длительность дозирования (без учета пауз)
+#define DOSING_PAUSE_TIMEOUT_MS    (10UL * 60 * 1000) // Пауза дольше - цикл завершается с частичным объемом
+#define DOSING_RESUME_RAMP_FROM    0.3f               // Коэффициент скорости сразу после продолжения
+#define DOSING_RESUME_RAMP_PER_SEC 0.25f              // Разгон до полной скорости (~3 с)
+
+// Непрерывный налив (только основной канал): до остановки или до лимита сумматора.
+// Вместо DOSING_MAX_DURATION_MS - собственный надзор: поток, температура и жесткий предел длительности.
+#define DOSING_CONT_MAX_VOLUME_ML    1000000UL           // Наибольший лимит сумматора (мл)
+#define DOSING_CONT_MAX_DURATION_MS  (4UL * 60 * 60 * 1000) // Жесткий предел времени RUNNING
+#define DOSING_CONT_FLOW_WINDOW_MS   10000               // Объем должен расти хотя бы на...
+#define DOSING_CONT_MIN_FLOW_ML      1.0f                // ...столько мл за окно, иначе поток потерян
+#define DOSING_CONT_TEMP_MARGIN_C    3.0f                // T_out выше уставки на столько...
+#define DOSING_CONT_TEMP_GRACE_MS    60000               // ...дольше этого - авто-пауза до охлаждения
+#define DOSING_LIVE_RATE_MS          1000                // Период оценки расхода (мл/мин)
+#define DOSING_LIVE_RATE_ALPHA       0.3f                // Сглаживание расхода (EMA)
+
+// Журнал переходов автомата (кольцевой буфер в RAM, 8 байт на запись)
+#define DOSING_JOURNAL_SIZE        64
+#define DOSING_RULE_EXTERNAL       0xFF // Переход сделан извне таблицы (веб, ESP-NOW, start/stopDosingCycle)
+
+typedef struct {
+    uint32_t timestamp_ms;
+    uint8_t from_state;
+    uint8_t to_state;
+    uint8_t rule;       // Индекс строки таблицы переходов или DOSING_RULE_EXTERNAL
+    uint8_t error_code; // SystemErrorCode в момент перехода
+} DosingJournalEntry_t;
+
+// Время пребывания в состоянии (по всем выходам из него с момента загрузки)
+typedef struct {
+    uint32_t count;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t total_ms;
+} DosingStateStats_t;
+
+// Текущие показания налива для живого мониторинга (/dosingLive)
+typedef struct {
+    uint8_t state;              // DosingState_t
+    bool continuous;
+    float volume_ml;            // Объем по датчику потока в текущем цикле
+    uint32_t target_ml;         // Цель цикла или лимит сумматора (0 - без лимита)
+    float flow_ml_min;          // Сглаженный расход
+    uint32_t run_ms;            // Время RUNNING без пауз
+    float temp_out;
+    bool compressor_on;
+    bool supervision_paused;    // Пауза по надзору температуры непрерывного налива
+    uint32_t temp_high_ms;      // Сколько T_out держится выше допуска (непрерывный налив)
+} DosingLiveStatus_t;
 
 extern DosingState_t current_dosing_state;
 extern portMUX_TYPE dosing_state_mutex; // Мьютекс для current_dosing_state и dosing_state_start_time
@@ -30,8 +84,29 @@ const char* getDosingStateString(DosingState_t state); // Новая функц
 
 void initDosingLogic();
 void handleDosingState();
-void startDosingCycle(int volumeML, bool fromWeb = false);
+// channelMask - битовая маска каналов насосов (бит 0 - основной канал с датчиком потока).
+// Основной канал дозирует по датчику потока, дополнительные - по шагам (volumeML / mlPerStep канала).
+void startDosingCycle(int volumeML, bool fromWeb = false, uint8_t channelMask = MOTOR_PRIMARY_CHANNEL_MASK);
+uint8_t getDosingChannelMask(); // Каналы текущего/последнего цикла
+// Маска допустима и все ее каналы откалиброваны (без setSystemError) - для заданий, принимаемых в очередь
+bool isDosingChannelMaskUsable(uint8_t channelMask);
+// Уставка, скорость и цель текущего цикла: задание очереди переопределяет настройки оператора только
+// на свой цикл, без записи в config. Вне цикла - значения config. Только из loop (снимок настроек).
+float getDosingTempSetpoint();
+int getDosingMotorSpeed();
+int getDosingVolumeTarget();
+uint32_t getDosingCycleSettingsVersion(); // Растет при смене переопределений (как getConfigVersion())
+// Непрерывный налив основным каналом до stopDosingCycle() или до limitML (0 - без лимита)
+bool startContinuousDosing(uint32_t limitML, bool fromWeb = false);
+bool isDosingContinuous();
+uint32_t getDosingContinuousLimit(); // Лимит сумматора непрерывного налива (0 - без лимита)
+void getDosingLiveStatus(DosingLiveStatus_t* out);
 void stopDosingCycle(bool fromWeb = false); // Объявление функции
-void log_dosing_state_change(DosingState_t new_state); // Объявление функции
+bool pauseDosingCycle();  // Запрос паузы (только из RUNNING), выполняется автоматом в loop
+bool resumeDosingCycle(); // Запрос продолжения (только из PAUSED)
+void log_dosing_state_change(DosingState_t new_state); // Смена состояния извне автомата (пишется в журнал)
+bool getDosingStateStats(DosingState_t state, DosingStateStats_t* out);
+void getDosingLastCycleBreakdown(uint32_t* out_ms); // DOSING_STATE_COUNT значений: мс в каждом состоянии за последний цикл
+int getDosingJournal(DosingJournalEntry_t* buffer, int max_entries); // Сначала новые записи, возвращает количество
 
 #endif // DOSING_LOGIC_H
\ No newline at end of file
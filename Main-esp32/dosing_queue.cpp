@@ -0,0 +1,188 @@
+#include "dosing_queue.h"
+#include "main.h"           // Для функций логирования
+#include "minute_rate.h"    // Минутные корзины для циклов в час
+#include "motor_control.h"  // Для MOTOR_ALL_CHANNELS_MASK
+
+portMUX_TYPE dosing_queue_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Кольцевой буфер заданий (защищен dosing_queue_mutex)
+static DosingJob_t dosing_jobs[DOSING_QUEUE_SIZE];
+static uint8_t dosing_jobs_head = 0; // Индекс следующего задания
+static uint8_t dosing_jobs_count = 0;
+static uint32_t dosing_next_job_id = 1;
+
+// Метрики (защищены dosing_queue_mutex)
+static DosingQueueMetrics_t queue_metrics;
+static MinuteRing<uint16_t, DOSING_QUEUE_METRIC_BUCKETS> cycle_ring;
+static unsigned long last_run_end_ms = 0;
+static bool gap_pending = false; // Следующий старт RUNNING - продолжение цепочки
+
+void initDosingQueue() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    dosing_jobs_head = 0;
+    dosing_jobs_count = 0;
+    memset(&queue_metrics, 0, sizeof(queue_metrics));
+    cycle_ring.reset(now);
+    gap_pending = false;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    log_i("DOSING_Q", "Dosing job queue initialized (%d slots).", DOSING_QUEUE_SIZE);
+}
+
+bool enqueueDosingJob(int volume_ml, float temp_setpoint, int motor_speed, uint8_t channel_mask, DosingJobSource_t source) {
+    if (volume_ml <= 0 || volume_ml > 10000) return false;
+    if (!isnan(temp_setpoint) && (temp_setpoint < -10.0f || temp_setpoint > 30.0f)) return false;
+    if (motor_speed < 0 || motor_speed > 2000) return false;
+    if (channel_mask == 0 || (channel_mask & ~MOTOR_ALL_CHANNELS_MASK) != 0) return false;
+
+    bool ok = false;
+    uint32_t id = 0;
+    uint8_t queued = 0;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    if (dosing_jobs_count < DOSING_QUEUE_SIZE) {
+        DosingJob_t* job = &dosing_jobs[(dosing_jobs_head + dosing_jobs_count) % DOSING_QUEUE_SIZE];
+        job->id = dosing_next_job_id++;
+        job->volume_ml = volume_ml;
+        job->temp_setpoint = temp_setpoint;
+        job->motor_speed = motor_speed;
+        job->channel_mask = channel_mask;
+        job->source = (uint8_t)source;
+        job->enqueued_ms = millis();
+        dosing_jobs_count++;
+        queue_metrics.jobs_enqueued++;
+        id = job->id;
+        ok = true;
+    } else {
+        queue_metrics.jobs_rejected++;
+    }
+    queued = dosing_jobs_count;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+
+    if (ok) {
+        log_i("DOSING_Q", "Job #%lu queued: %d ml, channels 0x%02X (source %d, %u in queue).", (unsigned long)id, volume_ml, channel_mask, source, queued);
+    } else {
+        log_w("DOSING_Q", "Queue full (%d), job of %d ml rejected.", DOSING_QUEUE_SIZE, volume_ml);
+    }
+    return ok;
+}
+
+bool peekDosingJob(DosingJob_t* out) {
+    bool ok = false;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    if (dosing_jobs_count > 0) {
+        if (out) *out = dosing_jobs[dosing_jobs_head];
+        ok = true;
+    }
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    return ok;
+}
+
+bool popDosingJob(DosingJob_t* out) {
+    bool ok = false;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    if (dosing_jobs_count > 0) {
+        if (out) *out = dosing_jobs[dosing_jobs_head];
+        dosing_jobs_head = (dosing_jobs_head + 1) % DOSING_QUEUE_SIZE;
+        dosing_jobs_count--;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    return ok;
+}
+
+bool requeueDosingJobFront(const DosingJob_t* job) {
+    if (!job) return false;
+    bool ok = false;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    if (dosing_jobs_count < DOSING_QUEUE_SIZE) {
+        dosing_jobs_head = (dosing_jobs_head + DOSING_QUEUE_SIZE - 1) % DOSING_QUEUE_SIZE;
+        dosing_jobs[dosing_jobs_head] = *job;
+        dosing_jobs_count++;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    if (!ok) log_w("DOSING_Q", "Queue full (%d), job #%lu not returned.", DOSING_QUEUE_SIZE, (unsigned long)job->id);
+    return ok;
+}
+
+uint8_t getDosingQueueLength() {
+    uint8_t n;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    n = dosing_jobs_count;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    return n;
+}
+
+void clearDosingQueue() {
+    uint8_t dropped;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    dropped = dosing_jobs_count;
+    dosing_jobs_count = 0;
+    gap_pending = false;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    if (dropped > 0) log_i("DOSING_Q", "Queue cleared, %u job(s) dropped.", dropped);
+}
+
+int getDosingQueueJobs(DosingJob_t* buffer, int max_jobs) {
+    if (!buffer || max_jobs <= 0) return 0;
+    int n = 0;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    for (; n < max_jobs && n < dosing_jobs_count; n++) {
+        buffer[n] = dosing_jobs[(dosing_jobs_head + n) % DOSING_QUEUE_SIZE];
+    }
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+    return n;
+}
+
+void dosingQueueNoteRunStart() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    if (gap_pending) {
+        uint32_t gap = (uint32_t)(now - last_run_end_ms);
+        queue_metrics.last_gap_ms = gap;
+        if (queue_metrics.gap_samples == 0 || gap < queue_metrics.min_gap_ms) queue_metrics.min_gap_ms = gap;
+        if (gap > queue_metrics.max_gap_ms) queue_metrics.max_gap_ms = gap;
+        queue_metrics.gap_samples++;
+        queue_metrics.avg_gap_ms += ((float)gap - queue_metrics.avg_gap_ms) / (float)queue_metrics.gap_samples;
+        gap_pending = false;
+    }
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+}
+
+void dosingQueueNoteRunEnd() {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    cycle_ring.rotate(now);
+    cycle_ring.current()++;
+    last_run_end_ms = now;
+    gap_pending = dosing_jobs_count > 0; // Паузу считаем только между заданиями, ожидавшими в очереди
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+}
+
+void dosingQueueNoteDropped() {
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    queue_metrics.jobs_dropped++;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+}
+
+void dosingQueueNoteChained() {
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    queue_metrics.jobs_chained++;
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+}
+
+void getDosingQueueMetrics(DosingQueueMetrics_t* out) {
+    if (!out) return;
+    unsigned long now = millis();
+    uint32_t cycles = 0;
+    portENTER_CRITICAL(&dosing_queue_mutex);
+    cycle_ring.rotate(now);
+    for (int i = 0; i < DOSING_QUEUE_METRIC_BUCKETS; i++) cycles += cycle_ring.buckets[i];
+    *out = queue_metrics;
+    out->queued = dosing_jobs_count;
+    unsigned long window = cycle_ring.windowMs(now);
+    portEXIT_CRITICAL(&dosing_queue_mutex);
+
+    out->cycles_last_hour = (uint16_t)cycles;
+    out->cycles_per_hour = minuteRatePerHour(cycles, window);
+}
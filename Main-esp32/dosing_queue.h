@@ -0,0 +1,65 @@
+#ifndef DOSING_QUEUE_H
+#define DOSING_QUEUE_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Очередь заданий дозирования. Задания из веба и ESP-NOW выполняются подряд:
+// после FINISHED автомат сразу переходит к следующему заданию (STARTING), не проходя IDLE/REQUESTED,
+// компрессор не отпускается, а сохранение статистики в NVS откладывается до опустошения очереди.
+
+#define DOSING_QUEUE_SIZE          8
+#define DOSING_QUEUE_KEEP_TEMP     NAN // temp_setpoint задания: оставить текущую уставку
+#define DOSING_QUEUE_KEEP_SPEED    0   // motor_speed задания: оставить текущую скорость
+#define DOSING_QUEUE_METRIC_BUCKETS 60 // Минутные корзины для циклов в час
+
+typedef enum {
+    DOSING_JOB_SOURCE_WEB = 0,
+    DOSING_JOB_SOURCE_ESP_NOW = 1,
+    DOSING_JOB_SOURCE_CLUSTER = 2  // Передано соседним контроллером (дальше не передается)
+} DosingJobSource_t;
+
+typedef struct {
+    uint32_t id;
+    int volume_ml;
+    float temp_setpoint;   // DOSING_QUEUE_KEEP_TEMP - без изменения
+    int motor_speed;       // DOSING_QUEUE_KEEP_SPEED - без изменения
+    uint8_t channel_mask;
+    uint8_t source;        // DosingJobSource_t
+    unsigned long enqueued_ms;
+} DosingJob_t;
+
+typedef struct {
+    uint8_t queued;
+    uint32_t jobs_enqueued;
+    uint32_t jobs_rejected;     // Очередь была полна
+    uint32_t jobs_chained;      // Запущено сразу после предыдущего цикла (без IDLE)
+    uint32_t jobs_dropped;      // Снято с очереди, но цикл не запустился (калибровка канала, питание)
+    uint16_t cycles_last_hour;
+    float cycles_per_hour;
+    uint32_t last_gap_ms;       // Пауза между концом RUNNING и следующим RUNNING для цепочки
+    uint32_t min_gap_ms;
+    uint32_t max_gap_ms;
+    float avg_gap_ms;
+    uint32_t gap_samples;
+} DosingQueueMetrics_t;
+
+extern portMUX_TYPE dosing_queue_mutex;
+
+void initDosingQueue();
+bool enqueueDosingJob(int volume_ml, float temp_setpoint, int motor_speed, uint8_t channel_mask, DosingJobSource_t source);
+bool peekDosingJob(DosingJob_t* out);
+bool popDosingJob(DosingJob_t* out);
+bool requeueDosingJobFront(const DosingJob_t* job); // Вернуть снятое задание в начало очереди (с прежним номером)
+uint8_t getDosingQueueLength();
+void clearDosingQueue();
+int getDosingQueueJobs(DosingJob_t* buffer, int max_jobs); // Снимок очереди, первым - следующее задание
+
+// Точки учета метрик, вызываются автоматом дозирования
+void dosingQueueNoteRunStart();
+void dosingQueueNoteRunEnd();
+void dosingQueueNoteChained();
+void dosingQueueNoteDropped();
+void getDosingQueueMetrics(DosingQueueMetrics_t* out);
+
+#endif // DOSING_QUEUE_H
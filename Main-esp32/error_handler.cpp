@@ -1,6 +1,5 @@
 #include "error_handler.h"
 #include "config_manager.h" // Для доступа к config.errorCount и saveConfig()
-#include <Preferences.h>     // Для работы с Preferences
 #include "motor_control.h"  // Для остановки мотора
 #include "dosing_logic.h"   // Для изменения состояния дозирования
 #include "calibration_logic.h" // Для getCalibrationModeState
@@ -8,6 +7,10 @@
 #include "main.h"           // Для функций логирования log_x
 #include "sensors.h"        // Для compressorOff() и compressorRunning
 #include "localization.h"   // For _T()
+#include "usage_rollups.h"  // Ошибки по часам/суткам
+#include "counter_journal.h" // Счетчик ошибок хранится в журнале счетчиков
+#include "crash_record.h"   // Запись об аварийной перезагрузке в RTC-памяти
+#include "error_journal.h"  // История ошибок на LittleFS
 
 // Внешние переменные, которые будут использоваться здесь
 // extern Config config; // Доступно через config_manager.h
@@ -28,10 +31,38 @@ unsigned long last_error_time = 0;
 // Мьютекс для защиты глобальных переменных этого модуля
 portMUX_TYPE error_handler_mutex = portMUX_INITIALIZER_UNLOCKED;
 
-// --- Для хранения списка ошибок ---
-static StoredError_t stored_errors_buffer[MAX_STORED_ERRORS];
-static int stored_errors_count = 0;
-static int stored_errors_next_idx = 0; // Для кольцевого буфера
+// Учет по кодам (защищен error_handler_mutex)
+static ErrorCodeStats_t error_stats[ERROR_STATS_SLOTS];
+static bool active_error_persisted = false; // Активная ошибка записана в лог и настройки (был токен)
+static bool active_clear_held = false;      // Автоматический сброс активной ошибки уже откладывался
+
+// Слот кода, при первой установке - новый (вызывать под error_handler_mutex)
+static ErrorCodeStats_t* findErrorStats(SystemErrorCode_t code) {
+    if (code == NO_ERROR) return NULL;
+    for (int i = 0; i < ERROR_STATS_SLOTS; i++) {
+        if (error_stats[i].code == (uint8_t)code) return &error_stats[i];
+        if (error_stats[i].code == 0) {
+            error_stats[i].code = (uint8_t)code;
+            error_stats[i].tokens = ERROR_RATE_BURST;
+            error_stats[i].last_refill_ms = millis();
+            return &error_stats[i];
+        }
+    }
+    return NULL;
+}
+
+// Корзина токенов: пополнение по прошедшему времени и попытка взять токен (вызывать под error_handler_mutex)
+static bool takeErrorToken(ErrorCodeStats_t* st, unsigned long now) {
+    uint32_t refills = (uint32_t)(now - st->last_refill_ms) / ERROR_RATE_REFILL_MS;
+    if (refills > 0) {
+        st->tokens = (st->tokens + refills >= ERROR_RATE_BURST) ? ERROR_RATE_BURST : st->tokens + refills;
+        st->last_refill_ms += refills * ERROR_RATE_REFILL_MS;
+    }
+    if (st->tokens == ERROR_RATE_BURST) st->last_refill_ms = now; // Полная корзина не копит время
+    if (st->tokens == 0) return false;
+    st->tokens--;
+    return true;
+}
 
 void initErrorHandler() {
     portENTER_CRITICAL(&error_handler_mutex);
@@ -39,66 +70,76 @@ void initErrorHandler() {
     strncpy(last_error_msg_buffer_internal, _T(L_NO_ACTIVE_ERROR_MSG), sizeof(last_error_msg_buffer_internal) - 1);
     last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal) - 1] = '\0'; // Ensure null termination
     last_error_time = 0;
+    memset(error_stats, 0, sizeof(error_stats));
+    active_error_persisted = false;
+    active_clear_held = false;
     portEXIT_CRITICAL(&error_handler_mutex);
-    // Очищаем буфер сохраненных ошибок при инициализации
-    stored_errors_count = 0;
-    stored_errors_next_idx = 0;
+}
+
+// Фатальная ошибка: без NVS и задержек - насос и компрессор выключаются сразу, запись в RTC-память
+// и перезагрузка. Может вызываться из loop, обработчиков и других задач; не возвращается.
+// Счетчик ошибок и сообщение сохранит следующая загрузка (initCrashRecord).
+static void handleFatalError(SystemErrorCode_t errorCode, const char* message) {
+    stopMotor();
+    compressorOff();
+    writeCrashRecord(errorCode, message);
+    log_e("FATAL_HANDLER", "FATAL ERROR %d: %s. Restarting.", errorCode, message);
+    ESP.restart();
 }
 
 void setSystemError(SystemErrorCode_t errorCode, const char* message) {
+    unsigned long current_time_ms = millis(); // Получаем время один раз
     portENTER_CRITICAL(&error_handler_mutex);
+    ErrorCodeStats_t* stats = findErrorStats(errorCode);
     if (current_system_error == errorCode && errorCode != NO_ERROR) { // Не логируем повторно ту же ошибку, если она уже активна
+        if (stats) stats->repeats++;
         portEXIT_CRITICAL(&error_handler_mutex);
         return;
     }
     current_system_error = errorCode;
-    unsigned long current_time_ms = millis(); // Получаем время один раз
     strncpy(last_error_msg_buffer_internal, message, sizeof(last_error_msg_buffer_internal) - 1);
     last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal) - 1] = '\0';
     last_error_time = current_time_ms;
-
-    // Добавляем ошибку в кольцевой буфер
-    stored_errors_buffer[stored_errors_next_idx].code = errorCode;
-    strncpy(stored_errors_buffer[stored_errors_next_idx].message, message, ERROR_HANDLER_LAST_MSG_BUFFER_SIZE - 1);
-    stored_errors_buffer[stored_errors_next_idx].message[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE - 1] = '\0';
-    stored_errors_buffer[stored_errors_next_idx].timestamp = current_time_ms;
-    stored_errors_next_idx = (stored_errors_next_idx + 1) % MAX_STORED_ERRORS;
-    if (stored_errors_count < MAX_STORED_ERRORS) {
-        stored_errors_count++;
+    // Без токена ошибка действует, но лог, журнал и настройки не трогаются
+    bool persist = true;
+    if (stats) {
+        stats->occurrences++;
+        stats->last_set_ms = current_time_ms;
+        persist = takeErrorToken(stats, current_time_ms);
+        if (!persist) stats->suppressed++;
     }
+    active_error_persisted = persist;
+    active_clear_held = false;
     portEXIT_CRITICAL(&error_handler_mutex);
 
+    // Проверяем, является ли ошибка фатальной (предполагаем, что все коды >= FATAL_WDT_RESET фатальны)
+    if (errorCode >= FATAL_WDT_RESET) {
+        handleFatalError(errorCode, message);
+        return;
+    }
 
     // Доступ к config должен быть потокобезопасным, если config изменяется из разных задач.
     // Предполагаем, что config_manager обеспечивает это или saveConfig() вызывается из одного потока.
-    config.errorCount++; // Увеличиваем счетчик ошибок в глобальной структуре config
-    strncpy(config.lastErrorMsgBuffer, message, sizeof(config.lastErrorMsgBuffer)-1);
-    config.lastErrorMsgBuffer[sizeof(config.lastErrorMsgBuffer)-1] = '\0';
-
-    // Используем функции логирования log_x, которые определены в main.c и доступны глобально
-    if (errorCode >= CRIT_TEMP_SENSOR_IN_FAIL) {
-        app_log_e("ERROR_HANDLER", "System Error %d: %s", errorCode, message);
-    } else if (errorCode >= INPUT_VALIDATION_ERROR) {
-        app_log_w("ERROR_HANDLER", "System Warning/Error %d: %s", errorCode, message);
-    } else {
-        app_log_i("ERROR_HANDLER", "System Info/Message %d: %s", errorCode, message);
-    }
+    config.errorCount++; // Увеличиваем счетчик ошибок в глобальной структуре config (запись счетчиков и так отложенная)
+    usageRollupNoteError();
+    counterJournalNoteChange();
+    if (persist) {
+        errorJournalAppend(errorCode, message); // В RAM; в файл дописывает handleErrorJournal()
+        strncpy(config.lastErrorMsgBuffer, message, sizeof(config.lastErrorMsgBuffer)-1);
+        config.lastErrorMsgBuffer[sizeof(config.lastErrorMsgBuffer)-1] = '\0';
 
-    // Проверяем, является ли ошибка фатальной (предполагаем, что все коды >= FATAL_WDT_RESET фатальны)
-    if (errorCode >= FATAL_WDT_RESET) { 
-        log_e("FATAL_HANDLER", "FATAL ERROR %d detected. Saving code and preparing for restart.", errorCode);
-        Preferences error_prefs;
-        if (error_prefs.begin(PREFS_ERROR_LOG_NAMESPACE, false)) { // R/W mode
-            error_prefs.putUInt("last_fatal", (uint32_t)errorCode);
-            error_prefs.end();
-            app_log_i("FATAL_HANDLER", "Fatal error code %d saved to NVS.", errorCode);
+        // Используем функции логирования log_x, которые определены в main.c и доступны глобально
+        if (errorCode >= CRIT_TEMP_SENSOR_IN_FAIL) {
+            app_log_e("ERROR_HANDLER", "System Error %d: %s", errorCode, message);
+        } else if (errorCode >= INPUT_VALIDATION_ERROR) {
+            app_log_w("ERROR_HANDLER", "System Warning/Error %d: %s", errorCode, message);
         } else {
-            app_log_e("FATAL_HANDLER", "Failed to open NVS to save fatal error code.");
+            app_log_i("ERROR_HANDLER", "System Info/Message %d: %s", errorCode, message);
         }
     }
 
     if (errorCode >= CRIT_TEMP_SENSOR_IN_FAIL) {
-        app_log_w("ERROR_HANDLER", "Critical/Fatal error (%d), stopping active processes.", errorCode);
+        if (persist) app_log_w("ERROR_HANDLER", "Critical error (%d), stopping active processes.", errorCode);
         // bool cal_stopped_by_timeout_local = false; // Локальная переменная для проверки состояния калибровки - удалена, т.к. не используется
         if (isMotorRunningAuto() || isMotorRunningManual()) { // Используем геттеры
             if (getCalibrationModeState() && errorCode == CALIBRATION_ERROR) {
@@ -126,12 +167,7 @@ void setSystemError(SystemErrorCode_t errorCode, const char* message) {
         // в своем цикле handleDosingState() и перейти в состояние ошибки.
         app_log_d("ERROR_HANDLER", "Critical error set. Dosing logic should handle state transition if active.");
     }
-    saveConfig(); // Сохраняем обновленный config (счетчик ошибок, сообщение)
-
-    if (errorCode >= FATAL_WDT_RESET) { // Если ошибка была фатальной
-        delay(5000);
-        ESP.restart();
-    }
+    if (persist) saveConfig(); // Сохраняем обновленный config (сообщение)
 }
 
 void clearSystemError() {
@@ -149,7 +185,13 @@ void clearSystemError() {
     current_system_error = NO_ERROR;
     strncpy(last_error_msg_buffer_internal, _T(L_NO_ACTIVE_ERROR_MSG), sizeof(last_error_msg_buffer_internal) -1);
     last_error_msg_buffer_internal[sizeof(last_error_msg_buffer_internal) -1] = '\0';
+    ErrorCodeStats_t* stats = findErrorStats(prev_error);
+    if (stats) stats->clears++;
+    // Сброс подавленной установки тоже не пишется: в логе и настройках ее не было
+    bool persist = active_error_persisted;
+    active_error_persisted = false;
     portEXIT_CRITICAL(&error_handler_mutex);
+    if (!persist) return;
     app_log_i("ERROR_HANDLER", "Clearing system error. Previous error: %d (%s)", prev_error, prev_msg_copy);
 
     strncpy(config.lastErrorMsgBuffer, _T(L_NO_ACTIVE_ERROR_MSG), sizeof(config.lastErrorMsgBuffer)-1);
@@ -157,6 +199,27 @@ void clearSystemError() {
     saveConfig();
 }
 
+bool clearSystemErrorRecovered(SystemErrorCode_t code) {
+    portENTER_CRITICAL(&error_handler_mutex);
+    if (current_system_error != code || code == NO_ERROR) {
+        portEXIT_CRITICAL(&error_handler_mutex);
+        return false;
+    }
+    if (millis() - last_error_time < ERROR_CLEAR_HOLD_MS) {
+        // Вызывается на каждом проходе, пока источник в норме; считаем один раз на установку
+        if (!active_clear_held) {
+            active_clear_held = true;
+            ErrorCodeStats_t* stats = findErrorStats(code);
+            if (stats) stats->clears_held++;
+        }
+        portEXIT_CRITICAL(&error_handler_mutex);
+        return false;
+    }
+    portEXIT_CRITICAL(&error_handler_mutex);
+    clearSystemError();
+    return true;
+}
+
 SystemErrorCode_t getSystemErrorCode() {
     SystemErrorCode_t code;
     portENTER_CRITICAL(&error_handler_mutex);
@@ -187,25 +250,18 @@ const char* getSystemErrorCodeString(SystemErrorCode_t code) {
     }
 }
 
-int getStoredErrors(StoredError_t* buffer, int max_errors_to_get) {
-    int num_to_copy = 0;
+int getErrorCodeStats(ErrorCodeStats_t* buffer, int max_entries) {
+    if (!buffer || max_entries <= 0) return 0;
+    int n = 0;
+    unsigned long now = millis();
     portENTER_CRITICAL(&error_handler_mutex);
-    if (buffer && max_errors_to_get > 0) {
-        num_to_copy = (stored_errors_count < max_errors_to_get) ? stored_errors_count : max_errors_to_get;
-        // Копируем в обратном порядке, чтобы новые ошибки были первыми
-        for (int i = 0; i < num_to_copy; i++) {
-            int source_idx = (stored_errors_next_idx - 1 - i + MAX_STORED_ERRORS) % MAX_STORED_ERRORS;
-            buffer[i] = stored_errors_buffer[source_idx];
-        }
+    for (int i = 0; i < ERROR_STATS_SLOTS && n < max_entries && error_stats[i].code != 0; i++) {
+        buffer[n] = error_stats[i];
+        // Токены на текущий момент (в самой таблице пополняются только при установке)
+        uint32_t refills = (uint32_t)(now - buffer[n].last_refill_ms) / ERROR_RATE_REFILL_MS;
+        buffer[n].tokens = (buffer[n].tokens + refills >= ERROR_RATE_BURST) ? ERROR_RATE_BURST : buffer[n].tokens + refills;
+        n++;
     }
     portEXIT_CRITICAL(&error_handler_mutex);
-    return num_to_copy;
-}
-
-void clearAllStoredErrors() {
-    portENTER_CRITICAL(&error_handler_mutex);
-    stored_errors_count = 0;
-    stored_errors_next_idx = 0;
-    portEXIT_CRITICAL(&error_handler_mutex);
-    app_log_i("ERROR_HANDLER", "All stored error messages cleared.");
+    return n;
 }
\ No newline at end of file
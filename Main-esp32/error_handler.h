@@ -21,14 +21,6 @@ enum SystemErrorCode {
 }; // Оставляем SystemErrorCode для обратной совместимости, если где-то используется без _t
 typedef enum SystemErrorCode SystemErrorCode_t; // Определяем SystemErrorCode_t
 
-// --- Для хранения списка ошибок ---
-#define MAX_STORED_ERRORS 20 // Максимальное количество хранимых сообщений об ошибках
-typedef struct {
-    SystemErrorCode_t code; // Теперь SystemErrorCode_t определен выше
-    char message[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE]; // Теперь ERROR_HANDLER_LAST_MSG_BUFFER_SIZE определен выше
-    unsigned long timestamp;
-} StoredError_t;
-
 
 extern SystemErrorCode_t current_system_error;
 extern char last_error_msg_buffer_internal[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE]; // Должно совпадать с именем в .c
@@ -42,7 +34,30 @@ void initErrorHandler(); // Для инициализации переменны
 SystemErrorCode getSystemErrorCode(); // Геттер для текущего кода ошибки
 const char* getSystemErrorMessage(); // Геттер для последнего сообщения об ошибке
 const char* getSystemErrorCodeString(SystemErrorCode code);
-int getStoredErrors(StoredError_t* buffer, int max_errors); // Для получения списка ошибок
-void clearAllStoredErrors(); // Для очистки списка ошибок (может понадобиться)
+// История ошибок - в журнале ошибок на LittleFS (error_journal.h)
+
+// Подавление "дребезга" ошибок. Для каждого кода ведутся счетчики и корзина токенов: установка кода без токена
+// меняет состояние и выполняет защитные действия как обычно, но не пишет лог, журнал ошибок и настройки.
+// Автоматический сброс (датчик снова в норме, WiFi подключен) выполняется не раньше ERROR_CLEAR_HOLD_MS
+// после установки - нестабильный датчик переключает ошибку не чаще этого.
+#define ERROR_STATS_SLOTS       32     // Разных кодов с учетом (остальные - без ограничения)
+#define ERROR_RATE_BURST        3      // Записей подряд для одного кода...
+#define ERROR_RATE_REFILL_MS    60000  // ...затем одна за такой период
+#define ERROR_CLEAR_HOLD_MS     30000  // Ошибка держится не меньше этого до автоматического сброса
+
+typedef struct {
+    uint8_t code;               // SystemErrorCode_t; 0 - свободный слот
+    uint8_t tokens;
+    uint32_t occurrences;       // Установки кода (повтор уже активного не считается)
+    uint32_t repeats;           // Повторные установки активного кода
+    uint32_t suppressed;        // Установки без лога, журнала и записи настроек (нет токена)
+    uint32_t clears;
+    uint32_t clears_held;       // Автоматические сбросы, отложенные удержанием
+    uint32_t last_set_ms;
+    uint32_t last_refill_ms;
+} ErrorCodeStats_t;
+
+bool clearSystemErrorRecovered(SystemErrorCode_t code); // Автоматический сброс code с удержанием; true - ошибка сброшена
+int getErrorCodeStats(ErrorCodeStats_t* buffer, int max_entries); // Коды с учетом, возвращает количество
 
 #endif // ERROR_HANDLER_H
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "error_journal.h"
+#include <LittleFS.h>
+#include <time.h>
+#include <rom/crc.h>        // Для crc32_le
+#include <stddef.h>         // Для offsetof
+#include "dosing_logic.h"   // Для getDosingState и getCurrentDosedVolume
+#include "sensors.h"        // Для tOut, tOut_filtered
+#include "main.h"           // Для g_littlefs_mounted и функций логирования
+
+#define ERROR_TIME_VALID_AFTER 1600000000UL // Меньшее UNIX-время - часы еще не синхронизированы
+#define ERROR_JOURNAL_READ_CHUNK 8          // Записей за одно чтение при проверке файла
+
+portMUX_TYPE error_journal_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Кольцо последних записей, слот = (seq - 1) % ERROR_JOURNAL_RAM_ENTRIES (защищено error_journal_mutex:
+// ошибки приходят из обработчика ESP-NOW и других задач)
+static ErrorJournalEntry_t ram_entries[ERROR_JOURNAL_RAM_ENTRIES];
+static uint32_t journal_next_seq = 1;
+static uint32_t journal_flushed_seq = 1; // Первая запись, еще не отданная в файл
+static uint32_t journal_first_seq = 1;   // Самая старая запись в файле
+static uint32_t journal_boot = 0;
+static uint32_t journal_dropped = 0;
+static bool journal_initialized = false;
+
+// Файл (только из loop)
+static bool journal_available = false;
+static uint32_t journal_write_failures = 0;
+static uint32_t journal_torn_records = 0;
+
+static uint32_t entryCrc(const ErrorJournalEntry_t* e) {
+    return crc32_le(0, (const uint8_t*)e, offsetof(ErrorJournalEntry_t, crc));
+}
+
+static bool entryValid(const ErrorJournalEntry_t* e) {
+    return e->magic == ERROR_JOURNAL_MAGIC && e->version == ERROR_JOURNAL_VERSION && e->crc == entryCrc(e);
+}
+
+// Копия сообщения без обрезанного посередине многобайтового символа UTF-8
+static void copyMessage(char* dst, size_t size, const char* src) {
+    strncpy(dst, src ? src : "", size - 1);
+    dst[size - 1] = '\0';
+    size_t len = strlen(dst);
+    if (len < size - 1) return;
+    size_t lead = len;
+    while (lead > 0 && ((uint8_t)dst[lead - 1] & 0xC0) == 0x80) lead--; // Продолжения символа
+    if (lead == 0 || ((uint8_t)dst[lead - 1] & 0x80) == 0) return;      // Последний символ - ASCII
+    uint8_t c = (uint8_t)dst[lead - 1];
+    size_t need = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+    if (len - (lead - 1) < need) dst[lead - 1] = '\0';
+}
+
+// Самая старая доступная запись (вызывать под error_journal_mutex)
+static uint32_t firstAvailableSeq() {
+    uint32_t window = journal_available ? ERROR_JOURNAL_CAPACITY : ERROR_JOURNAL_RAM_ENTRIES;
+    uint32_t first = journal_next_seq > window ? journal_next_seq - window : 1;
+    return first > journal_first_seq ? first : journal_first_seq;
+}
+
+// Номер и загрузка назначаются под мьютексом; previous_boot - запись о прошлой загрузке (аварийная перезагрузка)
+static void appendEntry(ErrorJournalEntry_t* e, bool previous_boot) {
+    portENTER_CRITICAL(&error_journal_mutex);
+    e->seq = journal_next_seq++;
+    e->boot = (previous_boot && journal_boot > 0) ? journal_boot - 1 : journal_boot;
+    ram_entries[(e->seq - 1) % ERROR_JOURNAL_RAM_ENTRIES] = *e;
+    // Кольцо заполнено записями, которые еще не в файле: самая старая теряется
+    if (journal_next_seq - journal_flushed_seq > ERROR_JOURNAL_RAM_ENTRIES) {
+        journal_flushed_seq = journal_next_seq - ERROR_JOURNAL_RAM_ENTRIES;
+        journal_dropped++;
+    }
+    portEXIT_CRITICAL(&error_journal_mutex);
+}
+
+static void fillEntry(ErrorJournalEntry_t* e, SystemErrorCode_t code, const char* message) {
+    memset(e, 0, sizeof(*e));
+    e->magic = ERROR_JOURNAL_MAGIC;
+    e->version = ERROR_JOURNAL_VERSION;
+    e->code = (uint8_t)code;
+    e->dosing_state = (uint8_t)getDosingState();
+    e->uptime_ms = millis();
+    time_t now_t = time(nullptr);
+    e->time = (unsigned long)now_t > ERROR_TIME_VALID_AFTER ? (uint32_t)now_t : 0;
+    e->volume_ml = getCurrentDosedVolume();
+    float temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+    e->temp_out_c10 = (temp == -127.0f) ? ERROR_JOURNAL_NO_TEMP : (int16_t)lroundf(temp * 10.0f);
+    copyMessage(e->message, sizeof(e->message), message);
+}
+
+void errorJournalAppend(SystemErrorCode_t code, const char* message) {
+    ErrorJournalEntry_t e;
+    fillEntry(&e, code, message);
+    appendEntry(&e, false);
+}
+
+void errorJournalAppendCrash(SystemErrorCode_t code, const char* message, uint8_t dosing_state, uint32_t uptime_s, float volume_ml) {
+    ErrorJournalEntry_t e;
+    fillEntry(&e, code, message);
+    e.dosing_state = dosing_state;
+    e.uptime_ms = uptime_s * 1000UL;
+    e.time = 0; // Время прошлой загрузки неизвестно
+    e.volume_ml = volume_ml;
+    e.temp_out_c10 = ERROR_JOURNAL_NO_TEMP;
+    appendEntry(&e, true);
+}
+
+// Проверка файла: наибольший номер и загрузка, самая старая запись
+static void scanJournalFile(uint32_t* max_seq, uint32_t* min_seq, uint32_t* max_boot) {
+    *max_seq = 0;
+    *min_seq = 0;
+    *max_boot = 0;
+    if (!LittleFS.exists(ERROR_JOURNAL_FILE)) return;
+    File f = LittleFS.open(ERROR_JOURNAL_FILE, "r");
+    if (!f) {
+        log_e("ERRLOG", "Failed to open %s.", ERROR_JOURNAL_FILE);
+        journal_available = false;
+        return;
+    }
+    size_t size = f.size();
+    if (size % sizeof(ErrorJournalEntry_t) != 0 || size > (size_t)ERROR_JOURNAL_CAPACITY * sizeof(ErrorJournalEntry_t)) {
+        // Другой размер записи или емкость (новая версия прошивки) - начинаем файл заново
+        f.close();
+        log_w("ERRLOG", "Error journal has unexpected size %u, recreating.", (unsigned)size);
+        LittleFS.remove(ERROR_JOURNAL_FILE);
+        return;
+    }
+    static ErrorJournalEntry_t chunk[ERROR_JOURNAL_READ_CHUNK];
+    size_t got;
+    while ((got = f.read((uint8_t*)chunk, sizeof(chunk))) >= sizeof(ErrorJournalEntry_t)) {
+        for (size_t i = 0; i < got / sizeof(ErrorJournalEntry_t); i++) {
+            const ErrorJournalEntry_t* e = &chunk[i];
+            if (!entryValid(e)) {
+                if (e->magic == ERROR_JOURNAL_MAGIC) journal_torn_records++;
+                continue;
+            }
+            if (e->seq > *max_seq) *max_seq = e->seq;
+            if (*min_seq == 0 || e->seq < *min_seq) *min_seq = e->seq;
+            if (e->boot > *max_boot) *max_boot = e->boot;
+        }
+    }
+    f.close();
+}
+
+void initErrorJournal() {
+    journal_available = g_littlefs_mounted;
+    journal_torn_records = 0;
+    uint32_t max_seq = 0, min_seq = 0, max_boot = 0;
+    if (journal_available) scanJournalFile(&max_seq, &min_seq, &max_boot);
+    else log_w("ERRLOG", "LittleFS not mounted, error journal kept in RAM only.");
+
+    // Записи, сделанные до инициализации, перенумеровываются после записей файла
+    static ErrorJournalEntry_t early[ERROR_JOURNAL_RAM_ENTRIES];
+    int early_count = 0;
+    portENTER_CRITICAL(&error_journal_mutex);
+    for (uint32_t seq = journal_flushed_seq; seq < journal_next_seq; seq++) {
+        early[early_count++] = ram_entries[(seq - 1) % ERROR_JOURNAL_RAM_ENTRIES];
+    }
+    memset(ram_entries, 0, sizeof(ram_entries));
+    journal_next_seq = max_seq + 1;
+    journal_flushed_seq = journal_next_seq;
+    journal_first_seq = min_seq ? min_seq : journal_next_seq;
+    journal_boot = max_boot + 1;
+    journal_initialized = true;
+    portEXIT_CRITICAL(&error_journal_mutex);
+    for (int i = 0; i < early_count; i++) appendEntry(&early[i], false);
+
+    log_i("ERRLOG", "Error journal ready: boot #%lu, next #%lu, %lu damaged records.", (unsigned long)journal_boot,
+          (unsigned long)journal_next_seq, (unsigned long)journal_torn_records);
+}
+
+void handleErrorJournal() {
+    if (!journal_initialized) return;
+    ErrorJournalEntry_t batch[ERROR_JOURNAL_FLUSH_BATCH];
+    int n = 0;
+    portENTER_CRITICAL(&error_journal_mutex);
+    if (!journal_available) journal_flushed_seq = journal_next_seq; // Без LittleFS журнал живет только в RAM
+    while (n < ERROR_JOURNAL_FLUSH_BATCH && journal_flushed_seq < journal_next_seq) {
+        batch[n++] = ram_entries[(journal_flushed_seq - 1) % ERROR_JOURNAL_RAM_ENTRIES];
+        journal_flushed_seq++;
+    }
+    portEXIT_CRITICAL(&error_journal_mutex);
+    if (n == 0) return;
+
+    bool exists = LittleFS.exists(ERROR_JOURNAL_FILE);
+    File f = LittleFS.open(ERROR_JOURNAL_FILE, exists ? "r+" : "w");
+    for (int i = 0; i < n; i++) {
+        ErrorJournalEntry_t* e = &batch[i];
+        e->crc = entryCrc(e);
+        // До первого оборота слот равен размеру файла (дописывание), после - перезапись самой старой записи
+        uint32_t slot = (e->seq - 1) % ERROR_JOURNAL_CAPACITY;
+        bool ok = f && f.seek(slot * sizeof(ErrorJournalEntry_t)) && f.write((const uint8_t*)e, sizeof(*e)) == sizeof(*e);
+        if (!ok) {
+            journal_write_failures++;
+            log_e("ERRLOG", "Failed to write error journal record #%lu.", (unsigned long)e->seq);
+        }
+    }
+    if (f) f.close();
+}
+
+int getErrorJournalPage(uint32_t offset, ErrorJournalEntry_t* buffer, int max_entries) {
+    if (!buffer || max_entries <= 0) return 0;
+    uint32_t next, first, ram_first;
+    portENTER_CRITICAL(&error_journal_mutex);
+    next = journal_next_seq;
+    first = firstAvailableSeq();
+    portEXIT_CRITICAL(&error_journal_mutex);
+    ram_first = next > ERROR_JOURNAL_RAM_ENTRIES ? next - ERROR_JOURNAL_RAM_ENTRIES : 1;
+    if (offset >= next - first) return 0;
+
+    File f;
+    int n = 0;
+    for (uint32_t seq = next - 1 - offset; seq >= first && n < max_entries; seq--) {
+        ErrorJournalEntry_t e;
+        bool ok = false;
+        if (seq >= ram_first) { // Последние записи - из RAM
+            portENTER_CRITICAL(&error_journal_mutex);
+            e = ram_entries[(seq - 1) % ERROR_JOURNAL_RAM_ENTRIES];
+            portEXIT_CRITICAL(&error_journal_mutex);
+            ok = e.magic == ERROR_JOURNAL_MAGIC && e.seq == seq;
+        }
+        if (!ok && journal_available) { // Старые записи (или вытесненные новыми, пока читали) - из файла
+            if (!f) f = LittleFS.open(ERROR_JOURNAL_FILE, "r");
+            if (!f) break;
+            ok = f.seek(((seq - 1) % ERROR_JOURNAL_CAPACITY) * sizeof(ErrorJournalEntry_t)) &&
+                 f.read((uint8_t*)&e, sizeof(e)) == sizeof(e) && entryValid(&e) && e.seq == seq;
+        }
+        if (ok) buffer[n++] = e; // Пропуски (запись не удалась или вытеснена до записи) не возвращаются
+    }
+    if (f) f.close();
+    return n;
+}
+
+void getErrorJournalStatus(ErrorJournalStatus_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&error_journal_mutex);
+    out->total = journal_next_seq - firstAvailableSeq();
+    out->next_seq = journal_next_seq;
+    out->boot = journal_boot;
+    out->pending = journal_next_seq - journal_flushed_seq;
+    out->dropped = journal_dropped;
+    portEXIT_CRITICAL(&error_journal_mutex);
+    out->available = journal_available;
+    out->write_failures = journal_write_failures;
+    out->torn_records = journal_torn_records;
+}
+
+void clearErrorJournal() {
+    if (g_littlefs_mounted && LittleFS.exists(ERROR_JOURNAL_FILE)) LittleFS.remove(ERROR_JOURNAL_FILE);
+    portENTER_CRITICAL(&error_journal_mutex);
+    memset(ram_entries, 0, sizeof(ram_entries));
+    journal_next_seq = 1;
+    journal_flushed_seq = 1;
+    journal_first_seq = 1;
+    journal_dropped = 0;
+    portEXIT_CRITICAL(&error_journal_mutex);
+    journal_torn_records = 0;
+    log_w("ERRLOG", "Error journal cleared.");
+}
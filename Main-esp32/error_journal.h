@@ -0,0 +1,63 @@
+#ifndef ERROR_JOURNAL_H
+#define ERROR_JOURNAL_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+#include "error_handler.h"     // Для SystemErrorCode_t
+
+// Журнал ошибок в кольцевом файле на LittleFS (переживает перезагрузку).
+// Записи фиксированного размера пишутся по месту (слот = (seq - 1) % ERROR_JOURNAL_CAPACITY), как в cycle_records:
+// запись с номером seq читается одним seek, поэтому страница из любого места журнала стоит столько же, сколько первая.
+// setSystemError() только кладет запись в кольцо последних записей в RAM (безопасно из любой задачи),
+// в файл их дописывает handleErrorJournal() из loop. Последние записи читаются из RAM без обращения к флешу.
+
+#define ERROR_JOURNAL_FILE          "/errors.bin"
+#define ERROR_JOURNAL_CAPACITY      2048   // ~160 КБ на флеше
+#define ERROR_JOURNAL_RAM_ENTRIES   16     // Последние записи (и очередь на запись) в RAM
+#define ERROR_JOURNAL_FLUSH_BATCH   8      // Записей в файл за один проход loop
+#define ERROR_JOURNAL_MAGIC         0xE7
+#define ERROR_JOURNAL_VERSION       1
+#define ERROR_JOURNAL_MSG_LEN       48     // Начало сообщения (обрезается по границе символа UTF-8)
+#define ERROR_JOURNAL_NO_TEMP       INT16_MIN
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t code;               // SystemErrorCode_t
+    uint8_t dosing_state;       // DosingState_t в момент ошибки
+    uint32_t seq;
+    uint32_t boot;              // Номер загрузки: на единицу больше наибольшего в файле при старте
+    uint32_t uptime_ms;
+    uint32_t time;              // UNIX-время (с), 0 - время не синхронизировано
+    float volume_ml;            // Объем текущего цикла
+    int16_t temp_out_c10;       // T_out * 10, ERROR_JOURNAL_NO_TEMP - нет данных
+    uint16_t reserved;
+    char message[ERROR_JOURNAL_MSG_LEN];
+    uint32_t crc;               // CRC32 всех предыдущих байт
+} ErrorJournalEntry_t;
+
+typedef struct {
+    bool available;             // Файл открыт и проверен
+    uint32_t total;             // Доступных записей (файл + еще не записанные)
+    uint32_t next_seq;
+    uint32_t boot;
+    uint32_t pending;           // Ждут записи в файл
+    uint32_t dropped;           // Вытеснены из RAM до записи
+    uint32_t write_failures;
+    uint32_t torn_records;      // Отброшенные при загрузке записи с неверным CRC
+} ErrorJournalStatus_t;
+
+extern portMUX_TYPE error_journal_mutex;
+
+void initErrorJournal();    // До loadConfig() (LittleFS уже смонтирована): ошибки загрузки настроек тоже попадают в журнал
+void handleErrorJournal();  // Вызывается из loop(): дописывание ожидающих записей
+void errorJournalAppend(SystemErrorCode_t code, const char* message); // Из setSystemError() (безопасен из любой задачи)
+// Фатальная ошибка прошлой загрузки (из initCrashRecord): состояние, время работы и объем - из записи в RTC-памяти
+void errorJournalAppendCrash(SystemErrorCode_t code, const char* message, uint8_t dosing_state, uint32_t uptime_s, float volume_ml);
+// Страница журнала, сначала новые: offset - сколько самых новых номеров пропустить (номера без записи, например
+// вытесненные до записи в файл, пропускаются). Возвращает количество записей.
+int getErrorJournalPage(uint32_t offset, ErrorJournalEntry_t* buffer, int max_entries);
+void getErrorJournalStatus(ErrorJournalStatus_t* out);
+void clearErrorJournal();
+
+#endif // ERROR_JOURNAL_H
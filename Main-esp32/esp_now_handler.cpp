@@ -4,14 +4,19 @@
 // --- Временное объявление для диагностики проблемы с include ---
 #include "error_handler.h"     // Для setSystemError, clearSystemError, SystemErrorCode_t, getSystemErrorCode, getSystemErrorMessage, PREFERENCES_ERROR, CRIT_MOTOR_FAIL
 #include "dosing_logic.h"      // Для startDosingCycle, stopDosingCycle, getDosingState, getCurrentDosedVolume, dosing_state_mutex
+#include "dosing_queue.h"      // Для enqueueDosingJob
 #include "calibration_logic.h" // Для startCalibrationMode, stopCalibrationMode, getCalibrationModeState
 #include "motor_control.h"     // Для updateMotorSpeed, stopMotor
+#include "compressor_control.h" // Для compressorReleaseAll
 #include "sensors.h"           // Для getTempOut, getFlowRate, isCompressorRunning, compressorOff, isWaterLevelOk, tIn, tOut_filtered, compressorOn
 #include "main.h"              // Для app_log_x функций и isSystemPowerEnabled(), MAIN_FIRMWARE_VERSION
 #include "pid_controller.h"    // For getIsPidTempControlEnabled, getPidSetpointTemp
 #include "localization.h"      // For _T(), L_ERROR_ESPNOW_INIT_FAIL, L_ERROR_ESPNOW_RECV_CB_REGISTER_FAIL, L_ERROR_INVALID_PEER_MAC_IN_CONFIG, L_ERROR_ESPNOW_PEER_ADD_READD_FAIL_MAC, L_ERROR_ESPNOW_PEER_ADD_READD_FAIL, L_WARN_ESPNOW_SEND_FAIL_AFTER_RETRIES, L_ERROR_EMERGENCY_STOP_VIA_ESPNOW
 #include "utils.h"             // Для getUptimeSeconds()
-#include "esp_now_protocol.h"  // <--- ДОБАВЛЕНО: Для struct_status_t, command_type_t, system_state_t, struct_command_t
+#include "esp_now_protocol.h"  // Формат кадров: struct_status_t, struct_command_t, espNowEncode*/espNowDecode*
+#include "esp_now_tx.h"        // Очередь передачи
+#include "esp_now_peers.h"     // Таблица пиров: экраны и пульты
+#include "cluster_coordinator.h" // Кадры кластера соседних контроллеров
 #include <string.h>            // <--- ДОБАВЛЕНО: Для strncpy
 #include "esp_err.h"           // Для esp_err_to_name
 #include "freertos/FreeRTOS.h" // Для vTaskDelay, pdMS_TO_TICKS
@@ -36,27 +41,37 @@ extern bool getScreenMacAddress(uint8_t* mac_addr_buf);
 // const unsigned long PEER_CHECK_INTERVAL_MS = 15000; // Defined below
 
 // Глобальные переменные для ESP-NOW, специфичные для этого модуля
-const int ESP_NOW_SEND_MAX_RETRIES_LOCAL = 3; // Локальное имя, чтобы не конфликтовать с возможным define
-const unsigned long ESP_NOW_SEND_RETRY_DELAY_MS_LOCAL = 200;
 unsigned long last_peer_check_time = 0;
 const unsigned long PEER_CHECK_INTERVAL_MS = 15000; // Проверять/передобавлять пир каждые 15 сек
 
 // Глобальная переменная, определенная в esp_now_handler.h
 bool esp_now_peer_added = false;
 // uint8_t screen_mac_address[6]; // MAC-адрес экрана, должен быть загружен из Preferences // This was in the diff as added then removed, using s_screen_mac_address
-static uint8_t s_screen_mac_address[6]; // Статический MAC-адрес экрана, будет загружен из Preferences
-static bool s_screen_mac_valid = false;
-// Мьютекс для защиты доступа к s_screen_mac_address, если он может изменяться во время выполнения
+static int s_registered_peers = 0; // Пиров таблицы в драйвере ESP-NOW (esp_now_peers)
+// Мьютекс для защиты доступа к таблице пиров - esp_now_peers_mutex
 // SemaphoreHandle_t screen_mac_mutex = NULL; // Если потребуется
 
-
-uint8_t calculate_checksum(const uint8_t* data, size_t len) {
-    uint8_t cs = 0;
-    for (size_t i = 0; i < len; i++) {
-        cs ^= data[i];
-    }
-    return cs;
-}
+// Протокол: счетчики (номера принятых кадров ведутся по пирам, исходящих - назначает очередь передачи).
+// Прием идет в задаче WiFi, отправка и чтение счетчиков - из loop.
+static portMUX_TYPE espnow_proto_mutex = portMUX_INITIALIZER_UNLOCKED;
+static bool s_keyframe_requested = false;   // CMD_REQUEST_KEYFRAME: экран просит полный статус (только из loop)
+static EspNowProtoStats_t s_proto_stats = {};
+
+// Очередь команд экрана: один производитель (задача WiFi, onEspNowReceive), один потребитель (loop).
+// Без блокировок: head пишет только производитель, tail - только потребитель.
+typedef struct {
+    uint8_t cmd_type;   // command_type_t
+    uint16_t seq;
+    int32_t value;
+    uint32_t rx_us;     // micros() приема - для задержки до применения
+} EspNowCmd_t;
+
+static EspNowCmd_t cmd_ring[ESP_NOW_CMD_QUEUE_SIZE];
+static volatile uint32_t cmd_ring_head = 0;
+static volatile uint32_t cmd_ring_tail = 0;
+static volatile uint32_t cmd_received = 0;  // Пишет производитель
+static volatile uint32_t cmd_overflows = 0; // Пишет производитель
+static EspNowCmdStats_t cmd_stats = {};     // Пишет потребитель
 
 // --- Инициализация ESP-NOW ---
 void initEspNow() {
@@ -73,180 +88,280 @@ void initEspNow() {
         app_log_e("ESPNOW", "Error registering ESP-NOW receive callback"); // Original log message
         setSystemError(ESP_NOW_INIT_ERROR, _T(L_ERROR_ESPNOW_RECV_CB_REGISTER_FAIL));
     }
-    // Загружаем MAC-адрес экрана из конфигурации
-    s_screen_mac_valid = getScreenMacAddress(s_screen_mac_address);
-    ensureEspNowPeer(); // Первая попытка добавить пир
+    // Таблица пиров из NVS (пустая заполняется экраном из настроек)
+    initEspNowPeers();
+    ensureEspNowPeer(); // Первая попытка добавить пиры
     app_log_i("ESP_NOW_INIT", "ESP-NOW Initialized.");
 }
 
 void ensureEspNowPeer() {
-    // Загрузка MAC-адреса экрана из Preferences (если еще не загружен)
-    if (!s_screen_mac_valid) { // Если MAC не был загружен при initEspNow или стал невалидным
-        // Try to load it again if it was not valid
-        s_screen_mac_valid = getScreenMacAddress(s_screen_mac_address);
-        if (!s_screen_mac_valid) { // Повторная проверка после попытки загрузки
-            app_log_e("ESP_NOW_PEER", "Screen MAC address not configured. Cannot add peer.");
-            esp_now_peer_added = false;
-            if (getSystemErrorCode() != PREFERENCES_ERROR) { // Не перезаписываем более важную ошибку Preferences (NVS)
-                setSystemError(PREFERENCES_ERROR, _T(L_ERROR_INVALID_PEER_MAC_IN_CONFIG));
-            }
-            return;
+    int count = getEspNowPeerCount();
+    if (count == 0) {
+        app_log_e("ESP_NOW_PEER", "No ESP-NOW peers configured. Cannot add peer.");
+        esp_now_peer_added = false;
+        s_registered_peers = 0;
+        if (getSystemErrorCode() != PREFERENCES_ERROR) { // Не перезаписываем более важную ошибку Preferences (NVS)
+            setSystemError(PREFERENCES_ERROR, _T(L_ERROR_INVALID_PEER_MAC_IN_CONFIG));
         }
-    }
-
-    // Если пир уже добавлен и существует, ничего не делаем
-    if (esp_now_peer_added && esp_now_is_peer_exist(s_screen_mac_address)) {
         return;
     }
 
-    // Сначала удаляем, если он вдруг был добавлен с ошибкой или устарел
-    if (esp_now_is_peer_exist(s_screen_mac_address)) {
-        esp_now_del_peer(s_screen_mac_address);
+    // Все пиры таблицы уже в драйвере - ничего не делаем
+    if (esp_now_peer_added && s_registered_peers == count) {
+        return;
     }
-    
-    esp_now_peer_info_t peerInfo = {}; 
-    memcpy(peerInfo.peer_addr, s_screen_mac_address, 6);
-    peerInfo.channel = ESP_NOW_CHANNEL; // Используем глобально определенный канал ESP_NOW_CHANNEL (assuming ESP_NOW_CHANNEL is defined elsewhere, e.g. config_manager.h or main.h)
-    peerInfo.ifidx = WIFI_IF_STA;
-    peerInfo.encrypt = false;
-
 
-    if (esp_now_add_peer(&peerInfo) == ESP_OK) {
+    s_registered_peers = registerEspNowPeers();
+    if (s_registered_peers > 0) {
         esp_now_peer_added = true;
-        char macStr[18];
-        sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X",
-                s_screen_mac_address[0], s_screen_mac_address[1], s_screen_mac_address[2],
-                s_screen_mac_address[3], s_screen_mac_address[4], s_screen_mac_address[5]);
-        app_log_i("ESPNOW", "Peer %s added/re-added successfully.", macStr);
+        app_log_i("ESPNOW", "%d of %d peers added/re-added successfully.", s_registered_peers, count);
         if (getSystemErrorCode() == ESP_NOW_PEER_ERROR) clearSystemError();
         if (getSystemErrorCode() == ESP_NOW_INIT_ERROR) clearSystemError();
     } else {
         esp_now_peer_added = false; 
-        char macStr[18];
-        sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X",
-                s_screen_mac_address[0], s_screen_mac_address[1], s_screen_mac_address[2],
-                s_screen_mac_address[3], s_screen_mac_address[4], s_screen_mac_address[5]);
-        // Используем L_ERROR_ESPNOW_PEER_ADD_READD_FAIL, так как L_ERROR_ESPNOW_PEER_ADD_READD_FAIL_MAC может быть не определен
-        app_log_e("ESPNOW", "%s MAC: %s", _T(L_ERROR_ESPNOW_PEER_ADD_READD_FAIL), macStr); // Исправлено использование ключа локализации
+        app_log_e("ESPNOW", "%s (%d peers)", _T(L_ERROR_ESPNOW_PEER_ADD_READD_FAIL), count);
         if (getSystemErrorCode() != ESP_NOW_PEER_ERROR) setSystemError(ESP_NOW_PEER_ERROR, _T(L_ERROR_ESPNOW_PEER_ADD_READD_FAIL));
     }
 }
 
 void onEspNowSend(const uint8_t *mac_addr, esp_now_send_status_t status) {
     app_log_d("ESPNOW_CB", "Send CB, status: %s", status == ESP_NOW_SEND_SUCCESS ? "Success" : "Fail");
-    if (status != ESP_NOW_SEND_SUCCESS) {
-        // Ошибка отправки здесь логируется, но setSystemError вызывается в sendEspNowData после всех попыток.
-    }
+    espNowTxOnSendComplete(mac_addr, status); // Повторы и отказ после всех попыток - в handleEspNowTx()
 }
 
 void onEspNowReceive(const uint8_t *mac_addr, const uint8_t *incomingData, int len) {
-    struct_command_t cmd; // Используем struct_command_t из esp_now_protocol.h
-    // Original check was: if (len == sizeof(esp_now_cmd_t))
-    // Diff introduces: else if (len == sizeof(struct_command_t))
-    // Assuming the old esp_now_cmd_t is deprecated and we only care about struct_command_t
-    if (len == sizeof(struct_command_t)) { 
-        memcpy(&cmd, incomingData, sizeof(struct_command_t)); // Copy data into the new struct type
-
-        // Checksum logic from original onEspNowReceive might be needed here if struct_command_t has a checksum field
-        // For now, assuming struct_command_t does not have a checksum field as per the diff's focus on cmd_type and value.
-        // If it does, it should be validated:
-        // uint8_t received_checksum = cmd.checksum; // Assuming cmd.checksum exists
-        // cmd.checksum = 0; 
-        // uint8_t calculated_checksum = calculate_checksum((uint8_t*)&cmd, sizeof(cmd) - sizeof(cmd.checksum));
-        // if (received_checksum != calculated_checksum) {
-        //     app_log_w("ESPNOW_RX", "Checksum mismatch! Rcv: %02X, Calc: %02X. Discarding.", received_checksum, calculated_checksum);
-        //     return;
-        // }
-
-        app_log_i("ESPNOW_RX", "Cmd: %d (Value:%d)", cmd.cmd_type, cmd.value); // Логируем поля из struct_command_t
-
-        // --- Handle Commands from Screen (using command_type_t) ---
-        switch (cmd.cmd_type) { // Используем cmd_type из struct_command_t
-            case CMD_SET_TEMPERATURE:
-                if (cmd.value >= -10 && cmd.value <= 30) { // Assuming value is temperature in degrees C
-                    app_log_i("ESPNOW_RX", "Set Target Temp: %d C", cmd.value);
-                    config.tempSetpoint = (float)cmd.value; // Используем config.tempSetpoint
-                    saveConfig();
-                    // PID controller will pick up the new setpoint from config
-                } else {
-                    app_log_w("ESPNOW_RX", "Invalid Target Temp: %d", cmd.value);
-                }
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    struct_command_t cmd;
+    struct_cluster_heartbeat_t cluster_hb;
+    struct_cluster_job_t cluster_job;
+    struct_cluster_job_reply_t cluster_job_reply;
+    espnow_frame_result_t res = (len > 0) ? espNowDecodeFrame(incomingData, (size_t)len, &hdr, &payload) : ESPNOW_FRAME_ERR_SHORT;
+    bool cluster_frame = false;
+    bool foreign_status = false;
+    if (res == ESPNOW_FRAME_OK) {
+        switch (hdr.type) {
+            case ESPNOW_MSG_COMMAND:
+                res = espNowDecodeCommand(&hdr, payload, &cmd);
                 break;
-            case CMD_SET_VOLUME:
-                if (cmd.value > 0 && cmd.value <= 10000) { // Assuming max volume 10000ml
-                    app_log_i("ESPNOW_RX", "Set Target Volume: %d ml", cmd.value);
-                    config.volumeTarget = cmd.value; // Используем config.volumeTarget
-                    saveConfig();
-                } else {
-                    app_log_w("ESPNOW_RX", "Invalid Target Volume: %d", cmd.value);
-                }
+            case ESPNOW_MSG_CLUSTER_HEARTBEAT:
+                res = espNowDecodeClusterHeartbeat(&hdr, payload, &cluster_hb);
+                cluster_frame = true;
                 break;
-            case CMD_START_PROCESS:
-                if (cmd.value > 0) { // Используем поле value для объема
-                    app_log_i("ESPNOW_RX", "Start Dosing command: %d ml", cmd.value);
-                    startDosingCycle(cmd.value, false); // false - не из веб
-                } else {
-                    app_log_w("ESPNOW_RX", "Invalid volume for Start Dosing: %d", cmd.value);
-                }
-                break; 
-            case CMD_PAUSE:
-                app_log_i("ESPNOW_RX", "Pause command received.");
-                // TODO: Implement pauseDosingCycle() in dosing_logic.c/h
-                // pauseDosingCycle();
+            case ESPNOW_MSG_CLUSTER_JOB:
+                res = espNowDecodeClusterJob(&hdr, payload, &cluster_job);
+                cluster_frame = true;
                 break;
-            case CMD_RESUME:
-                app_log_i("ESPNOW_RX", "Resume command received.");
-                // TODO: Implement resumeDosingCycle() in dosing_logic.c/h
-                // resumeDosingCycle();
+            case ESPNOW_MSG_CLUSTER_JOB_REPLY:
+                res = espNowDecodeClusterJobReply(&hdr, payload, &cluster_job_reply);
+                cluster_frame = true;
+                break;
+            case ESPNOW_MSG_STATUS:
+            case ESPNOW_MSG_STATUS_DELTA:
+                foreign_status = true; // Статус соседнего контроллера его экранам - не нам, но номер в ряду
                 break;
-            case CMD_STOP_PROCESS: 
-                app_log_i("ESPNOW_RX", "Stop Process command"); // Changed log from "Stop Dosing" to "Stop Process"
-                // This command is used for both "Stop Dosing" and "Emergency Stop" in the diff.
-                // Let's assume CMD_STOP_PROCESS means stop the current process (dosing/calibration)
-                // CMD_SET_MOTOR_SPEED and calibration commands were removed as they are not in esp_now_protocol.h command_type_t
-                stopMotor(); 
-                if(isCompressorRunning()) compressorOff(); // Check before turning off
-                if (getCalibrationModeState()) {
-                    // stopCalibrationMode(0, false); // Original logic for stopping calibration
-                    // Consider if a more specific stop is needed or if stopMotor() is sufficient
-                }
-
-                DosingState_t local_ds_state;
-                portENTER_CRITICAL(&dosing_state_mutex); 
-                local_ds_state = getDosingState(); 
-                portEXIT_CRITICAL(&dosing_state_mutex);
-
-                if (local_ds_state != DOSING_STATE_IDLE &&
-                    local_ds_state != DOSING_STATE_FINISHED &&
-                    local_ds_state != DOSING_STATE_ERROR) { 
-                    stopDosingCycle(true); // true - сброс состояния (stops motor, etc.) as per diff
-                }
-                // If this command is also intended for emergency stop, you might set a specific error here.
-                // setSystemError(CRIT_MOTOR_FAIL, _T(L_ERROR_EMERGENCY_STOP_VIA_ESPNOW)); // Only if it's an emergency stop
-                break; 
-            // If CMD_ACK_ERROR is added to esp_now_protocol.h:
-            // case CMD_ACK_ERROR: // This was commented out in the diff, but the clearSystemError() was not. Assuming it's a general error clear.
-            //     app_log_i("ESPNOW_RX", "Acknowledge Error command received.");
-            //     clearSystemError(); // This was present in the diff for CMD_ACK_ERROR
-            //     break;
-            // The original code had CMD_CLEAR_ERROR. If CMD_ACK_ERROR replaces it:
-            case CMD_ACK_ERROR: // Assuming CMD_ACK_ERROR is defined in esp_now_protocol.h
-                 app_log_i("ESPNOW_RX", "Acknowledge Error command received.");
-                 clearSystemError();
-                 break;
-
-
             default:
-                 app_log_w("ESPNOW_RX", "Unknown command type: %d", cmd.cmd_type); // Используем cmd_type
-                 break;
+                res = ESPNOW_FRAME_ERR_TYPE;
+                break;
         }
+    }
+
+    bool duplicate = false;
+    bool gap = false;
+    uint8_t role = 0;
+    bool authorized = res == ESPNOW_FRAME_OK &&
+                      espNowPeerNoteRx(mac_addr, hdr.seq, (hdr.flags & ESPNOW_FRAME_F_BROADCAST) != 0, &duplicate, &gap, &role);
+    if (foreign_status) return;
+    // Кадры кластера - только от контроллеров, команды - от экранов и пультов
+    if (authorized && cluster_frame != (role == ESP_NOW_PEER_CONTROLLER)) authorized = false;
+    portENTER_CRITICAL(&espnow_proto_mutex);
+    if (res == ESPNOW_FRAME_OK) {
+        if (!authorized) s_proto_stats.rx_unauthorized++;
+        else if (duplicate) s_proto_stats.rx_duplicates++;
+        else {
+            if (gap) s_proto_stats.rx_seq_gaps++;
+            s_proto_stats.rx_frames++;
+        }
+    } else if (res == ESPNOW_FRAME_ERR_CRC) {
+        s_proto_stats.rx_bad_crc++;
+    } else if (res == ESPNOW_FRAME_ERR_VERSION) {
+        s_proto_stats.rx_bad_version++;
     } else {
-        // Original log: "Invalid data length: %d, expected: %d", len, sizeof(esp_now_cmd_t)
-        // Diff log: "Received data length mismatch. Expected %d, got %d.", sizeof(struct_command_t), len
-        app_log_w("ESPNOW_RX", "Received data length mismatch. Expected %d for struct_command_t, got %d.", sizeof(struct_command_t), len);
+        s_proto_stats.rx_malformed++;
+    }
+    portEXIT_CRITICAL(&espnow_proto_mutex);
+
+    if (res != ESPNOW_FRAME_OK) {
+        app_log_w("ESPNOW_RX", "Frame rejected (%s), %d bytes.", espNowFrameResultName(res), len);
+        return;
+    }
+    if (!authorized) {
+        app_log_w("ESPNOW_RX", "Frame type %u from unauthorized peer %02X:%02X:%02X:%02X:%02X:%02X ignored.", hdr.type,
+                  mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+        return;
+    }
+    if (duplicate) {
+        app_log_d("ESPNOW_RX", "Duplicate frame seq %u ignored.", (unsigned)hdr.seq);
+        return;
+    }
+    if (hdr.type == ESPNOW_MSG_CLUSTER_HEARTBEAT) {
+        clusterOnHeartbeat(mac_addr, &cluster_hb);
+        return;
+    }
+    if (hdr.type == ESPNOW_MSG_CLUSTER_JOB) {
+        clusterOnJob(mac_addr, &cluster_job); // Постановка в очередь дозирования - в loop
+        return;
+    }
+    if (hdr.type == ESPNOW_MSG_CLUSTER_JOB_REPLY) {
+        clusterOnJobReply(mac_addr, &cluster_job_reply);
+        return;
+    }
+
+    // Разбор и проверка - здесь, действие - в loop (handleEspNowCommands): задача WiFi не ждет NVS и не трогает
+    // состояние, которым владеет цикл управления
+    uint32_t head = cmd_ring_head;
+    if (head - cmd_ring_tail >= ESP_NOW_CMD_QUEUE_SIZE) {
+        cmd_overflows++;
+        app_log_w("ESPNOW_RX", "Command queue full, cmd %d (seq %u) dropped.", cmd.cmd_type, (unsigned)hdr.seq);
+        return;
+    }
+    EspNowCmd_t* slot = &cmd_ring[head & (ESP_NOW_CMD_QUEUE_SIZE - 1)];
+    slot->cmd_type = cmd.cmd_type;
+    slot->value = cmd.value;
+    slot->seq = hdr.seq;
+    slot->rx_us = (uint32_t)micros();
+    __sync_synchronize(); // Содержимое ячейки видно потребителю раньше нового head
+    cmd_ring_head = head + 1;
+    cmd_received++;
+}
+
+// --- Применение команд экрана (из loop) ---
+static void applyEspNowCommand(const EspNowCmd_t& cmd) {
+    app_log_i("ESPNOW_RX", "Cmd: %d (Value:%ld, seq %u)", cmd.cmd_type, (long)cmd.value, (unsigned)cmd.seq);
+
+    // --- Handle Commands from Screen (using command_type_t) ---
+    switch (cmd.cmd_type) { // Используем cmd_type из struct_command_t
+        case CMD_SET_TEMPERATURE:
+            if (cmd.value >= -10 && cmd.value <= 30) { // Assuming value is temperature in degrees C
+                app_log_i("ESPNOW_RX", "Set Target Temp: %d C", (int)cmd.value);
+                config.tempSetpoint = (float)cmd.value; // Используем config.tempSetpoint
+                saveConfig();
+                // PID controller will pick up the new setpoint from config
+            } else {
+                app_log_w("ESPNOW_RX", "Invalid Target Temp: %d", (int)cmd.value);
+            }
+            break;
+        case CMD_SET_VOLUME:
+            if (cmd.value > 0 && cmd.value <= 10000) { // Assuming max volume 10000ml
+                app_log_i("ESPNOW_RX", "Set Target Volume: %d ml", (int)cmd.value);
+                config.volumeTarget = cmd.value; // Используем config.volumeTarget
+                saveConfig();
+            } else {
+                app_log_w("ESPNOW_RX", "Invalid Target Volume: %d", (int)cmd.value);
+            }
+            break;
+        case CMD_START_PROCESS:
+            if (cmd.value > 0) { // Используем поле value для объема
+                app_log_i("ESPNOW_RX", "Start Dosing command: %d ml", (int)cmd.value);
+                startDosingCycle(cmd.value, false); // false - не из веб
+            } else {
+                app_log_w("ESPNOW_RX", "Invalid volume for Start Dosing: %d", (int)cmd.value);
+            }
+            break; 
+        case CMD_QUEUE_DOSE:
+            if (!enqueueDosingJob(cmd.value, DOSING_QUEUE_KEEP_TEMP, DOSING_QUEUE_KEEP_SPEED, MOTOR_PRIMARY_CHANNEL_MASK, DOSING_JOB_SOURCE_ESP_NOW)) {
+                app_log_w("ESPNOW_RX", "Queue Dose rejected (volume %d ml, queue %u/%d).", (int)cmd.value, getDosingQueueLength(), DOSING_QUEUE_SIZE);
+            }
+            break;
+        case CMD_START_CONTINUOUS:
+            if (cmd.value >= 0 && (unsigned long)cmd.value <= DOSING_CONT_MAX_VOLUME_ML) {
+                app_log_i("ESPNOW_RX", "Start Continuous Pour command: limit %d ml", (int)cmd.value);
+                startContinuousDosing((uint32_t)cmd.value, false);
+            } else {
+                app_log_w("ESPNOW_RX", "Invalid limit for Continuous Pour: %d", (int)cmd.value);
+            }
+            break;
+        case CMD_PAUSE:
+            app_log_i("ESPNOW_RX", "Pause command received.");
+            pauseDosingCycle(); // Выполняется автоматом дозирования в loop
+            break;
+        case CMD_RESUME:
+            app_log_i("ESPNOW_RX", "Resume command received.");
+            resumeDosingCycle();
+            break;
+        case CMD_STOP_PROCESS: 
+            app_log_i("ESPNOW_RX", "Stop Process command"); // Changed log from "Stop Dosing" to "Stop Process"
+            // This command is used for both "Stop Dosing" and "Emergency Stop" in the diff.
+            // Let's assume CMD_STOP_PROCESS means stop the current process (dosing/calibration)
+            // CMD_SET_MOTOR_SPEED and calibration commands were removed as they are not in esp_now_protocol.h command_type_t
+            stopMotor(); 
+            compressorReleaseAll(); // Как аварийная остановка из веба: иначе планировщик снова включит компрессор после минимального простоя
+            if(isCompressorRunning()) compressorOff(); // Check before turning off
+            if (getCalibrationModeState()) {
+                // stopCalibrationMode(0, false); // Original logic for stopping calibration
+                // Consider if a more specific stop is needed or if stopMotor() is sufficient
+            }
+
+            DosingState_t local_ds_state;
+            portENTER_CRITICAL(&dosing_state_mutex); 
+            local_ds_state = getDosingState(); 
+            portEXIT_CRITICAL(&dosing_state_mutex);
+
+            if (local_ds_state != DOSING_STATE_IDLE &&
+                local_ds_state != DOSING_STATE_FINISHED &&
+                local_ds_state != DOSING_STATE_ERROR) { 
+                stopDosingCycle(true); // true - сброс состояния (stops motor, etc.) as per diff
+            }
+            // If this command is also intended for emergency stop, you might set a specific error here.
+            // setSystemError(CRIT_MOTOR_FAIL, _T(L_ERROR_EMERGENCY_STOP_VIA_ESPNOW)); // Only if it's an emergency stop
+            break; 
+        // If CMD_ACK_ERROR is added to esp_now_protocol.h:
+        // case CMD_ACK_ERROR: // This was commented out in the diff, but the clearSystemError() was not. Assuming it's a general error clear.
+        //     app_log_i("ESPNOW_RX", "Acknowledge Error command received.");
+        //     clearSystemError(); // This was present in the diff for CMD_ACK_ERROR
+        //     break;
+        // The original code had CMD_CLEAR_ERROR. If CMD_ACK_ERROR replaces it:
+        case CMD_ACK_ERROR: // Assuming CMD_ACK_ERROR is defined in esp_now_protocol.h
+             app_log_i("ESPNOW_RX", "Acknowledge Error command received.");
+             clearSystemError();
+             break;
+        case CMD_REQUEST_KEYFRAME: // Отправит handleEspNowStatus()
+             s_keyframe_requested = true;
+             break;
+
+
+        default:
+             app_log_w("ESPNOW_RX", "Unknown command type: %d", cmd.cmd_type); // Используем cmd_type
+             break;
     }
 }
 
+void handleEspNowCommands() {
+    uint32_t tail = cmd_ring_tail;
+    while (tail != cmd_ring_head) {
+        __sync_synchronize(); // head прочитан раньше содержимого ячейки
+        EspNowCmd_t cmd = cmd_ring[tail & (ESP_NOW_CMD_QUEUE_SIZE - 1)];
+        __sync_synchronize(); // Ячейка прочитана до ее освобождения
+        cmd_ring_tail = ++tail;
+
+        uint32_t depth = cmd_ring_head - tail + 1;
+        if (depth > cmd_stats.max_depth) cmd_stats.max_depth = (uint8_t)depth;
+        uint32_t latency = (uint32_t)micros() - cmd.rx_us;
+        applyEspNowCommand(cmd);
+        cmd_stats.applied++;
+        cmd_stats.last_latency_us = latency;
+        if (latency > cmd_stats.max_latency_us) cmd_stats.max_latency_us = latency;
+        cmd_stats.avg_latency_us += ((float)latency - cmd_stats.avg_latency_us) / (float)cmd_stats.applied;
+    }
+}
+
+void getEspNowCmdStats(EspNowCmdStats_t* out) {
+    if (!out) return;
+    *out = cmd_stats;
+    out->received = cmd_received;
+    out->overflows = cmd_overflows;
+}
+
 bool sendEspNowData(const uint8_t *data, size_t len, const uint8_t *peer_addr_target) {
     if (WiFi.status() != WL_CONNECTED) {
         app_log_w("ESPNOW_SEND", "WiFi not connected. Cannot send ESP-NOW data.");
@@ -255,34 +370,125 @@ bool sendEspNowData(const uint8_t *data, size_t len, const uint8_t *peer_addr_ta
 
     ensureEspNowPeer(); 
 
-    if (!s_screen_mac_valid || !esp_now_peer_added || !esp_now_is_peer_exist(peer_addr_target)) {
-        app_log_w("ESP_NOW_SEND", "Attempting ESP-NOW send, but peer not (fully) configured or not added.");
-        if (!s_screen_mac_valid || !esp_now_peer_added || !esp_now_is_peer_exist(peer_addr_target)) {
-             app_log_e("ESP_NOW_SEND", "Peer still not available after re-check. Cannot send.");
-             return false;
-        }
+    if (!esp_now_peer_added || !esp_now_is_peer_exist(peer_addr_target)) {
+        app_log_e("ESP_NOW_SEND", "Peer not available. Cannot send.");
+        return false;
     }
+    return espNowTxEnqueue(peer_addr_target, data, len, ESP_NOW_TX_PRIO_NORMAL, ESP_NOW_TX_KEY_NONE, NULL, NULL) != 0;
+}
 
-    esp_err_t result;
-    for (int i = 0; i < ESP_NOW_SEND_MAX_RETRIES_LOCAL; ++i) { 
-        result = esp_now_send(peer_addr_target, data, len);
-        if (result == ESP_OK) {
-            app_log_d("ESPNOW_SEND", "ESP-NOW data sent (attempt %d).", i + 1);
-            return true;
-        }
-        app_log_w("ESPNOW_SEND", "ESP-NOW send error (attempt %d/%d): %s. Delay %lu ms.",
-              i + 1, ESP_NOW_SEND_MAX_RETRIES_LOCAL, esp_err_to_name(result), ESP_NOW_SEND_RETRY_DELAY_MS_LOCAL);
-        if (i < ESP_NOW_SEND_MAX_RETRIES_LOCAL - 1) {
-            vTaskDelay(pdMS_TO_TICKS(ESP_NOW_SEND_RETRY_DELAY_MS_LOCAL)); 
+
+// --- Отправка статуса системы на дисплей ---
+// Ключевой кадр (полный статус) раз в ESP_NOW_KEYFRAME_INTERVAL_MS и по запросу экрана; между ними - дельты
+// изменившихся полей, как только изменение выходит за зону нечувствительности. Кадры статуса идут через очередь
+// передачи с одним ключом объединения: еще не ушедший статус заменяется свежим.
+// Дельта считается от подтвержденного экраном статуса, поэтому замененная или потерянная дельта не теряет полей.
+// Широковещательный кадр подтверждения не имеет (успех передачи не значит, что экраны его приняли), поэтому
+// для нескольких подписчиков дельта считается от последнего ключевого кадра и несет все поля, менявшиеся
+// после него: экран, пропустивший дельту, получает их в следующей.
+
+static struct_status_t s_acked_status;            // Что экран подтвердил (адресно) или последний ключевой кадр (широковещательно)
+static struct_status_t s_queued_status;           // Что экран будет знать после всех поставленных кадров
+static bool s_status_synced = false;              // Экран получил ключевой кадр
+static uint8_t s_keyframes_outstanding = 0;       // Ключевых кадров в очереди: дельты до их доставки не шлются
+static uint8_t s_status_outstanding = 0;          // Кадров статуса в очереди и в эфире
+static uint16_t s_outstanding_fields = 0;         // Поля, которые эти кадры могут изменить на экране
+static bool s_status_broadcast = false;           // Статус идет широковещательно (подписчиков несколько)
+static uint16_t s_broadcast_fields = 0;           // Поля широковещательных дельт после ключевого кадра
+static unsigned long s_last_keyframe_ms = 0;
+static unsigned long s_last_status_tx_ms = 0;
+
+static void collectSystemStatus(struct_status_t* status_data) {
+    memset(status_data, 0, sizeof(*status_data));
+
+    portENTER_CRITICAL(&dosing_state_mutex);
+    status_data->system_state = (uint8_t)getDosingState(); // Используем getDosingState()
+    portEXIT_CRITICAL(&dosing_state_mutex);
+
+    status_data->current_temperature_out = getTempOut(); // Используем getTempOut() из sensors.h
+    status_data->current_temperature_in = tIn; // Используем глобальную переменную tIn из sensors.h (ensure tIn is up-to-date)
+
+    const Config* cfg = getConfigSnapshot(); // Уставки одной согласованной версии настроек
+    status_data->current_volume_ml = getCurrentDosedVolume(); // Объем, налитый в текущем цикле (was getCurrentVolumeDispensedCycleMl)
+
+    // Целевой объем для текущего цикла; для непрерывного налива - лимит сумматора (0 - без лимита)
+    status_data->target_volume_ml = isDosingContinuous() ? (int)getDosingContinuousLimit() : getDosingVolumeTarget();
+
+    portENTER_CRITICAL(&error_handler_mutex); // Мьютекс из error_handler.h
+    status_data->error_code = (uint16_t)getSystemErrorCode();
+    portEXIT_CRITICAL(&error_handler_mutex);
+
+    status_data->current_setpoint_temperature = (int32_t)cfg->tempSetpoint;
+
+    status_data->current_setpoint_volume = cfg->volumeTarget;
+
+    status_data->uptime_seconds = getUptimeSeconds();
+
+    strncpy(status_data->version_main_esp, MAIN_FIRMWARE_VERSION != nullptr ? MAIN_FIRMWARE_VERSION : "N/A",
+            sizeof(status_data->version_main_esp) - 1);
+}
+
+static bool tempChanged(float sent, float now) {
+    if (isnan(sent) || isnan(now)) return isnan(sent) != isnan(now);
+    return fabsf(now - sent) >= ESP_NOW_DEADBAND_TEMP_C;
+}
+
+// Поля, которые экран должен узнать. Время работы в дельты не входит: экран досчитывает его сам,
+// а ключевой кадр его поправляет.
+static uint16_t statusDeltaMask(const struct_status_t* sent, const struct_status_t* cur) {
+    uint16_t mask = 0;
+    if (tempChanged(sent->current_temperature_out, cur->current_temperature_out)) mask |= ESPNOW_STATUS_F_TEMP_OUT;
+    if (tempChanged(sent->current_temperature_in, cur->current_temperature_in)) mask |= ESPNOW_STATUS_F_TEMP_IN;
+    if (abs((int)(cur->current_volume_ml - sent->current_volume_ml)) >= ESP_NOW_DEADBAND_VOLUME_ML) mask |= ESPNOW_STATUS_F_VOLUME;
+    if (cur->target_volume_ml != sent->target_volume_ml) mask |= ESPNOW_STATUS_F_TARGET_VOLUME;
+    if (cur->system_state != sent->system_state) mask |= ESPNOW_STATUS_F_STATE;
+    if (cur->error_code != sent->error_code) mask |= ESPNOW_STATUS_F_ERROR;
+    if (cur->current_setpoint_temperature != sent->current_setpoint_temperature) mask |= ESPNOW_STATUS_F_SETPOINT_TEMP;
+    if (cur->current_setpoint_volume != sent->current_setpoint_volume) mask |= ESPNOW_STATUS_F_SETPOINT_VOL;
+    if (memcmp(cur->version_main_esp, sent->version_main_esp, sizeof(cur->version_main_esp)) != 0) mask |= ESPNOW_STATUS_F_VERSION;
+    return mask;
+}
+
+// Копирует поля mask из src в dst (состояние экрана меняется только в отправленных полях,
+// иначе медленный дрейф внутри зоны нечувствительности никогда бы не ушел)
+static void copyStatusFields(struct_status_t* dst, const struct_status_t* src, uint16_t mask) {
+#define ESPNOW_FIELD_COPY(bit, field)                                                   \
+    if (mask & (bit)) memcpy((uint8_t*)dst + offsetof(struct_status_t, field),          \
+                             (const uint8_t*)src + offsetof(struct_status_t, field), ESPNOW_STATUS_FIELD_SIZE(field));
+    ESPNOW_STATUS_FIELDS(ESPNOW_FIELD_COPY)
+#undef ESPNOW_FIELD_COPY
+}
+
+// Результат кадра статуса (из handleEspNowTx или из постановки, заменившей кадр)
+static void onStatusFrameDone(uint32_t id, EspNowTxResult_t result, const uint8_t* frame, size_t len, void* arg) {
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    if (espNowDecodeFrame(frame, len, &hdr, &payload) != ESPNOW_FRAME_OK) return;
+    bool keyframe = hdr.type == ESPNOW_MSG_STATUS;
+    bool broadcast = (hdr.flags & ESPNOW_FRAME_F_BROADCAST) != 0;
+
+    if (s_status_outstanding > 0 && --s_status_outstanding == 0) s_outstanding_fields = 0;
+    if (keyframe && s_keyframes_outstanding > 0) s_keyframes_outstanding--;
+
+    if (result == ESP_NOW_TX_DELIVERED) {
+        if (keyframe) {
+            espNowDecodeStatus(&hdr, payload, &s_acked_status);
+            s_status_synced = true;
+            // Отсчет заново от этого кадра; поля кадров, ушедших после него, остаются в дельтах
+            s_broadcast_fields = s_outstanding_fields;
+        } else if (!broadcast) {
+            espNowApplyStatusDelta(&hdr, payload, &s_acked_status);
         }
+        portENTER_CRITICAL(&espnow_proto_mutex);
+        if (keyframe) s_proto_stats.tx_keyframes++;
+        else s_proto_stats.tx_deltas++;
+        portEXIT_CRITICAL(&espnow_proto_mutex);
+    } else if (result == ESP_NOW_TX_FAILED || (keyframe && result == ESP_NOW_TX_EVICTED)) {
+        // Экран мог не получить часть полей: следующим уйдет ключевой кадр
+        s_status_synced = false;
     }
-    app_log_e("ESPNOW_SEND", "Failed to send ESP-NOW data after %d attempts.", ESP_NOW_SEND_MAX_RETRIES_LOCAL);
-    setSystemError(WARN_ESP_NOW_SEND_FAIL, _T(L_WARN_ESPNOW_SEND_FAIL_AFTER_RETRIES));
-    return false;
 }
 
-
-// --- Отправка статуса системы на дисплей ---
 void sendSystemStatusEspNow() {
     ensureEspNowPeer(); 
     if (!isEspNowPeerAvailable()) { 
@@ -290,67 +496,118 @@ void sendSystemStatusEspNow() {
         return;
     }
 
-    struct_status_t status_data; 
-    memset(&status_data, 0, sizeof(status_data)); 
+    uint8_t dest[6];
+    if (!getEspNowStatusDestination(dest)) return; // Никто не подписан на статус
 
-    portENTER_CRITICAL(&dosing_state_mutex);
-    status_data.system_state = (system_state_t)getDosingState(); // Используем getDosingState()
-    portEXIT_CRITICAL(&dosing_state_mutex);
-    
-    status_data.current_temperature_out = getTempOut(); // Используем getTempOut() из sensors.h
-    status_data.current_temperature_in = tIn; // Используем глобальную переменную tIn из sensors.h (ensure tIn is up-to-date)
-
-    status_data.current_volume_ml = getCurrentDosedVolume(); // Объем, налитый в текущем цикле (was getCurrentVolumeDispensedCycleMl)
-
-    status_data.target_volume_ml = config.volumeTarget; // Целевой объем для текущего цикла
+    struct_status_t status_data;
+    collectSystemStatus(&status_data);
 
-    portENTER_CRITICAL(&error_handler_mutex); // Мьютекс из error_handler.h
-    status_data.error_code = (SystemErrorCode_t)getSystemErrorCode(); // Исправлено на SystemErrorCode_t
-    portEXIT_CRITICAL(&error_handler_mutex);
+    app_log_d("ESPNOW_STATUS", "Queueing keyframe: DS:%d, T_out:%.1f, T_in:%.1f, Vol:%d, TargetVol:%d, Err:%d, SetT:%d, SetV:%d, Uptime:%lu, FW:%s",
+        (int)status_data.system_state, status_data.current_temperature_out, status_data.current_temperature_in,
+        (int)status_data.current_volume_ml, (int)status_data.target_volume_ml, (int)status_data.error_code,
+        (int)status_data.current_setpoint_temperature, (int)status_data.current_setpoint_volume,
+        (unsigned long)status_data.uptime_seconds, status_data.version_main_esp);
+
+    uint8_t frame[ESPNOW_FRAME_OVERHEAD + sizeof(struct_status_t)];
+    size_t frame_len = espNowEncodeStatus(0, &status_data, frame, sizeof(frame)); // Номер назначит очередь
+
+    unsigned long now = millis();
+    s_last_keyframe_ms = now;
+    s_last_status_tx_ms = now;
+    s_keyframe_requested = false;
+    s_status_broadcast = (dest[0] & 0x01) != 0;
+
+    // Счетчики - до постановки: замененный кадр статуса отчитается прямо из espNowTxEnqueue()
+    s_status_outstanding++;
+    s_outstanding_fields = 0xFFFF;
+    s_keyframes_outstanding++;
+    if (espNowTxEnqueue(dest, frame, frame_len, ESP_NOW_TX_PRIO_NORMAL, ESP_NOW_TX_KEY_STATUS,
+                        onStatusFrameDone, NULL) == 0) {
+        s_status_outstanding--;
+        s_keyframes_outstanding--;
+        return;
+    }
+    s_queued_status = status_data;
+}
 
-    status_data.current_setpoint_temperature = config.tempSetpoint; // Используем config.tempSetpoint
+void handleEspNowStatus() {
+    if (!esp_now_peer_added || WiFi.status() != WL_CONNECTED) return;
 
-    status_data.current_setpoint_volume = config.volumeTarget; // Используем config.volumeTarget
+    unsigned long now = millis();
+    DosingState_t ds;
+    portENTER_CRITICAL(&dosing_state_mutex);
+    ds = getDosingState();
+    portEXIT_CRITICAL(&dosing_state_mutex);
+    bool active = ds != DOSING_STATE_IDLE && ds != DOSING_STATE_FINISHED && ds != DOSING_STATE_ERROR;
+    unsigned long min_interval = active ? ESP_NOW_DELTA_INTERVAL_ACTIVE_MS : ESP_NOW_DELTA_INTERVAL_IDLE_MS;
+    if (now - s_last_status_tx_ms < min_interval) return;
 
-    status_data.uptime_seconds = getUptimeSeconds();
+    bool keyframe_due = s_keyframe_requested || now - s_last_keyframe_ms >= ESP_NOW_KEYFRAME_INTERVAL_MS;
+    if ((!s_status_synced && s_keyframes_outstanding == 0) || keyframe_due) {
+        sendSystemStatusEspNow(); // Ключевые кадры реже прежнего полного статуса и укладываются в бюджет сами
+        return;
+    }
+    if (!s_status_synced) return; // Ждем доставки ключевого кадра
 
-    if (MAIN_FIRMWARE_VERSION != nullptr) {
-        strncpy(status_data.version_main_esp, MAIN_FIRMWARE_VERSION, sizeof(status_data.version_main_esp) - 1);
-        status_data.version_main_esp[sizeof(status_data.version_main_esp) - 1] = '\0'; 
-    } else {
-        strncpy(status_data.version_main_esp, "N/A", sizeof(status_data.version_main_esp) - 1);
-        status_data.version_main_esp[sizeof(status_data.version_main_esp) - 1] = '\0';
-        app_log_e("ESP_NOW_SEND", "MAIN_FIRMWARE_VERSION is null!");
+    uint8_t dest[6];
+    if (!getEspNowStatusDestination(dest)) return;
+    if (((dest[0] & 0x01) != 0) != s_status_broadcast) {
+        sendSystemStatusEspNow(); // Сменилось число подписчиков: базу дельт задает новый ключевой кадр
+        return;
     }
 
-    app_log_d("ESPNOW_STATUS", "Sending status: DS:%d, T_out:%.1f, T_in:%.1f, Vol:%.1f, TargetVol:%.1f, Err:%d, SetT:%.1f, SetV:%d, Uptime:%lu, FW:%s",
-        (int)status_data.system_state, status_data.current_temperature_out, status_data.current_temperature_in,
-        status_data.current_volume_ml, status_data.target_volume_ml, (int)status_data.error_code,
-        status_data.current_setpoint_temperature, status_data.current_setpoint_volume,
-        status_data.uptime_seconds, status_data.version_main_esp);
+    struct_status_t cur;
+    collectSystemStatus(&cur);
+    uint16_t new_fields = statusDeltaMask(&s_queued_status, &cur);
+    if (new_fields == 0) return;
+    // Поля от подтвержденного статуса плюс поля кадров, которые еще могут дойти: порядок доставки не важен
+    uint16_t mask = statusDeltaMask(&s_acked_status, &cur) | s_outstanding_fields | new_fields;
+    if (s_status_broadcast) mask |= s_broadcast_fields;
+    mask &= (uint16_t)~ESPNOW_STATUS_F_UPTIME;
+
+    if (!espNowTxAirtimeAvailable(ESPNOW_FRAME_OVERHEAD + espNowStatusDeltaPayloadLen(mask))) {
+        // Изменения не теряются: они войдут в следующую дельту, когда бюджет пополнится
+        portENTER_CRITICAL(&espnow_proto_mutex);
+        s_proto_stats.tx_budget_deferred++;
+        portEXIT_CRITICAL(&espnow_proto_mutex);
+        s_last_status_tx_ms = now;
+        return;
+    }
 
-    esp_err_t result = esp_now_send(s_screen_mac_address, (uint8_t *) &status_data, sizeof(status_data));
-    if (result == ESP_OK) {
-        app_log_d("ESP_NOW_SEND", "Status sent successfully with FW version: %s", status_data.version_main_esp);
-    } else {
-        app_log_e("ESP_NOW_SEND", "Error sending status: %s", esp_err_to_name(result));
-        setSystemError(WARN_ESP_NOW_SEND_FAIL, _T(L_WARN_ESPNOW_SEND_FAIL_AFTER_RETRIES)); 
+    uint8_t frame[ESPNOW_FRAME_OVERHEAD + sizeof(uint16_t) + sizeof(struct_status_t)];
+    size_t frame_len = espNowEncodeStatusDelta(0, &cur, mask, frame, sizeof(frame));
+    s_last_status_tx_ms = now;
+    s_status_outstanding++;
+    s_outstanding_fields |= mask;
+    if (espNowTxEnqueue(dest, frame, frame_len, ESP_NOW_TX_PRIO_LOW, ESP_NOW_TX_KEY_STATUS,
+                        onStatusFrameDone, NULL) == 0) {
+        s_status_outstanding--;
+        return;
     }
+    if (s_status_broadcast) s_broadcast_fields |= mask;
+    copyStatusFields(&s_queued_status, &cur, mask);
 }
 
 bool isEspNowPeerAvailable() {
-    if (!s_screen_mac_valid) {
-        return false;
-    }
-    return esp_now_peer_added && esp_now_is_peer_exist(s_screen_mac_address);
+    return esp_now_peer_added;
 }
 
+// Первый экран таблицы (совместимость с единственным пиром)
 void getRemotePeerAddress(uint8_t *mac_addr_buf) {
-    if (mac_addr_buf) { 
-        if (s_screen_mac_valid) { 
-            memcpy(mac_addr_buf, s_screen_mac_address, 6); 
-        } else {
-            memset(mac_addr_buf, 0, 6); 
+    if (!mac_addr_buf) return;
+    memset(mac_addr_buf, 0, 6);
+    EspNowPeer_t peer;
+    for (int i = 0; getEspNowPeer(i, &peer); i++) {
+        if (peer.role == ESP_NOW_PEER_SCREEN) {
+            memcpy(mac_addr_buf, peer.mac, 6);
+            return;
         }
     }
 }
+
+void getEspNowProtoStats(EspNowProtoStats_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&espnow_proto_mutex);
+    *out = s_proto_stats;
+    portEXIT_CRITICAL(&espnow_proto_mutex);
+}
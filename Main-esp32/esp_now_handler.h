@@ -3,48 +3,55 @@
 
 #include <Arduino.h>
 #include <esp_now.h>
-#include "error_handler.h" // For ERROR_HANDLER_LAST_MSG_BUFFER_SIZE
-
-typedef struct __attribute__((packed)) esp_now_cmd_s {
-    uint8_t command;        // Код команды (0-255)
-    int16_t volume;         // Целевой объем (мл), может быть отрицательным для спец. команд
-    float temp;             // Целевая температура (градусы C)
-    int16_t speed;          // Скорость мотора (шаги/сек)
-    float actualVolume;     // Фактический объем (для калибровки)
-    uint8_t checksum;       // Простая контрольная сумма (XOR всех байт до checksum)
-} esp_now_cmd_t;
-
-#define MAX_ESP_NOW_ERROR_MSG_LEN (ERROR_HANDLER_LAST_MSG_BUFFER_SIZE > 60 ? 60 : ERROR_HANDLER_LAST_MSG_BUFFER_SIZE - 1) // Ограничиваем длину сообщения для ESP-NOW
-
-// Статус, отправляемый на дисплей (СИНХРОНИЗИРОВАННАЯ СТРУКТURA)
-typedef struct __attribute__((packed)) esp_now_status_s {
-    uint8_t status_dosing_state;    // Текущее состояние дозирования (из DosingState enum)
-    float tempOut;                  // Температура на выходе (градусы C)
-    float flowRate;                 // Текущий расход (мл/мин)
-    int16_t volumeDispensedCycle_ml;// Объем, выданный в текущем цикле (мл)
-    uint8_t errorCode;              // Код текущей ошибки системы (из SystemErrorCode enum)
-    // Группируем битовые поля для лучшей совместимости и потенциального устранения предупреждения
-    uint8_t systemPower   : 1;      // Питание системы (0=OFF, 1=ON)
-    uint8_t compressorState : 1;    // Состояние компрессора (0=OFF, 1=ON)
-    uint8_t calibrationActive : 1;  // Режим калибровки активен (0=OFF, 1=ON)
-    uint8_t wifiConnected : 1;      // WiFi подключен
-    uint8_t waterLevelOk : 1;       // Состояние датчика уровня воды (1=OK, 0=LOW)
-    uint8_t reserved      : 3;      // Зарезервировано для будущих флагов (5 флагов + 3 бита = 1 байт)
-    float currentTempSetpoint;      // Текущая уставка температуры
-    int16_t currentVolumeTarget;    // Текущий целевой объем
-    char lastErrorMessage[MAX_ESP_NOW_ERROR_MSG_LEN + 1]; // Текстовое сообщение последней ошибки
-    uint8_t checksum;               // Простая контрольная сумма (XOR всех байт до checksum)
-} esp_now_status_t;
+
+// Статус на экран: ключевой кадр (полный статус) + дельты изменившихся полей
+#define ESP_NOW_KEYFRAME_INTERVAL_MS        10000 // Полный статус для ресинхронизации
+#define ESP_NOW_DELTA_INTERVAL_ACTIVE_MS    100   // Не чаще 10 Гц во время цикла дозирования
+#define ESP_NOW_DELTA_INTERVAL_IDLE_MS      500   // Вне цикла (температура, уставки, ошибки)
+#define ESP_NOW_DEADBAND_TEMP_C             0.1f
+#define ESP_NOW_DEADBAND_VOLUME_ML          1
+// Бюджет эфира - в esp_now_tx.h
+
+// Команды экрана: onEspNowReceive только проверяет кадр и кладет команду в очередь, применяет их loop
+#define ESP_NOW_CMD_QUEUE_SIZE              16    // Степень двойки
+
+typedef struct {
+    uint32_t received;          // Поставлены в очередь
+    uint32_t applied;
+    uint32_t overflows;         // Отброшены: очередь полна
+    uint8_t max_depth;
+    uint32_t last_latency_us;   // Прием -> применение
+    uint32_t max_latency_us;
+    float avg_latency_us;
+} EspNowCmdStats_t;
+
+// Счетчики кадров протокола (формат - в esp_now_protocol.h)
+typedef struct {
+    uint32_t tx_keyframes;       // Доставленные кадры статуса
+    uint32_t tx_deltas;
+    uint32_t tx_budget_deferred; // Дельта отложена: не хватило эфирного времени
+    uint32_t rx_frames;        // Принятые и разобранные кадры
+    uint32_t rx_malformed;     // Отброшены: длина, magic, тип или нагрузка
+    uint32_t rx_bad_crc;
+    uint32_t rx_bad_version;
+    uint32_t rx_unauthorized;  // Кадры от пиров не из таблицы
+    uint32_t rx_duplicates;    // Повтор номера предыдущего кадра пира (повторная отправка)
+    uint32_t rx_seq_gaps;      // Пропуски номеров (потерянные кадры)
+} EspNowProtoStats_t;
 
 extern bool esp_now_peer_added; // Объявляем глобальную переменную
 
 void initEspNow();
 void onEspNowSend(const uint8_t *mac_addr, esp_now_send_status_t status);
 void onEspNowReceive(const uint8_t *mac_addr, const uint8_t *incomingData, int len);
-bool sendEspNowData(const uint8_t *data, size_t len, const uint8_t *peer_addr); // Отправка с повторами
-void sendSystemStatusEspNow();
-bool isEspNowPeerAvailable(); // Проверяет, существует ли пир
-void getRemotePeerAddress(uint8_t *mac_addr_buf); // Копирует MAC-адрес пира (буфер должен быть 6 байт) - Объявление
-void ensureEspNowPeer(); // Пытается добавить пир, если он не добавлен или потерян
+bool sendEspNowData(const uint8_t *data, size_t len, const uint8_t *peer_addr); // В очередь передачи (не блокирует)
+void sendSystemStatusEspNow(); // Ключевой кадр немедленно
+void handleEspNowStatus();     // Вызывается из loop(): ключевые кадры и дельты статуса
+void handleEspNowCommands();   // Вызывается из loop(): применение команд экрана из очереди
+void getEspNowCmdStats(EspNowCmdStats_t* out);
+bool isEspNowPeerAvailable(); // Хотя бы один пир таблицы добавлен в драйвер
+void getRemotePeerAddress(uint8_t *mac_addr_buf); // MAC первого экрана таблицы (буфер 6 байт, нули - экрана нет)
+void ensureEspNowPeer(); // Добавляет в драйвер пиры таблицы, если они не добавлены или потеряны
+void getEspNowProtoStats(EspNowProtoStats_t* out);
 
 #endif // ESP_NOW_HANDLER_H
\ No newline at end of file
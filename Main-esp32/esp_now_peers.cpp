@@ -0,0 +1,278 @@
+#include "esp_now_peers.h"
+#include <Preferences.h>
+#include <WiFi.h>             // Для WIFI_IF_STA
+#include "config_manager.h"   // Для getScreenMacAddress (перенос единственного экрана из настроек)
+#include "esp_now_protocol.h" // Для ESP_NOW_CHANNEL
+#include "main.h"             // Для функций логирования
+#include <string.h>
+
+portMUX_TYPE esp_now_peers_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+static const uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Запись в NVS: только то, что задает пользователь
+typedef struct __attribute__((packed)) {
+    uint8_t mac[6];
+    uint8_t role;
+    uint8_t subscriptions;
+} EspNowPeerRecord_t;
+
+static EspNowPeer_t peers[ESP_NOW_PEER_TABLE_SIZE];
+static int peer_count = 0;
+static uint16_t bcast_tx_seq = 0;   // Широковещательные кадры
+static uint16_t unlisted_tx_seq = 0; // Адресные кадры пиру вне таблицы
+
+static int findPeerLocked(const uint8_t* mac) {
+    for (int i = 0; i < peer_count; i++) {
+        if (memcmp(peers[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+static void savePeers() {
+    EspNowPeerRecord_t records[ESP_NOW_PEER_TABLE_SIZE];
+    int count;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    count = peer_count;
+    for (int i = 0; i < count; i++) {
+        memcpy(records[i].mac, peers[i].mac, 6);
+        records[i].role = peers[i].role;
+        records[i].subscriptions = peers[i].subscriptions;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+
+    Preferences prefs;
+    if (!prefs.begin(ESP_NOW_PEERS_NAMESPACE, false)) {
+        log_e("ESPNOW_PEERS", "Failed to open NVS namespace '%s' for writing.", ESP_NOW_PEERS_NAMESPACE);
+        return;
+    }
+    if (count > 0) prefs.putBytes(ESP_NOW_PEERS_KEY, records, count * sizeof(EspNowPeerRecord_t));
+    else prefs.remove(ESP_NOW_PEERS_KEY);
+    prefs.end();
+}
+
+bool parseEspNowMac(const char* str, uint8_t* mac_out) {
+    if (!str || !mac_out || strlen(str) != 17) return false;
+    unsigned int b[6];
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) return false;
+    for (int i = 0; i < 6; i++) mac_out[i] = (uint8_t)b[i];
+    // Широковещательный и групповые адреса пиром быть не могут
+    return (mac_out[0] & 0x01) == 0;
+}
+
+void initEspNowPeers() {
+    memset(peers, 0, sizeof(peers));
+    peer_count = 0;
+
+    Preferences prefs;
+    if (prefs.begin(ESP_NOW_PEERS_NAMESPACE, true)) {
+        size_t len = prefs.getBytesLength(ESP_NOW_PEERS_KEY);
+        // Размер записи проверяем явно: обрывок или чужая раскладка отбрасываются
+        if (len > 0 && len % sizeof(EspNowPeerRecord_t) == 0 && len <= sizeof(EspNowPeerRecord_t) * ESP_NOW_PEER_TABLE_SIZE) {
+            EspNowPeerRecord_t records[ESP_NOW_PEER_TABLE_SIZE];
+            prefs.getBytes(ESP_NOW_PEERS_KEY, records, len);
+            for (size_t i = 0; i < len / sizeof(EspNowPeerRecord_t); i++) {
+                memcpy(peers[peer_count].mac, records[i].mac, 6);
+                peers[peer_count].role = records[i].role;
+                peers[peer_count].subscriptions = records[i].subscriptions;
+                peer_count++;
+            }
+        }
+        prefs.end();
+    }
+
+    if (peer_count == 0) {
+        // Прежняя настройка - один экран в config.remotePeerMacStr
+        uint8_t mac[6];
+        if (getScreenMacAddress(mac)) {
+            espNowPeerAdd(mac, ESP_NOW_PEER_SCREEN, ESP_NOW_SUB_STATUS);
+            log_i("ESPNOW_PEERS", "Screen %s from settings added to the peer table.", config.remotePeerMacStr);
+        }
+    }
+    log_i("ESPNOW_PEERS", "%d authorized ESP-NOW peers.", peer_count);
+}
+
+static bool registerDriverPeer(const uint8_t* mac) {
+    if (esp_now_is_peer_exist(mac)) return true;
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, mac, 6);
+    peerInfo.channel = ESP_NOW_CHANNEL;
+    peerInfo.ifidx = WIFI_IF_STA;
+    peerInfo.encrypt = false;
+    return esp_now_add_peer(&peerInfo) == ESP_OK;
+}
+
+int registerEspNowPeers() {
+    uint8_t macs[ESP_NOW_PEER_TABLE_SIZE][6];
+    int count;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    count = peer_count;
+    for (int i = 0; i < count; i++) memcpy(macs[i], peers[i].mac, 6);
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+
+    // Вызовы драйвера - вне критической секции
+    int registered = 0;
+    bool ok[ESP_NOW_PEER_TABLE_SIZE];
+    for (int i = 0; i < count; i++) {
+        ok[i] = registerDriverPeer(macs[i]);
+        if (ok[i]) registered++;
+        else log_w("ESPNOW_PEERS", "Failed to add peer %02X:%02X:%02X:%02X:%02X:%02X to ESP-NOW.",
+                   macs[i][0], macs[i][1], macs[i][2], macs[i][3], macs[i][4], macs[i][5]);
+    }
+    if (!registerDriverPeer(broadcast_mac)) log_w("ESPNOW_PEERS", "Failed to add broadcast peer.");
+
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    for (int i = 0; i < count; i++) {
+        int idx = findPeerLocked(macs[i]);
+        if (idx >= 0) peers[idx].registered = ok[i];
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    return registered;
+}
+
+bool espNowPeerAdd(const uint8_t* mac, EspNowPeerRole_t role, uint8_t subscriptions) {
+    if (!mac || (mac[0] & 0x01)) return false;
+    bool added = true;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    int idx = findPeerLocked(mac);
+    if (idx < 0) {
+        if (peer_count < ESP_NOW_PEER_TABLE_SIZE) {
+            idx = peer_count++;
+            memset(&peers[idx], 0, sizeof(peers[idx]));
+            memcpy(peers[idx].mac, mac, 6);
+        } else {
+            added = false;
+        }
+    }
+    if (idx >= 0) {
+        peers[idx].role = (uint8_t)role;
+        peers[idx].subscriptions = subscriptions;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    if (!added) {
+        log_w("ESPNOW_PEERS", "Peer table full (%d), peer not added.", ESP_NOW_PEER_TABLE_SIZE);
+        return false;
+    }
+    savePeers();
+    return true;
+}
+
+bool espNowPeerRemove(const uint8_t* mac) {
+    if (!mac) return false;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    int idx = findPeerLocked(mac);
+    if (idx >= 0) {
+        peers[idx] = peers[peer_count - 1];
+        peer_count--;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    if (idx < 0) return false;
+    if (esp_now_is_peer_exist(mac)) esp_now_del_peer(mac);
+    savePeers();
+    return true;
+}
+
+void resetEspNowPeers() {
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    peer_count = 0;
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    Preferences prefs;
+    if (prefs.begin(ESP_NOW_PEERS_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+}
+
+int getEspNowPeerCount() {
+    return peer_count;
+}
+
+bool getEspNowPeer(int index, EspNowPeer_t* out) {
+    if (!out) return false;
+    bool ok = false;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    if (index >= 0 && index < peer_count) {
+        *out = peers[index];
+        ok = true;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    return ok;
+}
+
+bool espNowPeerOnline(const EspNowPeer_t* peer) {
+    return peer && peer->last_seen_ms != 0 && millis() - peer->last_seen_ms < ESP_NOW_PEER_ONLINE_MS;
+}
+
+bool espNowPeerNoteRx(const uint8_t* mac, uint16_t seq, bool broadcast, bool* duplicate, bool* gap, uint8_t* role) {
+    bool authorized = false;
+    uint8_t peer_role = 0;
+    bool dup = false;
+    bool skipped = false;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    int idx = mac ? findPeerLocked(mac) : -1;
+    if (idx >= 0) {
+        EspNowPeer_t* p = &peers[idx];
+        authorized = true;
+        peer_role = p->role;
+        p->last_seen_ms = now ? now : 1;
+        bool* have = broadcast ? &p->have_rx_bcast_seq : &p->have_rx_seq;
+        uint16_t* last = broadcast ? &p->last_rx_bcast_seq : &p->last_rx_seq;
+        if (*have && seq == *last) {
+            dup = true;
+            p->rx_duplicates++;
+        } else {
+            if (*have && seq != (uint16_t)(*last + 1)) {
+                skipped = true;
+                p->rx_seq_gaps++;
+            }
+            *last = seq;
+            *have = true;
+            p->rx_frames++;
+        }
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    if (duplicate) *duplicate = dup;
+    if (gap) *gap = skipped;
+    if (role) *role = peer_role;
+    return authorized;
+}
+
+uint16_t espNowPeerNextTxSeq(const uint8_t* mac, uint8_t* frame_flags) {
+    uint16_t seq;
+    uint8_t flags = 0;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    if (memcmp(mac, broadcast_mac, 6) == 0) {
+        seq = bcast_tx_seq++;
+        flags = ESPNOW_FRAME_F_BROADCAST;
+    } else {
+        int idx = findPeerLocked(mac);
+        seq = idx >= 0 ? peers[idx].tx_seq++ : unlisted_tx_seq++;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    if (frame_flags) *frame_flags = flags;
+    return seq;
+}
+
+int getEspNowPeerCountByRole(EspNowPeerRole_t role) {
+    int count = 0;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].role == (uint8_t)role) count++;
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    return count;
+}
+
+bool getEspNowStatusDestination(uint8_t* mac_out) {
+    int subscribers = 0;
+    portENTER_CRITICAL(&esp_now_peers_mutex);
+    for (int i = 0; i < peer_count; i++) {
+        if (!(peers[i].subscriptions & ESP_NOW_SUB_STATUS) || !peers[i].registered) continue;
+        if (subscribers++ == 0) memcpy(mac_out, peers[i].mac, 6);
+    }
+    portEXIT_CRITICAL(&esp_now_peers_mutex);
+    // Несколько подписчиков - один широковещательный кадр вместо N адресных
+    if (subscribers > 1) memcpy(mac_out, broadcast_mac, 6);
+    return subscribers > 0;
+}
@@ -0,0 +1,63 @@
+#ifndef ESP_NOW_PEERS_H
+#define ESP_NOW_PEERS_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Таблица пиров ESP-NOW: экраны и пульты одного контроллера и соседние контроллеры кластера. Список авторизованных пиров (MAC, роль, подписки)
+// хранится в NVS; команды принимаются только от них. Статус уходит одним кадром: единственному подписчику -
+// адресно (с подтверждением и повторами), нескольким - широковещательно. Экран, заметивший пропуск номера
+// широковещательного кадра, просит ключевой кадр командой CMD_REQUEST_KEYFRAME.
+
+#define ESP_NOW_PEERS_NAMESPACE     "espnow_peers"
+#define ESP_NOW_PEERS_KEY           "table"
+#define ESP_NOW_PEER_TABLE_SIZE     (ESP_NOW_MAX_TOTAL_PEER_NUM - 1) // Один пир драйвера - широковещательный адрес
+#define ESP_NOW_PEER_ONLINE_MS      30000  // Пир на связи, если слышали его за это время
+
+#define ESP_NOW_SUB_STATUS          0x01   // Подписка на статус (ключевые кадры и дельты)
+
+typedef enum {
+    ESP_NOW_PEER_SCREEN = 0,
+    ESP_NOW_PEER_REMOTE = 1,
+    ESP_NOW_PEER_CONTROLLER = 2, // Соседний главный ESP32 (кластер, cluster_coordinator.h)
+} EspNowPeerRole_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t role;               // EspNowPeerRole_t
+    uint8_t subscriptions;      // ESP_NOW_SUB_*
+    bool registered;            // Добавлен в драйвер ESP-NOW
+    bool have_rx_seq;
+    bool have_rx_bcast_seq;
+    uint16_t last_rx_seq;       // Номера кадров у каждого пира свои: повторы и пропуски считаются по пиру,
+    uint16_t last_rx_bcast_seq; // отдельно для адресных и широковещательных (ESPNOW_FRAME_F_BROADCAST)
+    uint16_t tx_seq;            // Следующий номер адресного кадра этому пиру
+    unsigned long last_seen_ms; // 0 - с загрузки не появлялся
+    uint32_t rx_frames;
+    uint32_t rx_duplicates;
+    uint32_t rx_seq_gaps;
+} EspNowPeer_t;
+
+extern portMUX_TYPE esp_now_peers_mutex;
+
+// После loadConfig(): загрузка таблицы; пустая таблица заполняется экраном из config.remotePeerMacStr
+void initEspNowPeers();
+// Добавление в драйвер ESP-NOW всех пиров таблицы и широковещательного адреса. Возвращает число пиров в драйвере.
+int registerEspNowPeers();
+bool espNowPeerAdd(const uint8_t* mac, EspNowPeerRole_t role, uint8_t subscriptions); // С записью в NVS
+bool espNowPeerRemove(const uint8_t* mac);
+void resetEspNowPeers(); // Сброс к заводским: таблица очищается (после перезагрузки - экран из настроек)
+int getEspNowPeerCount();
+bool getEspNowPeer(int index, EspNowPeer_t* out);
+bool espNowPeerOnline(const EspNowPeer_t* peer);
+// Из задачи WiFi: кадр от mac с номером seq. false - пир не авторизован, иначе в *role - его роль.
+bool espNowPeerNoteRx(const uint8_t* mac, uint16_t seq, bool broadcast, bool* duplicate, bool* gap, uint8_t* role);
+// Номер следующего кадра на адрес mac (широковещательный - общий ряд) и флаги заголовка для него
+uint16_t espNowPeerNextTxSeq(const uint8_t* mac, uint8_t* frame_flags);
+int getEspNowPeerCountByRole(EspNowPeerRole_t role);
+// Адрес для статуса: false - подписчиков нет
+bool getEspNowStatusDestination(uint8_t* mac_out);
+bool parseEspNowMac(const char* str, uint8_t* mac_out); // "XX:XX:XX:XX:XX:XX"
+
+#endif // ESP_NOW_PEERS_H
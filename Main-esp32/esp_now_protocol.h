@@ -1,8 +1,12 @@
 #ifndef ESP_NOW_PROTOCOL_H
 #define ESP_NOW_PROTOCOL_H
-#include "error_handler.h" // Включаем для SystemErrorCode_t
+
+// Общий для главного ESP32 и экрана формат кадров ESP-NOW. Файл не зависит от остальной прошивки
+// (только stdint/string), поэтому один и тот же заголовок подключается в обе прошивки и собирается на хосте.
 
 #include <stdint.h> // Для uint8_t, uint16_t и т.д.
+#include <stddef.h> // Для size_t
+#include <string.h> // Для memcpy
 
 // --- Определения для ESP-NOW ---
 #define ESP_NOW_CHANNEL 1 // Канал должен быть одинаковым на обоих устройствах
@@ -16,12 +20,17 @@ typedef enum {
     CMD_RESUME = 4,
     CMD_STOP_PROCESS = 5, // Убедитесь, что это значение уникально
     CMD_ACK_ERROR = 6,    // Можно добавить, если ошибки требуют явного подтверждения с экрана
+    CMD_QUEUE_DOSE = 7,   // Поставить налив в очередь (value - объем, мл; уставка и скорость - текущие)
+    CMD_START_CONTINUOUS = 8, // Непрерывный налив до CMD_STOP_PROCESS (value - лимит, мл; 0 - без лимита)
+    CMD_REQUEST_KEYFRAME = 9, // Прислать полный статус (экран пропустил кадр или только что загрузился)
     // CMD_HEARTBEAT_SCREEN, // Опционально: для экрана, чтобы сигнализировать, что он жив
 } command_type_t;
 
-typedef struct struct_command {
-    command_type_t cmd_type;
-    int value; // Для температуры, объема или других данных
+// Полезная нагрузка ESPNOW_MSG_COMMAND. Все структуры на проводе упакованы и имеют поля фиксированной ширины
+// (little-endian, как у обоих ESP32): размер не зависит от компилятора и размера enum.
+typedef struct __attribute__((packed)) struct_command {
+    uint8_t cmd_type;  // command_type_t
+    int32_t value;     // Для температуры, объема или других данных
 } struct_command_t;
 
 // Состояния системы, отправляемые С ГЛАВНОГО ESP32 на ЭКРАН
@@ -42,17 +51,276 @@ typedef enum {
     // STATE_MAIN_ESP_REBOOTING, // Для отображения экраном "переподключение"
 } system_state_t;
 
-typedef struct struct_status {
+// Полезная нагрузка ESPNOW_MSG_STATUS
+typedef struct __attribute__((packed)) struct_status {
     float current_temperature_out; // Температура на выходе (tOut)
     float current_temperature_in;  // Температура на входе (tIn), если есть
-    int current_volume_ml;         // Текущий налитый объем во время FILLING
-    int target_volume_ml;          // Целевой объем для текущего цикла
-    system_state_t system_state;
-    SystemErrorCode_t error_code; // Используем тип из error_handler.h
-    int current_setpoint_temperature; // Подтвержденная/текущая уставка температуры
-    int current_setpoint_volume;      // Подтвержденная/текущая уставка объема
+    int32_t current_volume_ml;     // Текущий налитый объем во время FILLING
+    int32_t target_volume_ml;      // Целевой объем для текущего цикла
+    uint8_t system_state;          // system_state_t
+    uint8_t reserved;
+    uint16_t error_code;           // SystemErrorCode_t
+    int32_t current_setpoint_temperature; // Подтвержденная/текущая уставка температуры
+    int32_t current_setpoint_volume;      // Подтвержденная/текущая уставка объема
     uint32_t uptime_seconds;      // Опционально: для отображения времени работы главного модуля
     char version_main_esp[16];    // Опционально: для отображения версии прошивки главного модуля
 } struct_status_t;
 
+// --- Кластер: несколько главных ESP32 рядом (логика - в cluster_core.h) ---
+#define ESPNOW_CLUSTER_F_IDLE          0x01 // Автомат дозирования в IDLE, питание включено, ошибок нет
+#define ESPNOW_CLUSTER_F_COMPRESSOR_ON 0x02
+#define ESPNOW_CLUSTER_F_START_PENDING 0x04 // Ждет разрешения лидера на пуск компрессора
+#define ESPNOW_CLUSTER_F_LEADER        0x08 // Отправитель считает себя лидером
+#define ESPNOW_CLUSTER_TEMP_UNKNOWN    INT16_MIN
+#define ESPNOW_CLUSTER_AGE_UNKNOWN     0xFFFF
+
+// Полезная нагрузка ESPNOW_MSG_CLUSTER_HEARTBEAT (раз в секунду и при изменении флагов)
+typedef struct __attribute__((packed)) struct_cluster_heartbeat {
+    uint8_t flags;                 // ESPNOW_CLUSTER_F_*
+    uint8_t queue_len;             // Заданий в очереди дозирования
+    int16_t line_temp_c100;        // T_out, сотые °C (ESPNOW_CLUSTER_TEMP_UNKNOWN - датчик не готов)
+    int16_t setpoint_c100;         // Уставка, сотые °C
+    uint16_t compressor_start_age_s; // С последнего пуска компрессора (ESPNOW_CLUSTER_AGE_UNKNOWN - не было или давно)
+    uint16_t start_wait_s;         // Сколько ждет разрешения на пуск
+    uint8_t grant_mac[6];          // Лидер: кому сейчас разрешен пуск (нули - никому)
+    uint32_t uptime_seconds;
+} struct_cluster_heartbeat_t;
+
+// Полезная нагрузка ESPNOW_MSG_CLUSTER_JOB
+typedef struct __attribute__((packed)) struct_cluster_job {
+    uint32_t job_id;               // Номер задания у отправителя (для журнала)
+    int32_t volume_ml;
+    int16_t temp_setpoint_c100;    // Всегда ESPNOW_CLUSTER_TEMP_UNKNOWN: получатель держит свою уставку
+    int16_t motor_speed;           // 0 - скорость получателя
+    uint8_t channel_mask;
+    uint8_t reserved[3];
+} struct_cluster_job_t;
+
+// Полезная нагрузка ESPNOW_MSG_CLUSTER_JOB_REPLY: ответ получателя задания после постановки в свою очередь.
+// Подтверждение MAC-уровня значит только "кадр принят радио"; задание считается переданным по этому ответу.
+typedef struct __attribute__((packed)) struct_cluster_job_reply {
+    uint32_t job_id;               // Из struct_cluster_job_t
+    uint8_t accepted;              // 1 - в очереди получателя, 0 - отклонено (очередь или прием полны)
+    uint8_t reserved[3];
+} struct_cluster_job_reply_t;
+
+// --- Кадр ---
+// [заголовок 8 байт][полезная нагрузка len байт][CRC16 2 байта]
+// CRC-16/CCITT-FALSE (полином 0x1021, начальное значение 0xFFFF) по заголовку и нагрузке.
+// Версия меняется только при несовместимом изменении; новые поля дописываются в конец нагрузки,
+// а декодер принимает нагрузку не короче известной ему структуры (хвост игнорируется).
+
+#define ESPNOW_FRAME_MAGIC       0xA5
+#define ESPNOW_PROTOCOL_VERSION  1
+#define ESPNOW_FRAME_MAX_LEN     250 // ESP_NOW_MAX_DATA_LEN
+
+typedef enum {
+    ESPNOW_MSG_COMMAND = 1, // Экран -> главный: struct_command_t
+    ESPNOW_MSG_STATUS  = 2, // Главный -> экран: struct_status_t (ключевой кадр)
+    ESPNOW_MSG_STATUS_DELTA = 3, // Главный -> экран: изменившиеся поля struct_status_t
+    ESPNOW_MSG_CLUSTER_HEARTBEAT = 4, // Главный -> главные (широковещательно): struct_cluster_heartbeat_t
+    ESPNOW_MSG_CLUSTER_JOB = 5,       // Главный -> главный: struct_cluster_job_t (переданное задание налива)
+    ESPNOW_MSG_CLUSTER_JOB_REPLY = 6, // Главный -> главный: struct_cluster_job_reply_t (принято/отклонено)
+} espnow_msg_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;    // ESPNOW_FRAME_MAGIC
+    uint8_t version;  // ESPNOW_PROTOCOL_VERSION
+    uint8_t type;     // espnow_msg_type_t
+    uint8_t flags;    // ESPNOW_FRAME_F_*
+    uint16_t seq;     // Номер кадра отправителя (счетчик по модулю 2^16, свой для каждого получателя)
+    uint16_t len;     // Длина полезной нагрузки
+} espnow_frame_header_t;
+
+// Номер взят из счетчика широковещательных кадров отправителя. Адресные кадры нумеруются отдельно для
+// каждого получателя, поэтому приемник ведет два ряда номеров на пира и не видит в них чужих пропусков.
+#define ESPNOW_FRAME_F_BROADCAST 0x01
+
+#define ESPNOW_FRAME_OVERHEAD    (sizeof(espnow_frame_header_t) + sizeof(uint16_t))
+#define ESPNOW_MAX_PAYLOAD_LEN   (ESPNOW_FRAME_MAX_LEN - ESPNOW_FRAME_OVERHEAD)
+
+typedef enum {
+    ESPNOW_FRAME_OK = 0,
+    ESPNOW_FRAME_ERR_SHORT,    // Короче заголовка или нагрузки с CRC
+    ESPNOW_FRAME_ERR_MAGIC,
+    ESPNOW_FRAME_ERR_VERSION,
+    ESPNOW_FRAME_ERR_CRC,
+    ESPNOW_FRAME_ERR_TYPE,     // Не тот тип сообщения
+    ESPNOW_FRAME_ERR_PAYLOAD,  // Нагрузка короче структуры сообщения
+} espnow_frame_result_t;
+
+static inline uint16_t espNowCrc16(uint16_t crc, const uint8_t* data, size_t len) {
+    while (len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Дописывает заголовок и CRC вокруг нагрузки, уже лежащей в buf сразу после места под заголовок.
+// Вызывающий проверяет, что буфер вмещает ESPNOW_FRAME_OVERHEAD + payload_len.
+static inline size_t espNowFinishFrame(uint8_t type, uint16_t seq, size_t payload_len, uint8_t* buf) {
+    espnow_frame_header_t hdr;
+    hdr.magic = ESPNOW_FRAME_MAGIC;
+    hdr.version = ESPNOW_PROTOCOL_VERSION;
+    hdr.type = type;
+    hdr.flags = 0;
+    hdr.seq = seq;
+    hdr.len = (uint16_t)payload_len;
+    memcpy(buf, &hdr, sizeof(hdr));
+    uint16_t crc = espNowCrc16(0xFFFF, buf, sizeof(hdr) + payload_len);
+    memcpy(buf + sizeof(hdr) + payload_len, &crc, sizeof(crc));
+    return ESPNOW_FRAME_OVERHEAD + payload_len;
+}
+
+// Перенумеровывает готовый кадр (номер назначается при первой передаче, а не при сборке) и пересчитывает CRC
+static inline void espNowSetFrameSeq(uint8_t* buf, size_t frame_len, uint16_t seq, uint8_t flags) {
+    if (!buf || frame_len < ESPNOW_FRAME_OVERHEAD) return;
+    buf[offsetof(espnow_frame_header_t, flags)] = flags;
+    memcpy(buf + offsetof(espnow_frame_header_t, seq), &seq, sizeof(seq));
+    uint16_t crc = espNowCrc16(0xFFFF, buf, frame_len - sizeof(crc));
+    memcpy(buf + frame_len - sizeof(crc), &crc, sizeof(crc));
+}
+
+// Собирает кадр прямо в буфер отправки. Возвращает длину кадра или 0, если буфер мал.
+static inline size_t espNowEncodeFrame(uint8_t type, uint16_t seq, const void* payload, size_t payload_len,
+                                       uint8_t* buf, size_t buf_size) {
+    if (!buf || payload_len > ESPNOW_MAX_PAYLOAD_LEN || buf_size < ESPNOW_FRAME_OVERHEAD + payload_len) return 0;
+    if (payload_len) memcpy(buf + sizeof(espnow_frame_header_t), payload, payload_len);
+    return espNowFinishFrame(type, seq, payload_len, buf);
+}
+
+// Проверяет кадр без копирования: заголовок копируется в hdr, *payload указывает внутрь buf.
+static inline espnow_frame_result_t espNowDecodeFrame(const uint8_t* buf, size_t len, espnow_frame_header_t* hdr,
+                                                      const uint8_t** payload) {
+    if (!buf || len < ESPNOW_FRAME_OVERHEAD) return ESPNOW_FRAME_ERR_SHORT;
+    memcpy(hdr, buf, sizeof(*hdr));
+    if (hdr->magic != ESPNOW_FRAME_MAGIC) return ESPNOW_FRAME_ERR_MAGIC;
+    if (hdr->version != ESPNOW_PROTOCOL_VERSION) return ESPNOW_FRAME_ERR_VERSION;
+    if (hdr->len > ESPNOW_MAX_PAYLOAD_LEN || len < ESPNOW_FRAME_OVERHEAD + hdr->len) return ESPNOW_FRAME_ERR_SHORT;
+    uint16_t crc;
+    memcpy(&crc, buf + sizeof(*hdr) + hdr->len, sizeof(crc));
+    if (crc != espNowCrc16(0xFFFF, buf, sizeof(*hdr) + hdr->len)) return ESPNOW_FRAME_ERR_CRC;
+    if (payload) *payload = buf + sizeof(*hdr);
+    return ESPNOW_FRAME_OK;
+}
+
+static inline const char* espNowFrameResultName(espnow_frame_result_t r) {
+    switch (r) {
+        case ESPNOW_FRAME_OK:          return "ok";
+        case ESPNOW_FRAME_ERR_SHORT:   return "short";
+        case ESPNOW_FRAME_ERR_MAGIC:   return "magic";
+        case ESPNOW_FRAME_ERR_VERSION: return "version";
+        case ESPNOW_FRAME_ERR_CRC:     return "crc";
+        case ESPNOW_FRAME_ERR_TYPE:    return "type";
+        case ESPNOW_FRAME_ERR_PAYLOAD: return "payload";
+    }
+    return "?";
+}
+
+// --- Типизированные кодеки ---
+// Таблица сообщений: для каждой строки генерируются espNowEncode<Name>() и espNowDecode<Name>().
+// Новое сообщение - новый тип в espnow_msg_type_t и строка здесь.
+#define ESPNOW_MESSAGES(X) \
+    X(Command, ESPNOW_MSG_COMMAND, struct_command_t) \
+    X(Status,  ESPNOW_MSG_STATUS,  struct_status_t) \
+    X(ClusterHeartbeat, ESPNOW_MSG_CLUSTER_HEARTBEAT, struct_cluster_heartbeat_t) \
+    X(ClusterJob,       ESPNOW_MSG_CLUSTER_JOB,       struct_cluster_job_t) \
+    X(ClusterJobReply,  ESPNOW_MSG_CLUSTER_JOB_REPLY, struct_cluster_job_reply_t)
+
+#define ESPNOW_DEFINE_CODEC(Name, TypeId, PayloadT)                                                          \
+    static inline size_t espNowEncode##Name(uint16_t seq, const PayloadT* msg, uint8_t* buf, size_t buf_size) { \
+        return espNowEncodeFrame(TypeId, seq, msg, sizeof(PayloadT), buf, buf_size);                         \
+    }                                                                                                         \
+    static inline espnow_frame_result_t espNowDecode##Name(const espnow_frame_header_t* hdr,                  \
+                                                           const uint8_t* payload, PayloadT* out) {          \
+        if (hdr->type != TypeId) return ESPNOW_FRAME_ERR_TYPE;                                               \
+        if (hdr->len < sizeof(PayloadT)) return ESPNOW_FRAME_ERR_PAYLOAD;                                    \
+        memcpy(out, payload, sizeof(PayloadT));                                                              \
+        return ESPNOW_FRAME_OK;                                                                              \
+    }
+
+ESPNOW_MESSAGES(ESPNOW_DEFINE_CODEC)
+#undef ESPNOW_DEFINE_CODEC
+
+// --- Дельта статуса ---
+// Нагрузка ESPNOW_MSG_STATUS_DELTA: uint16_t маска полей, затем значения отмеченных полей в порядке битов.
+// Дельта отсчитывается от предыдущего отправленного статуса (ключевого кадра или дельты), поэтому экран,
+// заметивший пропуск номера, ждет следующего ключевого кадра или просит его командой CMD_REQUEST_KEYFRAME.
+// Новые поля получают следующие биты; неизвестные декодеру старшие биты лежат в конце и игнорируются.
+
+#define ESPNOW_STATUS_F_TEMP_OUT      (1u << 0)
+#define ESPNOW_STATUS_F_TEMP_IN       (1u << 1)
+#define ESPNOW_STATUS_F_VOLUME        (1u << 2)
+#define ESPNOW_STATUS_F_TARGET_VOLUME (1u << 3)
+#define ESPNOW_STATUS_F_STATE         (1u << 4)
+#define ESPNOW_STATUS_F_ERROR         (1u << 5)
+#define ESPNOW_STATUS_F_SETPOINT_TEMP (1u << 6)
+#define ESPNOW_STATUS_F_SETPOINT_VOL  (1u << 7)
+#define ESPNOW_STATUS_F_UPTIME        (1u << 8)
+#define ESPNOW_STATUS_F_VERSION       (1u << 9)
+
+#define ESPNOW_STATUS_FIELDS(X) \
+    X(ESPNOW_STATUS_F_TEMP_OUT,      current_temperature_out) \
+    X(ESPNOW_STATUS_F_TEMP_IN,       current_temperature_in) \
+    X(ESPNOW_STATUS_F_VOLUME,        current_volume_ml) \
+    X(ESPNOW_STATUS_F_TARGET_VOLUME, target_volume_ml) \
+    X(ESPNOW_STATUS_F_STATE,         system_state) \
+    X(ESPNOW_STATUS_F_ERROR,         error_code) \
+    X(ESPNOW_STATUS_F_SETPOINT_TEMP, current_setpoint_temperature) \
+    X(ESPNOW_STATUS_F_SETPOINT_VOL,  current_setpoint_volume) \
+    X(ESPNOW_STATUS_F_UPTIME,        uptime_seconds) \
+    X(ESPNOW_STATUS_F_VERSION,       version_main_esp)
+
+#define ESPNOW_STATUS_FIELD_SIZE(field) sizeof(((struct_status_t*)0)->field)
+
+// Длина нагрузки дельты с полями mask
+static inline size_t espNowStatusDeltaPayloadLen(uint16_t mask) {
+    size_t len = sizeof(uint16_t);
+#define ESPNOW_FIELD_LEN(bit, field) if (mask & (bit)) len += ESPNOW_STATUS_FIELD_SIZE(field);
+    ESPNOW_STATUS_FIELDS(ESPNOW_FIELD_LEN)
+#undef ESPNOW_FIELD_LEN
+    return len;
+}
+
+// Собирает дельту прямо в буфер отправки: поля mask берутся из status. Возвращает длину кадра или 0.
+static inline size_t espNowEncodeStatusDelta(uint16_t seq, const struct_status_t* status, uint16_t mask,
+                                             uint8_t* buf, size_t buf_size) {
+    size_t payload_len = espNowStatusDeltaPayloadLen(mask);
+    if (!buf || buf_size < ESPNOW_FRAME_OVERHEAD + payload_len) return 0;
+    uint8_t* p = buf + sizeof(espnow_frame_header_t);
+    memcpy(p, &mask, sizeof(mask));
+    p += sizeof(mask);
+#define ESPNOW_FIELD_PUT(bit, field)                                                                   \
+    if (mask & (bit)) {                                                                                \
+        memcpy(p, (const uint8_t*)status + offsetof(struct_status_t, field), ESPNOW_STATUS_FIELD_SIZE(field)); \
+        p += ESPNOW_STATUS_FIELD_SIZE(field);                                                          \
+    }
+    ESPNOW_STATUS_FIELDS(ESPNOW_FIELD_PUT)
+#undef ESPNOW_FIELD_PUT
+    return espNowFinishFrame(ESPNOW_MSG_STATUS_DELTA, seq, payload_len, buf);
+}
+
+// Применяет проверенную espNowDecodeFrame() дельту к состоянию экрана. Состояние меняется, только если
+// нагрузка вмещает все известные отмеченные поля.
+static inline espnow_frame_result_t espNowApplyStatusDelta(const espnow_frame_header_t* hdr, const uint8_t* payload,
+                                                           struct_status_t* state) {
+    if (hdr->type != ESPNOW_MSG_STATUS_DELTA) return ESPNOW_FRAME_ERR_TYPE;
+    uint16_t mask;
+    if (hdr->len < sizeof(mask)) return ESPNOW_FRAME_ERR_PAYLOAD;
+    memcpy(&mask, payload, sizeof(mask));
+    if (hdr->len < espNowStatusDeltaPayloadLen(mask)) return ESPNOW_FRAME_ERR_PAYLOAD;
+    const uint8_t* p = payload + sizeof(mask);
+#define ESPNOW_FIELD_GET(bit, field)                                                                   \
+    if (mask & (bit)) {                                                                                \
+        memcpy((uint8_t*)state + offsetof(struct_status_t, field), p, ESPNOW_STATUS_FIELD_SIZE(field)); \
+        p += ESPNOW_STATUS_FIELD_SIZE(field);                                                          \
+    }
+    ESPNOW_STATUS_FIELDS(ESPNOW_FIELD_GET)
+#undef ESPNOW_FIELD_GET
+    return ESPNOW_FRAME_OK;
+}
+
 #endif // ESP_NOW_PROTOCOL_H
@@ -0,0 +1,288 @@
+#include "esp_now_tx.h"
+#include "error_handler.h" // Для setSystemError, WARN_ESP_NOW_SEND_FAIL
+#include "localization.h"  // Для _T(), L_WARN_ESPNOW_SEND_FAIL_AFTER_RETRIES
+#include "main.h"          // Для функций логирования
+#include "esp_err.h"       // Для esp_err_to_name
+#include "esp_now_peers.h" // Для espNowPeerNextTxSeq
+#include <string.h>
+
+portMUX_TYPE esp_now_tx_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct {
+    bool used;
+    bool in_flight;
+    bool seq_assigned;
+    uint8_t prio;
+    uint8_t coalesce_key;
+    uint8_t attempts;
+    uint8_t len;
+    uint8_t peer[6];
+    uint32_t id;
+    unsigned long not_before_ms;
+    EspNowTxDoneCallback_t done;
+    void* arg;
+    uint8_t frame[ESPNOW_FRAME_MAX_LEN];
+} EspNowTxEntry_t;
+
+static EspNowTxEntry_t tx_queue[ESP_NOW_TX_QUEUE_SIZE];
+static int tx_in_flight = -1;           // Индекс кадра в эфире
+static unsigned long tx_sent_ms = 0;
+static bool tx_cb_done = false;         // Результат от драйвера получен (onEspNowSend)
+static bool tx_cb_ok = false;
+// Попытки, закрытые по таймауту: драйвер все равно сообщит их результат, и по MAC его не отличить
+// от результата следующей попытки тому же пиру. Результаты приходят в порядке передач, поэтому
+// первые tx_cb_owed обратных вызовов после таймаута относятся к закрытым попыткам.
+static uint8_t tx_cb_owed = 0;
+static unsigned long tx_cb_owed_ms = 0;
+static uint32_t tx_next_id = 1;
+static EspNowTxStats_t tx_stats = {};
+
+// Корзина эфирного времени (только из loop)
+static int32_t airtime_tokens_us = ESP_NOW_AIRTIME_BURST_US;
+static unsigned long airtime_refill_ms = 0;
+static int32_t airtime_extra_us_per_s = 0;
+
+int32_t espNowAirtimeUs(size_t frame_len) {
+    return ESP_NOW_AIR_PREAMBLE_US + (int32_t)(ESP_NOW_AIR_MAC_OVERHEAD_BYTES + frame_len) * 8 + ESP_NOW_AIR_ACK_US;
+}
+
+static void refillAirtimeBudget(unsigned long now) {
+    // Бюджет: полный статус раз в ESP_NOW_LEGACY_STATUS_INTERVAL_MS
+    static const int32_t budget_us_per_s =
+        espNowAirtimeUs(ESPNOW_FRAME_OVERHEAD + sizeof(struct_status_t)) * 1000 / ESP_NOW_LEGACY_STATUS_INTERVAL_MS;
+    unsigned long elapsed = now - airtime_refill_ms;
+    if (elapsed < 100) return;
+    airtime_refill_ms = now;
+    int64_t tokens = (int64_t)airtime_tokens_us + (int64_t)elapsed * (budget_us_per_s + airtime_extra_us_per_s) / 1000;
+    airtime_tokens_us = tokens > ESP_NOW_AIRTIME_BURST_US ? ESP_NOW_AIRTIME_BURST_US : (int32_t)tokens;
+}
+
+bool espNowTxAirtimeAvailable(size_t frame_len) {
+    refillAirtimeBudget(millis());
+    return airtime_tokens_us >= espNowAirtimeUs(frame_len);
+}
+
+void espNowTxSetExtraAirtime(int32_t us_per_s) {
+    airtime_extra_us_per_s = us_per_s > 0 ? us_per_s : 0;
+}
+
+static void chargeAirtime(size_t frame_len) {
+    airtime_tokens_us -= espNowAirtimeUs(frame_len);
+    if (airtime_tokens_us < -ESP_NOW_AIRTIME_BURST_US) airtime_tokens_us = -ESP_NOW_AIRTIME_BURST_US;
+}
+
+static uint8_t queueDepthLocked() {
+    uint8_t depth = 0;
+    for (int i = 0; i < ESP_NOW_TX_QUEUE_SIZE; i++) {
+        if (tx_queue[i].used) depth++;
+    }
+    return depth;
+}
+
+uint32_t espNowTxEnqueue(const uint8_t* peer, const uint8_t* frame, size_t len, EspNowTxPriority_t prio,
+                         uint8_t coalesce_key, EspNowTxDoneCallback_t done, void* arg) {
+    if (!peer || !frame || len == 0 || len > ESPNOW_FRAME_MAX_LEN) return 0;
+
+    // Вытесненная/замененная заявка: ее обработчик вызывается вне критической секции
+    EspNowTxEntry_t dropped;
+    EspNowTxResult_t dropped_result = ESP_NOW_TX_SUPERSEDED;
+    bool have_dropped = false;
+    uint32_t id = 0;
+
+    portENTER_CRITICAL(&esp_now_tx_mutex);
+    int slot = -1;
+    if (coalesce_key != ESP_NOW_TX_KEY_NONE) {
+        for (int i = 0; i < ESP_NOW_TX_QUEUE_SIZE; i++) {
+            EspNowTxEntry_t* e = &tx_queue[i];
+            if (e->used && !e->in_flight && e->coalesce_key == coalesce_key && memcmp(e->peer, peer, 6) == 0) {
+                slot = i;
+                tx_stats.coalesced++;
+                break;
+            }
+        }
+    }
+    if (slot < 0) {
+        for (int i = 0; i < ESP_NOW_TX_QUEUE_SIZE; i++) {
+            if (!tx_queue[i].used) { slot = i; break; }
+        }
+    }
+    if (slot < 0) {
+        // Очередь полна: вытесняем самую новую заявку с наименьшим приоритетом, если он ниже нового
+        for (int i = 0; i < ESP_NOW_TX_QUEUE_SIZE; i++) {
+            EspNowTxEntry_t* e = &tx_queue[i];
+            if (e->in_flight || e->prio >= (uint8_t)prio) continue;
+            if (slot < 0 || e->prio < tx_queue[slot].prio ||
+                (e->prio == tx_queue[slot].prio && e->id > tx_queue[slot].id)) {
+                slot = i;
+            }
+        }
+        if (slot >= 0) {
+            dropped_result = ESP_NOW_TX_EVICTED;
+            tx_stats.evicted++;
+        }
+    }
+    if (slot >= 0) {
+        EspNowTxEntry_t* e = &tx_queue[slot];
+        if (e->used) {
+            dropped = *e;
+            have_dropped = true;
+        }
+        id = tx_next_id++;
+        if (tx_next_id == 0) tx_next_id = 1;
+        e->used = true;
+        e->in_flight = false;
+        e->seq_assigned = false;
+        e->prio = (uint8_t)prio;
+        e->coalesce_key = coalesce_key;
+        e->attempts = 0;
+        e->len = (uint8_t)len;
+        memcpy(e->peer, peer, 6);
+        e->id = id;
+        e->not_before_ms = 0;
+        e->done = done;
+        e->arg = arg;
+        memcpy(e->frame, frame, len);
+        tx_stats.enqueued++;
+        tx_stats.depth = queueDepthLocked();
+        if (tx_stats.depth > tx_stats.max_depth) tx_stats.max_depth = tx_stats.depth;
+    } else {
+        tx_stats.rejected++;
+    }
+    portEXIT_CRITICAL(&esp_now_tx_mutex);
+
+    if (have_dropped && dropped.done) {
+        dropped.done(dropped.id, dropped_result, dropped.frame, dropped.len, dropped.arg);
+    }
+    if (id == 0) {
+        app_log_w("ESPNOW_TX", "TX queue full, frame (prio %d) rejected.", (int)prio);
+    }
+    return id;
+}
+
+void espNowTxOnSendComplete(const uint8_t* mac_addr, esp_now_send_status_t status) {
+    portENTER_CRITICAL(&esp_now_tx_mutex);
+    if (tx_cb_owed > 0) {
+        tx_cb_owed--;
+        tx_stats.late_callbacks++;
+    } else if (tx_in_flight >= 0 && !tx_cb_done && mac_addr && memcmp(mac_addr, tx_queue[tx_in_flight].peer, 6) == 0) {
+        tx_cb_ok = (status == ESP_NOW_SEND_SUCCESS);
+        tx_cb_done = true;
+    }
+    portEXIT_CRITICAL(&esp_now_tx_mutex);
+}
+
+// Завершение кадра в эфире: доставлен, повтор с паузой или отказ после всех попыток
+static void completeInFlight(unsigned long now) {
+    EspNowTxEntry_t finished;
+    bool have_finished = false;
+    EspNowTxResult_t result = ESP_NOW_TX_DELIVERED;
+
+    portENTER_CRITICAL(&esp_now_tx_mutex);
+    if (tx_in_flight < 0) {
+        portEXIT_CRITICAL(&esp_now_tx_mutex);
+        return;
+    }
+    EspNowTxEntry_t* e = &tx_queue[tx_in_flight];
+    bool ok;
+    if (tx_cb_done) {
+        ok = tx_cb_ok;
+    } else if (now - tx_sent_ms >= ESP_NOW_TX_CB_TIMEOUT_MS) {
+        ok = false;
+        tx_stats.cb_timeouts++;
+        if (tx_cb_owed < UINT8_MAX) tx_cb_owed++;
+        tx_cb_owed_ms = now;
+    } else {
+        portEXIT_CRITICAL(&esp_now_tx_mutex);
+        return;
+    }
+    tx_in_flight = -1;
+    tx_cb_done = false;
+    e->in_flight = false;
+    if (ok) {
+        tx_stats.delivered++;
+        result = ESP_NOW_TX_DELIVERED;
+    } else if (e->attempts < ESP_NOW_TX_MAX_ATTEMPTS) {
+        tx_stats.retries++;
+        e->not_before_ms = now + ((unsigned long)ESP_NOW_TX_BACKOFF_MS << (e->attempts - 1));
+    } else {
+        tx_stats.failed++;
+        result = ESP_NOW_TX_FAILED;
+    }
+    if (ok || e->attempts >= ESP_NOW_TX_MAX_ATTEMPTS) {
+        finished = *e;
+        have_finished = true;
+        e->used = false;
+        tx_stats.depth = queueDepthLocked();
+    }
+    portEXIT_CRITICAL(&esp_now_tx_mutex);
+
+    if (!have_finished) return;
+    if (result == ESP_NOW_TX_FAILED) {
+        app_log_e("ESPNOW_TX", "Frame %lu not delivered after %d attempts.", (unsigned long)finished.id, ESP_NOW_TX_MAX_ATTEMPTS);
+        setSystemError(WARN_ESP_NOW_SEND_FAIL, _T(L_WARN_ESPNOW_SEND_FAIL_AFTER_RETRIES));
+    }
+    if (finished.done) finished.done(finished.id, result, finished.frame, finished.len, finished.arg);
+}
+
+void handleEspNowTx() {
+    unsigned long now = millis();
+    refillAirtimeBudget(now);
+    completeInFlight(now);
+
+    // Следующий кадр: высший приоритет, внутри приоритета - старший по очереди
+    portENTER_CRITICAL(&esp_now_tx_mutex);
+    // Драйвер так и не ответил на закрытую попытку - не отбрасываем из-за нее результаты новых
+    if (tx_cb_owed > 0 && now - tx_cb_owed_ms >= ESP_NOW_TX_LATE_CB_WINDOW_MS) tx_cb_owed = 0;
+    if (tx_in_flight >= 0) {
+        portEXIT_CRITICAL(&esp_now_tx_mutex);
+        return;
+    }
+    int next = -1;
+    for (int i = 0; i < ESP_NOW_TX_QUEUE_SIZE; i++) {
+        EspNowTxEntry_t* e = &tx_queue[i];
+        if (!e->used || (long)(now - e->not_before_ms) < 0) continue;
+        if (next < 0 || e->prio > tx_queue[next].prio ||
+            (e->prio == tx_queue[next].prio && (int32_t)(e->id - tx_queue[next].id) < 0)) {
+            next = i;
+        }
+    }
+    if (next < 0) {
+        portEXIT_CRITICAL(&esp_now_tx_mutex);
+        return;
+    }
+    EspNowTxEntry_t* e = &tx_queue[next];
+    e->in_flight = true;
+    e->attempts++;
+    bool assign_seq = !e->seq_assigned;
+    e->seq_assigned = true;
+    tx_in_flight = next;
+    tx_cb_done = false;
+    tx_sent_ms = now;
+    tx_stats.sent++;
+    portEXIT_CRITICAL(&esp_now_tx_mutex);
+
+    // Кадр в эфире не меняется (объединение его пропускает), поэтому буфер читается без блокировки
+    if (assign_seq) {
+        uint8_t flags;
+        uint16_t seq = espNowPeerNextTxSeq(e->peer, &flags); // Ряд номеров получателя (таблица пиров)
+        espNowSetFrameSeq(e->frame, e->len, seq, flags);
+    }
+    chargeAirtime(e->len);
+    esp_err_t result = esp_now_send(e->peer, e->frame, e->len);
+    if (result != ESP_OK) {
+        app_log_w("ESPNOW_TX", "esp_now_send failed (attempt %d/%d): %s", e->attempts, ESP_NOW_TX_MAX_ATTEMPTS, esp_err_to_name(result));
+        // Драйвер кадр не принял и результата не пришлет: попытка закрывается на следующем проходе loop
+        portENTER_CRITICAL(&esp_now_tx_mutex);
+        tx_cb_ok = false;
+        tx_cb_done = true;
+        portEXIT_CRITICAL(&esp_now_tx_mutex);
+    }
+}
+
+void getEspNowTxStats(EspNowTxStats_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&esp_now_tx_mutex);
+    *out = tx_stats;
+    portEXIT_CRITICAL(&esp_now_tx_mutex);
+    out->airtime_tokens_us = airtime_tokens_us;
+}
@@ -0,0 +1,79 @@
+#ifndef ESP_NOW_TX_H
+#define ESP_NOW_TX_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+#include "esp_now_protocol.h"  // Для ESPNOW_FRAME_MAX_LEN
+
+// Очередь передачи ESP-NOW. Постановка в очередь не блокирует и безопасна из любой задачи; передачу ведет
+// handleEspNowTx() из loop: в эфире всегда один кадр, результат доставки приходит в onEspNowSend,
+// неудача повторяется с удвоением паузы. Кадры с одинаковым ключом объединения заменяют еще не отправленный
+// кадр (устаревший статус не ждет своей очереди). Номер кадра назначается при первой передаче из ряда
+// получателя (espNowPeerNextTxSeq), повторы идут с тем же номером - приемник отбрасывает дубликаты.
+
+#define ESP_NOW_TX_QUEUE_SIZE       8
+#define ESP_NOW_TX_MAX_ATTEMPTS     4
+#define ESP_NOW_TX_BACKOFF_MS       20     // Пауза перед повтором: 20, 40, 80 мс
+#define ESP_NOW_TX_CB_TIMEOUT_MS    100    // Нет результата от драйвера - попытка считается неудачной
+#define ESP_NOW_TX_LATE_CB_WINDOW_MS 1000  // Столько после таймаута ждем опоздавший результат закрытой попытки
+
+#define ESP_NOW_TX_KEY_NONE         0      // Без объединения
+#define ESP_NOW_TX_KEY_STATUS       1      // Статус на экран (ключевой кадр или дельта)
+#define ESP_NOW_TX_KEY_CLUSTER      2      // Heartbeat кластера
+
+// Бюджет эфира (все кадры, включая повторы): в среднем не больше прежнего полного статуса каждые 2 с
+// (плюс надбавка espNowTxSetExtraAirtime() для heartbeat кластера).
+// Корзина накапливается, пока ничего не меняется, и тратится всплеском во время налива.
+#define ESP_NOW_LEGACY_STATUS_INTERVAL_MS   2000
+#define ESP_NOW_AIRTIME_BURST_US            150000 // ~15 с дельт на 10 Гц
+#define ESP_NOW_AIR_PREAMBLE_US             192    // Длинная преамбула 802.11b, 1 Мбит/с
+#define ESP_NOW_AIR_MAC_OVERHEAD_BYTES      43     // MAC-заголовок, категория/OUI, vendor IE, FCS
+#define ESP_NOW_AIR_ACK_US                  304    // Подтверждение unicast-кадра
+
+typedef enum {
+    ESP_NOW_TX_PRIO_LOW = 0,    // Дельты статуса
+    ESP_NOW_TX_PRIO_NORMAL,     // Ключевые кадры, прочие данные
+    ESP_NOW_TX_PRIO_HIGH,
+} EspNowTxPriority_t;
+
+typedef enum {
+    ESP_NOW_TX_DELIVERED = 0,
+    ESP_NOW_TX_FAILED,          // Исчерпаны попытки
+    ESP_NOW_TX_SUPERSEDED,      // Заменен более свежим кадром с тем же ключом
+    ESP_NOW_TX_EVICTED,         // Вытеснен из полной очереди кадром с большим приоритетом
+} EspNowTxResult_t;
+
+// Вызывается из handleEspNowTx() или, для замененного/вытесненного кадра, из espNowTxEnqueue() в задаче вызывающего;
+// frame - кадр в том виде, в каком он ушел (с назначенным номером)
+typedef void (*EspNowTxDoneCallback_t)(uint32_t id, EspNowTxResult_t result, const uint8_t* frame, size_t len, void* arg);
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t rejected;          // Очередь полна, приоритет не выше имеющихся
+    uint32_t coalesced;
+    uint32_t evicted;
+    uint32_t sent;              // Попытки передачи
+    uint32_t delivered;
+    uint32_t retries;
+    uint32_t failed;
+    uint32_t cb_timeouts;
+    uint32_t late_callbacks;    // Результат пришел после таймаута и отброшен
+    uint8_t depth;
+    uint8_t max_depth;
+    int32_t airtime_tokens_us;
+} EspNowTxStats_t;
+
+extern portMUX_TYPE esp_now_tx_mutex;
+
+// Возвращает номер заявки (не 0) или 0, если кадр не принят
+uint32_t espNowTxEnqueue(const uint8_t* peer, const uint8_t* frame, size_t len, EspNowTxPriority_t prio,
+                         uint8_t coalesce_key, EspNowTxDoneCallback_t done, void* arg);
+void espNowTxOnSendComplete(const uint8_t* mac_addr, esp_now_send_status_t status); // Из onEspNowSend (задача WiFi)
+void handleEspNowTx(); // Вызывается из loop()
+int32_t espNowAirtimeUs(size_t frame_len);          // Оценка эфирного времени кадра
+bool espNowTxAirtimeAvailable(size_t frame_len);    // Хватает ли бюджета на кадр
+void espNowTxSetExtraAirtime(int32_t us_per_s);     // Надбавка к бюджету для собственного трафика модуля (кластер)
+void getEspNowTxStats(EspNowTxStats_t* out);
+
+#endif // ESP_NOW_TX_H
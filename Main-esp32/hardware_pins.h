@@ -8,6 +8,22 @@
 #define DIR_PIN             16 // Пин направления шагового двигателя
 #define STEP_PIN            17 // Пин шага шагового двигателя
 #define ENABLE_PIN          4  // Пин включения драйвера шагового двигателя (активный LOW)
+// Выбор микрошага (опционально). Без этих пинов драйвер работает с фиксированным делением (перемычки).
+// Уровни MS1/MS2 для режимов задаются в motor_control.h (MOTOR_MS_LEVELS_COARSE/FINE).
+// #define MOTOR_MS1_PIN       23
+// #define MOTOR_MS2_PIN       12
+
+// --- Дополнительные каналы насосов (опционально) ---
+// Канал 0 - пины выше. Раскомментируйте тройку пинов, чтобы добавить канал (класс Motor в motor_control.h).
+// Калибровка mlPerStep хранится для каждого канала отдельно.
+#define MOTOR_MAX_CHANNELS  3  // Максимум каналов (размер массивов в Config)
+// #define MOTOR1_DIR_PIN      13
+// #define MOTOR1_STEP_PIN     14
+// #define MOTOR1_ENABLE_PIN   27
+// #define MOTOR2_DIR_PIN      19
+// #define MOTOR2_STEP_PIN     21
+// #define MOTOR2_ENABLE_PIN   22
+// Для дополнительных каналов пины микрошага задаются аналогично: MOTOR1_MS1_PIN, MOTOR1_MS2_PIN и т.д.
 
 // --- Пины кнопок ---
 // (Ранее определены в main.c)
@@ -0,0 +1,210 @@
+#include "ilc_controller.h"
+#include <Preferences.h>
+#include "sensors.h"        // Для tOut_filtered
+#include "motor_control.h"  // Для getMotorSpeed, updateMotorSpeedFromPid
+#include "dosing_logic.h"   // Для getDosingState, getDosingTempSetpoint, getDosingMotorSpeed
+#include "pid_controller.h" // Для getIsPidTempControlEnabled
+#include "main.h"           // Для функций логирования
+
+#define ILC_NAMESPACE "ilc"
+
+portMUX_TYPE ilc_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+static IlcBandProfile_t ilc_profiles[ILC_BANDS];
+static const int ilc_band_limits[ILC_BANDS - 1] = ILC_BAND_LIMITS_ML;
+
+// Запись текущего цикла (только из loop)
+static bool ilc_cycle_active = false;
+static int ilc_cycle_band = 0;
+static unsigned long ilc_cycle_start_ms = 0;
+static float ilc_err_sum[ILC_SLOTS];
+static float ilc_speed_sum[ILC_SLOTS];
+static uint16_t ilc_samples[ILC_SLOTS];
+static int ilc_last_applied_slot = -1;
+
+static void ilcBandKey(int band, char* key, size_t key_size) {
+    snprintf(key, key_size, "band%d", band);
+}
+
+static void saveIlcBand(int band) {
+    Preferences prefs;
+    if (!prefs.begin(ILC_NAMESPACE, false)) {
+        log_e("ILC", "Failed to open NVS namespace '%s' for writing.", ILC_NAMESPACE);
+        return;
+    }
+    IlcBandProfile_t copy;
+    portENTER_CRITICAL(&ilc_mutex);
+    copy = ilc_profiles[band];
+    portEXIT_CRITICAL(&ilc_mutex);
+    char key[8];
+    ilcBandKey(band, key, sizeof(key));
+    prefs.putBytes(key, &copy, sizeof(copy));
+    prefs.end();
+}
+
+void initIlcController() {
+    memset(ilc_profiles, 0, sizeof(ilc_profiles));
+    Preferences prefs;
+    if (!prefs.begin(ILC_NAMESPACE, true)) {
+        log_i("ILC", "No stored ILC profiles, starting with flat profiles.");
+        return;
+    }
+    for (int b = 0; b < ILC_BANDS; b++) {
+        char key[8];
+        ilcBandKey(b, key, sizeof(key));
+        IlcBandProfile_t loaded;
+        // Размер записи проверяем явно: при изменении ILC_SLOTS старые профили отбрасываются
+        if (prefs.getBytesLength(key) == sizeof(loaded) && prefs.getBytes(key, &loaded, sizeof(loaded)) == sizeof(loaded)) {
+            ilc_profiles[b] = loaded;
+            log_i("ILC", "Band %d profile loaded: %u cycles, last RMS %.2f C.", b, loaded.cycles_learned, loaded.last_rms_error);
+        }
+    }
+    prefs.end();
+}
+
+int getIlcBandForVolume(int volumeML) {
+    for (int b = 0; b < ILC_BANDS - 1; b++) {
+        if (volumeML <= ilc_band_limits[b]) return b;
+    }
+    return ILC_BANDS - 1;
+}
+
+void ilcBeginCycle(int volumeML) {
+    ilc_cycle_band = getIlcBandForVolume(volumeML);
+    ilc_cycle_start_ms = millis();
+    memset(ilc_err_sum, 0, sizeof(ilc_err_sum));
+    memset(ilc_speed_sum, 0, sizeof(ilc_speed_sum));
+    memset(ilc_samples, 0, sizeof(ilc_samples));
+    ilc_last_applied_slot = -1;
+    portENTER_CRITICAL(&ilc_mutex);
+    ilc_cycle_active = true;
+    portEXIT_CRITICAL(&ilc_mutex);
+    log_d("ILC", "Cycle started, volume %d ml -> band %d.", volumeML, ilc_cycle_band);
+}
+
+static int ilcCurrentSlot() {
+    if (!ilc_cycle_active) return -1;
+    unsigned long elapsed = millis() - ilc_cycle_start_ms;
+    int slot = (int)(elapsed / ILC_SLOT_MS);
+    return slot < ILC_SLOTS ? slot : -1;
+}
+
+float getIlcFeedForward() {
+    int slot = ilcCurrentSlot();
+    if (slot < 0) return 0.0f;
+    float ff;
+    portENTER_CRITICAL(&ilc_mutex);
+    ff = (float)ilc_profiles[ilc_cycle_band].offset[slot];
+    portEXIT_CRITICAL(&ilc_mutex);
+    return ff;
+}
+
+void handleIlc() {
+    if (!ilc_cycle_active) return;
+    if (getDosingState() != DOSING_STATE_RUNNING) return;
+
+    int slot = ilcCurrentSlot();
+    if (slot >= 0 && tOut_filtered != -127.0f) {
+        ilc_err_sum[slot] += getDosingTempSetpoint() - tOut_filtered;
+        ilc_speed_sum[slot] += getMotorSpeed();
+        ilc_samples[slot]++;
+    }
+
+    // С PID добавка учитывается в handlePidControl(); без PID применяем профиль сами
+    if (getIsPidTempControlEnabled()) return;
+    if (slot != ilc_last_applied_slot) {
+        int base_speed = getDosingMotorSpeed();
+        if (slot >= 0) {
+            float speed = (float)base_speed + getIlcFeedForward();
+            updateMotorSpeedFromPid(speed < 1.0f ? 1.0f : speed); // Не останавливаем мотор: иначе сработает no-flow
+        } else {
+            updateMotorSpeedFromPid((float)base_speed); // Окно обучения закончилось - базовая скорость
+        }
+        ilc_last_applied_slot = slot;
+    }
+}
+
+void ilcEndCycle(bool success) {
+    if (!ilc_cycle_active) return;
+    portENTER_CRITICAL(&ilc_mutex);
+    ilc_cycle_active = false;
+    portEXIT_CRITICAL(&ilc_mutex);
+
+    if (!success) {
+        log_i("ILC", "Cycle aborted, trajectory discarded.");
+        return;
+    }
+
+    // Средняя ошибка по слотам и СКО за окно
+    float mean_err[ILC_SLOTS];
+    float sq_sum = 0.0f;
+    int valid_slots = 0;
+    for (int k = 0; k < ILC_SLOTS; k++) {
+        if (ilc_samples[k] >= ILC_MIN_SAMPLES_PER_SLOT) {
+            mean_err[k] = ilc_err_sum[k] / ilc_samples[k];
+            sq_sum += mean_err[k] * mean_err[k];
+            valid_slots++;
+        } else {
+            mean_err[k] = NAN;
+        }
+    }
+    if (valid_slots < ILC_SLOTS / 2) {
+        log_i("ILC", "Cycle too short for learning (%d/%d slots), profile unchanged.", valid_slots, ILC_SLOTS);
+        return;
+    }
+    float rms = sqrtf(sq_sum / valid_slots);
+
+    IlcBandProfile_t p;
+    portENTER_CRITICAL(&ilc_mutex);
+    p = ilc_profiles[ilc_cycle_band];
+    portEXIT_CRITICAL(&ilc_mutex);
+
+    // Шаг обучения: ошибка слота k + lag относится к скорости слота k
+    float raw[ILC_SLOTS];
+    for (int k = 0; k < ILC_SLOTS; k++) {
+        int ek = k + ILC_LAG_SLOTS;
+        if (ek >= ILC_SLOTS) ek = ILC_SLOTS - 1;
+        float e = isnan(mean_err[ek]) ? 0.0f : mean_err[ek];
+        raw[k] = ILC_FORGET_FACTOR * (float)p.offset[k] + ILC_LEARNING_GAIN * e;
+    }
+    // Q-фильтр (сглаживание 1-2-1), подавляет высокочастотный шум между слотами
+    for (int k = 0; k < ILC_SLOTS; k++) {
+        float left = raw[k > 0 ? k - 1 : k];
+        float right = raw[k < ILC_SLOTS - 1 ? k + 1 : k];
+        float v = 0.25f * left + 0.5f * raw[k] + 0.25f * right;
+        p.offset[k] = (int16_t)constrain((int)roundf(v), -ILC_MAX_OFFSET, ILC_MAX_OFFSET);
+    }
+    if (p.cycles_learned == 0) p.first_rms_error = rms;
+    if (p.cycles_learned < 0xFFFF) p.cycles_learned++;
+    p.last_rms_error = rms;
+
+    portENTER_CRITICAL(&ilc_mutex);
+    ilc_profiles[ilc_cycle_band] = p;
+    portEXIT_CRITICAL(&ilc_mutex);
+    saveIlcBand(ilc_cycle_band);
+
+    log_i("ILC", "Band %d updated (cycle %u): RMS %.2f C (first %.2f C), offset[0]=%d, avg speed[0]=%.0f st/s.",
+          ilc_cycle_band, p.cycles_learned, rms, p.first_rms_error, p.offset[0],
+          ilc_samples[0] ? ilc_speed_sum[0] / ilc_samples[0] : 0.0f);
+}
+
+bool getIlcBandProfile(int band, IlcBandProfile_t* out) {
+    if (band < 0 || band >= ILC_BANDS || !out) return false;
+    portENTER_CRITICAL(&ilc_mutex);
+    *out = ilc_profiles[band];
+    portEXIT_CRITICAL(&ilc_mutex);
+    return true;
+}
+
+void resetIlcProfiles() {
+    portENTER_CRITICAL(&ilc_mutex);
+    memset(ilc_profiles, 0, sizeof(ilc_profiles));
+    ilc_cycle_active = false;
+    portEXIT_CRITICAL(&ilc_mutex);
+    Preferences prefs;
+    if (prefs.begin(ILC_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+    log_w("ILC", "All ILC profiles reset.");
+}
@@ -0,0 +1,43 @@
+#ifndef ILC_CONTROLLER_H
+#define ILC_CONTROLLER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Итеративное обучение (ILC) для переходного процесса в начале цикла дозирования.
+// За первые ILC_SLOTS * ILC_SLOT_MS мс каждого цикла записываются скорость и ошибка температуры,
+// после успешного цикла профиль упреждающей (feed-forward) добавки к скорости уточняется:
+//   u[k] = Q * (forget * u[k] + gain * e[k + lag])
+// Профили хранятся отдельно для каждого диапазона объема (короткие и длинные наливы ведут себя по-разному).
+
+#define ILC_SLOT_MS              500   // Длительность одного слота профиля (мс)
+#define ILC_SLOTS                24    // Количество слотов (окно обучения 12 с)
+#define ILC_BANDS                4     // Количество диапазонов объема
+#define ILC_LAG_SLOTS            2     // Запаздывание реакции T_out на изменение скорости (слоты)
+#define ILC_LEARNING_GAIN        8.0f  // (шаг/с) на °C ошибки за одну итерацию
+#define ILC_FORGET_FACTOR        0.98f // Забывание, чтобы профиль не "уплывал" от шума
+#define ILC_MAX_OFFSET           300   // Ограничение добавки к скорости (шаг/с)
+#define ILC_MIN_SAMPLES_PER_SLOT 2     // Минимум отсчетов в слоте, иначе слот не обучается
+
+// Верхние границы диапазонов объема (мл), последний диапазон - все, что больше
+#define ILC_BAND_LIMITS_ML       { 100, 250, 500 }
+
+typedef struct {
+    uint16_t cycles_learned;   // Сколько циклов учтено в профиле
+    float last_rms_error;      // СКО ошибки температуры в окне последнего цикла (°C)
+    float first_rms_error;     // СКО ошибки первого учтенного цикла (для оценки сходимости)
+    int16_t offset[ILC_SLOTS]; // Добавка к скорости по слотам (шаг/с)
+} IlcBandProfile_t;
+
+extern portMUX_TYPE ilc_mutex;
+
+void initIlcController();      // Загрузка профилей из NVS
+void handleIlc();              // Запись траектории и применение профиля без PID; вызывается из loop()
+void ilcBeginCycle(int volumeML); // Вызывается при переходе в RUNNING
+void ilcEndCycle(bool success);   // Обновление профиля (только при success) и сохранение
+float getIlcFeedForward();     // Текущая добавка к скорости (0 вне окна обучения)
+int getIlcBandForVolume(int volumeML);
+bool getIlcBandProfile(int band, IlcBandProfile_t* out);
+void resetIlcProfiles();       // Сброс всех профилей (в т.ч. в NVS)
+
+#endif // ILC_CONTROLLER_H
@@ -217,6 +217,18 @@ const char* const translations_ru[L_KEY_COUNT] PROGMEM = {
     [L_ERROR_CALIBRATION_NOT_ACTIVE_FLOW] = "Калибровка не активна (поток).",
     [L_ERROR_INVALID_FLOW_CALIBRATION_DATA] = "Неверные данные калибровки потока (Объем/Импульсы).",
     [L_ERROR_CALIBRATION_TIMED_OUT_MOTOR_STOPPED] = "Тайм-аут калибровки. Мотор остановлен.",
+    [L_ERROR_INVALID_CHANNEL_MASK] = "Неверная маска каналов насосов.",
+    [L_ERROR_CHANNEL_NOT_CALIBRATED] = "Дополнительный канал не откалиброван (mlPerStep).",
+    [L_PAUSE_DOSING] = "Пауза",
+    [L_RESUME_DOSING] = "Продолжить",
+    [L_ERROR_CONTINUOUS_FLOW_LOST] = "Непрерывный налив: поток пропал.",
+    [L_CONTINUOUS_POUR] = "Непрерывный налив",
+    [L_CONTINUOUS_LIMIT_ML] = "Лимит объема, мл (0 - до остановки)",
+    [L_START_CONTINUOUS_POUR] = "Начать непрерывный налив",
+    [L_ERROR_PREFS_BLOB_CORRUPT] = "Сохраненные настройки повреждены, применены значения по умолчанию.",
+    [L_CRASH_RESET_WDT] = "Перезагрузка по сторожевому таймеру",
+    [L_CRASH_RESET_PANIC] = "Перезагрузка после программного исключения",
+    [L_CRASH_RESET_BROWNOUT] = "Перезагрузка из-за просадки питания",
 };
 
 // Английский
@@ -431,6 +443,18 @@ const char* const translations_en[L_KEY_COUNT] PROGMEM = {
     [L_ERROR_CALIBRATION_NOT_ACTIVE_FLOW] = "Calibration not active (flow).",
     [L_ERROR_INVALID_FLOW_CALIBRATION_DATA] = "Invalid flow calibration data (Volume/Pulses).",
     [L_ERROR_CALIBRATION_TIMED_OUT_MOTOR_STOPPED] = "Calibration timed out. Motor stopped.",
+    [L_ERROR_INVALID_CHANNEL_MASK] = "Invalid pump channel mask.",
+    [L_ERROR_CHANNEL_NOT_CALIBRATED] = "Extra pump channel not calibrated (mlPerStep).",
+    [L_PAUSE_DOSING] = "Pause",
+    [L_RESUME_DOSING] = "Resume",
+    [L_ERROR_CONTINUOUS_FLOW_LOST] = "Continuous pour: flow lost.",
+    [L_CONTINUOUS_POUR] = "Continuous pour",
+    [L_CONTINUOUS_LIMIT_ML] = "Volume limit, ml (0 - until stopped)",
+    [L_START_CONTINUOUS_POUR] = "Start continuous pour",
+    [L_ERROR_PREFS_BLOB_CORRUPT] = "Saved settings are corrupted, defaults applied.",
+    [L_CRASH_RESET_WDT] = "Reset by watchdog timer",
+    [L_CRASH_RESET_PANIC] = "Reset after unhandled exception",
+    [L_CRASH_RESET_BROWNOUT] = "Reset due to brownout",
 };
 
 // Буфер для строк, прочитанных из PROGMEM
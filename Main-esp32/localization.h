@@ -216,6 +216,18 @@ typedef enum {
     L_ERROR_CALIBRATION_NOT_ACTIVE_FLOW,
     L_ERROR_INVALID_FLOW_CALIBRATION_DATA,
     L_ERROR_CALIBRATION_TIMED_OUT_MOTOR_STOPPED,
+    L_ERROR_INVALID_CHANNEL_MASK,
+    L_ERROR_CHANNEL_NOT_CALIBRATED,
+    L_PAUSE_DOSING,
+    L_RESUME_DOSING,
+    L_ERROR_CONTINUOUS_FLOW_LOST,
+    L_CONTINUOUS_POUR,
+    L_CONTINUOUS_LIMIT_ML,
+    L_START_CONTINUOUS_POUR,
+    L_ERROR_PREFS_BLOB_CORRUPT,
+    L_CRASH_RESET_WDT,
+    L_CRASH_RESET_PANIC,
+    L_CRASH_RESET_BROWNOUT,
 
     L_KEY_COUNT 
 } LangKey;
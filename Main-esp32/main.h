@@ -13,6 +13,7 @@ extern WebServer server; // Определен в Main-esp32.ino
 extern bool system_power_enabled;
 extern bool ap_mode_active; // Флаг, что устройство в режиме точки доступа
 extern bool g_preferences_operational; // Флаг состояния Preferences
+extern bool g_littlefs_mounted;        // Флаг успешного монтирования LittleFS
 extern const char* MAIN_FIRMWARE_VERSION; // Firmware version of the main ESP32
 
 // Функции логирования (определены в Main-esp32.ino)
@@ -0,0 +1,53 @@
+#ifndef MINUTE_RATE_H
+#define MINUTE_RATE_H
+
+// Скользящее окно из минутных корзин для метрик "в час" (пуски компрессора, циклы дозирования).
+// Bucket - структура или число, обнуляется значением Bucket{}. Синхронизацию обеспечивает вызывающий.
+
+#include <stdint.h>
+#include <string.h>
+
+#define MINUTE_RATE_BUCKET_MS      60000UL
+#define MINUTE_RATE_MIN_WINDOW_MS  600000UL // Меньшее окно не экстраполируется в "в час"
+
+template <typename Bucket, int N>
+struct MinuteRing {
+    Bucket buckets[N];
+    unsigned long current_minute;
+    unsigned long start_ms;
+
+    void reset(unsigned long now) {
+        memset(buckets, 0, sizeof(buckets));
+        current_minute = now / MINUTE_RATE_BUCKET_MS;
+        start_ms = now;
+    }
+
+    // Обнуляет корзины минут, прошедших с прошлого вызова
+    void rotate(unsigned long now) {
+        unsigned long minute = now / MINUTE_RATE_BUCKET_MS;
+        if (minute == current_minute) return;
+        unsigned long gap = minute - current_minute;
+        if (gap > (unsigned long)N) gap = N;
+        for (unsigned long i = 1; i <= gap; i++) {
+            buckets[(current_minute + i) % N] = Bucket{};
+        }
+        current_minute = minute;
+    }
+
+    Bucket& current() { return buckets[current_minute % N]; }
+
+    // Покрытое корзинами время: с момента reset(), но не больше N минут
+    unsigned long windowMs(unsigned long now) const {
+        unsigned long window = now - start_ms;
+        const unsigned long max_window = (unsigned long)N * MINUTE_RATE_BUCKET_MS;
+        return window > max_window ? max_window : window;
+    }
+};
+
+// В первые минуты после загрузки не экстраполируем одно событие в "сотни в час"
+static inline float minuteRatePerHour(uint32_t count, unsigned long window_ms) {
+    if (window_ms < MINUTE_RATE_MIN_WINDOW_MS) window_ms = MINUTE_RATE_MIN_WINDOW_MS;
+    return (float)count * 3600000.0f / (float)window_ms;
+}
+
+#endif // MINUTE_RATE_H
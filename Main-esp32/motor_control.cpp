@@ -7,226 +7,326 @@
 #include "hardware_pins.h"  // <-- ДОБАВЛЕНО: Единый файл с определениями пинов
 
 // Пины DIR_PIN, STEP_PIN, ENABLE_PIN теперь определены в hardware_pins.h
-// #define DIR_PIN             16
-// #define STEP_PIN            17
-// #define ENABLE_PIN          4
-
-// Определения глобальных переменных из motor_control.h
-bool motor_running_auto = false;
-bool motor_running_manual = false;
-bool motor_dir = HIGH; // HIGH - forward
-float current_steps_per_sec = 0;
-unsigned long step_interval_us = 0;
-long steps_taken_dosing = 0;
-long steps_target_dosing = 0;
-
-// Мьютекс для защиты состояния мотора (флаги, скорость, интервал)
-portMUX_TYPE motor_state_mutex = portMUX_INITIALIZER_UNLOCKED;
+// Каналы насосов (канал 0 - основной, с датчиком потока)
+static Motor motors[MOTOR_CHANNEL_COUNT] = {
+    {0, STEP_PIN, DIR_PIN, ENABLE_PIN, MOTOR_MS1_PIN, MOTOR_MS2_PIN},
+#if MOTOR_CHANNEL_COUNT > 1
+    {1, MOTOR1_STEP_PIN, MOTOR1_DIR_PIN, MOTOR1_ENABLE_PIN, MOTOR1_MS1_PIN, MOTOR1_MS2_PIN},
+#endif
+#if MOTOR_CHANNEL_COUNT > 2
+    {2, MOTOR2_STEP_PIN, MOTOR2_DIR_PIN, MOTOR2_ENABLE_PIN, MOTOR2_MS1_PIN, MOTOR2_MS2_PIN},
+#endif
+};
 
 // Внешние переменные
 // extern Config config; // Доступно через config_manager.h
 // extern bool system_power_enabled; // Доступно через main.h
-// extern float volume_dispensed_cycle; // Доступно через dosing_logic.h (если нужно здесь)
 // extern portMUX_TYPE motor_cal_steps_mutex; // Из calibration_logic.h
 // extern long steps_taken_calibration;      // Из calibration_logic.h
-// extern bool pid_temp_control_enabled;     // Заменено на getIsPidTempControlEnabled()
 
-// Функции логирования доступны через main.h
-// extern void log_i(const char* tag, const char* format, ...);
-// extern void log_w(const char* tag, const char* format, ...);
-// extern void log_d(const char* tag, const char* format, ...);
+// --- Motor ---
 
-unsigned long last_step_time = 0;
+Motor::Motor(uint8_t channel, uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin, uint8_t ms1_pin, uint8_t ms2_pin)
+    : channel(channel), step_pin(step_pin), dir_pin(dir_pin), enable_pin(enable_pin), ms1_pin(ms1_pin), ms2_pin(ms2_pin),
+      running_auto(false), running_manual(false), dir(MOTOR_DIR_FORWARD),
+      steps_per_sec(0.0f), speed_scale(1.0f), step_interval_us(0), steps_taken(0), steps_target(0),
+      fine_requested(false), fine_mode(false), last_step_time(0) {
+}
+
+void Motor::begin() {
+    pinMode(dir_pin, OUTPUT);
+    pinMode(step_pin, OUTPUT);
+    pinMode(enable_pin, OUTPUT);
+    digitalWrite(enable_pin, HIGH); // Мотор выключен по умолчанию
+    digitalWrite(dir_pin, dir.load());
+    if (ms1_pin != MOTOR_PIN_NONE) pinMode(ms1_pin, OUTPUT);
+    if (ms2_pin != MOTOR_PIN_NONE) pinMode(ms2_pin, OUTPUT);
+    applyMicrostepMode(false);
+    log_i("MOTOR", "Channel %u pins initialized (STEP=%u, DIR=%u, EN=%u). DISABLED (HIGH). Microstep control: %s.",
+          channel, step_pin, dir_pin, enable_pin, hasMicrostepControl() ? "yes" : "no");
+}
+
+void Motor::applyMicrostepMode(bool fine) {
+    uint8_t levels = fine ? MOTOR_MS_LEVELS_FINE : MOTOR_MS_LEVELS_COARSE;
+    if (ms1_pin != MOTOR_PIN_NONE) digitalWrite(ms1_pin, (levels & 0x01) ? HIGH : LOW);
+    if (ms2_pin != MOTOR_PIN_NONE) digitalWrite(ms2_pin, (levels & 0x02) ? HIGH : LOW);
+    fine_mode.store(fine);
+}
+
+void Motor::setFineApproach(bool fine) {
+    fine_requested.store(fine);
+}
+
+void Motor::setSpeed(float steps_sec) {
+    steps_per_sec.store(steps_sec < 0.01f ? 0.0f : steps_sec); // Считаем 0, если очень мало
+    updateStepInterval();
+}
+
+void Motor::setSpeedScale(float scale) {
+    if (scale > 1.0f) scale = 1.0f;
+    if (scale < 0.01f) scale = 0.01f;
+    speed_scale.store(scale);
+    updateStepInterval();
+}
+
+void Motor::updateStepInterval() {
+    float effective = steps_per_sec.load() * speed_scale.load();
+    if (effective < 0.01f) {
+        step_interval_us.store(0); // Мотор остановлен
+    } else {
+        step_interval_us.store((uint32_t)(1000000.0f / effective));
+    }
+}
+
+void Motor::setDirection(bool forward) {
+    dir.store(forward);
+    digitalWrite(dir_pin, forward ? MOTOR_DIR_FORWARD : MOTOR_DIR_REVERSE);
+}
+
+void Motor::startAuto(long target_steps) {
+    // Счетчики сброшены - позиция выровнена, крупный режим можно включить сразу
+    fine_requested.store(false);
+    applyMicrostepMode(false);
+    steps_taken.store(0);
+    steps_target.store((int32_t)(target_steps * MOTOR_MICROSTEP_RATIO));
+    setDirection(MOTOR_DIR_FORWARD);
+    digitalWrite(enable_pin, LOW);
+    running_auto.store(true);
+}
+
+bool Motor::pauseAuto() {
+    if (!running_auto.exchange(false)) return false;
+    digitalWrite(enable_pin, HIGH);
+    return true;
+}
+
+void Motor::resumeAuto() {
+    setDirection(MOTOR_DIR_FORWARD);
+    last_step_time = micros(); // Без "догоняющих" импульсов за время паузы
+    digitalWrite(enable_pin, LOW);
+    running_auto.store(true);
+}
+
+void Motor::startManual(bool forward) {
+    // Ручной режим и калибровка mlPerStep - всегда в крупном шаге
+    fine_requested.store(false);
+    applyMicrostepMode(false);
+    setDirection(forward);
+    digitalWrite(enable_pin, LOW);
+    running_manual.store(true);
+}
+
+void Motor::stopManual() {
+    if (running_manual.exchange(false)) {
+        digitalWrite(enable_pin, HIGH);
+    }
+}
+
+void Motor::stop() {
+    digitalWrite(enable_pin, HIGH);
+    running_auto.store(false);
+    running_manual.store(false);
+}
+
+bool Motor::isEnabled() const {
+    return digitalRead(enable_pin) == LOW;
+}
+
+float Motor::getMlPerStep() const {
+    return channel == 0 ? config.mlPerStep : config.extraMlPerStep[channel - 1];
+}
+
+void Motor::setMlPerStep(float ml_per_step) {
+    if (channel == 0) {
+        config.mlPerStep = ml_per_step;
+    } else {
+        config.extraMlPerStep[channel - 1] = ml_per_step;
+    }
+    publishConfig();
+}
+
+float Motor::getDispensedEstimateMl() const {
+    return (float)steps_taken.load() / MOTOR_MICROSTEP_RATIO * getMlPerStep();
+}
+
+uint16_t Motor::handleStepping() {
+    bool is_auto = running_auto.load();
+    bool is_manual = running_manual.load();
+
+    // В режиме калибровки мотор тоже вращается только в ручном режиме (manualMotorForward/Reverse)
+    if (!is_auto && !is_manual) {
+        if (digitalRead(enable_pin) == LOW) { // Если мотор был включен, но не должен работать
+            digitalWrite(enable_pin, HIGH);
+            log_d("MOTOR", "Channel %u disabled (no active mode).", channel);
+        }
+        return 0;
+    }
+
+    uint32_t interval = step_interval_us.load();
+    if (interval == 0) { // Скорость 0, мотор не должен шагать
+        if (digitalRead(enable_pin) == LOW) digitalWrite(enable_pin, HIGH);
+        return 0;
+    }
+    if (digitalRead(enable_pin) == HIGH) digitalWrite(enable_pin, LOW); // Скорость снова > 0
+
+    // Каналы по шагам сами переходят в мелкий режим перед целью
+    int32_t target = steps_target.load();
+    if (is_auto && target > 0 && target - steps_taken.load() <= (int32_t)MOTOR_FINE_APPROACH_STEPS * MOTOR_MICROSTEP_RATIO) {
+        fine_requested.store(true);
+    }
+
+    // Переключение режима: в мелкий - сразу, обратно в крупный - только на границе крупного шага
+    bool want_fine = fine_requested.load();
+    if (want_fine != fine_mode.load()) {
+        if (want_fine || (steps_taken.load() % MOTOR_MICROSTEP_RATIO) == 0) {
+            applyMicrostepMode(want_fine);
+            log_d("MOTOR", "Channel %u microstep mode -> %s.", channel, want_fine ? "FINE" : "COARSE");
+        }
+    }
+    bool is_fine = fine_mode.load();
+    // Без пинов MS "мелкий" режим означает только снижение подачи, деление драйвера не меняется
+    bool hw_fine = is_fine && hasMicrostepControl();
+    int32_t units_per_pulse = hw_fine ? 1 : MOTOR_MICROSTEP_RATIO;
+    if (is_fine) interval *= MOTOR_FINE_APPROACH_SLOWDOWN;
+    if (hw_fine) interval /= MOTOR_MICROSTEP_RATIO;
+    if (interval == 0) interval = 1;
+
+    uint32_t current_micros = micros();
+    uint32_t elapsed = current_micros - last_step_time;
+    if (elapsed < interval) return 0;
+
+    // Один импульс за вызов. Опоздавший loop() не догоняется пачкой импульсов (мотор не успевает за скачком
+    // частоты и теряет шаги): отсчет начинается заново, частота не превышает заданной.
+    last_step_time = current_micros;
+    uint16_t pulses = 0;
+    if (!(is_auto && target > 0 && steps_taken.load() >= target)) {
+        digitalWrite(step_pin, HIGH);
+        delayMicroseconds(2); // Короткий импульс для шага
+        digitalWrite(step_pin, LOW);
+        pulses = 1;
+        if (is_auto) steps_taken.fetch_add(units_per_pulse);
+    }
+
+    if (is_auto && target > 0 && steps_taken.load() >= target) { // Дозирование по шагам (каналы без датчика потока)
+        running_auto.store(false);
+        digitalWrite(enable_pin, HIGH);
+        log_i("MOTOR", "Channel %u reached step target (%ld steps).", channel, getStepsTaken());
+    }
+    return pulses;
+}
+
+// --- Модульные функции ---
+
+Motor& getMotor(uint8_t channel) {
+    return motors[channel < MOTOR_CHANNEL_COUNT ? channel : MOTOR_PRIMARY_CHANNEL];
+}
+
+uint8_t getMotorsRunningAutoMask() {
+    uint8_t mask = 0;
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        if (motors[ch].isRunningAuto()) mask |= (1u << ch);
+    }
+    return mask;
+}
 
 void initMotor() {
-    pinMode(DIR_PIN, OUTPUT);
-    pinMode(STEP_PIN, OUTPUT);
-    pinMode(ENABLE_PIN, OUTPUT);
-    digitalWrite(ENABLE_PIN, HIGH); // Мотор выключен по умолчанию
-    log_i("MOTOR", "Motor pins initialized. ENABLED (HIGH).");
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        motors[ch].begin();
+    }
+    log_i("MOTOR", "%d motor channel(s) initialized.", MOTOR_CHANNEL_COUNT);
 }
 
 void updateMotorSpeed(int speedSetting) {
-    // ... (реализация как в mainbuidv4.c, с учетом pid_temp_control_enabled) ...
     if (speedSetting < 0) {
         log_w("MOTOR", "Invalid speed setting: %d. Setting to 0.", speedSetting);
         speedSetting = 0;
     }
-    config.motorSpeed = speedSetting; // Сохраняем запрошенную пользователем скорость
+    if (config.motorSpeed != speedSetting) {
+        config.motorSpeed = speedSetting; // Сохраняем запрошенную пользователем скорость
+        publishConfig();
+    }
+    applyMotorSpeed(speedSetting);
+}
 
-    portENTER_CRITICAL(&motor_state_mutex);
+void applyMotorSpeed(int speedSetting) {
+    if (speedSetting < 0) speedSetting = 0;
     if (!getIsPidTempControlEnabled() || speedSetting == 0) {
-        current_steps_per_sec = (float)config.motorSpeed;
-        if (current_steps_per_sec == 0) {
-            step_interval_us = 0;
-            // log_i("MOTOR", "Motor speed set to 0 (PID off or explicit stop)."); // Может быть избыточным
-        } else {
-            step_interval_us = (unsigned long)(1000000.0f / current_steps_per_sec);
+        for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+            motors[ch].setSpeed((float)speedSetting);
         }
-        log_i("MOTOR", "Speed (PID off or explicit 0) updated to: %.1f steps/sec, interval: %lu us", current_steps_per_sec, step_interval_us);
+        log_i("MOTOR", "Speed (PID off or explicit 0) updated to: %.1f steps/sec, interval: %lu us", motors[0].getSpeed(), motors[0].getStepIntervalUs());
     } else {
-        log_i("MOTOR", "PID is active. Base speed set to %d. PID will control actual steps/sec.", config.motorSpeed);
-        // PID будет управлять current_steps_per_sec и step_interval_us напрямую
+        log_i("MOTOR", "PID is active. Base speed set to %d. PID will control actual steps/sec.", speedSetting);
+        // PID будет управлять скоростью напрямую через updateMotorSpeedFromPid()
     }
-    portEXIT_CRITICAL(&motor_state_mutex);
 }
 
 void updateMotorSpeedFromPid(float steps_sec) {
-    portENTER_CRITICAL(&motor_state_mutex);
-    current_steps_per_sec = steps_sec;
-    if (current_steps_per_sec < 0.01f) { // Считаем 0, если очень мало
-        current_steps_per_sec = 0;
-        step_interval_us = 0; // Мотор остановлен
-    } else {
-        step_interval_us = (unsigned long)(1000000.0f / current_steps_per_sec);
+    // Температура на выходе общая для всех каналов - скорость задается всем сразу
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        motors[ch].setSpeed(steps_sec);
     }
-    portEXIT_CRITICAL(&motor_state_mutex);
-    // Эта функция напрямую меняет current_steps_per_sec и step_interval_us
 }
 
 void handleMotorStepping() {
-    // ... (реализация как в mainbuidv4.c) ...
-    // volume_dispensed_cycle теперь обновляется в handleFlowSensor()
-    // steps_taken_dosing все еще считаем для информации или резерва
-    bool local_motor_running_auto;
-    bool local_motor_running_manual;
-    unsigned long local_step_interval_us;
-
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_motor_running_auto = motor_running_auto;
-    local_motor_running_manual = motor_running_manual;
-    local_step_interval_us = step_interval_us;
-    portEXIT_CRITICAL(&motor_state_mutex);
-
-    // getCalibrationModeState() использует свой мьютекс
-    if (!local_motor_running_auto && !local_motor_running_manual && !getCalibrationModeState()) {
-        if (digitalRead(ENABLE_PIN) == LOW) { // Если мотор был включен, но не должен работать
-            digitalWrite(ENABLE_PIN, HIGH);
-            log_d("MOTOR", "Motor disabled (no active mode).");
-        }
-        return;
-    }
-
-    if (local_step_interval_us == 0) { // Скорость 0, мотор не должен шагать
-        if (digitalRead(ENABLE_PIN) == LOW) digitalWrite(ENABLE_PIN, HIGH);
-        return;
-    }
-
-    unsigned long current_micros = micros();
-    if (current_micros - last_step_time >= local_step_interval_us) {
-        last_step_time = current_micros;
-        digitalWrite(STEP_PIN, HIGH);
-        delayMicroseconds(2); // Короткий импульс для шага
-        digitalWrite(STEP_PIN, LOW);
-
-        // Читаем motor_running_auto и motor_running_manual еще раз, если они могли измениться
-        // другим потоком между первой проверкой и этим местом.
-        // Однако, для простоты и учитывая, что handleMotorStepping вызывается часто,
-        // можно использовать ранее прочитанные локальные значения, если вероятность изменения мала.
-        // Для большей строгости, можно снова прочитать под мьютексом.
-        // В данном случае, используем локальные значения, так как основной контроль уже прошел.
-
-        if (local_motor_running_auto) {
-            steps_taken_dosing++;
-            // volume_dispensed_cycle = (float)steps_taken_dosing * config.mlPerStep; // УДАЛЕНО, теперь по датчику потока
-        } else if (getCalibrationModeState() && local_motor_running_manual) { // Шаги для калибровки считаются только в ручном режиме калибровки
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        uint16_t pulses = motors[ch].handleStepping();
+        // Шаги для калибровки считаются только в ручном режиме калибровки основного канала (всегда крупный шаг)
+        if (pulses > 0 && ch == MOTOR_PRIMARY_CHANNEL && getCalibrationModeState() && motors[ch].isRunningManual()) {
             portENTER_CRITICAL(&motor_cal_steps_mutex);
-            steps_taken_calibration++;
+            steps_taken_calibration += pulses;
             portEXIT_CRITICAL(&motor_cal_steps_mutex);
         }
     }
 }
 
-void manualMotorForward() {
-    bool local_motor_running_auto;
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_motor_running_auto = motor_running_auto;
-    portEXIT_CRITICAL(&motor_state_mutex);
-
-    if (!system_power_enabled || local_motor_running_auto) return;
-
-    log_i("MOTOR_MAN", "Manual Forward");
-    portENTER_CRITICAL(&motor_state_mutex);
-    motor_dir = HIGH;
-    portEXIT_CRITICAL(&motor_state_mutex);
-    digitalWrite(DIR_PIN, motor_dir);
+static void manualMotorStart(bool forward) {
+    Motor& m = motors[MOTOR_PRIMARY_CHANNEL];
+    if (!system_power_enabled || m.isRunningAuto()) return;
+
+    log_i("MOTOR_MAN", forward ? "Manual Forward" : "Manual Reverse");
     updateMotorSpeed(config.motorSpeed > 0 ? config.motorSpeed : 100); // Используем текущую или базовую скорость
-    digitalWrite(ENABLE_PIN, LOW);
-    portENTER_CRITICAL(&motor_state_mutex);
-    motor_running_manual = true;
-    portEXIT_CRITICAL(&motor_state_mutex);
+    m.startManual(forward);
 }
 
-void manualMotorReverse() {
-    bool local_motor_running_auto;
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_motor_running_auto = motor_running_auto;
-    portEXIT_CRITICAL(&motor_state_mutex);
-
-    if (!system_power_enabled || local_motor_running_auto) return;
+void manualMotorForward() {
+    manualMotorStart(MOTOR_DIR_FORWARD);
+}
 
-    log_i("MOTOR_MAN", "Manual Reverse");
-    portENTER_CRITICAL(&motor_state_mutex);
-    motor_dir = LOW;
-    portEXIT_CRITICAL(&motor_state_mutex);
-    digitalWrite(DIR_PIN, motor_dir);
-    updateMotorSpeed(config.motorSpeed > 0 ? config.motorSpeed : 100);
-    digitalWrite(ENABLE_PIN, LOW);
-    portENTER_CRITICAL(&motor_state_mutex);
-    motor_running_manual = true;
-    portEXIT_CRITICAL(&motor_state_mutex);
+void manualMotorReverse() {
+    manualMotorStart(MOTOR_DIR_REVERSE);
 }
 
 void stopManualMotor() {
-    bool local_motor_running_manual;
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_motor_running_manual = motor_running_manual;
-    portEXIT_CRITICAL(&motor_state_mutex);
-
-    if (local_motor_running_manual) {
+    if (motors[MOTOR_PRIMARY_CHANNEL].isRunningManual()) {
         log_i("MOTOR_MAN", "Manual Stop");
-        digitalWrite(ENABLE_PIN, HIGH);
-        portENTER_CRITICAL(&motor_state_mutex);
-        motor_running_manual = false;
-        portEXIT_CRITICAL(&motor_state_mutex);
+        motors[MOTOR_PRIMARY_CHANNEL].stopManual();
     }
 }
 
-void stopMotor() { // Общая функция остановки
-    digitalWrite(ENABLE_PIN, HIGH);
-    portENTER_CRITICAL(&motor_state_mutex);
-    motor_running_auto = false;
-    motor_running_manual = false;
-    // current_steps_per_sec = 0; // Можно также сбросить скорость здесь, если это требуется
-    // step_interval_us = 0;
-    portEXIT_CRITICAL(&motor_state_mutex);
+void stopMotor() { // Общая функция остановки - все каналы
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        motors[ch].stop();
+    }
     log_i("MOTOR", "Motor stopped (general stop).");
 }
 
 bool isMotorEnabled() {
-    return digitalRead(ENABLE_PIN) == LOW;
+    return motors[MOTOR_PRIMARY_CHANNEL].isEnabled();
 }
 
 int getMotorDirection() {
-    int local_dir;
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_dir = motor_dir;
-    portEXIT_CRITICAL(&motor_state_mutex);
-    return local_dir;
+    return motors[MOTOR_PRIMARY_CHANNEL].getDirection();
+}
+
+float getMotorSpeed() {
+    return motors[MOTOR_PRIMARY_CHANNEL].getSpeed();
 }
 
 bool isMotorRunningManual() {
-    bool status;
-    portENTER_CRITICAL(&motor_state_mutex);
-    status = motor_running_manual;
-    portEXIT_CRITICAL(&motor_state_mutex);
-    return status;
+    return motors[MOTOR_PRIMARY_CHANNEL].isRunningManual();
 }
 
 bool isMotorRunningAuto() {
-    bool status;
-    portENTER_CRITICAL(&motor_state_mutex);
-    status = motor_running_auto;
-    portEXIT_CRITICAL(&motor_state_mutex);
-    return status;
-}
\ No newline at end of file
+    return getMotorsRunningAutoMask() != 0;
+}
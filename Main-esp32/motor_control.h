@@ -2,28 +2,143 @@
 #define MOTOR_CONTROL_H
 
 #include <Arduino.h>
-// Определения пинов мотора теперь находятся в hardware_pins.h
+#include <atomic>
+#include "hardware_pins.h" // Пины каналов и MOTOR_MAX_CHANNELS
 
 // Определения для направления мотора
 #define MOTOR_DIR_FORWARD HIGH
 #define MOTOR_DIR_REVERSE LOW
 
-// Глобальные переменные, связанные с мотором (объявляем как extern)
-extern bool motor_running_auto;
-extern bool motor_running_manual;
-extern bool motor_dir; // HIGH - forward, LOW - reverse
-extern float current_steps_per_sec;
-extern unsigned long step_interval_us;
-extern long steps_taken_dosing;
-extern long steps_target_dosing;
+// Количество каналов определяется пинами, объявленными в hardware_pins.h
+#if defined(MOTOR2_STEP_PIN)
+#define MOTOR_CHANNEL_COUNT 3
+#elif defined(MOTOR1_STEP_PIN)
+#define MOTOR_CHANNEL_COUNT 2
+#else
+#define MOTOR_CHANNEL_COUNT 1
+#endif
 
+#if MOTOR_CHANNEL_COUNT > MOTOR_MAX_CHANNELS
+#error "MOTOR_CHANNEL_COUNT exceeds MOTOR_MAX_CHANNELS"
+#endif
 
-// Мьютекс для защиты состояния мотора (определен в .c файле)
-extern portMUX_TYPE motor_state_mutex;
+#define MOTOR_PRIMARY_CHANNEL      0    // Канал с датчиком потока (дозирование по объему)
+#define MOTOR_PRIMARY_CHANNEL_MASK 0x01
+#define MOTOR_ALL_CHANNELS_MASK    ((uint8_t)((1u << MOTOR_CHANNEL_COUNT) - 1))
+#define MOTOR_PIN_NONE             0xFF // Пин не подключен
 
-// Функции
+// --- Динамический микрошаг ---
+// Крейсерский режим - крупный шаг (меньше частота STEP при той же подаче), на финальном подходе - мелкий.
+// "Шаг" во всем API (скорость, счетчики, mlPerStep) - всегда шаг крупного режима; внутри считаются микрошаги
+// мелкого режима (MOTOR_MICROSTEP_RATIO на один крупный шаг), поэтому учет не зависит от переключений.
+// Уровни MS1/MS2 (бит 0 - MS1, бит 1 - MS2) по умолчанию для TMC2208/2209 standalone: HL = 1/2, HH = 1/16.
+#define MOTOR_MICROSTEP_COARSE_DIV  2
+#define MOTOR_MICROSTEP_FINE_DIV    16
+#define MOTOR_MICROSTEP_RATIO       (MOTOR_MICROSTEP_FINE_DIV / MOTOR_MICROSTEP_COARSE_DIV)
+#define MOTOR_MS_LEVELS_COARSE      0x01
+#define MOTOR_MS_LEVELS_FINE        0x03
+#define MOTOR_FINE_APPROACH_STEPS   200   // Каналы по шагам: мелкий режим за столько крупных шагов до цели
+#define MOTOR_FINE_APPROACH_ML      5.0f  // Основной канал: мелкий режим, когда до цели осталось меньше (мл)...
+#define MOTOR_FINE_APPROACH_FRACTION 0.05f // ...или меньше этой доли целевого объема
+#define MOTOR_FINE_APPROACH_SLOWDOWN 2    // Во сколько раз снижается подача на финальном подходе
+
+#ifndef MOTOR_MS1_PIN
+#define MOTOR_MS1_PIN MOTOR_PIN_NONE
+#endif
+#ifndef MOTOR_MS2_PIN
+#define MOTOR_MS2_PIN MOTOR_PIN_NONE
+#endif
+#ifndef MOTOR1_MS1_PIN
+#define MOTOR1_MS1_PIN MOTOR_PIN_NONE
+#endif
+#ifndef MOTOR1_MS2_PIN
+#define MOTOR1_MS2_PIN MOTOR_PIN_NONE
+#endif
+#ifndef MOTOR2_MS1_PIN
+#define MOTOR2_MS1_PIN MOTOR_PIN_NONE
+#endif
+#ifndef MOTOR2_MS2_PIN
+#define MOTOR2_MS2_PIN MOTOR_PIN_NONE
+#endif
+
+// Один шаговый насос. Состояние - атомики: флаги и скорость пишутся из loop, веб-обработчиков
+// и callback ESP-NOW без критических секций; генератор шагов читает их в каждом проходе loop.
+class Motor {
+public:
+    Motor(uint8_t channel, uint8_t step_pin, uint8_t dir_pin, uint8_t enable_pin,
+          uint8_t ms1_pin = MOTOR_PIN_NONE, uint8_t ms2_pin = MOTOR_PIN_NONE);
+
+    void begin();
+    uint16_t handleStepping(); // Генератор шагов, возвращает количество выданных импульсов STEP
+
+    void setSpeed(float steps_sec); // 0 - шаги не генерируются
+    float getSpeed() const { return steps_per_sec.load(); } // Заданная скорость (без коэффициента)
+    // Коэффициент скорости (0..1] поверх заданной: им монитор срыва снижает и вновь разгоняет подачу,
+    // не вмешиваясь в PID и базовую скорость
+    void setSpeedScale(float scale);
+    float getSpeedScale() const { return speed_scale.load(); }
+    float getEffectiveSpeed() const { return steps_per_sec.load() * speed_scale.load(); }
+    unsigned long getStepIntervalUs() const { return step_interval_us.load(); }
+
+    void setDirection(bool forward);
+    bool getDirection() const { return dir.load(); }
+
+    void startAuto(long target_steps = 0); // target_steps 0 - без ограничения (объем по датчику потока)
+    bool pauseAuto();  // Остановка без сброса счетчиков шагов, false - канал не работал в авто-режиме
+    void resumeAuto(); // Продолжение после pauseAuto()
+    void startManual(bool forward);
+    void stopManual();
+    void stop();
+
+    bool isRunningAuto() const { return running_auto.load(); }
+    bool isRunningManual() const { return running_manual.load(); }
+    bool isEnabled() const;
+
+    long getStepsTaken() const { return steps_taken.load() / MOTOR_MICROSTEP_RATIO; } // Крупные шаги
+    long getStepsTarget() const { return steps_target.load() / MOTOR_MICROSTEP_RATIO; }
+
+    // Финальный подход: мелкий микрошаг и сниженная подача. Возврат в крупный режим -
+    // только на границе крупного шага (выравнивание), чтобы не потерять позицию.
+    void setFineApproach(bool fine);
+    bool isFineMode() const { return fine_mode.load(); }
+    bool hasMicrostepControl() const { return ms1_pin != MOTOR_PIN_NONE || ms2_pin != MOTOR_PIN_NONE; }
+    float getMlPerStep() const;            // Калибровка канала (из config)
+    void setMlPerStep(float ml_per_step);  // Пишет в config, сохранение - снаружи
+    float getDispensedEstimateMl() const;  // Оценка объема по шагам
+
+    uint8_t getChannel() const { return channel; }
+
+private:
+    const uint8_t channel;
+    const uint8_t step_pin;
+    const uint8_t dir_pin;
+    const uint8_t enable_pin;
+    const uint8_t ms1_pin;
+    const uint8_t ms2_pin;
+
+    std::atomic<bool> running_auto;
+    std::atomic<bool> running_manual;
+    std::atomic<bool> dir;
+    std::atomic<float> steps_per_sec;
+    std::atomic<float> speed_scale;
+    std::atomic<uint32_t> step_interval_us;
+    std::atomic<int32_t> steps_taken;  // В микрошагах мелкого режима
+    std::atomic<int32_t> steps_target; // В микрошагах мелкого режима, 0 - без ограничения
+    std::atomic<bool> fine_requested;
+    std::atomic<bool> fine_mode;
+    uint32_t last_step_time; // Только из loop (handleStepping)
+
+    void applyMicrostepMode(bool fine);
+    void updateStepInterval();
+};
+
+Motor& getMotor(uint8_t channel); // Канал вне диапазона -> основной канал
+uint8_t getMotorsRunningAutoMask();
+
+// Функции (совместимость: ручное управление и калибровка - основной канал, скорость и остановка - все каналы)
 void initMotor();
 void updateMotorSpeed(int speedSetting); // Устанавливает базовую скорость
+void applyMotorSpeed(int speedSetting);  // Скорость моторам без записи в config (задание очереди)
 void updateMotorSpeedFromPid(float steps_sec); // Устанавливает скорость от PID
 void handleMotorStepping(); // Основная функция для генерации шагов
 void manualMotorForward();
@@ -32,7 +147,8 @@ void stopManualMotor();
 void stopMotor(); // Общая функция остановки мотора
 bool isMotorEnabled(); // Проверяет, включен ли мотор (ENABLE_PIN)
 bool isMotorRunningManual(); // Геттер для motor_running_manual
-bool isMotorRunningAuto(); // Геттер для motor_running_auto
+bool isMotorRunningAuto(); // true, если хотя бы один канал работает в авто-режиме
 int getMotorDirection(); // Возвращает текущее направление мотора
+float getMotorSpeed();   // Текущая скорость основного канала (шаг/с)
 
-#endif // MOTOR_CONTROL_H
\ No newline at end of file
+#endif // MOTOR_CONTROL_H
@@ -1,10 +1,11 @@
 #include "pid_controller.h"
 #include "config_manager.h" // Для config.tempSetpoint
 #include "sensors.h"        // Для tOut (или tOut_filtered)
-#include "motor_control.h"  // Для current_steps_per_sec, step_interval_us
+#include "motor_control.h"  // Для updateMotorSpeedFromPid, getMotorSpeed
 #include "dosing_logic.h"   // Для current_dosing_state
 
 #include "main.h"           // Для system_power_enabled и функций логирования
+#include "ilc_controller.h" // Для getIlcFeedForward
 // Статические переменные модуля PID
 static bool pid_temp_control_enabled_static = false;
 static float pid_kp_static = 20.0f;
@@ -14,6 +15,10 @@ static float pid_setpoint_temp_static = 4.0f; // Начальное значен
 static float pid_integral_static = 0.0f;
 static float pid_previous_error_static = 0.0f;
 static unsigned long pid_last_time_static = 0;
+// Настройки из снимка config (только из loop): перечитываются, когда меняется версия
+static uint32_t pid_config_version = 0;
+static uint32_t pid_cycle_settings_version = 0;
+static int pid_base_speed = 150;
 
 // Мьютекс для защиты статических переменных PID
 portMUX_TYPE pid_params_mutex = portMUX_INITIALIZER_UNLOCKED;
@@ -73,10 +78,19 @@ float getPidSetpointTemp() {
     return val;
 }
 
+// Уставка и базовая скорость из снимка настроек (вызывать под pid_params_mutex)
+static void loadPidConfigSnapshot() {
+    pid_config_version = getConfigVersion();
+    pid_cycle_settings_version = getDosingCycleSettingsVersion();
+    pid_setpoint_temp_static = getDosingTempSetpoint(); // С переопределением задания очереди
+    int speed = getDosingMotorSpeed();
+    pid_base_speed = speed > 0 ? speed : PID_BASE_MOTOR_SPEED;
+}
+
 void initPidController() {
     portENTER_CRITICAL(&pid_params_mutex);
     pid_temp_control_enabled_static = false; // По умолчанию выключен
-    pid_setpoint_temp_static = config.tempSetpoint; // Инициализируем уставкой из конфига
+    loadPidConfigSnapshot(); // Инициализируем уставкой из конфига
     pid_integral_static = 0.0f;
     pid_previous_error_static = 0.0f;
     pid_last_time_static = millis();
@@ -92,7 +106,7 @@ void enablePidTempControl(bool enable) {
     portENTER_CRITICAL(&pid_params_mutex);
     pid_temp_control_enabled_static = enable;
     if (enable) {
-        pid_setpoint_temp_static = config.tempSetpoint; // Устанавливаем текущую уставку
+        loadPidConfigSnapshot(); // Устанавливаем текущую уставку
         pid_integral_static = 0.0f;
         pid_previous_error_static = 0.0f;
         pid_last_time_static = millis();
@@ -113,11 +127,18 @@ void setPidCoefficients(float kp, float ki, float kd) {
         config.pidKp = kp;
         config.pidKi = ki;
         config.pidKd = kd;
+        publishConfig();
         // saveConfig(); // <--- УДАЛИТЬ ВЫЗОВ saveConfig() ОТСЮДА
         log_i("PID", "PID Coefficients in config struct updated. Save externally if needed.");
     }
 }
 
+void pidResetTimebase() {
+    portENTER_CRITICAL(&pid_params_mutex);
+    pid_last_time_static = millis();
+    portEXIT_CRITICAL(&pid_params_mutex);
+}
+
 void handlePidControl() {
     // Читаем состояние PID и dosing_state под мьютексами
     bool local_pid_enabled;
@@ -154,16 +175,19 @@ void handlePidControl() {
         return;
     }
 
-    // Обновляем уставку PID, если она изменилась в config
-    if (fabs(local_pid_setpoint - config.tempSetpoint) > 0.01f) {
+    // Настройки перечитываются только после публикации новой версии config, а не сравнением на каждом такте
+    if (getConfigVersion() != pid_config_version || getDosingCycleSettingsVersion() != pid_cycle_settings_version) {
         portENTER_CRITICAL(&pid_params_mutex);
-        pid_setpoint_temp_static = config.tempSetpoint;
+        loadPidConfigSnapshot();
+        bool setpoint_changed = fabs(local_pid_setpoint - pid_setpoint_temp_static) > 0.01f;
         local_pid_setpoint = pid_setpoint_temp_static; // Обновляем локальную копию
-        // Сброс интеграла при смене уставки может быть полезен
-        pid_integral_static = 0.0f;
-        local_pid_integral = 0.0f;
+        if (setpoint_changed) {
+            // Сброс интеграла при смене уставки может быть полезен
+            pid_integral_static = 0.0f;
+            local_pid_integral = 0.0f;
+        }
         portEXIT_CRITICAL(&pid_params_mutex);
-        log_i("PID", "Setpoint updated to %.1f C", local_pid_setpoint);
+        if (setpoint_changed) log_i("PID", "Setpoint updated to %.1f C", local_pid_setpoint);
     }
 
     float current_temp = tOut_filtered; // Используем отфильтрованную температуру
@@ -187,13 +211,15 @@ void handlePidControl() {
     float d_term = local_pid_kd * derivative;
 
     float pid_output_correction = p_term + local_pid_integral + d_term;
-    int base_speed = config.motorSpeed > 0 ? config.motorSpeed : PID_BASE_MOTOR_SPEED;
-    int new_motor_speed = constrain(base_speed + (int)round(pid_output_correction), PID_MIN_MOTOR_SPEED, PID_MAX_MOTOR_SPEED);
+    int base_speed = pid_base_speed;
+    // Упреждающая добавка ILC (обучена на предыдущих циклах); PID исправляет только остаток
+    float ilc_ff = getIlcFeedForward();
+    int new_motor_speed = constrain(base_speed + (int)round(ilc_ff + pid_output_correction), PID_MIN_MOTOR_SPEED, PID_MAX_MOTOR_SPEED);
 
     updateMotorSpeedFromPid((float)new_motor_speed); // Эта функция должна быть в motor_control.h/c
 
-    log_d("PID_TEMP", "Tset:%.1f, Tcur:%.1f, Err:%.2f, P:%.2f, I(sum):%.2f, D:%.2f, OutCorr:%.2f, BaseSpd:%d, NewSpeed:%d (%.1f st/s)",
-          local_pid_setpoint, current_temp, error, p_term, local_pid_integral, d_term, pid_output_correction, base_speed, new_motor_speed, current_steps_per_sec);
+    log_d("PID_TEMP", "Tset:%.1f, Tcur:%.1f, Err:%.2f, P:%.2f, I(sum):%.2f, D:%.2f, OutCorr:%.2f, ILC:%.0f, BaseSpd:%d, NewSpeed:%d (%.1f st/s)",
+          local_pid_setpoint, current_temp, error, p_term, local_pid_integral, d_term, pid_output_correction, ilc_ff, base_speed, new_motor_speed, getMotorSpeed());
 
     // Сохраняем обновленные значения PID состояния
     portENTER_CRITICAL(&pid_params_mutex);
@@ -4,7 +4,7 @@
 #include <Arduino.h>
 #include "config_manager.h" // Для Config
 #include "sensors.h"        // Для tOut_filtered
-#include "motor_control.h"  // Для current_steps_per_sec, step_interval_us, updateMotorSpeedFromPid
+#include "motor_control.h"  // Для updateMotorSpeedFromPid
 #include "dosing_logic.h"   // Для DosingState, current_dosing_state
 
 // Мьютекс для защиты статических переменных PID (определен в .c файле)
@@ -15,6 +15,7 @@ void handlePidControl();  // Основная функция расчета и 
 void enablePidTempControl(bool enable); // Включение/выключение PID
 float getPidSetpointTemp(); // Объявление геттера для уставки PID
 void setPidCoefficients(float kp, float ki, float kd); // Установка коэффициентов
+void pidResetTimebase(); // После паузы: интеграл сохраняется, время паузы не попадает в dt
 
 // Функции для получения текущих значений PID (для отображения в UI и т.д.)
 bool getIsPidTempControlEnabled();
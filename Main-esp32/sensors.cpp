@@ -5,6 +5,8 @@
 #include "dosing_logic.h"   // Для current_dosing_state, volume_dispensed_cycle
 #include "calibration_logic.h" // Для getCalibrationModeState
 #include "main.h"           // Для system_power_enabled и функций логирования
+#include "compressor_control.h" // Планировщик компрессора (min ON/OFF, прогноз)
+#include "counter_journal.h" // Счетчики пусков и наработки компрессора
 
 // Пины определены в sensors.h
 
@@ -22,6 +24,7 @@ int consecutive_temp_cooler_errors = 0;
 int consecutive_temp_out_errors = 0;
 
 volatile unsigned long flow_pulse_count = 0;
+volatile uint32_t flow_pulse_total = 0;
 portMUX_TYPE flow_pulse_mutex = portMUX_INITIALIZER_UNLOCKED;
 float current_flow_rate_ml_per_min = 0;
 bool checking_for_flow = false;
@@ -149,8 +152,7 @@ void handleTempLogic() {
         tOut = temp_val_out;
         tOut_filtered = getFilteredTempOut(); // Используем функцию фильтрации
         consecutive_temp_out_errors = 0; // Используем getSystemErrorCode()
-        if (getSystemErrorCode() == CRIT_TEMP_SENSOR_OUT_FAIL) {
-            clearSystemError();
+        if (clearSystemErrorRecovered(CRIT_TEMP_SENSOR_OUT_FAIL)) { // С удержанием: нестабильный датчик не переключает ошибку на каждом чтении
             log_i("TEMP", "Temp Out sensor recovered. Error cleared.");
         }
     } else {
@@ -164,8 +166,7 @@ void handleTempLogic() {
     if (temp_val_in != -127.0f) {
         tIn = temp_val_in;
         consecutive_temp_in_errors = 0; // Используем getSystemErrorCode()
-        if (getSystemErrorCode() == CRIT_TEMP_SENSOR_IN_FAIL) {
-            clearSystemError();
+        if (clearSystemErrorRecovered(CRIT_TEMP_SENSOR_IN_FAIL)) {
             log_i("TEMP", "Temp In sensor recovered. Error cleared.");
         }
     } else {
@@ -177,8 +178,7 @@ void handleTempLogic() {
     if (temp_val_cooler != -127.0f) {
         tCool = temp_val_cooler;
         consecutive_temp_cooler_errors = 0; // Используем getSystemErrorCode()
-        if (getSystemErrorCode() == CRIT_TEMP_SENSOR_COOLER_FAIL) {
-            clearSystemError();
+        if (clearSystemErrorRecovered(CRIT_TEMP_SENSOR_COOLER_FAIL)) {
             log_i("TEMP", "Temp Cooler sensor recovered. Error cleared.");
         }
     } else {
@@ -250,17 +250,21 @@ void handleTempLogic() {
             // Используем отфильтрованную температуру для управления
             float control_temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered; // Если фильтр еще не готов, используем сырую
             if (control_temp != -127.0f) { // Убедимся, что есть валидное значение
-                const float temp_hysteresis_general = 0.5f; // Гистерезис для общего управления
-                if (control_temp > (config.tempSetpoint + temp_hysteresis_general)) {
-                    compressorOn();
+                // Реле переключает планировщик с учетом минимального времени работы/простоя.
+                // Запрос выставляется и заранее, если по наклону T_out полоса будет превышена.
+                const float temp_hysteresis_general = COMPRESSOR_BAND_C; // Гистерезис для общего управления
+                if (control_temp > (config.tempSetpoint + temp_hysteresis_general) ||
+                    compressorPredictsOvershoot(control_temp, config.tempSetpoint + temp_hysteresis_general)) {
+                    compressorRequest(COMP_DEMAND_GENERAL, true);
                 } else if (control_temp < config.tempSetpoint) {
-                    compressorOff();
+                    compressorRequest(COMP_DEMAND_GENERAL, false);
                 }
             }
         } // Используем getSystemErrorCode()
     } else if (!system_power_enabled || getSystemErrorCode() == CRIT_TEMP_SENSOR_OUT_FAIL) {
         // Жесткое выключение компрессора, если система выключена или критическая ошибка датчика,
-        // независимо от состояния дозирования или задержек.
+        // независимо от состояния дозирования или задержек (минуя планировщик).
+        compressorReleaseAll();
         if (compressorRunning) {
             compressorOff();
         }
@@ -287,6 +291,7 @@ float getFilteredTempOut() {
 void IRAM_ATTR flowPulse() {
     portENTER_CRITICAL_ISR(&flow_pulse_mutex);
     flow_pulse_count++;
+    flow_pulse_total++;
     if (getCalibrationModeState()) { // Если в режиме калибровки, считаем импульсы и для нее
         portENTER_CRITICAL_ISR(&cal_pulse_mutex); // Используем отдельный мьютекс для калибровочных импульсов
         flow_pulses_calibration++;
@@ -323,16 +328,17 @@ void handleFlowSensor() {
         local_dosing_state = current_dosing_state;
         portEXIT_CRITICAL(&dosing_state_mutex);
 
-        if (motor_running_auto && local_dosing_state == DOSING_STATE_RUNNING) {
+        // Датчик потока стоит на линии основного канала
+        bool primary_running_auto = getMotor(MOTOR_PRIMARY_CHANNEL).isRunningAuto();
+        if (primary_running_auto && local_dosing_state == DOSING_STATE_RUNNING) {
             portENTER_CRITICAL(&volume_dispensed_mutex); // Мьютекс из dosing_logic.h
             volume_dispensed_cycle += (float)p_snap * ml_per_pulse;
             portEXIT_CRITICAL(&volume_dispensed_mutex);
         }
 
         // Логика No-Flow Timeout
-        // motor_running_auto - bool, чтение атомарно
         // local_dosing_state уже прочитан выше
-        if (motor_running_auto && local_dosing_state == DOSING_STATE_RUNNING) {
+        if (primary_running_auto && local_dosing_state == DOSING_STATE_RUNNING) {
             if (p_snap > 0) {
                 // Если поток обнаружен, сбрасываем таймер (или флаг) no-flow
                 if (checking_for_flow) { // checking_for_flow устанавливается в true в dosing_logic.c при старте мотора
@@ -370,8 +376,10 @@ void compressorOn() {
         digitalWrite(COMPRESSOR_PIN, HIGH);
         compressorRunning = true;
         config.compressorStartCount++;
+        counterJournalNoteChange();
         lastCompressorStartTime = millis(); // Раскомментировано для отслеживания времени работы
         log_i("COMPRESSOR", "Compressor ON");
+        compressorNotifyStateChange(true);
     }
 }
 
@@ -382,8 +390,10 @@ void compressorOff() {
         if (lastCompressorStartTime > 0) { // Убедимся, что время старта было зафиксировано
            config.compressorRunTime += (millis() - lastCompressorStartTime);
            lastCompressorStartTime = 0; // Сбрасываем для следующего цикла
+           counterJournalNoteChange();
         }
         log_i("COMPRESSOR", "Compressor OFF");
+        compressorNotifyStateChange(false);
     }
 }
 
@@ -44,7 +44,8 @@ extern int consecutive_temp_cooler_errors;
 extern int consecutive_temp_out_errors;
 
 extern volatile unsigned long flow_pulse_count; // Счетчик импульсов с датчика потока
-extern portMUX_TYPE flow_pulse_mutex;          // Мьютекс для защиты flow_pulse_count
+extern volatile uint32_t flow_pulse_total;     // Монотонный счетчик импульсов (не сбрасывается), для окон монитора срыва
+extern portMUX_TYPE flow_pulse_mutex;          // Мьютекс для защиты flow_pulse_count и flow_pulse_total
 extern float current_flow_rate_ml_per_min;     // Текущий рассчитанный расход
 
 extern bool checking_for_flow;                 // Флаг, что активна проверка на отсутствие потока
@@ -0,0 +1,222 @@
+#include "stall_monitor.h"
+#include "config_manager.h" // Для config.mlPerStep, config.flowMlPerPulse
+#include "sensors.h"        // Для flow_pulse_total, checking_for_flow
+#include "motor_control.h"  // Для getMotor
+#include "dosing_logic.h"   // Для getDosingState
+#include "error_handler.h"  // Для setSystemError
+#include "main.h"           // Для функций логирования
+
+portMUX_TYPE stall_monitor_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+static StallMonitorStats_t stall_stats;
+
+// Окно отсчетов (только из loop)
+static int32_t window_steps[STALL_WINDOW_SAMPLES];
+static uint32_t window_pulses[STALL_WINDOW_SAMPLES];
+static int window_pos = 0;
+static int window_filled = 0;
+static long last_steps = 0;
+static uint32_t last_pulses = 0;
+static unsigned long last_sample_ms = 0;
+static unsigned long settle_until_ms = 0;
+static bool monitor_active = false;
+static int slip_windows = 0;
+static float speed_scale = 1.0f;
+static float ceiling_steps_sec = 0.0f;
+static bool reramp_pending = false;
+static float reramp_per_sec = STALL_RERAMP_PER_SEC;
+
+static uint32_t readFlowPulseTotal() {
+    uint32_t total;
+    portENTER_CRITICAL(&flow_pulse_mutex);
+    total = flow_pulse_total;
+    portEXIT_CRITICAL(&flow_pulse_mutex);
+    return total;
+}
+
+static void resetWindow(unsigned long now) {
+    window_pos = 0;
+    window_filled = 0;
+    slip_windows = 0;
+    last_steps = getMotor(MOTOR_PRIMARY_CHANNEL).getStepsTaken();
+    last_pulses = readFlowPulseTotal();
+    last_sample_ms = now;
+    settle_until_ms = now + STALL_SETTLE_MS;
+}
+
+static void applyScale(float scale) {
+    speed_scale = scale;
+    getMotor(MOTOR_PRIMARY_CHANNEL).setSpeedScale(scale);
+}
+
+void initStallMonitor() {
+    memset(&stall_stats, 0, sizeof(stall_stats));
+    stall_stats.speed_scale = 1.0f;
+    monitor_active = false;
+    speed_scale = 1.0f;
+    ceiling_steps_sec = 0.0f;
+    log_i("STALL", "Stall monitor initialized (window %d ms, stall < %.2f, slip < %.2f).",
+          STALL_SAMPLE_MS * STALL_WINDOW_SAMPLES, STALL_RATIO, SLIP_RATIO);
+}
+
+// Срыв или проскальзывание подтверждены: снижаем скорость и запоминаем потолок
+static void handleStallEvent(bool is_stall, float ratio, unsigned long now) {
+    Motor& primary = getMotor(MOTOR_PRIMARY_CHANNEL);
+    float effective = primary.getEffectiveSpeed();
+    float new_ceiling = effective * STALL_CEILING_MARGIN;
+    if (ceiling_steps_sec <= 0.0f || new_ceiling < ceiling_steps_sec) ceiling_steps_sec = new_ceiling;
+
+    uint16_t stalls_cycle;
+    portENTER_CRITICAL(&stall_monitor_mutex);
+    if (is_stall) {
+        stall_stats.stalls_cycle++;
+        stall_stats.stalls_total++;
+    } else {
+        stall_stats.slips_cycle++;
+        stall_stats.slips_total++;
+    }
+    stalls_cycle = stall_stats.stalls_cycle;
+    portEXIT_CRITICAL(&stall_monitor_mutex);
+
+    if (is_stall && (speed_scale <= STALL_MIN_SCALE || stalls_cycle > STALL_MAX_EVENTS_PER_CYCLE)) {
+        log_e("STALL", "Pump stall persists (ratio %.2f, scale %.2f, %u stalls this cycle).", ratio, speed_scale, stalls_cycle);
+        portENTER_CRITICAL(&stall_monitor_mutex);
+        stall_stats.faults_total++;
+        portEXIT_CRITICAL(&stall_monitor_mutex);
+        setSystemError(CRIT_MOTOR_FAIL, "Pump stall: flow does not follow steps after speed back-off.");
+        monitor_active = false;
+        return;
+    }
+
+    float factor = is_stall ? STALL_BACKOFF_FACTOR : SLIP_BACKOFF_FACTOR;
+    float scale = speed_scale * factor;
+    if (scale < STALL_MIN_SCALE) scale = STALL_MIN_SCALE;
+    log_w("STALL", "%s detected: measured/expected %.2f at %.0f st/s. Speed scale %.2f -> %.2f, ceiling %.0f st/s.",
+          is_stall ? "Stall" : "Slip", ratio, effective, speed_scale, scale, ceiling_steps_sec);
+    applyScale(scale);
+    reramp_pending = true;
+    resetWindow(now);
+}
+
+// Плавный возврат коэффициента к потолку скорости (или к 1.0, если потолок не найден)
+static void rerampSpeed(unsigned long dt_ms) {
+    Motor& primary = getMotor(MOTOR_PRIMARY_CHANNEL);
+    float commanded = primary.getSpeed();
+    float target = 1.0f;
+    if (ceiling_steps_sec > 0.0f && commanded > ceiling_steps_sec) target = ceiling_steps_sec / commanded;
+    if (target < STALL_MIN_SCALE) target = STALL_MIN_SCALE;
+
+    if (speed_scale < target) {
+        float scale = speed_scale + reramp_per_sec * (float)dt_ms / 1000.0f;
+        if (scale >= target) {
+            scale = target;
+            reramp_per_sec = STALL_RERAMP_PER_SEC;
+            if (reramp_pending) {
+                reramp_pending = false;
+                portENTER_CRITICAL(&stall_monitor_mutex);
+                stall_stats.recoveries_total++;
+                portEXIT_CRITICAL(&stall_monitor_mutex);
+                log_i("STALL", "Speed re-ramped to %.0f st/s (scale %.2f).", commanded * scale, scale);
+            }
+        }
+        applyScale(scale);
+    } else if (speed_scale > target) {
+        applyScale(target); // PID поднял заданную скорость выше потолка
+    }
+}
+
+void handleStallMonitor() {
+    unsigned long now = millis();
+    if (now - last_sample_ms < STALL_SAMPLE_MS) return;
+    unsigned long dt_ms = now - last_sample_ms;
+
+    Motor& primary = getMotor(MOTOR_PRIMARY_CHANNEL);
+    bool should_run = getDosingState() == DOSING_STATE_RUNNING && primary.isRunningAuto() &&
+                      config.flowMlPerPulse > 0.000001f && primary.getMlPerStep() > 0.000001f;
+
+    if (!should_run) {
+        if (getDosingState() == DOSING_STATE_PAUSED) {
+            last_sample_ms = now; // На паузе держим коэффициент и потолок цикла
+            return;
+        }
+        if (monitor_active || speed_scale != 1.0f) {
+            applyScale(1.0f);
+            ceiling_steps_sec = 0.0f;
+            reramp_pending = false;
+            monitor_active = false;
+            portENTER_CRITICAL(&stall_monitor_mutex);
+            stall_stats.stalls_cycle = 0;
+            stall_stats.slips_cycle = 0;
+            portEXIT_CRITICAL(&stall_monitor_mutex);
+        }
+        last_sample_ms = now;
+    } else {
+        if (!monitor_active) { // Новый цикл
+            monitor_active = true;
+            ceiling_steps_sec = 0.0f;
+            portENTER_CRITICAL(&stall_monitor_mutex);
+            stall_stats.stalls_cycle = 0;
+            stall_stats.slips_cycle = 0;
+            portEXIT_CRITICAL(&stall_monitor_mutex);
+            resetWindow(now);
+        } else {
+            // Отсчет окна
+            long steps = primary.getStepsTaken();
+            uint32_t pulses = readFlowPulseTotal();
+            window_steps[window_pos] = (int32_t)(steps - last_steps);
+            window_pulses[window_pos] = pulses - last_pulses;
+            window_pos = (window_pos + 1) % STALL_WINDOW_SAMPLES;
+            if (window_filled < STALL_WINDOW_SAMPLES) window_filled++;
+            last_steps = steps;
+            last_pulses = pulses;
+            last_sample_ms = now;
+
+            rerampSpeed(dt_ms);
+
+            // Пока трубка заполняется (checking_for_flow), отсутствие потока ловит no-flow таймаут
+            if (!checking_for_flow && (long)(now - settle_until_ms) >= 0 && window_filled == STALL_WINDOW_SAMPLES) {
+                int32_t sum_steps = 0;
+                uint32_t sum_pulses = 0;
+                for (int i = 0; i < STALL_WINDOW_SAMPLES; i++) {
+                    sum_steps += window_steps[i];
+                    sum_pulses += window_pulses[i];
+                }
+                float expected_ml = (float)sum_steps * primary.getMlPerStep();
+                float expected_pulses = expected_ml / config.flowMlPerPulse;
+                if (expected_pulses >= STALL_MIN_EXPECTED_PULSES) {
+                    float ratio = (float)sum_pulses * config.flowMlPerPulse / expected_ml;
+                    portENTER_CRITICAL(&stall_monitor_mutex);
+                    stall_stats.last_ratio = ratio;
+                    portEXIT_CRITICAL(&stall_monitor_mutex);
+                    if (ratio < STALL_RATIO) {
+                        handleStallEvent(true, ratio, now);
+                    } else if (ratio < SLIP_RATIO) {
+                        if (++slip_windows >= SLIP_CONFIRM_WINDOWS) handleStallEvent(false, ratio, now);
+                    } else {
+                        slip_windows = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    portENTER_CRITICAL(&stall_monitor_mutex);
+    stall_stats.active = monitor_active;
+    stall_stats.speed_scale = speed_scale;
+    stall_stats.ceiling_steps_sec = ceiling_steps_sec;
+    portEXIT_CRITICAL(&stall_monitor_mutex);
+}
+
+void stallMonitorStartRamp(float from_scale, float per_sec) {
+    if (from_scale < STALL_MIN_SCALE) from_scale = STALL_MIN_SCALE;
+    if (from_scale < speed_scale) applyScale(from_scale);
+    reramp_per_sec = per_sec > 0.0f ? per_sec : STALL_RERAMP_PER_SEC;
+    if (monitor_active) resetWindow(millis()); // Окно до паузы не относится к новой скорости
+}
+
+void getStallMonitorStats(StallMonitorStats_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&stall_monitor_mutex);
+    *out = stall_stats;
+    portEXIT_CRITICAL(&stall_monitor_mutex);
+}
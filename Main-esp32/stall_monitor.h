@@ -0,0 +1,48 @@
+#ifndef STALL_MONITOR_H
+#define STALL_MONITOR_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Монитор срыва/проскальзывания основного насоса.
+// Каждые STALL_SAMPLE_MS снимаются приращения шагов мотора и импульсов датчика потока; по скользящему окну
+// сравнивается ожидаемый объем (шаги * mlPerStep) с измеренным (импульсы * flowMlPerPulse).
+// При срыве или проскальзывании скорость снижается коэффициентом (Motor::setSpeedScale), затем плавно
+// поднимается до потолка, найденного в этом цикле. Ошибка CRIT_MOTOR_FAIL - только при повторяющихся срывах.
+
+#define STALL_SAMPLE_MS             100   // Период снятия отсчетов (мс)
+#define STALL_WINDOW_SAMPLES        5     // Размер скользящего окна (отсчетов), окно 500 мс
+#define STALL_SETTLE_MS             1000  // Пауза после старта/снижения скорости: поток догоняет мотор
+#define STALL_MIN_EXPECTED_PULSES   4.0f  // Меньше ожидаемых импульсов в окне - сравнение не значимо
+#define STALL_RATIO                 0.30f // Измерено/ожидаемо ниже этого - срыв
+#define SLIP_RATIO                  0.75f // Ниже этого (но выше STALL_RATIO) - проскальзывание
+#define SLIP_CONFIRM_WINDOWS        3     // Проскальзывание подтверждается N окнами подряд
+#define STALL_BACKOFF_FACTOR        0.60f // Снижение коэффициента скорости при срыве
+#define SLIP_BACKOFF_FACTOR         0.85f // Снижение коэффициента скорости при проскальзывании
+#define STALL_CEILING_MARGIN        0.90f // Потолок скорости = скорость в момент события * запас
+#define STALL_MIN_SCALE             0.25f // Срыв на этом коэффициенте - отказ насоса
+#define STALL_RERAMP_PER_SEC        0.10f // Скорость восстановления коэффициента (1/с)
+#define STALL_MAX_EVENTS_PER_CYCLE  5     // Больше срывов за цикл - отказ насоса
+
+typedef struct {
+    bool active;                // Монитор сейчас оценивает окна (RUNNING, поток обнаружен)
+    float speed_scale;          // Текущий коэффициент скорости основного канала
+    float ceiling_steps_sec;    // Потолок скорости, найденный в этом цикле (0 - не ограничен)
+    float last_ratio;           // Измерено/ожидаемо в последнем значимом окне
+    uint16_t stalls_cycle;
+    uint16_t slips_cycle;
+    uint32_t stalls_total;
+    uint32_t slips_total;
+    uint32_t recoveries_total;  // Сколько раз скорость вернулась к потолку без нового события
+    uint32_t faults_total;
+} StallMonitorStats_t;
+
+extern portMUX_TYPE stall_monitor_mutex;
+
+void initStallMonitor();
+void handleStallMonitor(); // Вызывается из loop() после handleFlowSensor()
+void getStallMonitorStats(StallMonitorStats_t* out);
+// Плавный разгон основного канала с коэффициента from_scale (например, после паузы); только из loop
+void stallMonitorStartRamp(float from_scale, float per_sec);
+
+#endif // STALL_MONITOR_H
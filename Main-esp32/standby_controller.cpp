@@ -0,0 +1,259 @@
+#include "standby_controller.h"
+#include <Preferences.h>
+#include <time.h>
+#include "config_manager.h"     // Для config.tempSetpoint
+#include "sensors.h"            // Для tOut, tOut_filtered
+#include "dosing_logic.h"       // Для getDosingState, volume_dispensed_cycle
+#include "compressor_control.h" // Для compressorRequest
+#include "error_handler.h"      // Для getSystemErrorCode
+#include "main.h"               // Для system_power_enabled и функций логирования
+
+#define STANDBY_NAMESPACE "standby"
+#define STANDBY_HIST_KEY  "hist"
+
+portMUX_TYPE standby_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Гистограмма запросов по времени суток (защищена standby_mutex)
+static uint16_t standby_hist[STANDBY_SLOTS];
+static uint32_t standby_hist_total = 0;
+static bool standby_hist_dirty = false;
+static StandbyMetrics_t standby_metrics;
+
+// Состояние регулятора (только из loop)
+static bool standby_active = false;
+static bool standby_demand_on = false;
+static unsigned long standby_last_eval_ms = 0;
+static unsigned long standby_last_save_ms = 0;
+static unsigned long standby_last_cycle_ms = 0;
+static bool standby_had_cycle = false;
+
+// Измерение задержки "запрос -> поток" (request_pending защищен standby_mutex, остальное - из loop)
+static bool request_pending = false;
+static unsigned long request_ms = 0;
+static bool request_precooled = false;
+
+// Слот текущего локального времени; -1, если время еще не синхронизировано
+static int currentSlot() {
+    struct tm tm_now;
+    if (!getLocalTime(&tm_now, 0)) return -1;
+    return (tm_now.tm_hour * 60 + tm_now.tm_min) / STANDBY_SLOT_MIN;
+}
+
+static void saveStandbyHistogram() {
+    uint16_t copy[STANDBY_SLOTS];
+    portENTER_CRITICAL(&standby_mutex);
+    memcpy(copy, standby_hist, sizeof(copy));
+    standby_hist_dirty = false;
+    portEXIT_CRITICAL(&standby_mutex);
+    Preferences prefs;
+    if (!prefs.begin(STANDBY_NAMESPACE, false)) {
+        log_e("STANDBY", "Failed to open NVS namespace '%s' for writing.", STANDBY_NAMESPACE);
+        return;
+    }
+    prefs.putBytes(STANDBY_HIST_KEY, copy, sizeof(copy));
+    prefs.end();
+    log_d("STANDBY", "Request histogram saved to NVS.");
+}
+
+void initStandbyController() {
+    memset(standby_hist, 0, sizeof(standby_hist));
+    memset(&standby_metrics, 0, sizeof(standby_metrics));
+    standby_hist_total = 0;
+
+    Preferences prefs;
+    if (prefs.begin(STANDBY_NAMESPACE, true)) {
+        // Размер проверяем явно: при изменении STANDBY_SLOT_MIN старая гистограмма отбрасывается
+        if (prefs.getBytesLength(STANDBY_HIST_KEY) == sizeof(standby_hist)) {
+            prefs.getBytes(STANDBY_HIST_KEY, standby_hist, sizeof(standby_hist));
+            for (int i = 0; i < STANDBY_SLOTS; i++) standby_hist_total += standby_hist[i];
+        }
+        prefs.end();
+    }
+
+    // Локальное время нужно только для гистограммы; без сети остается режим "после недавнего цикла"
+    configTzTime(STANDBY_TZ, STANDBY_NTP_SERVER1, STANDBY_NTP_SERVER2);
+    standby_last_save_ms = millis();
+    log_i("STANDBY", "Keep-cold standby initialized (%lu requests in histogram, TZ '%s').",
+          (unsigned long)standby_hist_total, STANDBY_TZ);
+}
+
+void standbyNoteRequest() {
+    int slot = currentSlot();
+    portENTER_CRITICAL(&standby_mutex);
+    standby_metrics.requests++;
+    request_pending = true;
+    request_ms = millis();
+    request_precooled = false;
+    if (slot >= 0) {
+        if (standby_hist[slot] >= STANDBY_HIST_MAX_WEIGHT) {
+            // Старение: старые привычки постепенно уступают новым
+            standby_hist_total = 0;
+            for (int i = 0; i < STANDBY_SLOTS; i++) {
+                standby_hist[i] /= 2;
+                standby_hist_total += standby_hist[i];
+            }
+        }
+        standby_hist[slot]++;
+        standby_hist_total++;
+        standby_hist_dirty = true;
+    }
+    portEXIT_CRITICAL(&standby_mutex);
+}
+
+// Спрос в ближайшие STANDBY_LOOKAHEAD_MIN минут относительно равномерного по суткам (1.0 - как в среднем)
+static float demandDensity(int slot, uint32_t* total_out) {
+    const int lookahead_slots = (STANDBY_LOOKAHEAD_MIN + STANDBY_SLOT_MIN - 1) / STANDBY_SLOT_MIN;
+    uint32_t ahead = 0;
+    uint32_t total;
+    portENTER_CRITICAL(&standby_mutex);
+    total = standby_hist_total;
+    // Текущий слот тоже учитываем: запрос может прийти до его конца
+    for (int i = 0; i <= lookahead_slots; i++) ahead += standby_hist[(slot + i) % STANDBY_SLOTS];
+    portEXIT_CRITICAL(&standby_mutex);
+    if (total_out) *total_out = total;
+    if (total == 0) return 0.0f;
+    float expected = (float)total * (float)(lookahead_slots + 1) / (float)STANDBY_SLOTS;
+    return (float)ahead / expected;
+}
+
+// Задержка "запрос -> поток": ждем первого объема по датчику потока в RUNNING
+static void trackRequestLatency(DosingState_t state, unsigned long now) {
+    bool pending;
+    unsigned long started;
+    portENTER_CRITICAL(&standby_mutex);
+    pending = request_pending;
+    started = request_ms;
+    portEXIT_CRITICAL(&standby_mutex);
+    if (!pending) return;
+
+    if (state == DOSING_STATE_PRE_COOLING) {
+        request_precooled = true;
+        return;
+    }
+    if (state == DOSING_STATE_RUNNING) {
+        float volume;
+        portENTER_CRITICAL(&volume_dispensed_mutex);
+        volume = volume_dispensed_cycle;
+        portEXIT_CRITICAL(&volume_dispensed_mutex);
+        if (volume <= 0.0f) return;
+
+        uint32_t latency = (uint32_t)(now - started);
+        portENTER_CRITICAL(&standby_mutex);
+        request_pending = false;
+        StandbyMetrics_t* m = &standby_metrics;
+        m->last_latency_ms = latency;
+        if (m->latency_samples == 0 || latency < m->min_latency_ms) m->min_latency_ms = latency;
+        if (latency > m->max_latency_ms) m->max_latency_ms = latency;
+        m->latency_samples++;
+        m->avg_latency_ms += ((float)latency - m->avg_latency_ms) / (float)m->latency_samples;
+        if (request_precooled) {
+            m->precool_samples++;
+            m->avg_latency_precool_ms += ((float)latency - m->avg_latency_precool_ms) / (float)m->precool_samples;
+        } else {
+            m->chilled_samples++;
+            m->avg_latency_chilled_ms += ((float)latency - m->avg_latency_chilled_ms) / (float)m->chilled_samples;
+        }
+        portEXIT_CRITICAL(&standby_mutex);
+        log_i("STANDBY", "Request-to-flow latency %lu ms (%s).", (unsigned long)latency, request_precooled ? "pre-cooled" : "line was cold");
+        return;
+    }
+    if (state == DOSING_STATE_IDLE || state == DOSING_STATE_ERROR || state == DOSING_STATE_STOPPING) {
+        portENTER_CRITICAL(&standby_mutex);
+        request_pending = false; // Цикл не дошел до потока - замер не учитываем
+        portEXIT_CRITICAL(&standby_mutex);
+    }
+}
+
+void handleStandbyController() {
+    unsigned long now = millis();
+    DosingState_t state = getDosingState();
+
+    trackRequestLatency(state, now);
+    if (state == DOSING_STATE_RUNNING || state == DOSING_STATE_PAUSED) {
+        standby_last_cycle_ms = now;
+        standby_had_cycle = true;
+    }
+
+    if (now - standby_last_eval_ms < STANDBY_EVAL_INTERVAL_MS) return;
+    standby_last_eval_ms = now;
+
+    bool dirty;
+    portENTER_CRITICAL(&standby_mutex);
+    dirty = standby_hist_dirty;
+    portEXIT_CRITICAL(&standby_mutex);
+    if (dirty && now - standby_last_save_ms >= STANDBY_SAVE_INTERVAL_MS) {
+        standby_last_save_ms = now;
+        saveStandbyHistogram();
+    }
+
+    // Решение: держать ли линию охлажденной
+    int slot = currentSlot();
+    uint32_t total = 0;
+    float density = slot >= 0 ? demandDensity(slot, &total) : 0.0f;
+    uint8_t reason = STANDBY_REASON_NONE;
+    if (slot >= 0 && total >= STANDBY_MIN_SAMPLES && density >= STANDBY_DENSITY_THRESHOLD) {
+        reason = STANDBY_REASON_FORECAST;
+    } else if (standby_had_cycle && now - standby_last_cycle_ms < STANDBY_RECENT_HOLD_MS) {
+        reason = STANDBY_REASON_RECENT;
+    }
+
+    // Управляем только между циклами; во время цикла компрессором управляет dosing_logic
+    bool allowed = system_power_enabled &&
+                   getSystemErrorCode() != CRIT_TEMP_SENSOR_OUT_FAIL &&
+                   (state == DOSING_STATE_IDLE || state == DOSING_STATE_FINISHED);
+    bool active = allowed && reason != STANDBY_REASON_NONE;
+
+    if (active != standby_active) {
+        if (active) {
+            log_i("STANDBY", "Keep-cold standby on (%s, demand x%.1f).", reason == STANDBY_REASON_FORECAST ? "forecast" : "recent cycle", density);
+        } else {
+            log_i("STANDBY", "Keep-cold standby off.");
+        }
+        standby_active = active;
+    }
+
+    if (active) {
+        float control_temp = (tOut_filtered == -127.0f) ? tOut : tOut_filtered;
+        if (control_temp != -127.0f) {
+            // Полоса ниже общей: линия остается в пределах старта без PRE_COOLING
+            if (control_temp > config.tempSetpoint + STANDBY_BAND_HIGH_C) {
+                standby_demand_on = true;
+            } else if (control_temp < config.tempSetpoint - STANDBY_BAND_LOW_C) {
+                standby_demand_on = false;
+            }
+        }
+    } else {
+        standby_demand_on = false;
+    }
+    compressorRequest(COMP_DEMAND_STANDBY, standby_demand_on);
+
+    portENTER_CRITICAL(&standby_mutex);
+    standby_metrics.time_synced = slot >= 0;
+    standby_metrics.active = active;
+    standby_metrics.reason = active ? reason : STANDBY_REASON_NONE;
+    standby_metrics.demand_density = density;
+    standby_metrics.histogram_total = standby_hist_total;
+    portEXIT_CRITICAL(&standby_mutex);
+}
+
+void getStandbyMetrics(StandbyMetrics_t* out) {
+    if (!out) return;
+    portENTER_CRITICAL(&standby_mutex);
+    *out = standby_metrics;
+    out->histogram_total = standby_hist_total;
+    portEXIT_CRITICAL(&standby_mutex);
+}
+
+void resetStandbyHistogram() {
+    portENTER_CRITICAL(&standby_mutex);
+    memset(standby_hist, 0, sizeof(standby_hist));
+    standby_hist_total = 0;
+    standby_hist_dirty = false;
+    portEXIT_CRITICAL(&standby_mutex);
+    Preferences prefs;
+    if (prefs.begin(STANDBY_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+    log_w("STANDBY", "Standby request histogram reset.");
+}
@@ -0,0 +1,60 @@
+#ifndef STANDBY_CONTROLLER_H
+#define STANDBY_CONTROLLER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Режим ожидания "держать холод" между циклами.
+// Запросы startDosingCycle() накапливаются в гистограмме по времени суток (слоты по 15 минут, время - NTP).
+// Если в ближайшие STANDBY_LOOKAHEAD_MIN минут запросы ожидаются заметно чаще среднего (или цикл был совсем недавно),
+// компрессор держит линию ниже уставки, и следующий налив стартует без PRE_COOLING.
+// Эффект измеряется задержкой "запрос -> поток" (отдельно для запросов с охлажденной и теплой линией).
+
+#define STANDBY_TZ                  "UTC0"   // POSIX TZ для локального времени суток (например, "EET-2EEST,M3.5.0/3,M10.5.0/4")
+#define STANDBY_NTP_SERVER1         "pool.ntp.org"
+#define STANDBY_NTP_SERVER2         "time.nist.gov"
+#define STANDBY_SLOT_MIN            15
+#define STANDBY_SLOTS               (24 * 60 / STANDBY_SLOT_MIN)
+#define STANDBY_LOOKAHEAD_MIN       30       // Горизонт прогноза спроса
+#define STANDBY_DENSITY_THRESHOLD   1.5f     // Спрос в горизонте выше среднего во столько раз - держим холод
+#define STANDBY_MIN_SAMPLES         20       // Меньше запросов в гистограмме - прогноз не используется
+#define STANDBY_RECENT_HOLD_MS      (10UL * 60 * 1000) // После цикла держим холод столько (и без NTP)
+#define STANDBY_BAND_LOW_C          0.3f     // Охлаждаем до уставки минус столько
+#define STANDBY_BAND_HIGH_C         0.2f     // Включаемся при превышении уставки на столько
+#define STANDBY_EVAL_INTERVAL_MS    1000
+#define STANDBY_SAVE_INTERVAL_MS    (60UL * 60 * 1000) // Гистограмма пишется в NVS не чаще раза в час
+#define STANDBY_HIST_MAX_WEIGHT     60000    // При достижении все веса делятся пополам (старение)
+
+typedef enum {
+    STANDBY_REASON_NONE = 0,
+    STANDBY_REASON_FORECAST = 1, // Прогноз по гистограмме
+    STANDBY_REASON_RECENT = 2    // Недавний цикл
+} StandbyReason_t;
+
+typedef struct {
+    bool time_synced;
+    bool active;
+    uint8_t reason;              // StandbyReason_t
+    float demand_density;        // Спрос в горизонте относительно среднего по суткам
+    uint32_t histogram_total;
+    uint32_t requests;
+    uint32_t latency_samples;
+    uint32_t last_latency_ms;    // Запрос -> первый объем по датчику потока
+    uint32_t min_latency_ms;
+    uint32_t max_latency_ms;
+    float avg_latency_ms;
+    float avg_latency_chilled_ms; // Линия была охлаждена при запросе
+    float avg_latency_precool_ms; // Понадобилось предохлаждение
+    uint32_t chilled_samples;
+    uint32_t precool_samples;    // Запросы, которым понадобился PRE_COOLING
+} StandbyMetrics_t;
+
+extern portMUX_TYPE standby_mutex;
+
+void initStandbyController();      // После запуска Wi-Fi (NTP)
+void handleStandbyController();    // Вызывается из loop() перед handleCompressorScheduler()
+void standbyNoteRequest();         // Вызывается из startDosingCycle() при принятом запросе
+void getStandbyMetrics(StandbyMetrics_t* out);
+void resetStandbyHistogram();      // Сброс гистограммы (в т.ч. в NVS)
+
+#endif // STANDBY_CONTROLLER_H
@@ -0,0 +1,88 @@
+// Пропускная способность кодеков ESP-NOW на хосте: make -C test bench
+// Сравнивать между собой только прогоны на одной машине; на ESP32 (240 МГц) CRC медленнее в разы.
+
+#include "esp_now_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static volatile uint32_t sink; // Не дает компилятору выбросить цикл
+
+static void report(const char* name, long iterations, size_t bytes_per_iter, double seconds) {
+    printf("%-28s %10.0f frames/s %8.1f MB/s %8.1f ns/frame\n", name, iterations / seconds,
+           (double)iterations * bytes_per_iter / seconds / 1e6, seconds * 1e9 / iterations);
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+    struct_status_t status;
+    memset(&status, 0, sizeof(status));
+    status.current_temperature_out = 4.2f;
+    status.current_volume_ml = 100;
+    status.system_state = STATE_FILLING;
+    strncpy(status.version_main_esp, "1.2.3", sizeof(status.version_main_esp));
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+
+    double t0 = nowSec();
+    for (long i = 0; i < iterations; i++) {
+        status.current_volume_ml = (int32_t)i;
+        sink += (uint32_t)espNowEncodeStatus((uint16_t)i, &status, buf, sizeof(buf));
+    }
+    report("encode status", iterations, ESPNOW_FRAME_OVERHEAD + sizeof(status), nowSec() - t0);
+
+    size_t len = espNowEncodeStatus(1, &status, buf, sizeof(buf));
+    t0 = nowSec();
+    for (long i = 0; i < iterations; i++) {
+        espnow_frame_header_t hdr;
+        const uint8_t* payload;
+        struct_status_t out = {};
+        buf[sizeof(espnow_frame_header_t)] ^= (uint8_t)(i & 1); // Каждый второй кадр - с ошибкой CRC
+        if (espNowDecodeFrame(buf, len, &hdr, &payload) == ESPNOW_FRAME_OK &&
+            espNowDecodeStatus(&hdr, payload, &out) == ESPNOW_FRAME_OK) {
+            sink += (uint32_t)out.current_volume_ml;
+        }
+    }
+    report("decode status (1/2 bad crc)", iterations, len, nowSec() - t0);
+
+    const uint16_t mask = ESPNOW_STATUS_F_TEMP_OUT | ESPNOW_STATUS_F_VOLUME | ESPNOW_STATUS_F_UPTIME;
+    size_t delta_len = ESPNOW_FRAME_OVERHEAD + espNowStatusDeltaPayloadLen(mask);
+    t0 = nowSec();
+    for (long i = 0; i < iterations; i++) {
+        status.uptime_seconds = (uint32_t)i;
+        sink += (uint32_t)espNowEncodeStatusDelta((uint16_t)i, &status, mask, buf, sizeof(buf));
+    }
+    report("encode status delta", iterations, delta_len, nowSec() - t0);
+
+    struct_status_t screen = status;
+    t0 = nowSec();
+    for (long i = 0; i < iterations; i++) {
+        espnow_frame_header_t hdr;
+        const uint8_t* payload;
+        if (espNowDecodeFrame(buf, delta_len, &hdr, &payload) == ESPNOW_FRAME_OK &&
+            espNowApplyStatusDelta(&hdr, payload, &screen) == ESPNOW_FRAME_OK) {
+            sink += screen.uptime_seconds;
+        }
+    }
+    report("decode + apply delta", iterations, delta_len, nowSec() - t0);
+
+    struct_command_t cmd = {CMD_QUEUE_DOSE, 330};
+    t0 = nowSec();
+    for (long i = 0; i < iterations; i++) {
+        espnow_frame_header_t hdr;
+        const uint8_t* payload;
+        struct_command_t out = {};
+        size_t n = espNowEncodeCommand((uint16_t)i, &cmd, buf, sizeof(buf));
+        if (espNowDecodeFrame(buf, n, &hdr, &payload) == ESPNOW_FRAME_OK &&
+            espNowDecodeCommand(&hdr, payload, &out) == ESPNOW_FRAME_OK) {
+            sink += (uint32_t)out.value;
+        }
+    }
+    report("command round trip", iterations, ESPNOW_FRAME_OVERHEAD + sizeof(cmd), nowSec() - t0);
+    return 0;
+}
@@ -0,0 +1,342 @@
+// Кластер из нескольких узлов в одном процессе: каждый узел держит свою таблицу, heartbeat раздаются
+// остальным раз в CLUSTER_HEARTBEAT_MS, решения - функции cluster_core.h, как в cluster_coordinator.cpp.
+
+#include "cluster_core.h"
+#include "test_common.h"
+
+#define SIM_STEP_MS 100
+
+typedef struct {
+    uint8_t mac[6];
+    bool online;
+    unsigned long boot_ms;
+    ClusterNode_t table[CLUSTER_MAX_NODES]; // [0] - свой узел
+    int count;
+    ClusterLeaderState_t leader_state;
+    int leader;                             // Индекс в своей таблице после последнего шага
+    // Состояние, которое узел объявляет в heartbeat
+    bool idle;
+    uint8_t queue_len;
+    int16_t line_temp_c100;
+    int16_t setpoint_c100;
+    // Пуск компрессора
+    bool pending;
+    unsigned long pending_since;
+    bool have_start;
+    unsigned long start_ms;
+} SimNode;
+
+typedef struct {
+    SimNode nodes[CLUSTER_MAX_NODES];
+    int count;
+    unsigned long now;
+    unsigned long starts_ms[16];            // Все пуски кластера по порядку
+    int starts_node[16];
+    int starts;
+} Sim;
+
+static void simInit(Sim* sim, const uint8_t macs[][6], int count) {
+    memset(sim, 0, sizeof(*sim));
+    sim->count = count;
+    for (int i = 0; i < count; i++) {
+        SimNode* n = &sim->nodes[i];
+        memcpy(n->mac, macs[i], 6);
+        n->online = true;
+        n->count = 1;
+        memcpy(n->table[0].mac, n->mac, 6);
+        n->table[0].self = true;
+        n->table[0].hb.line_temp_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+        n->table[0].hb.compressor_start_age_s = ESPNOW_CLUSTER_AGE_UNKNOWN;
+        n->line_temp_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+        n->leader = 0;
+    }
+}
+
+static void simSetOnline(Sim* sim, int i, bool online) {
+    SimNode* n = &sim->nodes[i];
+    if (online && !n->online) {
+        n->boot_ms = sim->now; // Перезагрузка: таблица и состояние лидера с нуля
+        n->count = 1;
+        memset(&n->leader_state, 0, sizeof(n->leader_state));
+    }
+    n->online = online;
+}
+
+// Собственный heartbeat, выборы и шаг лидера - как handleClusterCoordinator()
+static void simNodeStep(Sim* sim, int i) {
+    SimNode* n = &sim->nodes[i];
+    unsigned long now = sim->now;
+    struct_cluster_heartbeat_t* hb = &n->table[0].hb;
+    memset(hb, 0, sizeof(*hb));
+    if (n->idle) hb->flags |= ESPNOW_CLUSTER_F_IDLE;
+    if (n->pending) {
+        hb->flags |= ESPNOW_CLUSTER_F_START_PENDING;
+        hb->start_wait_s = (uint16_t)((now - n->pending_since) / 1000UL);
+    }
+    hb->queue_len = n->queue_len;
+    hb->line_temp_c100 = n->line_temp_c100;
+    hb->setpoint_c100 = n->setpoint_c100;
+    hb->compressor_start_age_s = n->have_start ? (uint16_t)((now - n->start_ms) / 1000UL) : ESPNOW_CLUSTER_AGE_UNKNOWN;
+    n->table[0].heard_ms = now;
+
+    n->leader = clusterElectLeader(n->table, n->count, now);
+    const uint8_t* grant;
+    if (n->leader == 0) {
+        clusterLeaderUpdate(&n->leader_state, n->table, n->count, now);
+        hb->flags |= ESPNOW_CLUSTER_F_LEADER;
+        memcpy(hb->grant_mac, n->leader_state.grant_mac, 6);
+        grant = n->leader_state.grant_mac;
+    } else {
+        memset(&n->leader_state, 0, sizeof(n->leader_state));
+        grant = n->table[n->leader].hb.grant_mac;
+    }
+
+    // clusterCompressorStartAllowed(): после загрузки сначала слушаем соседей
+    if (n->pending && now - n->boot_ms >= CLUSTER_NODE_TIMEOUT_MS && memcmp(grant, n->mac, 6) == 0) {
+        n->pending = false;
+        n->have_start = true;
+        n->start_ms = now;
+        if (sim->starts < 16) {
+            sim->starts_ms[sim->starts] = now;
+            sim->starts_node[sim->starts] = i;
+            sim->starts++;
+        }
+    }
+}
+
+// clusterOnHeartbeat() у каждого живого соседа
+static void simBroadcast(Sim* sim, int from) {
+    const SimNode* src = &sim->nodes[from];
+    for (int j = 0; j < sim->count; j++) {
+        SimNode* dst = &sim->nodes[j];
+        if (j == from || !dst->online) continue;
+        int idx = clusterFindNode(dst->table, dst->count, src->mac);
+        if (idx < 0 && dst->count < CLUSTER_MAX_NODES) {
+            idx = dst->count++;
+            memset(&dst->table[idx], 0, sizeof(dst->table[idx]));
+            memcpy(dst->table[idx].mac, src->mac, 6);
+        }
+        if (idx > 0) {
+            dst->table[idx].hb = src->table[0].hb;
+            dst->table[idx].heard_ms = sim->now;
+        }
+    }
+}
+
+static void simRun(Sim* sim, unsigned long duration_ms) {
+    unsigned long end = sim->now + duration_ms;
+    while (sim->now < end) {
+        sim->now += SIM_STEP_MS;
+        for (int i = 0; i < sim->count; i++) {
+            if (sim->nodes[i].online) simNodeStep(sim, i);
+        }
+        if (sim->now % CLUSTER_HEARTBEAT_MS == 0) {
+            for (int i = 0; i < sim->count; i++) {
+                if (sim->nodes[i].online) simBroadcast(sim, i);
+            }
+        }
+    }
+}
+
+static const uint8_t* simLeaderMac(const Sim* sim, int i) {
+    const SimNode* n = &sim->nodes[i];
+    return n->leader >= 0 ? n->table[n->leader].mac : NULL;
+}
+
+// Все живые узлы видят лидером expected
+static bool simAllAgree(const Sim* sim, const uint8_t* expected) {
+    for (int i = 0; i < sim->count; i++) {
+        if (!sim->nodes[i].online) continue;
+        const uint8_t* mac = simLeaderMac(sim, i);
+        if (!mac || memcmp(mac, expected, 6) != 0) return false;
+    }
+    return true;
+}
+
+static const uint8_t kMacs[5][6] = {
+    {0x24, 0x6F, 0x28, 0x10, 0x00, 0x30},
+    {0x24, 0x6F, 0x28, 0x10, 0x00, 0x05}, // Наименьший
+    {0x24, 0x6F, 0x28, 0x10, 0x00, 0x40},
+    {0x24, 0x6F, 0x28, 0x10, 0x00, 0x12}, // Второй
+    {0x24, 0x6F, 0x28, 0x10, 0x01, 0x00},
+};
+
+static void testLeaderElection() {
+    Sim sim;
+    simInit(&sim, kMacs, 5);
+    // До первого обмена каждый считает лидером себя
+    simRun(&sim, SIM_STEP_MS);
+    for (int i = 0; i < 5; i++) CHECK_EQ(sim.nodes[i].leader, 0);
+
+    simRun(&sim, 2 * CLUSTER_HEARTBEAT_MS);
+    CHECK(simAllAgree(&sim, kMacs[1]));
+    int leaders = 0;
+    for (int i = 0; i < 5; i++) {
+        CHECK_EQ(sim.nodes[i].count, 5);
+        if (sim.nodes[i].table[0].hb.flags & ESPNOW_CLUSTER_F_LEADER) leaders++;
+    }
+    CHECK_EQ(leaders, 1);
+
+    // Лидер пропал: до таймаута остальные держатся за него, после - следующий по MAC
+    simSetOnline(&sim, 1, false);
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS - 2 * CLUSTER_HEARTBEAT_MS);
+    CHECK(simAllAgree(&sim, kMacs[1]));
+    simRun(&sim, 2 * CLUSTER_HEARTBEAT_MS + SIM_STEP_MS);
+    CHECK(simAllAgree(&sim, kMacs[3]));
+
+    // Вернулся после перезагрузки: лидерство назад за один heartbeat
+    simSetOnline(&sim, 1, true);
+    simRun(&sim, 2 * CLUSTER_HEARTBEAT_MS);
+    CHECK(simAllAgree(&sim, kMacs[1]));
+    CHECK_EQ(sim.nodes[1].leader, 0);
+}
+
+static void testStartStagger() {
+    Sim sim;
+    simInit(&sim, kMacs, 4);
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS + CLUSTER_HEARTBEAT_MS);
+    // Запросы в разное время: порядок пусков - по времени ожидания, не по MAC.
+    // Ожидание в heartbeat - в целых секундах, поэтому запросы разнесены больше чем на секунду.
+    const int order[4] = {2, 0, 3, 1};
+    for (int k = 0; k < 4; k++) {
+        SimNode* n = &sim.nodes[order[k]];
+        n->pending = true;
+        n->pending_since = sim.now;
+        simRun(&sim, 2 * CLUSTER_HEARTBEAT_MS);
+    }
+    simRun(&sim, 5 * CLUSTER_START_STAGGER_MS);
+
+    CHECK_EQ(sim.starts, 4);
+    for (int k = 0; k < sim.starts && k < 4; k++) CHECK_EQ(sim.starts_node[k], order[k]);
+    for (int k = 1; k < sim.starts; k++) {
+        CHECK(sim.starts_ms[k] - sim.starts_ms[k - 1] >= CLUSTER_START_STAGGER_MS);
+        // Очередь не простаивает: следующий пуск - вскоре после окончания интервала
+        CHECK(sim.starts_ms[k] - sim.starts_ms[k - 1] <= CLUSTER_START_STAGGER_MS + 3 * CLUSTER_HEARTBEAT_MS);
+    }
+    CHECK_EQ(sim.nodes[1].leader_state.grants_issued, 4u);
+}
+
+static void testStartStaggerSurvivesFailover() {
+    Sim sim;
+    simInit(&sim, kMacs, 4);
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS + CLUSTER_HEARTBEAT_MS);
+    sim.nodes[2].pending = true;
+    sim.nodes[2].pending_since = sim.now;
+    simRun(&sim, 3 * CLUSTER_HEARTBEAT_MS);
+    CHECK_EQ(sim.starts, 1);
+
+    // Лидер пропал сразу после пуска соседа; новый лидер знает о пуске из heartbeat
+    simSetOnline(&sim, 1, false);
+    sim.nodes[0].pending = true;
+    sim.nodes[0].pending_since = sim.now;
+    simRun(&sim, 3 * CLUSTER_START_STAGGER_MS);
+    CHECK(simAllAgree(&sim, kMacs[3]));
+    CHECK_EQ(sim.starts, 2);
+    if (sim.starts == 2) {
+        CHECK_EQ(sim.starts_node[1], 0);
+        CHECK(sim.starts_ms[1] - sim.starts_ms[0] >= CLUSTER_START_STAGGER_MS);
+    }
+}
+
+static void testGrantTimeout() {
+    Sim sim;
+    simInit(&sim, kMacs, 3);
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS + CLUSTER_HEARTBEAT_MS);
+    // Узел 0 ждет дольше, но пропадает с разрешением на руках - разрешение переходит к узлу 2
+    sim.nodes[0].pending = true;
+    sim.nodes[0].pending_since = sim.now;
+    simRun(&sim, CLUSTER_HEARTBEAT_MS);
+    sim.nodes[2].pending = true;
+    sim.nodes[2].pending_since = sim.now;
+    simSetOnline(&sim, 0, false);
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS + CLUSTER_GRANT_TIMEOUT_MS + 2 * CLUSTER_HEARTBEAT_MS);
+    CHECK_EQ(sim.starts, 1);
+    if (sim.starts == 1) CHECK_EQ(sim.starts_node[0], 2);
+}
+
+static void testDispatchTarget() {
+    Sim sim;
+    simInit(&sim, kMacs, 5);
+    // Узел 0 раздает; он сам холоднее всех, но себе задание не передается
+    sim.nodes[0].line_temp_c100 = 100;
+    sim.nodes[0].setpoint_c100 = 400;
+    sim.nodes[0].idle = true;
+    // Узел 1 свободен, линия на 1.0C выше уставки
+    sim.nodes[1].idle = true;
+    sim.nodes[1].line_temp_c100 = 500;
+    sim.nodes[1].setpoint_c100 = 400;
+    // Узел 2 свободен, абсолютно теплее узла 1, но относительно своей уставки холоднее (+0.5C)
+    sim.nodes[2].idle = true;
+    sim.nodes[2].line_temp_c100 = 650;
+    sim.nodes[2].setpoint_c100 = 600;
+    // Узел 3 холоднее всех, но наливает
+    sim.nodes[3].idle = false;
+    sim.nodes[3].line_temp_c100 = 200;
+    sim.nodes[3].setpoint_c100 = 400;
+    // Узел 4 без готового датчика
+    sim.nodes[4].idle = true;
+    sim.nodes[4].setpoint_c100 = 400;
+    simRun(&sim, 2 * CLUSTER_HEARTBEAT_MS);
+
+    const SimNode* d = &sim.nodes[0];
+    int target = clusterPickDispatchTarget(d->table, d->count, sim.now);
+    CHECK(target > 0);
+    if (target > 0) CHECK(memcmp(d->table[target].mac, kMacs[2], 6) == 0);
+
+    // С заданием в очереди узел не выбирается, даже свободный
+    sim.nodes[2].queue_len = 1;
+    simRun(&sim, CLUSTER_HEARTBEAT_MS);
+    target = clusterPickDispatchTarget(d->table, d->count, sim.now);
+    CHECK(target > 0);
+    if (target > 0) CHECK(memcmp(d->table[target].mac, kMacs[1], 6) == 0);
+
+    // Равный запас - меньший MAC
+    sim.nodes[2].queue_len = 0;
+    sim.nodes[2].line_temp_c100 = 700;
+    simRun(&sim, CLUSTER_HEARTBEAT_MS);
+    target = clusterPickDispatchTarget(d->table, d->count, sim.now);
+    CHECK(target > 0);
+    if (target > 0) CHECK(memcmp(d->table[target].mac, kMacs[1], 6) == 0);
+
+    // Пропавший узел не выбирается; без свободных соседей - -1
+    simSetOnline(&sim, 1, false);
+    sim.nodes[2].idle = false;
+    simRun(&sim, CLUSTER_NODE_TIMEOUT_MS + CLUSTER_HEARTBEAT_MS);
+    CHECK_EQ(clusterPickDispatchTarget(d->table, d->count, sim.now), -1);
+    CHECK_EQ(clusterPickDispatchTarget(d->table, 1, sim.now), -1);
+}
+
+static void testLastStartFromHeartbeats() {
+    ClusterNode_t nodes[3];
+    memset(nodes, 0, sizeof(nodes));
+    for (int i = 0; i < 3; i++) {
+        nodes[i].mac[5] = (uint8_t)(i + 1);
+        nodes[i].hb.compressor_start_age_s = ESPNOW_CLUSTER_AGE_UNKNOWN;
+    }
+    nodes[0].self = true;
+    unsigned long now = 100000;
+    nodes[0].heard_ms = now;
+    unsigned long last = 0;
+    CHECK(!clusterLastStartMs(nodes, 3, now, &last));
+    // Возраст из heartbeat плюс время с его приема; берется самый свежий пуск
+    nodes[1].heard_ms = now - 500;
+    nodes[1].hb.compressor_start_age_s = 20;
+    nodes[2].heard_ms = now - 200;
+    nodes[2].hb.compressor_start_age_s = 7;
+    CHECK(clusterLastStartMs(nodes, 3, now, &last));
+    CHECK_EQ(last, now - 7200);
+    // Выбывший узел не учитывается
+    nodes[2].heard_ms = now - CLUSTER_NODE_TIMEOUT_MS;
+    CHECK(clusterLastStartMs(nodes, 3, now, &last));
+    CHECK_EQ(last, now - 20500);
+}
+
+int main() {
+    RUN_TEST(testLeaderElection);
+    RUN_TEST(testStartStagger);
+    RUN_TEST(testStartStaggerSurvivesFailover);
+    RUN_TEST(testGrantTimeout);
+    RUN_TEST(testDispatchTarget);
+    RUN_TEST(testLastStartFromHeartbeats);
+    return testSummary();
+}
@@ -0,0 +1,34 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+// Минимальная обвязка хостовых тестов: CHECK печатает место ошибки и продолжает, код возврата - число ошибок.
+
+#include <stdio.h>
+
+static int test_failures = 0;
+static int test_checks = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        test_checks++;                                                               \
+        if (!(cond)) {                                                               \
+            test_failures++;                                                         \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+#define RUN_TEST(fn)                         \
+    do {                                     \
+        int before = test_failures;          \
+        fn();                                \
+        printf("%-40s %s\n", #fn, test_failures == before ? "ok" : "FAILED"); \
+    } while (0)
+
+static inline int testSummary() {
+    printf("%d checks, %d failed\n", test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif // TEST_COMMON_H
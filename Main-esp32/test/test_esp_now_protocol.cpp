@@ -0,0 +1,326 @@
+// Хостовые тесты формата кадров ESP-NOW (esp_now_protocol.h): make -C test test
+
+#include "esp_now_protocol.h"
+#include "test_common.h"
+
+static struct_status_t sampleStatus() {
+    struct_status_t s;
+    memset(&s, 0, sizeof(s));
+    s.current_temperature_out = 4.25f;
+    s.current_temperature_in = 18.5f;
+    s.current_volume_ml = 120;
+    s.target_volume_ml = 500;
+    s.system_state = STATE_FILLING;
+    s.error_code = 0;
+    s.current_setpoint_temperature = 4;
+    s.current_setpoint_volume = 500;
+    s.uptime_seconds = 3600;
+    strncpy(s.version_main_esp, "1.2.3", sizeof(s.version_main_esp));
+    return s;
+}
+
+static void testWireSizes() {
+    // Размеры на проводе фиксированы: обе прошивки должны видеть одинаковые структуры
+    CHECK_EQ(sizeof(espnow_frame_header_t), 8u);
+    CHECK_EQ(sizeof(struct_command_t), 5u);
+    CHECK_EQ(sizeof(struct_status_t), 48u);
+    CHECK_EQ(sizeof(struct_cluster_heartbeat_t), 20u);
+    CHECK_EQ(sizeof(struct_cluster_job_t), 16u);
+    CHECK_EQ(sizeof(struct_cluster_job_reply_t), 8u);
+    CHECK(ESPNOW_FRAME_OVERHEAD + sizeof(struct_status_t) <= ESPNOW_FRAME_MAX_LEN);
+}
+
+static void testCrcKnownValue() {
+    // CRC-16/CCITT-FALSE("123456789") = 0x29B1
+    const uint8_t data[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    CHECK_EQ(espNowCrc16(0xFFFF, data, sizeof(data)), 0x29B1);
+}
+
+static void testCommandRoundTrip() {
+    struct_command_t cmd = {CMD_SET_TEMPERATURE, -7};
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeCommand(42, &cmd, buf, sizeof(buf));
+    CHECK_EQ(len, ESPNOW_FRAME_OVERHEAD + sizeof(cmd));
+
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(hdr.type, ESPNOW_MSG_COMMAND);
+    CHECK_EQ(hdr.seq, 42);
+    struct_command_t out = {};
+    CHECK_EQ(espNowDecodeCommand(&hdr, payload, &out), ESPNOW_FRAME_OK);
+    CHECK_EQ(out.cmd_type, CMD_SET_TEMPERATURE);
+    CHECK_EQ(out.value, -7);
+}
+
+static void testStatusRoundTrip() {
+    struct_status_t s = sampleStatus();
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeStatus(65535, &s, buf, sizeof(buf));
+    CHECK(len > 0);
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_status_t out = {};
+    CHECK_EQ(espNowDecodeStatus(&hdr, payload, &out), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&out, &s, sizeof(s)) == 0);
+}
+
+static void testClusterRoundTrip() {
+    struct_cluster_heartbeat_t hb;
+    memset(&hb, 0, sizeof(hb));
+    hb.flags = ESPNOW_CLUSTER_F_IDLE | ESPNOW_CLUSTER_F_LEADER;
+    hb.line_temp_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+    hb.setpoint_c100 = 400;
+    hb.compressor_start_age_s = ESPNOW_CLUSTER_AGE_UNKNOWN;
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeClusterHeartbeat(1, &hb, buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_cluster_heartbeat_t hb_out = {};
+    CHECK_EQ(espNowDecodeClusterHeartbeat(&hdr, payload, &hb_out), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&hb_out, &hb, sizeof(hb)) == 0);
+
+    struct_cluster_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.job_id = 77;
+    job.volume_ml = 330;
+    job.temp_setpoint_c100 = ESPNOW_CLUSTER_TEMP_UNKNOWN;
+    job.channel_mask = 0x03;
+    len = espNowEncodeClusterJob(2, &job, buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_cluster_job_t job_out = {};
+    CHECK_EQ(espNowDecodeClusterJob(&hdr, payload, &job_out), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&job_out, &job, sizeof(job)) == 0);
+    // Кадр одного типа не декодируется кодеком другого
+    CHECK_EQ(espNowDecodeClusterHeartbeat(&hdr, payload, &hb_out), ESPNOW_FRAME_ERR_TYPE);
+
+    struct_cluster_job_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.job_id = 77;
+    reply.accepted = 1;
+    len = espNowEncodeClusterJobReply(3, &reply, buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(hdr.type, ESPNOW_MSG_CLUSTER_JOB_REPLY);
+    struct_cluster_job_reply_t reply_out = {};
+    CHECK_EQ(espNowDecodeClusterJobReply(&hdr, payload, &reply_out), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&reply_out, &reply, sizeof(reply)) == 0);
+    CHECK_EQ(espNowDecodeClusterJob(&hdr, payload, &job_out), ESPNOW_FRAME_ERR_TYPE);
+}
+
+static void testEncodeBufferTooSmall() {
+    struct_status_t s = sampleStatus();
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    CHECK_EQ(espNowEncodeStatus(1, &s, buf, ESPNOW_FRAME_OVERHEAD + sizeof(s) - 1), 0u);
+    CHECK_EQ(espNowEncodeStatus(1, &s, NULL, sizeof(buf)), 0u);
+    uint8_t big[ESPNOW_MAX_PAYLOAD_LEN + 1] = {0};
+    CHECK_EQ(espNowEncodeFrame(ESPNOW_MSG_COMMAND, 1, big, sizeof(big), buf, sizeof(buf)), 0u);
+}
+
+static void testTruncatedFrames() {
+    struct_command_t cmd = {CMD_START_PROCESS, 250};
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeCommand(3, &cmd, buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    // Любая обрезка кадра отвергается, нагрузка не выдается
+    for (size_t cut = 0; cut < len; cut++) {
+        payload = NULL;
+        espnow_frame_result_t r = espNowDecodeFrame(buf, cut, &hdr, &payload);
+        CHECK(r != ESPNOW_FRAME_OK);
+        CHECK(payload == NULL);
+    }
+    CHECK_EQ(espNowDecodeFrame(NULL, len, &hdr, &payload), ESPNOW_FRAME_ERR_SHORT);
+    // Заголовок обещает нагрузку длиннее кадра
+    CHECK_EQ(espNowDecodeFrame(buf, ESPNOW_FRAME_OVERHEAD, &hdr, &payload), ESPNOW_FRAME_ERR_SHORT);
+}
+
+static void testMalformedHeader() {
+    struct_command_t cmd = {CMD_STOP_PROCESS, 0};
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeCommand(4, &cmd, buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+
+    uint8_t bad[ESPNOW_FRAME_MAX_LEN];
+    memcpy(bad, buf, len);
+    bad[0] ^= 0xFF;
+    CHECK_EQ(espNowDecodeFrame(bad, len, &hdr, &payload), ESPNOW_FRAME_ERR_MAGIC);
+
+    memcpy(bad, buf, len);
+    bad[1] = ESPNOW_PROTOCOL_VERSION + 1;
+    CHECK_EQ(espNowDecodeFrame(bad, len, &hdr, &payload), ESPNOW_FRAME_ERR_VERSION);
+
+    // Длина нагрузки больше допустимой - до чтения CRC за пределами кадра
+    memcpy(bad, buf, len);
+    uint16_t huge = 0xFFFF;
+    memcpy(bad + offsetof(espnow_frame_header_t, len), &huge, sizeof(huge));
+    CHECK_EQ(espNowDecodeFrame(bad, len, &hdr, &payload), ESPNOW_FRAME_ERR_SHORT);
+}
+
+static void testBadCrc() {
+    struct_status_t s = sampleStatus();
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeStatus(9, &s, buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    // Одиночная ошибка в любом бите после magic/version ловится CRC (или проверкой длины)
+    for (size_t byte = 2; byte < len; byte++) {
+        for (int bit = 0; bit < 8; bit++) {
+            uint8_t bad[ESPNOW_FRAME_MAX_LEN];
+            memcpy(bad, buf, len);
+            bad[byte] ^= (uint8_t)(1u << bit);
+            CHECK(espNowDecodeFrame(bad, len, &hdr, &payload) != ESPNOW_FRAME_OK);
+        }
+    }
+}
+
+static void testPayloadShorterThanStruct() {
+    // Кадр с верной CRC, но нагрузкой короче struct_command_t (старый или чужой отправитель)
+    uint8_t short_payload[sizeof(struct_command_t) - 1] = {CMD_SET_VOLUME, 1, 2, 3};
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeFrame(ESPNOW_MSG_COMMAND, 5, short_payload, sizeof(short_payload), buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_command_t out = {};
+    CHECK_EQ(espNowDecodeCommand(&hdr, payload, &out), ESPNOW_FRAME_ERR_PAYLOAD);
+}
+
+static void testPayloadLongerThanStruct() {
+    // Новые поля дописываются в конец: старый декодер берет известную часть
+    uint8_t longer[sizeof(struct_command_t) + 4];
+    struct_command_t cmd = {CMD_QUEUE_DOSE, 300};
+    memcpy(longer, &cmd, sizeof(cmd));
+    memset(longer + sizeof(cmd), 0xEE, 4);
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeFrame(ESPNOW_MSG_COMMAND, 6, longer, sizeof(longer), buf, sizeof(buf));
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_command_t out = {};
+    CHECK_EQ(espNowDecodeCommand(&hdr, payload, &out), ESPNOW_FRAME_OK);
+    CHECK_EQ(out.cmd_type, CMD_QUEUE_DOSE);
+    CHECK_EQ(out.value, 300);
+}
+
+static void testSetFrameSeq() {
+    struct_command_t cmd = {CMD_PAUSE, 0};
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeCommand(0, &cmd, buf, sizeof(buf));
+    espNowSetFrameSeq(buf, len, 1234, ESPNOW_FRAME_F_BROADCAST);
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(hdr.seq, 1234);
+    CHECK_EQ(hdr.flags, ESPNOW_FRAME_F_BROADCAST);
+}
+
+static void testStatusDeltaRoundTrip() {
+    struct_status_t prev = sampleStatus();
+    struct_status_t next = prev;
+    next.current_volume_ml = 180;
+    next.current_temperature_out = 4.5f;
+    next.uptime_seconds = 3601;
+    uint16_t mask = ESPNOW_STATUS_F_VOLUME | ESPNOW_STATUS_F_TEMP_OUT | ESPNOW_STATUS_F_UPTIME;
+
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    size_t len = espNowEncodeStatusDelta(10, &next, mask, buf, sizeof(buf));
+    CHECK_EQ(len, ESPNOW_FRAME_OVERHEAD + sizeof(uint16_t) + 4 + 4 + 4);
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_status_t screen = prev;
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&screen, &next, sizeof(next)) == 0);
+
+    // Все поля сразу
+    len = espNowEncodeStatusDelta(11, &next, 0x03FF, buf, sizeof(buf));
+    CHECK_EQ(len, ESPNOW_FRAME_OVERHEAD + sizeof(uint16_t) + sizeof(struct_status_t) - 1); // Без reserved
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    memset(&screen, 0, sizeof(screen));
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_OK);
+    CHECK(memcmp(&screen, &next, sizeof(next)) == 0);
+}
+
+static void testStatusDeltaMalformed() {
+    struct_status_t next = sampleStatus();
+    uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+    espnow_frame_header_t hdr;
+    const uint8_t* payload = NULL;
+
+    // Маска обещает поля, которых нет в нагрузке: состояние экрана не меняется
+    uint16_t mask = ESPNOW_STATUS_F_VOLUME | ESPNOW_STATUS_F_VERSION;
+    uint8_t partial[sizeof(uint16_t) + 4];
+    memcpy(partial, &mask, sizeof(mask));
+    memset(partial + sizeof(mask), 0x11, 4);
+    size_t len = espNowEncodeFrame(ESPNOW_MSG_STATUS_DELTA, 12, partial, sizeof(partial), buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    struct_status_t screen = next;
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_ERR_PAYLOAD);
+    CHECK(memcmp(&screen, &next, sizeof(next)) == 0);
+
+    // Нагрузка короче маски
+    uint8_t one = 0x01;
+    len = espNowEncodeFrame(ESPNOW_MSG_STATUS_DELTA, 13, &one, 1, buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_ERR_PAYLOAD);
+
+    // Ключевой кадр - не дельта
+    len = espNowEncodeStatus(14, &next, buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_ERR_TYPE);
+
+    // Неизвестные старшие биты маски без данных игнорируются
+    mask = ESPNOW_STATUS_F_STATE | 0x8000;
+    uint8_t future[sizeof(uint16_t) + 1];
+    memcpy(future, &mask, sizeof(mask));
+    future[sizeof(mask)] = STATE_PAUSED;
+    len = espNowEncodeFrame(ESPNOW_MSG_STATUS_DELTA, 15, future, sizeof(future), buf, sizeof(buf));
+    CHECK_EQ(espNowDecodeFrame(buf, len, &hdr, &payload), ESPNOW_FRAME_OK);
+    CHECK_EQ(espNowApplyStatusDelta(&hdr, payload, &screen), ESPNOW_FRAME_OK);
+    CHECK_EQ(screen.system_state, STATE_PAUSED);
+}
+
+static void testRandomGarbage() {
+    // Случайные байты не должны проходить проверку кадра (и не должны читать за пределами буфера)
+    uint32_t rng = 12345;
+    int accepted = 0;
+    for (int i = 0; i < 20000; i++) {
+        uint8_t buf[ESPNOW_FRAME_MAX_LEN];
+        rng = rng * 1103515245u + 12345u;
+        size_t len = (rng >> 16) % sizeof(buf);
+        for (size_t j = 0; j < len; j++) {
+            rng = rng * 1103515245u + 12345u;
+            buf[j] = (uint8_t)(rng >> 24);
+        }
+        if (len > 1 && (i & 1)) {
+            buf[0] = ESPNOW_FRAME_MAGIC; // Половина - с верным началом, чтобы дойти до проверки длины и CRC
+            buf[1] = ESPNOW_PROTOCOL_VERSION;
+        }
+        espnow_frame_header_t hdr;
+        const uint8_t* payload = NULL;
+        if (espNowDecodeFrame(buf, len, &hdr, &payload) == ESPNOW_FRAME_OK) accepted++;
+    }
+    CHECK_EQ(accepted, 0);
+}
+
+int main() {
+    RUN_TEST(testWireSizes);
+    RUN_TEST(testCrcKnownValue);
+    RUN_TEST(testCommandRoundTrip);
+    RUN_TEST(testStatusRoundTrip);
+    RUN_TEST(testClusterRoundTrip);
+    RUN_TEST(testEncodeBufferTooSmall);
+    RUN_TEST(testTruncatedFrames);
+    RUN_TEST(testMalformedHeader);
+    RUN_TEST(testBadCrc);
+    RUN_TEST(testPayloadShorterThanStruct);
+    RUN_TEST(testPayloadLongerThanStruct);
+    RUN_TEST(testSetFrameSeq);
+    RUN_TEST(testStatusDeltaRoundTrip);
+    RUN_TEST(testStatusDeltaMalformed);
+    RUN_TEST(testRandomGarbage);
+    return testSummary();
+}
@@ -0,0 +1,243 @@
+#include "usage_rollups.h"
+#include <Preferences.h>
+#include <time.h>
+#include "main.h"           // Для функций логирования
+
+#define USAGE_NAMESPACE          "rollups"
+#define USAGE_TIME_VALID_AFTER   1600000000UL // Меньшее UNIX-время - часы еще не синхронизированы
+
+portMUX_TYPE usage_rollups_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+// Кольца (защищены usage_rollups_mutex: ошибки и компрессор могут прийти не из loop)
+static UsageBucket_t hourly[USAGE_HOURLY_BUCKETS];
+static UsageBucket_t daily[USAGE_DAILY_BUCKETS];
+static uint8_t hourly_head = 0; // Индекс текущей корзины
+static uint8_t daily_head = 0;
+static bool usage_dirty = false;
+
+// Компрессор: работа учитывается порциями от последней контрольной точки
+static bool comp_running = false;
+static unsigned long comp_checkpoint_ms = 0;
+
+// Только из loop
+static unsigned long last_checkpoint_ms = 0;
+static unsigned long last_save_ms = 0;
+static uint32_t last_saved_day = 0;
+
+// Номер суток от 1970-01-01 для даты по григорианскому календарю
+static uint32_t daysFromCivil(int y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (uint32_t)(era * 146097 + (int)doe - 719468);
+}
+
+// Текущие ключи корзин; false - время еще не синхронизировано
+static bool currentKeys(uint32_t* hour_key, uint32_t* day_key) {
+    time_t now_t = time(nullptr);
+    if ((unsigned long)now_t <= USAGE_TIME_VALID_AFTER) return false;
+    struct tm tm_local;
+    localtime_r(&now_t, &tm_local);
+    *hour_key = (uint32_t)(now_t / 3600);
+    *day_key = daysFromCivil(tm_local.tm_year + 1900, tm_local.tm_mon + 1, tm_local.tm_mday);
+    return true;
+}
+
+// Переход кольца к корзине key, пропущенные корзины обнуляются (вызывать под usage_rollups_mutex)
+static void advanceRing(UsageBucket_t* ring, uint8_t* head, int size, uint32_t key) {
+    UsageBucket_t* cur = &ring[*head];
+    if (cur->key == key) return;
+    if (cur->key == 0) { // Данные до синхронизации времени относим к текущему часу/суткам
+        cur->key = key;
+        return;
+    }
+    if (key < cur->key) return; // Часы ушли назад (коррекция NTP) - продолжаем копить в текущей
+    uint32_t steps = key - cur->key;
+    if (steps > (uint32_t)size) steps = size;
+    // Пропущенные часы/сутки остаются пустыми корзинами со своими ключами
+    for (uint32_t i = steps; i > 0; i--) {
+        *head = (*head + 1) % size;
+        memset(&ring[*head], 0, sizeof(UsageBucket_t));
+        ring[*head].key = key - (i - 1);
+    }
+}
+
+// Ключи считаются до входа в критическую секцию (localtime_r берет блокировки)
+static void rotate(bool synced, uint32_t hour_key, uint32_t day_key) {
+    if (!synced) return;
+    advanceRing(hourly, &hourly_head, USAGE_HOURLY_BUCKETS, hour_key);
+    advanceRing(daily, &daily_head, USAGE_DAILY_BUCKETS, day_key);
+}
+
+// Работа компрессора с последней контрольной точки - в текущие корзины (вызывать под usage_rollups_mutex)
+static void checkpointCompressor(unsigned long now) {
+    if (comp_running) {
+        uint32_t secs = (uint32_t)((now - comp_checkpoint_ms) / 1000);
+        if (secs > 0) {
+            hourly[hourly_head].compressor_s += secs;
+            daily[daily_head].compressor_s += secs;
+            comp_checkpoint_ms += secs * 1000UL; // Остаток миллисекунд переходит в следующую порцию
+            usage_dirty = true;
+        }
+    } else {
+        comp_checkpoint_ms = now;
+    }
+}
+
+static void saveUsageRollups() {
+    static UsageBucket_t hourly_copy[USAGE_HOURLY_BUCKETS];
+    static UsageBucket_t daily_copy[USAGE_DAILY_BUCKETS];
+    uint8_t heads[2];
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    memcpy(hourly_copy, hourly, sizeof(hourly));
+    memcpy(daily_copy, daily, sizeof(daily));
+    heads[0] = hourly_head;
+    heads[1] = daily_head;
+    usage_dirty = false;
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+    Preferences prefs;
+    if (!prefs.begin(USAGE_NAMESPACE, false)) {
+        log_e("USAGE", "Failed to open NVS namespace '%s' for writing.", USAGE_NAMESPACE);
+        return;
+    }
+    prefs.putBytes("hourly", hourly_copy, sizeof(hourly_copy));
+    prefs.putBytes("daily", daily_copy, sizeof(daily_copy));
+    prefs.putBytes("heads", heads, sizeof(heads));
+    prefs.end();
+    log_d("USAGE", "Usage rollups saved to NVS.");
+}
+
+void initUsageRollups() {
+    memset(hourly, 0, sizeof(hourly));
+    memset(daily, 0, sizeof(daily));
+    hourly_head = 0;
+    daily_head = 0;
+    Preferences prefs;
+    if (prefs.begin(USAGE_NAMESPACE, true)) {
+        uint8_t heads[2];
+        // Размеры проверяем явно: при изменении числа корзин старые сводки отбрасываются
+        if (prefs.getBytesLength("hourly") == sizeof(hourly) && prefs.getBytesLength("daily") == sizeof(daily) &&
+            prefs.getBytes("heads", heads, sizeof(heads)) == sizeof(heads) &&
+            heads[0] < USAGE_HOURLY_BUCKETS && heads[1] < USAGE_DAILY_BUCKETS) {
+            prefs.getBytes("hourly", hourly, sizeof(hourly));
+            prefs.getBytes("daily", daily, sizeof(daily));
+            hourly_head = heads[0];
+            daily_head = heads[1];
+        }
+        prefs.end();
+    }
+    unsigned long now = millis();
+    comp_checkpoint_ms = now;
+    last_checkpoint_ms = now;
+    last_save_ms = now;
+    last_saved_day = daily[daily_head].key;
+    log_i("USAGE", "Usage rollups initialized (%d hourly, %d daily buckets).", USAGE_HOURLY_BUCKETS, USAGE_DAILY_BUCKETS);
+}
+
+void handleUsageRollups() {
+    unsigned long now = millis();
+    if (now - last_checkpoint_ms < USAGE_CHECKPOINT_MS) return;
+    last_checkpoint_ms = now;
+
+    uint32_t hour_key = 0, day_key = 0;
+    bool synced = currentKeys(&hour_key, &day_key);
+    bool dirty;
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    checkpointCompressor(now); // Работа до смены часа относится к прошлой корзине
+    rotate(synced, hour_key, day_key);
+    day_key = daily[daily_head].key;
+    dirty = usage_dirty;
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+
+    // Редкое сохранение: по интервалу и при смене суток (итог прошедших суток не теряется при перезагрузке)
+    if (dirty && (now - last_save_ms >= USAGE_SAVE_INTERVAL_MS || day_key != last_saved_day)) {
+        last_save_ms = now;
+        last_saved_day = day_key;
+        saveUsageRollups();
+    }
+}
+
+void usageRollupNoteCycle(float volume_ml) {
+    uint32_t hour_key = 0, day_key = 0;
+    bool synced = currentKeys(&hour_key, &day_key);
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    checkpointCompressor(millis());
+    rotate(synced, hour_key, day_key);
+    hourly[hourly_head].cycles++;
+    hourly[hourly_head].volume_ml += volume_ml;
+    daily[daily_head].cycles++;
+    daily[daily_head].volume_ml += volume_ml;
+    usage_dirty = true;
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+}
+
+void usageRollupNoteCompressor(bool running) {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    if (running != comp_running) {
+        checkpointCompressor(now);
+        comp_running = running;
+        comp_checkpoint_ms = now;
+    }
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+}
+
+void usageRollupNoteError() {
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    hourly[hourly_head].errors++;
+    daily[daily_head].errors++;
+    usage_dirty = true;
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+}
+
+static int snapshotRing(const UsageBucket_t* ring, uint8_t head, int size, UsageBucket_t* buffer, int max_buckets) {
+    int n = 0;
+    for (int i = 0; i < size && n < max_buckets; i++) {
+        const UsageBucket_t* b = &ring[(head - i + size) % size];
+        if (i > 0 && b->key == 0) break; // Дальше корзины еще не заполнялись
+        buffer[n++] = *b;
+    }
+    return n;
+}
+
+int getUsageHourly(UsageBucket_t* buffer, int max_buckets) {
+    if (!buffer || max_buckets <= 0) return 0;
+    int n;
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    checkpointCompressor(millis()); // Текущая работа компрессора видна сразу
+    n = snapshotRing(hourly, hourly_head, USAGE_HOURLY_BUCKETS, buffer, max_buckets);
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+    return n;
+}
+
+int getUsageDaily(UsageBucket_t* buffer, int max_buckets) {
+    if (!buffer || max_buckets <= 0) return 0;
+    int n;
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    checkpointCompressor(millis());
+    n = snapshotRing(daily, daily_head, USAGE_DAILY_BUCKETS, buffer, max_buckets);
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+    return n;
+}
+
+bool isUsageTimeSynced() {
+    return (unsigned long)time(nullptr) > USAGE_TIME_VALID_AFTER;
+}
+
+void resetUsageRollups() {
+    portENTER_CRITICAL(&usage_rollups_mutex);
+    memset(hourly, 0, sizeof(hourly));
+    memset(daily, 0, sizeof(daily));
+    hourly_head = 0;
+    daily_head = 0;
+    usage_dirty = false;
+    portEXIT_CRITICAL(&usage_rollups_mutex);
+    Preferences prefs;
+    if (prefs.begin(USAGE_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+    log_w("USAGE", "Usage rollups reset.");
+}
@@ -0,0 +1,39 @@
+#ifndef USAGE_ROLLUPS_H
+#define USAGE_ROLLUPS_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h" // Для portMUX_TYPE
+
+// Сводки использования по часам и по суткам для планирования мощности.
+// События (завершенный цикл, переключение компрессора, ошибка) обновляют текущие корзины за O(1);
+// история не пересматривается. Кольца корзин живут в RAM и редко сохраняются в NVS.
+// Часовые корзины - по UNIX-часу, суточные - по локальной дате (TZ из standby_controller.h).
+// Пока время не синхронизировано (NTP), события копятся в последней корзине без смены часа/суток.
+
+#define USAGE_HOURLY_BUCKETS      48    // Двое суток по часам
+#define USAGE_DAILY_BUCKETS       31    // Месяц по суткам
+#define USAGE_CHECKPOINT_MS       60000 // Период учета текущей работы компрессора
+#define USAGE_SAVE_INTERVAL_MS    (6UL * 60 * 60 * 1000) // Сохранение в NVS не чаще (и при смене суток)
+
+typedef struct {
+    uint32_t key;               // UNIX-час или номер локальных суток от 1970-01-01; 0 - время не синхронизировано
+    float volume_ml;
+    uint16_t cycles;
+    uint16_t errors;
+    uint32_t compressor_s;      // Время работы компрессора
+} UsageBucket_t;
+
+extern portMUX_TYPE usage_rollups_mutex;
+
+void initUsageRollups();
+void handleUsageRollups();           // Вызывается из loop(): учет работы компрессора, смена корзин, сохранение
+void usageRollupNoteCycle(float volume_ml);
+void usageRollupNoteCompressor(bool running); // Из compressorNotifyStateChange()
+void usageRollupNoteError();         // Из setSystemError()
+// Снимки колец, первой - текущая корзина; возвращают количество корзин с данными
+int getUsageHourly(UsageBucket_t* buffer, int max_buckets);
+int getUsageDaily(UsageBucket_t* buffer, int max_buckets);
+bool isUsageTimeSynced();
+void resetUsageRollups();
+
+#endif // USAGE_ROLLUPS_H
@@ -8,12 +8,25 @@
 #include "dosing_logic.h"
 #include "calibration_logic.h"
 #include "esp_now_handler.h" // <-- ДОБАВЛЕНО: Для isEspNowPeerAvailable и getRemotePeerAddress
+#include "esp_now_tx.h"      // Для getEspNowTxStats
+#include "esp_now_peers.h"   // Таблица пиров ESP-NOW
+#include "cluster_coordinator.h" // Состояние кластера контроллеров
 #include "pid_controller.h"
 #include "sensors.h"
 #include "motor_control.h"
 #include "utils.h" // Для getUptimeString
 #include "sensitive_config.h" // <-- ДОБАВЛЕНО: Для получения учетных данных веб-сервера
 #include "localization.h"   // <-- ДОБАВЛЕНО: Для локализации
+#include "compressor_control.h" // Метрики планировщика компрессора
+#include "ilc_controller.h" // Профили ILC для диагностики
+#include "stall_monitor.h" // Статистика монитора срыва
+#include "standby_controller.h" // Метрики режима ожидания
+#include "cycle_records.h"  // Записи по циклам
+#include "dosing_queue.h"  // Очередь заданий дозирования
+#include "usage_rollups.h"  // Сводки по часам/суткам
+#include "counter_journal.h" // Состояние журнала счетчиков
+#include "crash_record.h"   // Аварийная перезагрузка прошлой загрузки
+#include "error_journal.h"  // Журнал ошибок на LittleFS
 
 // WebServer server; // Defined in main.c and extern in main.h (included above)
 
@@ -86,6 +99,17 @@ static String htmlEscapeContent(const String& str) {
     return escapedStr;
 }
 
+// Строка для значения JSON: кавычки, обратная косая черта и управляющие символы
+static String jsonEscapeString(const char* str) {
+    String escapedStr;
+    for (const char* p = str; *p; p++) {
+        if (*p == '"' || *p == '\\') { escapedStr += '\\'; escapedStr += *p; }
+        else if ((uint8_t)*p < 0x20) escapedStr += ' ';
+        else escapedStr += *p;
+    }
+    return escapedStr;
+}
+
 static String get_csrf_input_field() { // Now static
     // Важно: не кодируем HTML здесь, так как WebServer::sendContent ожидает обычный HTML
     return "<input type='hidden' name='csrf_token' value='" + csrf_token_value + "'>";
@@ -352,8 +376,19 @@ void handleStartDosing() {
 
     if (server.hasArg("dosingVolume")) {
         int volume = server.arg("dosingVolume").toInt();
+        // Необязательный параметр channels - битовая маска каналов насосов (по умолчанию основной канал)
+        uint8_t channel_mask = MOTOR_PRIMARY_CHANNEL_MASK;
+        if (server.hasArg("channels")) {
+            long mask_arg = server.arg("channels").toInt();
+            if (mask_arg <= 0 || mask_arg > MOTOR_ALL_CHANNELS_MASK) {
+                server.send(400, "text/plain", "Invalid channels mask.");
+                setSystemError(INPUT_VALIDATION_ERROR, "Invalid channels mask via web");
+                return;
+            }
+            channel_mask = (uint8_t)mask_arg;
+        }
         if (volume > 0 && volume <= 10000) {
-            startDosingCycle(volume, true);
+            startDosingCycle(volume, true, channel_mask);
             sendRedirect("/");
         } else {
             server.send(400, "text/plain", "Invalid dosing volume. Must be between 1 and 10000 ml.");
@@ -371,6 +406,125 @@ void handleStopDosing() {
     sendRedirect("/");
 }
 
+void handlePauseDosing() {
+    if (!preCheckPost()) return;
+    if (!pauseDosingCycle()) {
+        server.send(409, "text/plain", "Dosing is not running.");
+        return;
+    }
+    sendRedirect("/dosingcontrol");
+}
+
+void handleResumeDosing() {
+    if (!preCheckPost()) return;
+    if (!resumeDosingCycle()) {
+        server.send(409, "text/plain", "Dosing is not paused.");
+        return;
+    }
+    sendRedirect("/dosingcontrol");
+}
+
+void handleQueueDosing() {
+    if (!preCheckPost()) return;
+
+    if (!server.hasArg("dosingVolume")) {
+        server.send(400, "text/plain", "Missing dosingVolume parameter.");
+        setSystemError(INPUT_VALIDATION_ERROR, "Missing dosing volume parameter");
+        return;
+    }
+    int volume = server.arg("dosingVolume").toInt();
+    float temp = DOSING_QUEUE_KEEP_TEMP;
+    if (server.hasArg("temp") && server.arg("temp").length() > 0) temp = server.arg("temp").toFloat();
+    int speed = DOSING_QUEUE_KEEP_SPEED;
+    if (server.hasArg("speed") && server.arg("speed").length() > 0) speed = server.arg("speed").toInt();
+    uint8_t channel_mask = MOTOR_PRIMARY_CHANNEL_MASK;
+    if (server.hasArg("channels")) {
+        long mask_arg = server.arg("channels").toInt();
+        if (mask_arg <= 0 || mask_arg > MOTOR_ALL_CHANNELS_MASK) {
+            server.send(400, "text/plain", "Invalid channels mask.");
+            setSystemError(INPUT_VALIDATION_ERROR, "Invalid channels mask via web");
+            return;
+        }
+        channel_mask = (uint8_t)mask_arg;
+    }
+    if (volume <= 0 || volume > 10000 || (!isnan(temp) && (temp < -10.0f || temp > 30.0f)) || speed < 0 || speed > 2000) {
+        server.send(400, "text/plain", "Invalid job: volume 1-10000 ml, temp -10..30 C, speed 0-2000 steps/s.");
+        setSystemError(INPUT_VALIDATION_ERROR, "Invalid queued dosing job via web");
+        return;
+    }
+    if (!enqueueDosingJob(volume, temp, speed, channel_mask, DOSING_JOB_SOURCE_WEB)) {
+        server.send(409, "text/plain", "Dosing queue is full.");
+        return;
+    }
+    sendRedirect("/");
+}
+
+void handleClearQueue() {
+    if (!preCheckPost()) return;
+    clearDosingQueue();
+    sendRedirect("/");
+}
+
+void handleQueueStatus() {
+    DosingQueueMetrics_t m;
+    getDosingQueueMetrics(&m);
+    DosingJob_t jobs[DOSING_QUEUE_SIZE];
+    int n = getDosingQueueJobs(jobs, DOSING_QUEUE_SIZE);
+    char buffer[200];
+    String json;
+    json.reserve(256 + n * 120);
+    snprintf(buffer, sizeof(buffer), "{\"queued\":%u,\"capacity\":%d,\"enqueued\":%lu,\"rejected\":%lu,\"dropped\":%lu,\"chained\":%lu,",
+             m.queued, DOSING_QUEUE_SIZE, (unsigned long)m.jobs_enqueued, (unsigned long)m.jobs_rejected, (unsigned long)m.jobs_dropped,
+             (unsigned long)m.jobs_chained);
+    json += buffer;
+    snprintf(buffer, sizeof(buffer), "\"cyclesLastHour\":%u,\"cyclesPerHour\":%.1f,\"gapMs\":{\"last\":%lu,\"min\":%lu,\"avg\":%.0f,\"max\":%lu,\"samples\":%lu},\"jobs\":[",
+             m.cycles_last_hour, m.cycles_per_hour, (unsigned long)m.last_gap_ms, (unsigned long)m.min_gap_ms, m.avg_gap_ms,
+             (unsigned long)m.max_gap_ms, (unsigned long)m.gap_samples);
+    json += buffer;
+    for (int i = 0; i < n; i++) {
+        char temp_str[12];
+        if (isnan(jobs[i].temp_setpoint)) strcpy(temp_str, "null"); else snprintf(temp_str, sizeof(temp_str), "%.1f", jobs[i].temp_setpoint);
+        snprintf(buffer, sizeof(buffer), "%s{\"id\":%lu,\"volume\":%d,\"temp\":%s,\"speed\":%d,\"channels\":%u,\"source\":%u,\"waitMs\":%lu}",
+                 i ? "," : "", (unsigned long)jobs[i].id, jobs[i].volume_ml, temp_str, jobs[i].motor_speed, jobs[i].channel_mask,
+                 jobs[i].source, millis() - jobs[i].enqueued_ms);
+        json += buffer;
+    }
+    json += "]}";
+    server.send(200, "application/json", json);
+}
+
+void handleStartContinuous() {
+    if (!preCheckPost()) return;
+
+    long limit = 0;
+    if (server.hasArg("limit") && server.arg("limit").length() > 0) limit = server.arg("limit").toInt();
+    if (limit < 0 || (unsigned long)limit > DOSING_CONT_MAX_VOLUME_ML) {
+        server.send(400, "text/plain", "Invalid limit. Must be between 0 (until stopped) and 1000000 ml.");
+        setSystemError(INPUT_VALIDATION_ERROR, "Invalid continuous pour limit via web");
+        return;
+    }
+    if (!startContinuousDosing((uint32_t)limit, true)) {
+        server.send(409, "text/plain", "Cannot start continuous pour now.");
+        return;
+    }
+    sendRedirect("/dosingcontrol");
+}
+
+void handleDosingLive() {
+    DosingLiveStatus_t live;
+    getDosingLiveStatus(&live);
+    char buffer[320];
+    snprintf(buffer, sizeof(buffer),
+             "{\"state\":\"%s\",\"continuous\":%s,\"volumeMl\":%.1f,\"targetMl\":%lu,\"flowMlMin\":%.1f,\"runMs\":%lu,"
+             "\"tempOut\":%.2f,\"setpoint\":%.1f,\"compressor\":%s,\"supervisionPaused\":%s,\"tempHighMs\":%lu,\"error\":%d}",
+             getDosingStateString((DosingState_t)live.state), live.continuous ? "true" : "false", live.volume_ml,
+             (unsigned long)live.target_ml, live.flow_ml_min, (unsigned long)live.run_ms, live.temp_out, getDosingTempSetpoint(),
+             live.compressor_on ? "true" : "false", live.supervision_paused ? "true" : "false", (unsigned long)live.temp_high_ms,
+             (int)getSystemErrorCode());
+    server.sendHeader("Cache-Control", "no-store");
+    server.send(200, "application/json", buffer);
+}
+
 void handleStartCalibration() {
     if (!preCheckPost()) return;
 
@@ -483,6 +637,35 @@ void handleClearErrorWeb() {
     sendRedirect("/");
 }
 
+void handleEspNowPeers() {
+    if (!preCheckPost()) return;
+    uint8_t mac[6];
+    if (!parseEspNowMac(server.arg("mac").c_str(), mac)) {
+        server.send(400, "text/plain", "Invalid MAC address (expected XX:XX:XX:XX:XX:XX, unicast).");
+        return;
+    }
+    String action = server.arg("action");
+    bool ok;
+    if (action == "add") {
+        String role_arg = server.arg("role");
+        EspNowPeerRole_t role = role_arg == "1" ? ESP_NOW_PEER_REMOTE : (role_arg == "2" ? ESP_NOW_PEER_CONTROLLER : ESP_NOW_PEER_SCREEN);
+        // Контроллеру статус для экрана не нужен: ему хватает heartbeat кластера
+        ok = espNowPeerAdd(mac, role, (server.hasArg("status") && role != ESP_NOW_PEER_CONTROLLER) ? ESP_NOW_SUB_STATUS : 0);
+    } else if (action == "remove") {
+        ok = espNowPeerRemove(mac);
+    } else {
+        server.send(400, "text/plain", "Unknown action.");
+        return;
+    }
+    if (!ok) {
+        server.send(409, "text/plain", action == "add" ? "Peer table full." : "Peer not found.");
+        return;
+    }
+    app_log_i("WEB", "ESP-NOW peer %s: %s", action.c_str(), server.arg("mac").c_str());
+    ensureEspNowPeer(); // Новый пир сразу в драйвер
+    sendRedirect("/diagnostics");
+}
+
 void handleUpdateConfig() {
     if (!preCheckPost()) return;
 
@@ -641,6 +824,8 @@ void handleUpdateConfig() {
 void handleEmergencyStop() {
     log_w("SYSTEM", "Emergency stop initiated from web!");
     stopMotor();
+    compressorReleaseAll(); // Иначе планировщик снова включит компрессор после минимального простоя
+    clearDosingQueue(); // Задания из очереди не должны стартовать после аварийной остановки
     compressorOff();
     if (getCalibrationModeState()) {
         log_w("SYSTEM", "Emergency stop during active calibration. Stopping calibration.");
@@ -690,10 +875,6 @@ void handleDiagnostics() {
     DosingState local_diag_dosing_state;
     unsigned long local_diag_dosing_state_start_time;
     float local_diag_volume_dispensed_cycle;
-    bool local_motor_auto, local_motor_manual;
-    float local_current_steps_sec;
-    unsigned long local_step_interval_us;
-    int local_motor_dir;
     long local_motor_cal_steps;
     unsigned long local_flow_pulses_cal_diag;
     SystemErrorCode local_diag_current_system_error;
@@ -710,14 +891,6 @@ void handleDiagnostics() {
     local_diag_volume_dispensed_cycle = volume_dispensed_cycle;
     portEXIT_CRITICAL(&volume_dispensed_mutex);
 
-    portENTER_CRITICAL(&motor_state_mutex);
-    local_motor_auto = motor_running_auto;
-    local_motor_manual = motor_running_manual;
-    local_current_steps_sec = current_steps_per_sec;
-    local_step_interval_us = step_interval_us;
-    local_motor_dir = motor_dir; 
-    portEXIT_CRITICAL(&motor_state_mutex);
-
     portENTER_CRITICAL(&motor_cal_steps_mutex); 
     local_motor_cal_steps = steps_taken_calibration; 
     portEXIT_CRITICAL(&motor_cal_steps_mutex);
@@ -760,7 +933,36 @@ void handleDiagnostics() {
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Текущее состояние: <strong>%s (%d)</strong></p>", dosing_state_str_diag, local_diag_dosing_state); server.sendContent(buffer);
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Время в текущем состоянии: <strong>%lu мс</strong></p>", millis() - local_diag_dosing_state_start_time); server.sendContent(buffer);
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Объем в цикле (по датчику потока): <strong>%.2f мл</strong></p>", local_diag_volume_dispensed_cycle); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Целевой объем: <strong>%d мл</strong></p>", config.volumeTarget); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Целевой объем: <strong>%d мл</strong></p>", getDosingVolumeTarget()); server.sendContent(buffer);
+
+    server.sendContent("<h3>Автомат дозирования: время по состояниям</h3>");
+    server.sendContent("<table><tr><th>Состояние</th><th>Выходов</th><th>Мин, мс</th><th>Сред, мс</th><th>Макс, мс</th><th>Последний цикл, мс</th></tr>");
+    uint32_t last_cycle_ms[DOSING_STATE_COUNT];
+    getDosingLastCycleBreakdown(last_cycle_ms);
+    uint32_t last_cycle_total_ms = 0;
+    for (int st = 0; st < DOSING_STATE_COUNT; st++) {
+        DosingStateStats_t state_stats;
+        if (!getDosingStateStats((DosingState_t)st, &state_stats)) continue;
+        last_cycle_total_ms += last_cycle_ms[st];
+        snprintf(buffer, sizeof(buffer), "<tr><td>%s</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td></tr>",
+                 getDosingStateString((DosingState_t)st), (unsigned long)state_stats.count, (unsigned long)state_stats.min_ms,
+                 state_stats.count ? (unsigned long)(state_stats.total_ms / state_stats.count) : 0UL, (unsigned long)state_stats.max_ms,
+                 (unsigned long)last_cycle_ms[st]);
+        server.sendContent(buffer);
+    }
+    server.sendContent("</table>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Длительность последнего цикла: <strong>%lu мс</strong></p>", (unsigned long)last_cycle_total_ms); server.sendContent(buffer);
+
+    DosingJournalEntry_t journal[10];
+    int journal_count = getDosingJournal(journal, 10);
+    server.sendContent("<p class='status-item'>Последние переходы (правило 255 - внешний переход):</p><ul>");
+    for (int i = 0; i < journal_count; i++) {
+        snprintf(buffer, sizeof(buffer), "<li>%lu мс: %s &rarr; %s (правило %u, ошибка %u)</li>", (unsigned long)journal[i].timestamp_ms,
+                 getDosingStateString((DosingState_t)journal[i].from_state), getDosingStateString((DosingState_t)journal[i].to_state),
+                 journal[i].rule, journal[i].error_code);
+        server.sendContent(buffer);
+    }
+    server.sendContent("</ul>");
 
     server.sendContent("<h3>Датчики температуры</h3>");
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>T_вход: <strong>%.2f °C</strong> (Найден: %s, Ошибок подряд: %d)</p>", tIn, tempInSensorFound ? "Да" : "Нет", consecutive_temp_in_errors); server.sendContent(buffer);
@@ -774,22 +976,159 @@ void handleDiagnostics() {
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Импульсов датчика потока (в режиме калибровки): <strong>%lu</strong></p>", local_flow_pulses_cal_diag); server.sendContent(buffer);
 
     server.sendContent("<h3>Мотор</h3>");
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Работает (авто): <strong>%s</strong></p>", local_motor_auto ? "Да" : "Нет"); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Работает (ручной): <strong>%s</strong></p>", local_motor_manual ? "Да" : "Нет"); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Включен (ENABLE_PIN): <strong>%s</strong></p>", isMotorEnabled() ? "Да (LOW)" : "Нет (HIGH)"); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Направление (motor_dir): <strong>%s</strong></p>", local_motor_dir == HIGH ? "Вперед (HIGH)" : "Назад (LOW)"); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Скорость (шаг/сек): &lt;strong&gt;%.1f&lt;/strong&gt; (Интервал: %lu мкс)&lt;/p&gt;", local_current_steps_sec, local_step_interval_us); server.sendContent(buffer); // Исправлено &lt; и &gt;
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Шагов в цикле дозирования: &lt;strong&gt;%ld&lt;/strong&gt; (Цель: %ld)&lt;/p&gt;", steps_taken_dosing, steps_target_dosing); server.sendContent(buffer); // Исправлено &lt; и &gt;
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Шагов мотора (в режиме калибровки): &lt;strong&gt;%ld&lt;/strong&gt;&lt;/p&gt;", local_motor_cal_steps); server.sendContent(buffer); // Исправлено &lt; и &gt;
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Скорость (шаг/сек): <strong>%.1f</strong> (Интервал: %lu мкс)</p>", local_current_steps_sec, local_step_interval_us); server.sendContent(buffer);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Шагов в цикле дозирования: <strong>%ld</strong> (Цель: %ld)</p>", steps_taken_dosing, steps_target_dosing); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Каналов: <strong>%d</strong> (Маска цикла: 0x%02X)</p>", MOTOR_CHANNEL_COUNT, getDosingChannelMask()); server.sendContent(buffer);
+    for (uint8_t ch = 0; ch < MOTOR_CHANNEL_COUNT; ch++) {
+        Motor& m = getMotor(ch);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Канал %u: <strong>%s</strong> (Авто: %s, Ручной: %s, Направление: %s, Микрошаг: %s%s)</p>", ch,
+                 m.isEnabled() ? "Включен (LOW)" : "Выключен (HIGH)", m.isRunningAuto() ? "Да" : "Нет", m.isRunningManual() ? "Да" : "Нет",
+                 m.getDirection() == MOTOR_DIR_FORWARD ? "Вперед" : "Назад", m.isFineMode() ? "мелкий" : "крупный",
+                 m.hasMicrostepControl() ? "" : ", без пинов MS");
+        server.sendContent(buffer);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Канал %u скорость (шаг/сек): <strong>%.1f</strong> (Интервал: %lu мкс), Шагов в цикле: <strong>%ld</strong> (Цель: %ld), мл/шаг: %.6f</p>", ch,
+                 m.getSpeed(), m.getStepIntervalUs(), m.getStepsTaken(), m.getStepsTarget(), m.getMlPerStep());
+        server.sendContent(buffer);
+    }
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Шагов мотора (в режиме калибровки): <strong>%ld</strong></p>", local_motor_cal_steps); server.sendContent(buffer);
 
+    CompressorMetrics_t comp_metrics;
+    getCompressorMetrics(&comp_metrics);
+    server.sendContent("<h3>Компрессор (планировщик)</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Работает: <strong>%s</strong> (Запрос: 0x%02X, Блокировка переключения: %lu с)</p>", comp_metrics.running ? "Да" : "Нет", comp_metrics.demand_mask, comp_metrics.lockout_remaining_ms / 1000); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Пусков за окно: <strong>%u</strong> (%.1f в час, окно %lu мин)</p>", comp_metrics.starts_last_hour, comp_metrics.starts_per_hour, comp_metrics.window_ms / 60000); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Коэффициент работы (duty): <strong>%.1f %%</strong></p>", comp_metrics.duty_percent); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Время выше уставки (+%.1f °C): <strong>%.1f %%</strong> (%lu с)</p>", COMPRESSOR_BAND_C, comp_metrics.above_setpoint_percent, comp_metrics.above_setpoint_ms / 1000); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Наклон T_выход: <strong>%.3f °C/мин</strong> (Прогнозных пусков: %lu, Отложенных запросов: %lu)</p>", comp_metrics.slope_c_per_min, (unsigned long)comp_metrics.predictive_starts, (unsigned long)comp_metrics.deferred_requests); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Всего пусков / наработка: <strong>%d / %lu с</strong></p>", config.compressorStartCount, config.compressorRunTime / 1000); server.sendContent(buffer);
+
+    StallMonitorStats_t stall_stats;
+    getStallMonitorStats(&stall_stats);
+    StandbyMetrics_t standby_metrics;
+    getStandbyMetrics(&standby_metrics);
+    DosingQueueMetrics_t queue_metrics;
+    getDosingQueueMetrics(&queue_metrics);
+    CycleRecordsStatus_t cycles_status;
+    getCycleRecordsStatus(&cycles_status);
+    server.sendContent("<h3>Записи циклов</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Файл: <strong>%s</strong> (Записей: %lu из %d, следующая #%lu, ошибок записи: %lu) <a href='/cycles?format=csv'>CSV</a> <a href='/cycles'>JSON</a></p>",
+             cycles_status.available ? "Доступен" : "Недоступен", (unsigned long)cycles_status.records, CYCLE_RECORDS_CAPACITY,
+             (unsigned long)cycles_status.next_seq, (unsigned long)cycles_status.write_failures); server.sendContent(buffer);
+    UsageBucket_t usage_today;
+    if (getUsageDaily(&usage_today, 1) == 1) {
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Сводка за сутки: <strong>%.0f мл</strong> (Циклов: %u, Компрессор: %lu мин, Ошибок: %u) <a href='/usage'>JSON</a></p>",
+                 usage_today.volume_ml, usage_today.cycles, (unsigned long)(usage_today.compressor_s / 60), usage_today.errors); server.sendContent(buffer);
+    }
+
+    server.sendContent("<h3>Очередь заданий</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>В очереди: <strong>%u / %d</strong> (Принято: %lu, Отклонено: %lu, Не запущено: %lu, Подряд без IDLE: %lu)</p>",
+             queue_metrics.queued, DOSING_QUEUE_SIZE, (unsigned long)queue_metrics.jobs_enqueued, (unsigned long)queue_metrics.jobs_rejected,
+             (unsigned long)queue_metrics.jobs_dropped, (unsigned long)queue_metrics.jobs_chained); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Циклов за окно: <strong>%u</strong> (%.1f в час)</p>", queue_metrics.cycles_last_hour, queue_metrics.cycles_per_hour); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Пауза между циклами: <strong>%lu мс</strong> (мин %lu, сред %.0f, макс %lu, замеров %lu)</p>",
+             (unsigned long)queue_metrics.last_gap_ms, (unsigned long)queue_metrics.min_gap_ms, queue_metrics.avg_gap_ms,
+             (unsigned long)queue_metrics.max_gap_ms, (unsigned long)queue_metrics.gap_samples); server.sendContent(buffer);
+
+    server.sendContent("<h3>Монитор срыва насоса</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Активен: <strong>%s</strong> (Коэффициент скорости: %.2f, Потолок: %.0f шаг/с)</p>",
+             stall_stats.active ? "Да" : "Нет", stall_stats.speed_scale, stall_stats.ceiling_steps_sec); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Поток/шаги в последнем окне: <strong>%.2f</strong></p>", stall_stats.last_ratio); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Срывов / проскальзываний: <strong>%u / %u</strong> за цикл, %lu / %lu всего (Восстановлений: %lu, Отказов: %lu)</p>",
+             stall_stats.stalls_cycle, stall_stats.slips_cycle, (unsigned long)stall_stats.stalls_total, (unsigned long)stall_stats.slips_total,
+             (unsigned long)stall_stats.recoveries_total, (unsigned long)stall_stats.faults_total); server.sendContent(buffer);
+
+    server.sendContent("<h3>Режим ожидания (удержание холода)</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Активен: <strong>%s</strong> (Причина: %s, Спрос в ближайшие %d мин: x%.1f)</p>",
+             standby_metrics.active ? "Да" : "Нет",
+             standby_metrics.reason == STANDBY_REASON_FORECAST ? "прогноз" : (standby_metrics.reason == STANDBY_REASON_RECENT ? "недавний цикл" : "-"),
+             STANDBY_LOOKAHEAD_MIN, standby_metrics.demand_density); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Время NTP: <strong>%s</strong> (Запросов в гистограмме: %lu)</p>",
+             standby_metrics.time_synced ? "Синхронизировано" : "Нет", (unsigned long)standby_metrics.histogram_total); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Запрос -> поток: <strong>%lu мс</strong> (мин/сред/макс: %lu / %.0f / %lu мс, замеров: %lu)</p>",
+             (unsigned long)standby_metrics.last_latency_ms, (unsigned long)standby_metrics.min_latency_ms, standby_metrics.avg_latency_ms,
+             (unsigned long)standby_metrics.max_latency_ms, (unsigned long)standby_metrics.latency_samples); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Линия охлаждена: <strong>%.0f мс</strong> (%lu), с предохлаждением: <strong>%.0f мс</strong> (%lu из %lu запросов)</p>",
+             standby_metrics.avg_latency_chilled_ms, (unsigned long)standby_metrics.chilled_samples, standby_metrics.avg_latency_precool_ms,
+             (unsigned long)standby_metrics.precool_samples, (unsigned long)standby_metrics.requests); server.sendContent(buffer);
+
+    server.sendContent("<h3>Обучение старта цикла (ILC)</h3>");
+    for (int b = 0; b < ILC_BANDS; b++) {
+        IlcBandProfile_t ilc_profile;
+        if (!getIlcBandProfile(b, &ilc_profile)) continue;
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Диапазон %d: <strong>%u циклов</strong> (СКО: %.2f °C, в начале: %.2f °C, добавка старта: %d шаг/с)</p>",
+                 b, ilc_profile.cycles_learned, ilc_profile.last_rms_error, ilc_profile.first_rms_error, ilc_profile.offset[0]);
+        server.sendContent(buffer);
+    }
+
     server.sendContent("<h3>ESP-NOW</h3>");
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Пир добавлен: <strong>%s</strong></p>", isEspNowPeerAvailable() ? "Да" : "Нет"); server.sendContent(buffer); 
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>MAC адрес пира (из Config): <strong>%s</strong></p>", config.remotePeerMacStr); server.sendContent(buffer);
-    uint8_t current_peer_addr[6]; getRemotePeerAddress(current_peer_addr);
-    snprintf(buffer, sizeof(buffer), "<p class='status-item'>MAC адрес пира (актуальный): <strong>%02X:%02X:%02X:%02X:%02X:%02X</strong></p>", current_peer_addr[0], current_peer_addr[1], current_peer_addr[2], current_peer_addr[3], current_peer_addr[4], current_peer_addr[5]); server.sendContent(buffer);
+    uint8_t status_dest[6];
+    bool have_status_dest = getEspNowStatusDestination(status_dest);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Статус отправляется: <strong>%s</strong> (Пиров: %d из %d)</p>",
+             !have_status_dest ? "никому" : (status_dest[0] == 0xFF ? "широковещательно" : "адресно"),
+             getEspNowPeerCount(), ESP_NOW_PEER_TABLE_SIZE); server.sendContent(buffer);
+    if (getEspNowPeerCount() > 0) {
+        server.sendContent("<table><tr><th>MAC</th><th>Роль</th><th>Статус</th><th>В драйвере</th><th>На связи</th><th>Кадров</th><th>Повторов</th><th>Пропусков</th><th></th></tr>");
+        EspNowPeer_t peer;
+        for (int i = 0; getEspNowPeer(i, &peer); i++) {
+            char mac_str[18];
+            snprintf(mac_str, sizeof(mac_str), "%02X:%02X:%02X:%02X:%02X:%02X", peer.mac[0], peer.mac[1], peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5]);
+            char seen[24];
+            if (peer.last_seen_ms == 0) snprintf(seen, sizeof(seen), "не появлялся");
+            else snprintf(seen, sizeof(seen), "%s, %lu с назад", espNowPeerOnline(&peer) ? "да" : "нет", (millis() - peer.last_seen_ms) / 1000);
+            snprintf(buffer, sizeof(buffer), "<tr><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%lu</td><td>%lu</td><td>%lu</td><td>",
+                     mac_str, peer.role == ESP_NOW_PEER_REMOTE ? "Пульт" : (peer.role == ESP_NOW_PEER_CONTROLLER ? "Контроллер" : "Экран"), (peer.subscriptions & ESP_NOW_SUB_STATUS) ? "да" : "нет",
+                     peer.registered ? "да" : "нет", seen, (unsigned long)peer.rx_frames, (unsigned long)peer.rx_duplicates,
+                     (unsigned long)peer.rx_seq_gaps); server.sendContent(buffer);
+            server.sendContent("<form action='/espnowPeers' method='POST' style='display:inline-block;'>");
+            server.sendContent(get_csrf_input_field());
+            snprintf(buffer, sizeof(buffer), "<input type='hidden' name='action' value='remove'><input type='hidden' name='mac' value='%s'><input type='submit' value='Удалить'></form></td></tr>", mac_str);
+            server.sendContent(buffer);
+        }
+        server.sendContent("</table>");
+    }
+    server.sendContent("<form action='/espnowPeers' method='POST'>");
+    server.sendContent(get_csrf_input_field());
+    server.sendContent("<input type='hidden' name='action' value='add'>MAC: <input type='text' name='mac' placeholder='XX:XX:XX:XX:XX:XX' maxlength='17'> "
+                       "<select name='role'><option value='0'>Экран</option><option value='1'>Пульт</option><option value='2'>Контроллер</option></select> "
+                       "<label><input type='checkbox' name='status' value='1' checked> Статус</label> <input type='submit' value='Добавить пир'></form>");
+    EspNowProtoStats_t espnow_proto;
+    getEspNowProtoStats(&espnow_proto);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Принято кадров: <strong>%lu</strong> (Битых: %lu, CRC: %lu, Версия: %lu, Чужих: %lu, Повторов: %lu, Пропусков: %lu)</p>",
+             (unsigned long)espnow_proto.rx_frames, (unsigned long)espnow_proto.rx_malformed, (unsigned long)espnow_proto.rx_bad_crc,
+             (unsigned long)espnow_proto.rx_bad_version, (unsigned long)espnow_proto.rx_unauthorized, (unsigned long)espnow_proto.rx_duplicates, (unsigned long)espnow_proto.rx_seq_gaps); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Статус доставлен: <strong>%lu ключевых, %lu дельт</strong> (Отложено по бюджету эфира: %lu)</p>",
+             (unsigned long)espnow_proto.tx_keyframes, (unsigned long)espnow_proto.tx_deltas, (unsigned long)espnow_proto.tx_budget_deferred); server.sendContent(buffer);
+    EspNowTxStats_t espnow_tx;
+    getEspNowTxStats(&espnow_tx);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Очередь передачи: <strong>%u</strong> (макс %u из %d, Объединено: %lu, Вытеснено: %lu, Отклонено: %lu)</p>",
+             espnow_tx.depth, espnow_tx.max_depth, ESP_NOW_TX_QUEUE_SIZE, (unsigned long)espnow_tx.coalesced, (unsigned long)espnow_tx.evicted,
+             (unsigned long)espnow_tx.rejected); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Передач: <strong>%lu</strong> (Доставлено: %lu, Повторов: %lu, Отказов: %lu, Без ответа драйвера: %lu/%lu поздн., Бюджет эфира: %ld мкс)</p>",
+             (unsigned long)espnow_tx.sent, (unsigned long)espnow_tx.delivered, (unsigned long)espnow_tx.retries, (unsigned long)espnow_tx.failed,
+             (unsigned long)espnow_tx.cb_timeouts, (unsigned long)espnow_tx.late_callbacks, (long)espnow_tx.airtime_tokens_us); server.sendContent(buffer);
+    EspNowCmdStats_t espnow_cmd;
+    getEspNowCmdStats(&espnow_cmd);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Команды экрана: <strong>%lu</strong> (Применено: %lu, Переполнений: %lu, Макс. очередь: %u; задержка до применения: %lu мкс, сред %.0f, макс %lu)</p>",
+             (unsigned long)espnow_cmd.received, (unsigned long)espnow_cmd.applied, (unsigned long)espnow_cmd.overflows, espnow_cmd.max_depth,
+             (unsigned long)espnow_cmd.last_latency_us, espnow_cmd.avg_latency_us, (unsigned long)espnow_cmd.max_latency_us); server.sendContent(buffer);
+
+    ClusterStats_t cluster;
+    getClusterStats(&cluster);
+    server.sendContent("<h3>Кластер контроллеров</h3>");
+    if (!cluster.active) {
+        server.sendContent("<p class='status-item'>Выключен (нет пиров с ролью \"Контроллер\")</p>");
+    } else {
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Лидер: <strong>%02X:%02X:%02X:%02X:%02X:%02X%s</strong> (Узлов на связи: %u, Смен лидера: %lu)</p>",
+                 cluster.leader_mac[0], cluster.leader_mac[1], cluster.leader_mac[2], cluster.leader_mac[3], cluster.leader_mac[4], cluster.leader_mac[5],
+                 cluster.leader ? ", этот узел" : "", cluster.nodes_alive, (unsigned long)cluster.leader_changes); server.sendContent(buffer);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Пуск компрессора: <strong>%s</strong> (Отложено: %lu, Без разрешения: %lu, Выдано разрешений: %lu)</p>",
+                 cluster.start_pending ? "ждет очереди" : "не нужен", (unsigned long)cluster.starts_deferred, (unsigned long)cluster.starts_forced,
+                 (unsigned long)cluster.grants_issued); server.sendContent(buffer);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Задания: <strong>передано %lu</strong> (Возвращено: %lu, без ответа %lu, повторов %lu; Принято: %lu, Отклонено: %lu; heartbeat: %lu/%lu)</p>",
+                 (unsigned long)cluster.jobs_dispatched, (unsigned long)cluster.jobs_returned, (unsigned long)cluster.jobs_unanswered, (unsigned long)cluster.jobs_resent,
+                 (unsigned long)cluster.jobs_received,
+                 (unsigned long)cluster.jobs_rejected, (unsigned long)cluster.heartbeats_tx, (unsigned long)cluster.heartbeats_rx); server.sendContent(buffer);
+    }
 
     server.sendContent("<h3>Системные ошибки</h3>");
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Текущая ошибка (код): <strong>%d</strong></p>", local_diag_current_system_error); server.sendContent(buffer);
@@ -797,6 +1136,65 @@ void handleDiagnostics() {
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Время последней ошибки: <strong>%lu мс</strong> (назад: %lu с)</p>", local_diag_last_error_time, (millis() - local_diag_last_error_time)/1000); server.sendContent(buffer);
     snprintf(buffer, sizeof(buffer), "<p class='status-item'>Всего ошибок (счетчик): <strong>%d</strong></p>", config.errorCount); server.sendContent(buffer);
 
+    ConfigPersistStats_t persist_stats;
+    getConfigPersistStats(&persist_stats);
+    server.sendContent("<h3>Сохранение настроек (NVS)</h3>");
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Ожидает записи: <strong>%s</strong> (%lu мс) (Запросов: %lu, Объединено: %lu)</p>",
+             persist_stats.pending ? "Да" : "Нет", (unsigned long)persist_stats.pending_age_ms,
+             (unsigned long)persist_stats.save_requests, (unsigned long)persist_stats.coalesced); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Записей: <strong>%lu</strong> (Принудительных: %lu, Без изменений: %lu, Ошибок: %lu)</p>",
+             (unsigned long)persist_stats.flushes, (unsigned long)persist_stats.forced_flushes, (unsigned long)persist_stats.unchanged,
+             (unsigned long)persist_stats.failures); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Длительность записи: <strong>%lu мкс</strong> (сред %.0f, макс %lu)</p>",
+             (unsigned long)persist_stats.last_flush_us, persist_stats.avg_flush_us, (unsigned long)persist_stats.max_flush_us); server.sendContent(buffer);
+    ConfigLoadInfo_t load_info;
+    getConfigLoadInfo(&load_info);
+    static const char* const config_sources[] = {"По умолчанию", "Запись (blob)", "Перенос из ключей", "Запись повреждена", "Перенос из записи v1"};
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Загрузка при старте: <strong>%lu мкс</strong> (Источник: %s, Удалено старых ключей: %u, Свободных записей NVS: %lu)</p>",
+             (unsigned long)load_info.load_us, config_sources[load_info.source], load_info.legacy_keys_erased,
+             (unsigned long)load_info.nvs_free_entries); server.sendContent(buffer);
+    CounterJournalStatus_t counters_status;
+    getCounterJournalStatus(&counters_status);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Журнал счетчиков: <strong>%s</strong> (Записей: %lu из %d, Сжатий: %lu, Ошибок записи: %lu, Битых: %lu%s)</p>",
+             counters_status.on_littlefs ? "LittleFS" : "NVS", (unsigned long)counters_status.records, COUNTER_JOURNAL_CAPACITY,
+             (unsigned long)counters_status.compactions, (unsigned long)counters_status.write_failures,
+             (unsigned long)counters_status.torn_records, counters_status.pending ? ", ожидает записи" : ""); server.sendContent(buffer);
+    CrashRecord_t crash;
+    if (getLastCrashRecord(&crash)) {
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Аварийная перезагрузка: <strong>%u</strong> (%s; Состояние: %s, Время работы: %lu с, Объем цикла: %.1f мл)</p>",
+                 crash.error_code, crash.message, crash.dosing_state < DOSING_STATE_COUNT ? getDosingStateString((DosingState_t)crash.dosing_state) : "-",
+                 (unsigned long)crash.uptime_s, crash.volume_ml); server.sendContent(buffer);
+        server.sendContent("<ul>");
+        for (int i = 0; i < crash.transition_count; i++) {
+            const DosingJournalEntry_t* e = &crash.transitions[i];
+            snprintf(buffer, sizeof(buffer), "<li>%lu мс: %s &rarr; %s (правило %u, ошибка %u)</li>", (unsigned long)e->timestamp_ms,
+                     getDosingStateString((DosingState_t)e->from_state), getDosingStateString((DosingState_t)e->to_state),
+                     e->rule, e->error_code);
+            server.sendContent(buffer);
+        }
+        server.sendContent("</ul>");
+    }
+
+    server.sendContent("<h3>Ошибки по кодам</h3>");
+    static ErrorCodeStats_t code_stats[ERROR_STATS_SLOTS];
+    int code_count = getErrorCodeStats(code_stats, ERROR_STATS_SLOTS);
+    snprintf(buffer, sizeof(buffer), "<p class='status-item'>Записей подряд: %d, затем одна в %lu с; удержание перед автоматическим сбросом: %lu с</p>",
+             ERROR_RATE_BURST, (unsigned long)(ERROR_RATE_REFILL_MS / 1000), (unsigned long)(ERROR_CLEAR_HOLD_MS / 1000)); server.sendContent(buffer);
+    if (code_count == 0) {
+        server.sendContent("<p class='status-item'>Ошибок с момента загрузки не было.</p>");
+    } else {
+        server.sendContent("<table><tr><th>Код</th><th>Установок</th><th>Повторов</th><th>Подавлено</th><th>Сбросов</th><th>Сбросов отложено</th><th>Токенов</th><th>Последняя, с назад</th></tr>");
+        unsigned long now_ms = millis();
+        for (int i = 0; i < code_count; i++) {
+            const ErrorCodeStats_t* cs = &code_stats[i];
+            snprintf(buffer, sizeof(buffer), "<tr><td>%u</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%u</td><td>%lu</td></tr>",
+                     cs->code, (unsigned long)cs->occurrences, (unsigned long)cs->repeats, (unsigned long)cs->suppressed, (unsigned long)cs->clears,
+                     (unsigned long)cs->clears_held, cs->tokens, cs->occurrences ? (unsigned long)((now_ms - cs->last_set_ms) / 1000) : 0UL);
+            server.sendContent(buffer);
+        }
+        server.sendContent("</table>");
+    }
+
     server.sendContent("<div class='action-buttons' style='margin-top: 25px;'><a href='/' class='button-link'>Вернуться к статусу</a></div>");
     endHtmlResponse();
 }
@@ -827,6 +1225,141 @@ void handleDownloadLog() {
     app_log_i("FS_LOG", "Log file %s sent, %d bytes.", LOG_FILENAME_WEB_HANDLER, sent);
 }
 
+// Столбцы времени по состояниям цикла (REQUESTED..PAUSED) в экспорте записей
+static const char* const cycle_state_columns[] = { "requested", "precool", "starting", "running", "stopping", "paused" };
+
+typedef struct {
+    bool csv;
+    bool first;
+    uint32_t skip;
+} CycleExportCtx_t;
+
+static bool countCycleRecord(const CycleRecord_t* rec, void* arg) {
+    return true;
+}
+
+static bool sendCycleRecord(const CycleRecord_t* rec, void* arg) {
+    CycleExportCtx_t* ctx = (CycleExportCtx_t*)arg;
+    if (ctx->skip > 0) {
+        ctx->skip--;
+        return true;
+    }
+    char buffer[320];
+    int len;
+    if (ctx->csv) {
+        len = snprintf(buffer, sizeof(buffer), "%lu,%lu,%lu,%u,%u",
+                       (unsigned long)rec->seq, (unsigned long)rec->start_time, (unsigned long)rec->start_uptime_s, rec->flags, rec->channel_mask);
+    } else {
+        len = snprintf(buffer, sizeof(buffer), "%s{\"seq\":%lu,\"startTime\":%lu,\"startUptimeS\":%lu,\"flags\":%u,\"channels\":%u,\"stateMs\":{",
+                       ctx->first ? "" : ",", (unsigned long)rec->seq, (unsigned long)rec->start_time, (unsigned long)rec->start_uptime_s,
+                       rec->flags, rec->channel_mask);
+    }
+    for (int i = 0; i < (int)(sizeof(cycle_state_columns) / sizeof(cycle_state_columns[0])) && len < (int)sizeof(buffer); i++) {
+        uint32_t ms = rec->state_ms[DOSING_STATE_REQUESTED + i];
+        len += ctx->csv ? snprintf(buffer + len, sizeof(buffer) - len, ",%lu", (unsigned long)ms)
+                        : snprintf(buffer + len, sizeof(buffer) - len, "%s\"%s\":%lu", i ? "," : "", cycle_state_columns[i], (unsigned long)ms);
+    }
+    if (len < (int)sizeof(buffer)) {
+        snprintf(buffer + len, sizeof(buffer) - len,
+                 ctx->csv ? ",%.1f,%.1f,%.1f,%.2f,%.2f,%.1f,%u,%u\n"
+                          : "},\"targetMl\":%.1f,\"actualMl\":%.1f,\"overshootMl\":%.1f,\"tempMeanC\":%.2f,\"tempMaxC\":%.2f,\"flowMlMin\":%.1f,\"compressorDutyPct\":%u,\"error\":%u}",
+                 rec->target_ml, rec->actual_ml, rec->overshoot_ml, rec->temp_mean_c, rec->temp_max_c, rec->flow_mean_ml_min,
+                 rec->compressor_duty_pct, rec->error_code);
+    }
+    server.sendContent(buffer);
+    ctx->first = false;
+    return true;
+}
+
+void handleCycleRecordsExport() {
+    if (!handleAuthentication()) return;
+
+    CycleExportCtx_t ctx;
+    ctx.csv = server.hasArg("format") && server.arg("format") == "csv";
+    ctx.first = true;
+    ctx.skip = 0;
+    uint32_t from_time = server.hasArg("from") ? (uint32_t)strtoul(server.arg("from").c_str(), NULL, 10) : 0;
+    uint32_t to_time = server.hasArg("to") ? (uint32_t)strtoul(server.arg("to").c_str(), NULL, 10) : 0;
+    if (server.hasArg("last")) {
+        long last = server.arg("last").toInt();
+        if (last <= 0) {
+            server.send(400, "text/plain", "Invalid last parameter.");
+            return;
+        }
+        int total = forEachCycleRecord(from_time, to_time, countCycleRecord, NULL);
+        if (total > last) ctx.skip = (uint32_t)(total - last);
+    }
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    if (ctx.csv) {
+        server.sendHeader("Content-Disposition", "attachment; filename=\"cycles.csv\"");
+        server.send(200, "text/csv", "");
+        String header = "seq,start_time,start_uptime_s,flags,channels";
+        for (size_t i = 0; i < sizeof(cycle_state_columns) / sizeof(cycle_state_columns[0]); i++) {
+            header += ",";
+            header += cycle_state_columns[i];
+            header += "_ms";
+        }
+        header += ",target_ml,actual_ml,overshoot_ml,temp_mean_c,temp_max_c,flow_ml_min,compressor_duty_pct,error_code\n";
+        server.sendContent(header);
+    } else {
+        server.send(200, "application/json", "");
+        server.sendContent("{\"records\":[");
+    }
+    forEachCycleRecord(from_time, to_time, sendCycleRecord, &ctx);
+    if (!ctx.csv) server.sendContent("]}");
+    server.sendContent(""); // Завершаем передачу
+}
+
+void handleUsageSummary() {
+    if (!handleAuthentication()) return;
+
+    static UsageBucket_t buckets[USAGE_HOURLY_BUCKETS > USAGE_DAILY_BUCKETS ? USAGE_HOURLY_BUCKETS : USAGE_DAILY_BUCKETS];
+    bool synced = isUsageTimeSynced();
+    // Доля работы компрессора за текущие сутки - от прошедшего с полуночи времени
+    uint32_t today_elapsed_s = 86400;
+    if (synced) {
+        time_t now_t = time(nullptr);
+        struct tm tm_local;
+        localtime_r(&now_t, &tm_local);
+        today_elapsed_s = (uint32_t)(tm_local.tm_hour * 3600 + tm_local.tm_min * 60 + tm_local.tm_sec);
+        if (today_elapsed_s == 0) today_elapsed_s = 1;
+    }
+
+    char buffer[200];
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    snprintf(buffer, sizeof(buffer), "{\"timeSynced\":%s,\"hourly\":[", synced ? "true" : "false");
+    server.sendContent(buffer);
+    int n = getUsageHourly(buckets, USAGE_HOURLY_BUCKETS);
+    for (int i = 0; i < n; i++) {
+        const UsageBucket_t* b = &buckets[i];
+        snprintf(buffer, sizeof(buffer), "%s{\"hourStart\":%lu,\"volumeMl\":%.1f,\"cycles\":%u,\"compressorS\":%lu,\"errors\":%u}",
+                 i ? "," : "", (unsigned long)b->key * 3600UL, b->volume_ml, b->cycles, (unsigned long)b->compressor_s, b->errors);
+        server.sendContent(buffer);
+    }
+    server.sendContent("],\"daily\":[");
+    n = getUsageDaily(buckets, USAGE_DAILY_BUCKETS);
+    for (int i = 0; i < n; i++) {
+        const UsageBucket_t* b = &buckets[i];
+        char date_str[12] = "";
+        if (b->key != 0) {
+            time_t day_t = (time_t)b->key * 86400;
+            struct tm tm_day;
+            gmtime_r(&day_t, &tm_day); // Ключ - уже локальная дата, поэтому без смещения TZ
+            strftime(date_str, sizeof(date_str), "%Y-%m-%d", &tm_day);
+        }
+        uint32_t period_s = (i == 0) ? today_elapsed_s : 86400;
+        float duty = (float)b->compressor_s * 100.0f / (float)period_s;
+        if (duty > 100.0f) duty = 100.0f;
+        snprintf(buffer, sizeof(buffer), "%s{\"date\":\"%s\",\"volumeMl\":%.1f,\"cycles\":%u,\"compressorS\":%lu,\"dutyPct\":%.1f,\"errors\":%u}",
+                 i ? "," : "", date_str, b->volume_ml, b->cycles, (unsigned long)b->compressor_s, duty, b->errors);
+        server.sendContent(buffer);
+    }
+    server.sendContent("]}");
+    server.sendContent(""); // Завершаем передачу
+}
+
 void handlePowerToggleWeb() {
     if (!handleAuthentication()) return;
     toggleSystemPower(true); // true indicates it's from the web for redirection
@@ -859,6 +1392,7 @@ void handleWifiSetup() {
         String response_msg = "Настройки WiFi обновлены. Система перезагрузится через 5 секунд для применения изменений.";
         server.send(200, "text/plain; charset=UTF-8", response_msg);
         log_i("WEB_WIFI", "WiFi settings updated via web. SSID: %s. Restarting in 5s.", new_ssid.c_str());
+        flushConfigNow();
         delay(5000);
         ESP.restart();
 
@@ -955,6 +1489,7 @@ void handleApSaveWifiCredentials() {
     String response_msg = "Настройки Wi-Fi сохранены. Устройство перезагрузится через 5 секунд и попытается подключиться к новой сети.";
     server.send(200, "text/plain; charset=UTF-8", response_msg); // Добавляем charset=UTF-8
     
+    flushConfigNow();
     delay(5000);
     ESP.restart();
 }
@@ -967,36 +1502,107 @@ void handleApSimplePage() {
     endHtmlResponse();
 }
 
+#define ERROR_LOG_PAGE_SIZE  50
+#define ERROR_LOG_JSON_LIMIT 200
+#define ERROR_LOG_CHUNK      10 // Записей за одно чтение журнала (буфер на стеке)
+
 void handleErrorLogPage() {
     if (!handleAuthentication()) return;
-    beginHtmlResponse();
-    char buffer[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE + 150]; // Увеличил буфер для безопасности
 
-    server.sendContent_P(PSTR("<h1>")); server.sendContent(_T(L_ERROR_LOG_TITLE)); server.sendContent_P(PSTR("</h1>"));
-    snprintf(buffer, sizeof(buffer), "<p><a href='/' class='button-link'>%s</a> <a href='/settings' class='button-link'>%s</a></p>", _T(L_BACK_TO_STATUS), _T(L_BACK_TO_SETTINGS)); server.sendContent(buffer);
+    bool json = server.hasArg("format") && server.arg("format") == "json";
+    uint32_t offset = server.hasArg("offset") ? (uint32_t)strtoul(server.arg("offset").c_str(), NULL, 10) : 0;
+    uint32_t limit = json ? 100 : ERROR_LOG_PAGE_SIZE;
+    if (json && server.hasArg("limit")) {
+        long requested = server.arg("limit").toInt();
+        if (requested <= 0 || requested > ERROR_LOG_JSON_LIMIT) {
+            server.send(400, "text/plain", "Invalid limit parameter.");
+            return;
+        }
+        limit = (uint32_t)requested;
+    }
+    ErrorJournalStatus_t status;
+    getErrorJournalStatus(&status);
+
+    char buffer[ERROR_HANDLER_LAST_MSG_BUFFER_SIZE + 250];
+    ErrorJournalEntry_t entries[ERROR_LOG_CHUNK];
+    if (json) {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(200, "application/json", "");
+        snprintf(buffer, sizeof(buffer), "{\"total\":%lu,\"nextSeq\":%lu,\"boot\":%lu,\"offset\":%lu,\"entries\":[",
+                 (unsigned long)status.total, (unsigned long)status.next_seq, (unsigned long)status.boot, (unsigned long)offset);
+        server.sendContent(buffer);
+    } else {
+        beginHtmlResponse();
+        server.sendContent_P(PSTR("<h1>")); server.sendContent(_T(L_ERROR_LOG_TITLE)); server.sendContent_P(PSTR("</h1>"));
+        snprintf(buffer, sizeof(buffer), "<p><a href='/' class='button-link'>%s</a> <a href='/settings' class='button-link'>%s</a></p>", _T(L_BACK_TO_STATUS), _T(L_BACK_TO_SETTINGS)); server.sendContent(buffer);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>Записей: <strong>%lu</strong> (загрузка #%lu, %s, ожидают записи: %lu, потеряно: %lu, ошибок записи: %lu) <a href='/errors?format=json&offset=%lu'>JSON</a></p>",
+                 (unsigned long)status.total, (unsigned long)status.boot, status.available ? "LittleFS" : "только RAM", (unsigned long)status.pending,
+                 (unsigned long)status.dropped, (unsigned long)status.write_failures, (unsigned long)offset); server.sendContent(buffer);
+    }
 
-    StoredError_t errors[MAX_STORED_ERRORS];
-    int num_errors = getStoredErrors(errors, MAX_STORED_ERRORS);
+    // Номера идут подряд, поэтому страница читается по смещению без обхода более новых записей
+    uint32_t shown = 0;
+    uint32_t scanned = 0;
+    while (scanned < limit && offset + scanned < status.total) {
+        uint32_t chunk = limit - scanned < ERROR_LOG_CHUNK ? limit - scanned : ERROR_LOG_CHUNK;
+        int n = getErrorJournalPage(offset + scanned, entries, (int)chunk);
+        if (n == 0) break;
+        for (int i = 0; i < n; i++) {
+            const ErrorJournalEntry_t* e = &entries[i];
+            char time_str[20] = "";
+            if (e->time != 0) {
+                time_t t = (time_t)e->time;
+                struct tm tm_local;
+                localtime_r(&t, &tm_local);
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_local);
+            }
+            const char* state_str = e->dosing_state < DOSING_STATE_COUNT ? getDosingStateString((DosingState_t)e->dosing_state) : "-";
+            if (json) {
+                snprintf(buffer, sizeof(buffer), "%s{\"seq\":%lu,\"boot\":%lu,\"uptimeMs\":%lu,\"time\":%lu,\"code\":%u,\"state\":%u,\"volumeMl\":%.1f,\"tempOut\":",
+                         shown ? "," : "", (unsigned long)e->seq, (unsigned long)e->boot, (unsigned long)e->uptime_ms, (unsigned long)e->time,
+                         e->code, e->dosing_state, e->volume_ml);
+                server.sendContent(buffer);
+                if (e->temp_out_c10 == ERROR_JOURNAL_NO_TEMP) snprintf(buffer, sizeof(buffer), "null,\"message\":\"%s\"}", jsonEscapeString(e->message).c_str());
+                else snprintf(buffer, sizeof(buffer), "%.1f,\"message\":\"%s\"}", e->temp_out_c10 / 10.0f, jsonEscapeString(e->message).c_str());
+                server.sendContent(buffer);
+            } else {
+                if (shown == 0) {
+                    server.sendContent("<table border='1' style='width:100%; border-collapse: collapse;'>");
+                    server.sendContent("<tr><th style='padding: 8px;'>#</th><th style='padding: 8px;'>Загрузка</th><th style='padding: 8px;'>Время работы</th><th style='padding: 8px;'>Время</th><th style='padding: 8px;'>Код</th><th style='padding: 8px;'>Состояние</th><th style='padding: 8px;'>Сообщение</th></tr>");
+                }
+                snprintf(buffer, sizeof(buffer),
+                         "<tr><td style='padding: 8px;'>%lu</td><td style='padding: 8px;'>%lu</td><td style='padding: 8px;'>%lu с</td><td style='padding: 8px;'>%s</td><td style='padding: 8px;'>%u</td><td style='padding: 8px;'>%s</td><td style='padding: 8px;'>%s</td></tr>",
+                         (unsigned long)e->seq, (unsigned long)e->boot, (unsigned long)(e->uptime_ms / 1000), time_str, e->code, state_str,
+                         htmlEscapeContent(e->message).c_str());
+                server.sendContent(buffer);
+            }
+            shown++;
+        }
+        // Сдвиг - по номерам: последняя запись куска задает, сколько номеров уже пройдено (с учетом пропусков).
+        // Ошибка, добавленная во время вывода, сдвигает номера - обход все равно продвигается вперед.
+        uint32_t next_scanned = (status.next_seq - 1 - offset) - entries[n - 1].seq + 1;
+        scanned = next_scanned > scanned ? next_scanned : scanned + (uint32_t)n;
+    }
 
-    if (num_errors == 0) {
+    if (json) {
+        server.sendContent("]}");
+        server.sendContent(""); // Завершаем передачу
+        return;
+    }
+    if (shown == 0) {
         server.sendContent_P(PSTR("<p>")); server.sendContent(_T(L_NO_STORED_ERRORS)); server.sendContent_P(PSTR("</p>"));
     } else {
-        server.sendContent("<table border='1' style='width:100%; border-collapse: collapse;'>");
-        server.sendContent("<tr><th style='padding: 8px;'>Время (назад)</th><th style='padding: 8px;'>Код</th><th style='padding: 8px;'>Сообщение</th></tr>");
-        unsigned long current_millis = millis();
-        for (int i = 0; i < num_errors; i++) {
-            unsigned long time_ago_s = (current_millis - errors[i].timestamp) / 1000;
-            snprintf(buffer, sizeof(buffer),
-                     "<tr><td style='padding: 8px;'>%lu с</td><td style='padding: 8px;'>%d</td><td style='padding: 8px;'>%s</td></tr>",
-                     time_ago_s, errors[i].code, htmlEscapeContent(errors[i].message).c_str());
-            server.sendContent(buffer);
-        }
         server.sendContent("</table>");
     }
-    // Кнопка для очистки лога ошибок (опционально)
-    // server.sendContent("<form action='/clearAllErrors' method='POST' style='margin-top: 20px;'>");
-    // server.sendContent(get_csrf_input_field());
-    // server.sendContent("<input type='submit' value='Очистить журнал ошибок' style='background-color: var(--warn-orange);'></form>");
+    server.sendContent("<p>");
+    if (offset > 0) {
+        snprintf(buffer, sizeof(buffer), "<a href='/errors?offset=%lu' class='button-link'>&larr; Новее</a> ",
+                 (unsigned long)(offset > ERROR_LOG_PAGE_SIZE ? offset - ERROR_LOG_PAGE_SIZE : 0)); server.sendContent(buffer);
+    }
+    if (offset + ERROR_LOG_PAGE_SIZE < status.total) {
+        snprintf(buffer, sizeof(buffer), "<a href='/errors?offset=%lu' class='button-link'>Старше &rarr;</a>", (unsigned long)(offset + ERROR_LOG_PAGE_SIZE)); server.sendContent(buffer);
+    }
+    server.sendContent("</p>");
 
     endHtmlResponse();
 }
@@ -1075,6 +1681,24 @@ void handleDosingControlPage() {
     snprintf(buffer, sizeof(buffer), "<div class='form-group'><label for='volumeTarget'>%s:</label><input type='number' id='volumeTarget' name='volumeTarget' value='%d' required></div>", _T(L_TARGET_DOSING_VOLUME_ML), config.volumeTarget); server.sendContent(buffer);
     snprintf(buffer, sizeof(buffer), "<input type='submit' value='%s'></form>", _T(L_SAVE_AND_START_DOSING)); server.sendContent(buffer);
 
+    server.sendContent_P(PSTR("<h2>")); server.sendContent(_T(L_CONTINUOUS_POUR)); server.sendContent_P(PSTR("</h2>"));
+    if (isDosingContinuous() && (local_dosing_state == DOSING_STATE_RUNNING || local_dosing_state == DOSING_STATE_PAUSED)) {
+        DosingLiveStatus_t live;
+        getDosingLiveStatus(&live);
+        snprintf(buffer, sizeof(buffer), "<p class='status-item'>%.1f / %lu ml, %.0f ml/min (<a href='/dosingLive'>JSON</a>)</p>",
+                 live.volume_ml, (unsigned long)live.target_ml, live.flow_ml_min); server.sendContent(buffer);
+    }
+    server.sendContent("<form action='/startContinuous' method='POST'>");
+    server.sendContent(get_csrf_input_field());
+    snprintf(buffer, sizeof(buffer), "<div class='form-group'><label for='limit'>%s:</label><input type='number' id='limit' name='limit' min='0' value='0'></div>", _T(L_CONTINUOUS_LIMIT_ML)); server.sendContent(buffer);
+    snprintf(buffer, sizeof(buffer), "<input type='submit' value='%s'></form>", _T(L_START_CONTINUOUS_POUR)); server.sendContent(buffer);
+
+    if (local_dosing_state == DOSING_STATE_RUNNING || local_dosing_state == DOSING_STATE_PAUSED) {
+        bool paused = local_dosing_state == DOSING_STATE_PAUSED;
+        snprintf(buffer, sizeof(buffer), "<form action='%s' method='POST' style='margin-top: 10px;'>", paused ? "/resumeDosing" : "/pauseDosing"); server.sendContent(buffer);
+        server.sendContent(get_csrf_input_field());
+        snprintf(buffer, sizeof(buffer), "<input type='submit' value='%s'></form>", _T(paused ? L_RESUME_DOSING : L_PAUSE_DOSING)); server.sendContent(buffer);
+    }
     if (local_dosing_state != DOSING_STATE_IDLE && local_dosing_state != DOSING_STATE_FINISHED && local_dosing_state != DOSING_STATE_ERROR) {
         server.sendContent("<form action='/stopDosing' method='POST' style='margin-top: 10px;'>");
         server.sendContent(get_csrf_input_field());
@@ -1101,6 +1725,13 @@ void setupWebServerRoutes() {
         server.on("/settings", HTTP_POST, handleUpdateConfig);
         server.on("/startDosing", HTTP_POST, handleStartDosing);
         server.on("/stopDosing", HTTP_POST, handleStopDosing);
+        server.on("/pauseDosing", HTTP_POST, handlePauseDosing);
+        server.on("/resumeDosing", HTTP_POST, handleResumeDosing);
+        server.on("/queueDosing", HTTP_POST, handleQueueDosing);
+        server.on("/clearQueue", HTTP_POST, handleClearQueue);
+        server.on("/queue", HTTP_GET, handleQueueStatus);
+        server.on("/startContinuous", HTTP_POST, handleStartContinuous);
+        server.on("/dosingLive", HTTP_GET, handleDosingLive);
         server.on("/startCalibration", HTTP_POST, handleStartCalibration);
         server.on("/stopCalibration", HTTP_POST, handleStopCalibration);
         // Добавляем маршруты для ручного управления мотором в режиме калибровки
@@ -1111,10 +1742,13 @@ void setupWebServerRoutes() {
         server.on("/stopFlowCalibration", HTTP_POST, handleStopFlowCalibration); 
         server.on("/resetStats", HTTP_POST, handleResetStatsWeb);
         server.on("/clearError", HTTP_POST, handleClearErrorWeb);
+        server.on("/espnowPeers", HTTP_POST, handleEspNowPeers);
         server.on("/factoryReset", HTTP_POST, handleFactoryReset);
         server.on("/emergency", HTTP_GET, handleEmergencyStop); // Consider making this POST
         server.on("/diagnostics", HTTP_GET, handleDiagnostics);
         server.on("/downloadlog", HTTP_GET, handleDownloadLog);
+        server.on("/cycles", HTTP_GET, handleCycleRecordsExport);
+        server.on("/usage", HTTP_GET, handleUsageSummary);
         server.on("/powerToggle", HTTP_GET, handlePowerToggleWeb);
         server.on("/wifi_setup", HTTP_GET, handleWifiSetup);  // Маршрут для GET
         server.on("/wifi_setup", HTTP_POST, handleWifiSetup); // Маршрут для POST
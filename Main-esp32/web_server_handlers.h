@@ -16,15 +16,25 @@ void handleRoot();
 void handleSettings();
 void handleDiagnostics();
 void handleDownloadLog();
+void handleCycleRecordsExport(); // GET: записи по циклам (format=csv|json, from/to - UNIX-время, last - N последних)
+void handleUsageSummary();       // GET: сводки использования по часам и суткам (JSON)
 
 // Action Handlers
 void handleUpdateConfig();
 void handleStartDosing();
 void handleStopDosing();
+void handlePauseDosing();  // POST: пауза текущего цикла
+void handleResumeDosing(); // POST: продолжение после паузы
+void handleQueueDosing();  // POST: задание в очередь (dosingVolume, необяз. temp, speed, channels)
+void handleClearQueue();   // POST: очистить очередь
+void handleQueueStatus();  // GET: очередь и метрики в JSON
+void handleStartContinuous(); // POST: непрерывный налив (необяз. limit, мл; 0 - до остановки)
+void handleDosingLive();   // GET: текущий объем, расход и надзор налива в JSON
 void handleStartCalibration();
 void handleStopCalibration();
 void handleResetStatsWeb();
 void handleClearErrorWeb();
+void handleEspNowPeers();  // POST: добавить/удалить пир ESP-NOW (action=add|remove, mac, role, status)
 void handleStopFlowCalibration(); // Было пропущено в предыдущих изменениях, добавляем для полноты
 
 void handleCalibrateMotorFwd();